@@ -0,0 +1,48 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ACPI table discovery: just enough of the MADT to find CPUs and
+// interrupt controllers
+
+#define ACPI_MAX_CPUS     16
+#define ACPI_MAX_IOAPICS  4
+#define ACPI_MAX_OVERRIDES 16
+
+// Interrupt source override: ISA IRQ routed to a different GSI
+typedef struct {
+    uint8_t irq;                // ISA IRQ number
+    uint32_t gsi;               // Global system interrupt it arrives on
+    uint16_t flags;             // MPS INTI polarity/trigger flags
+} acpi_override_t;
+
+typedef struct {
+    uint8_t id;
+    uint32_t address;           // MMIO base
+    uint32_t gsi_base;          // First GSI it handles
+} acpi_ioapic_t;
+
+typedef struct {
+    uint64_t lapic_base;        // Local APIC MMIO base
+    uint32_t cpu_count;
+    uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+    uint32_t ioapic_count;
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+    uint32_t override_count;
+    acpi_override_t overrides[ACPI_MAX_OVERRIDES];
+    bool legacy_pic;            // Dual 8259s present (PCAT_COMPAT)
+} acpi_info_t;
+
+// Locate the RSDP and parse the MADT. Returns false if there is no MADT,
+// in which case the machine is treated as a uniprocessor.
+bool acpi_init(void);
+
+// Parsed MADT contents
+const acpi_info_t* acpi_get_info(void);
+
+// Find a table by its 4-character signature (NULL if absent)
+const void* acpi_find_table(const char* signature);
+
+#endif // ACPI_H
@@ -0,0 +1,55 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Local APIC: per-CPU interrupt controller used for inter-processor
+// interrupts and the per-CPU timer tick. Registers are reached through
+// MMIO (xAPIC) or MSRs (x2APIC).
+
+// IPI and APIC vectors, above the remapped PIC range
+#define LAPIC_TIMER_VECTOR      0xF0    // Per-CPU scheduler tick
+#define IPI_RESCHEDULE_VECTOR   0xF1    // Run the scheduler
+#define IPI_TLB_VECTOR          0xF2    // TLB shootdown request
+#define LAPIC_SPURIOUS_VECTOR   0xFF
+
+// Map the local APIC registers. Returns false if there is no APIC.
+bool lapic_init(uint64_t base);
+
+// Software-enable the calling CPU's local APIC
+void lapic_enable(void);
+
+// True if the local APICs run in x2APIC (MSR) mode
+bool lapic_is_x2apic(void);
+
+// APIC ID of the calling CPU
+uint32_t lapic_id(void);
+
+// Acknowledge the interrupt being serviced
+void lapic_eoi(void);
+
+// Send a fixed-delivery IPI to one CPU
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+// Wake an application processor with INIT-SIPI-SIPI. It starts in real
+// mode at the page given by 'vector' (physical address / 4096).
+void lapic_start_ap(uint32_t apic_id, uint8_t vector);
+
+// Measure the timer rate against the PIT (boot CPU, once)
+void lapic_timer_calibrate(void);
+
+// Run the calling CPU's timer periodically at 'hz'
+bool lapic_timer_start(uint32_t hz);
+
+// One-shot: fire once after 'ns' nanoseconds
+void lapic_timer_oneshot(uint64_t ns);
+
+// TSC-deadline mode: fire once when the TSC reaches 'tsc'
+bool lapic_has_tsc_deadline(void);
+void lapic_timer_deadline(uint64_t tsc);
+
+// Stop the calling CPU's timer
+void lapic_timer_stop(void);
+
+#endif // APIC_H
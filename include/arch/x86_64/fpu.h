@@ -0,0 +1,43 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+#include "smp.h"
+
+// x87/SSE/AVX state for user processes, switched lazily. The kernel is
+// built without vector registers, so the registers only ever hold the
+// state of one process per CPU (the owner). CR0.TS is set whenever there
+// is no owner; the first vector instruction after that traps (#NM),
+// loads the running process's state and makes it the owner. A process
+// that never touches the registers costs nothing on a switch.
+//
+// State is saved with XSAVEOPT, XSAVE or FXSAVE, whichever the CPU has.
+// A process's save area is allocated on its first use and starts in
+// the initial state.
+
+struct process;
+
+// Enable SSE/AVX and set up the boot CPU; fpu_init_ap() on the others
+void fpu_init(void);
+void fpu_init_ap(void);
+
+// Save the outgoing process's registers if it owns them and give them up
+void fpu_switch_out(struct process* prev);
+
+// From schedule(), before the switch
+static inline void fpu_switch(struct process* prev) {
+    if (this_cpu()->fpu_owner == prev) {
+        fpu_switch_out(prev);
+    }
+}
+
+// fork/clone: the child starts with a copy of the parent's state
+int fpu_copy(struct process* child, struct process* parent);
+
+// exec and teardown: drop the state; the next use starts afresh
+void fpu_release(struct process* proc);
+
+// Print the save method and how often state moved
+void fpu_print_stats(void);
+
+#endif // FPU_H
@@ -0,0 +1,22 @@
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// I/O APIC: routes ISA and other device interrupts to local APICs,
+// replacing the 8259 PICs
+
+// Map every I/O APIC listed in the MADT and mask all of its inputs.
+// Returns false if there is none.
+bool ioapic_init(void);
+
+// Deliver an ISA IRQ to 'vector' on the CPU with 'apic_id', honouring
+// the MADT's interrupt source overrides. Returns -1 if no I/O APIC
+// handles the IRQ's GSI.
+int ioapic_route_isa(uint8_t irq, uint8_t vector, uint32_t apic_id);
+
+// Stop delivering an ISA IRQ
+void ioapic_mask_isa(uint8_t irq);
+
+#endif // IOAPIC_H
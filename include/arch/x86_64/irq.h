@@ -0,0 +1,47 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "isr.h"
+
+// Interrupt dispatch. Every vector has a descriptor saying where it
+// comes from, which tells the dispatcher how to acknowledge it: ISA IRQs
+// through the 8259 or the I/O APIC, local APIC sources (timer, IPIs)
+// through the local APIC, and spurious vectors not at all. The EOI is
+// sent before the handler runs, so a handler that switches processes
+// never leaves its controller waiting.
+
+#define IRQ_BASE    32      // Vector of ISA IRQ 0
+#define ISA_IRQS    16
+
+// Descriptor flags
+#define IRQ_FLAG_ISA        0x1     // ISA line via 8259 or I/O APIC
+#define IRQ_FLAG_LAPIC      0x2     // Local APIC source
+#define IRQ_FLAG_SPURIOUS   0x4     // Never acknowledged
+
+// Remap the 8259s above the exceptions with every line masked
+void irq_init(void);
+
+// Move ISA IRQs to the I/O APIC and mask the 8259s for good. Returns
+// false (staying on the 8259) if there is no I/O APIC or "noapic" was
+// given.
+bool irq_enable_ioapic(void);
+
+// Install the handler for an ISA IRQ and unmask it
+void irq_register(uint8_t irq, isr_t handler, const char* name);
+
+// Mask an ISA IRQ
+void irq_mask(uint8_t irq);
+
+// Install the handler for a local APIC vector (timer or IPI)
+void irq_register_lapic(uint8_t vector, isr_t handler, const char* name);
+
+// Acknowledge and run the handler for regs->int_no
+void irq_dispatch(registers_t* regs);
+
+// Print per-vector counts, entry-to-EOI cycles and the longest a handler
+// kept interrupts off
+void irq_print_stats(void);
+
+#endif // IRQ_H
@@ -16,12 +16,10 @@ typedef struct __attribute__((packed)) {
     uint16_t iomap_base; // I/O permission bitmap offset
 } tss_t;
 
-// TSS functions
+// TSS functions. Each CPU has its own TSS in its cpu_t (see smp.h).
 void tss_init(void);
+void tss_init_cpu(tss_t* tss, uint64_t stack);
 void tss_set_kernel_stack(uint64_t stack);
 uint64_t tss_get_kernel_stack(void);
 
-// Global TSS instance
-extern tss_t tss;
-
 #endif // TSS_H
\ No newline at end of file
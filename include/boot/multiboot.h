@@ -0,0 +1,34 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+
+// Multiboot2 boot information and kernel command line
+
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36d76289
+
+// Tag types
+#define MULTIBOOT_TAG_TYPE_END      0
+#define MULTIBOOT_TAG_TYPE_CMDLINE  1
+#define MULTIBOOT_TAG_TYPE_ACPI_OLD 14  // Copy of the ACPI 1.0 RSDP
+#define MULTIBOOT_TAG_TYPE_ACPI_NEW 15  // Copy of the ACPI 2.0+ RSDP
+
+#define CMDLINE_MAX 256
+
+// Parse the boot information passed by the bootloader
+void multiboot_init(uint32_t magic, uint64_t info_addr);
+
+// Get the full kernel command line ("" if none)
+const char* multiboot_cmdline(void);
+
+// Get the bootloader's copy of the ACPI RSDP (NULL if none was passed)
+const void* multiboot_acpi_rsdp(void);
+
+// Look up "key" or "key=value" on the command line. Returns a pointer to
+// the value (ends at a space or NUL), or NULL if the key is absent.
+const char* cmdline_param(const char* key);
+
+// Parse a size parameter such as "cma=16M" (K, M and G suffixes)
+uint64_t cmdline_size(const char* key, uint64_t default_value);
+
+#endif // MULTIBOOT_H
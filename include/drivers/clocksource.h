@@ -0,0 +1,48 @@
+#ifndef CLOCKSOURCE_H
+#define CLOCKSOURCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Nanosecond timekeeping. The best available counter is picked at boot:
+// the TSC if it is invariant (constant rate, runs in every C-state),
+// otherwise the HPET main counter, otherwise the PIT tick count (at the
+// tick's resolution). Cycles are turned into nanoseconds with a
+// fixed-point multiply, so reading the clock never divides.
+
+#define NSEC_PER_SEC    1000000000ULL
+#define NSEC_PER_MSEC   1000000ULL
+#define NSEC_PER_USEC   1000ULL
+
+// Clock IDs for clock_gettime. There is no RTC driver, so the only
+// clock is time since boot.
+#define CLOCK_MONOTONIC 1
+
+typedef struct {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+} timespec_t;
+
+// Pick and calibrate a clocksource. Needs the PIT tick running and the
+// ACPI tables located (for the HPET).
+void clocksource_init(void);
+
+// Nanoseconds since clocksource_init()
+uint64_t ktime_get_ns(void);
+
+// Fold elapsed time into the base so narrow counters never wrap between
+// reads; called from the boot CPU's tick
+void clocksource_update(void);
+
+// Name of the clocksource in use
+const char* clocksource_name(void);
+
+// True unless the clock is only as fine as the PIT tick (which cannot
+// drive a tickless kernel: it is the tick)
+bool clocksource_highres(void);
+
+// TSC value at which ktime_get_ns() reaches 'ns'. False unless the TSC
+// is the clocksource.
+bool ktime_to_tsc(uint64_t ns, uint64_t* tsc);
+
+#endif // CLOCKSOURCE_H
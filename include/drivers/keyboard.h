@@ -12,4 +12,7 @@ bool keyboard_has_char(void);
 // Get character from keyboard buffer (returns 0 if none available)
 char keyboard_getchar(void);
 
+// Block the calling process until a character is available
+void keyboard_wait(void);
+
 #endif // KEYBOARD_H
\ No newline at end of file
@@ -2,17 +2,71 @@
 #define TIMER_H
 
 #include <stdint.h>
+#include <stdbool.h>
+
+// One-shot timer on the kernel timer wheel. The callback runs from the
+// timer interrupt with interrupts disabled.
+typedef struct timer_event {
+    uint64_t expires;                   // Tick at which to fire
+    void (*callback)(void* data);
+    void* data;
+    bool pending;                       // Queued on the wheel
+    struct timer_event* next;
+    struct timer_event** pprev;         // Link pointing at us (slot or prev->next)
+} timer_event_t;
 
 // Initialize timer with given frequency (in Hz)
 void init_timer(uint32_t frequency);
 
+// Reference interval for calibrating other clocks: start a one-shot
+// countdown of 'ms' (at most 54) on PIT channel 2 and poll for its end
+void pit_oneshot_start(uint32_t ms);
+bool pit_oneshot_done(void);
+
+// Move the boot CPU's tick from the PIT to its local APIC timer
+bool timer_use_lapic(void);
+
+// Start the local APIC tick on an application processor
+void timer_start_ap(void);
+
 // Get system uptime in timer ticks
 uint64_t timer_get_ticks(void);
 
 // Get system uptime in milliseconds
 uint64_t timer_get_ms(void);
 
+// Get the tick frequency (in Hz)
+uint32_t timer_get_frequency(void);
+
+// Convert milliseconds to timer ticks, rounding up
+uint64_t timer_ms_to_ticks(uint64_t ms);
+
 // Sleep for specified milliseconds
 void sleep_ms(uint32_t ms);
 
+// Timer wheel
+void timer_event_init(timer_event_t* timer, void (*callback)(void* data), void* data);
+void timer_add(timer_event_t* timer, uint64_t expires);
+bool timer_del(timer_event_t* timer);
+
+// Arm a timer that may fire up to 'slack' ticks late, so nearby timers
+// coalesce into one wakeup. Sleeps allow 1/2^TIMER_SLACK_SHIFT of their
+// length.
+#define TIMER_SLACK_SHIFT 5
+void timer_add_slack(timer_event_t* timer, uint64_t expires, uint64_t slack);
+
+// Switch to tickless mode once a high-resolution clocksource is up.
+// "nohz=off" keeps the periodic tick.
+void timer_enable_nohz(void);
+
+// "periodic", "LAPIC one-shot" or "TSC-deadline"
+const char* timer_tick_mode(void);
+
+// Halt until the next interrupt; idle loops use this instead of hlt so
+// the tick can stop
+void timer_idle(void);
+
+// Called on interrupt entry to restart a stopped tick
+void tick_irq_enter(void);
+
 #endif // TIMER_H
\ No newline at end of file
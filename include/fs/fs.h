@@ -8,6 +8,7 @@
 #define FS_MAX_FILES 64
 #define FS_BLOCK_SIZE 512
 #define FS_MAX_BLOCKS 1024
+#define FS_MAX_FILE_SIZE ((uint64_t)FS_MAX_BLOCKS * FS_BLOCK_SIZE)
 
 // File types
 #define FS_TYPE_FILE 1
@@ -38,8 +39,8 @@ typedef struct {
 
 // File operations
 typedef struct {
-    int (*read)(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
-    int (*write)(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
+    int (*read)(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer);
+    int (*write)(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer);
     void (*open)(fs_node_t* node);
     void (*close)(fs_node_t* node);
     fs_dirent_t* (*readdir)(fs_node_t* node, uint32_t index);
@@ -65,8 +66,8 @@ void fs_init(void);
 fs_node_t* fs_root(void);
 
 // File operations
-int fs_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
-int fs_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
+int fs_read(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer);
+int fs_write(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer);
 void fs_open(fs_node_t* node);
 void fs_close(fs_node_t* node);
 fs_dirent_t* fs_readdir(fs_node_t* node, uint32_t index);
@@ -0,0 +1,40 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fast user-space mutexes. User code does the locking with atomics on a
+// 32-bit word and only calls in to sleep on it or to wake sleepers.
+// Waiters are hashed by the word's physical address, so a futex works
+// between threads and between processes sharing memory alike.
+
+// futex() operations
+#define FUTEX_WAIT 0        // Sleep if *uaddr == val
+#define FUTEX_WAKE 1        // Wake up to val sleepers
+
+#define FUTEX_HASH_SIZE 256
+
+typedef struct {
+    uint64_t waits;         // FUTEX_WAIT calls
+    uint64_t wakes;         // FUTEX_WAKE calls
+    uint64_t woken;         // Sleepers woken
+    uint64_t eagain;        // Waits refused because the word had changed
+    uint64_t timeouts;      // Waits that ran out of time
+} futex_stats_t;
+
+struct process;
+
+// Sleep while *uaddr == val, for at most timeout_ms (0 = forever).
+// Returns 0 when woken, -1 if the value differed or the time ran out.
+int futex_wait(volatile uint32_t* uaddr, uint32_t val, uint64_t timeout_ms);
+
+// Wake up to nr sleepers on uaddr. Returns how many were woken.
+int futex_wake(volatile uint32_t* uaddr, uint32_t nr);
+
+// Thread exit: clear the registered TID word and wake a joiner
+void futex_exit(struct process* proc);
+
+const futex_stats_t* futex_get_stats(void);
+
+#endif
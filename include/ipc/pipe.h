@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "wait.h"
 
 #define PIPE_SIZE 4096
 
@@ -13,6 +14,8 @@ typedef struct {
     uint32_t count;
     int reader_closed;
     int writer_closed;
+    wait_queue_t readers;            // Blocked on an empty pipe
+    wait_queue_t writers;            // Blocked on a full pipe
 } pipe_t;
 
 // Create a pipe and return file descriptors
@@ -24,4 +27,16 @@ void pipe_destroy(pipe_t* pipe);
 int pipe_read(pipe_t* pipe, void* buffer, size_t count);
 int pipe_write(pipe_t* pipe, const void* buffer, size_t count);
 
+// Moves data straight into or out of a pipe's buffer (sendfile, splice).
+// Called with one contiguous run of the buffer; returns how many bytes
+// it filled or used, or -1. Runs with interrupts off and must not sleep.
+typedef int (*pipe_actor_t)(void* data, uint8_t* buf, size_t len);
+
+// pipe_write() with 'actor' producing the data in place. Stops early
+// when the actor comes up short.
+int pipe_splice_in(pipe_t* pipe, size_t count, pipe_actor_t actor, void* data);
+
+// pipe_read() with 'actor' consuming the data in place
+int pipe_splice_out(pipe_t* pipe, size_t count, pipe_actor_t actor, void* data);
+
 #endif
\ No newline at end of file
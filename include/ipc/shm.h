@@ -0,0 +1,48 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// System V style shared memory segments
+
+#define SHM_MAX_SEGMENTS 32
+#define SHM_MAX_SIZE     (16 * 1024 * 1024)  // 16MB per segment
+
+// Keys and flags
+#define IPC_PRIVATE 0
+#define IPC_CREAT   01000   // Create segment if key doesn't exist
+#define IPC_EXCL    02000   // Fail if key exists
+
+// shmctl commands
+#define IPC_RMID 0          // Destroy segment after last detach
+#define IPC_STAT 2          // Get segment information
+
+typedef struct {
+    int key;
+    uint64_t size;
+    uint32_t creator_pid;
+    uint32_t nattch;        // Number of current attaches
+} shmid_ds_t;
+
+// Per-process record of an attached segment
+typedef struct shm_attach {
+    int shmid;
+    uint64_t addr;
+    struct shm_attach* next;
+} shm_attach_t;
+
+struct process;
+struct mm;
+
+// Segment operations
+int shm_get(int key, size_t size, int flags);
+uint64_t shm_attach(struct process* proc, int shmid, uint64_t addr);
+int shm_detach(struct process* proc, uint64_t addr);
+int shm_ctl(int shmid, int cmd, shmid_ds_t* buf);
+
+// Address space lifecycle hooks
+void shm_fork(struct mm* parent, struct mm* child);
+void shm_exit(struct mm* mm);
+
+#endif
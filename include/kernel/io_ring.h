@@ -0,0 +1,132 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "syscall.h"
+
+// Batched I/O through rings shared with the kernel. An address space
+// gets one ring: user space fills submission queue entries (SQEs) and
+// moves sq_tail; ring_enter() has the kernel take them all in one trap
+// and post a completion queue entry (CQE) for each. Requests that could
+// sleep (stdin, an empty or full pipe) go to worker threads, so the
+// trap itself never blocks on I/O unless asked to wait for completions.
+//
+// An SQE with IO_RING_LINK starts or continues a chain: the next SQE
+// runs only after this one finishes, and only if it succeeded. When a
+// member fails, the rest of its chain completes with -1 unrun.
+
+#define IO_RING_ADDR        0x40100000  // USER_RING_START in vmm.h
+#define IO_RING_MAX_ENTRIES 256         // Submission slots (power of two)
+#define IO_RING_WORKERS     4           // Worker threads for blocking requests
+
+// Operations
+#define IO_RING_OP_NOP      0
+#define IO_RING_OP_READ     1           // read(fd, addr, len)
+#define IO_RING_OP_WRITE    2           // write(fd, addr, len)
+#define IO_RING_OP_OPEN     3           // open(addr, len = flags)
+#define IO_RING_OP_CLOSE    4           // close(fd)
+#define IO_RING_OP_PIPE     5           // pipe(addr = int[2])
+
+// SQE flags
+#define IO_RING_LINK        (1 << 0)    // The next SQE depends on this one
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t reserved;
+    int32_t fd;
+    uint64_t addr;                      // Buffer, path or pipe fd pair
+    uint32_t len;
+    uint32_t reserved2;
+    uint64_t user_data;                 // Handed back in the CQE
+} io_ring_sqe_t;
+
+typedef struct {
+    uint64_t user_data;
+    int64_t res;                        // The system call's return value
+} io_ring_cqe_t;
+
+// Start of the shared pages. The SQE and CQE arrays follow at the given
+// offsets; the completion queue has twice as many entries as the
+// submission queue.
+typedef struct {
+    volatile uint32_t sq_head;          // Next SQE the kernel takes
+    volatile uint32_t sq_tail;          // Next SQE user space fills
+    volatile uint32_t cq_head;          // Next CQE user space reads
+    volatile uint32_t cq_tail;          // Next CQE the kernel posts
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    volatile uint32_t cq_overflow;      // Completions lost to a full queue
+    uint32_t sqes_offset;
+    uint32_t cqes_offset;
+    uint32_t reserved[7];
+} io_ring_shared_t;
+
+#define IO_RING_SQES(r)  ((io_ring_sqe_t*)((uint8_t*)(r) + (r)->sqes_offset))
+#define IO_RING_CQES(r)  ((io_ring_cqe_t*)((uint8_t*)(r) + (r)->cqes_offset))
+
+struct process;
+struct mm;
+
+// Start the worker threads
+void io_ring_init(void);
+
+// SYS_RING_SETUP: give the caller's address space a ring with 'entries'
+// submission slots. Returns IO_RING_ADDR, or -1.
+int64_t io_ring_setup(struct process* proc, uint32_t entries);
+
+// SYS_RING_ENTER: submit up to 'to_submit' SQEs, then sleep until at
+// least 'min_complete' CQEs are ready or nothing is left in flight.
+// Returns the number submitted.
+int64_t io_ring_enter(struct process* proc, uint32_t to_submit, uint32_t min_complete);
+
+// Drop the address space's ring (exec, teardown). Requests still with a
+// worker finish first.
+void io_ring_exit(struct mm* mm);
+
+// Print submission, completion and worker counts
+void io_ring_print_stats(void);
+
+// User space side
+static inline io_ring_shared_t* ring_setup(uint32_t entries) {
+    int64_t addr = (int64_t)syscall1(SYS_RING_SETUP, entries);
+    return addr < 0 ? NULL : (io_ring_shared_t*)addr;
+}
+
+static inline int64_t ring_enter(uint32_t to_submit, uint32_t min_complete) {
+    return (int64_t)syscall2(SYS_RING_ENTER, to_submit, min_complete);
+}
+
+// The next free SQE, cleared, or NULL if the queue is full. It is not
+// queued until ring_push_sqe().
+static inline io_ring_sqe_t* ring_get_sqe(io_ring_shared_t* r) {
+    if (r->sq_tail - r->sq_head >= r->sq_entries) {
+        return NULL;
+    }
+    io_ring_sqe_t* sqe = &IO_RING_SQES(r)[r->sq_tail & (r->sq_entries - 1)];
+    *sqe = (io_ring_sqe_t){ 0 };
+    return sqe;
+}
+
+static inline void ring_push_sqe(io_ring_shared_t* r) {
+    __sync_synchronize();
+    r->sq_tail++;
+}
+
+// The oldest unread CQE, or NULL; ring_cqe_seen() consumes it
+static inline io_ring_cqe_t* ring_peek_cqe(io_ring_shared_t* r) {
+    if (r->cq_head == r->cq_tail) {
+        return NULL;
+    }
+    __sync_synchronize();
+    return &IO_RING_CQES(r)[r->cq_head & (r->cq_entries - 1)];
+}
+
+static inline void ring_cqe_seen(io_ring_shared_t* r) {
+    __sync_synchronize();
+    r->cq_head++;
+}
+
+#endif // IO_RING_H
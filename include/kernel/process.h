@@ -4,17 +4,26 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "timer.h"
+#include "wait.h"
+#include "smp.h"
+#include "isr.h"
+#include "mm.h"
 
 // Process states
 typedef enum {
     PROCESS_STATE_READY,
     PROCESS_STATE_RUNNING,
     PROCESS_STATE_BLOCKED,
+    PROCESS_STATE_SLEEPING,     // Waiting on the timer wheel
     PROCESS_STATE_WAITING,      // Waiting for child process
     PROCESS_STATE_ZOMBIE,       // Terminated but not yet reaped
     PROCESS_STATE_TERMINATED
 } process_state_t;
 
+// State set for try_to_wake_up()
+#define STATE_BIT(state) (1U << (state))
+
 // x86_64 context structure
 typedef struct {
     // Callee-saved registers (must be preserved across function calls)
@@ -38,63 +47,132 @@ typedef struct {
 // Process Control Block (PCB)
 typedef struct process {
     uint32_t pid;                    // Process ID
+    uint32_t tgid;                   // Thread group: PID of the first thread
     char name[32];                   // Process name
     
     context_t context;               // CPU context
     process_state_t state;           // Current state
     
     // Memory management
-    uint64_t* page_table;           // Process's CR3 value (PML4 base)
-    uint64_t heap_start;            // Start of heap (for sbrk)
-    uint64_t heap_current;          // Current heap end
-    uint64_t heap_max;              // Maximum heap size
+    mm_t* mm;                       // Address space, shared by threads
     uint64_t stack_bottom;          // Bottom of user stack
     uint64_t stack_top;             // Top of user stack (grows down)
+    uint64_t fs_base;               // Thread-local storage base (FS)
+    uint64_t gs_base;               // User GS base, in KERNEL_GS_BASE while in the kernel
+    volatile uint32_t* clear_child_tid; // Zeroed and futex-woken on exit
+    void* fpu_state;                // FPU/SSE/AVX save area, from first use
+    
+    uint32_t page_color;            // Cache color cursor for new frames
     
     // Memory statistics
-    size_t pages_allocated;         // Number of pages this process owns
     size_t page_faults;             // Page fault counter
     
     void* kernel_stack;             // Kernel stack base
     size_t kernel_stack_size;       // Kernel stack size
     
-    uint64_t ticks_total;           // Total CPU ticks used
+    uint64_t sum_exec_runtime;      // Total CPU time used (ns)
+    uint64_t exec_start;            // ktime when last put on a CPU
     uint64_t ticks_remaining;       // Ticks left in current quantum
     uint32_t priority;              // Process priority (0 = highest)
+    uint32_t boost;                 // Interactivity bonus levels from I/O waits
+    uint32_t rq_level;              // Run queue level while queued
+    struct prio_array* rq_array;    // Priority array holding us (NULL if not queued)
+    bool on_rq;                     // Queued in a scheduling class
+    uint32_t cpu;                   // CPU whose run queue owns us
+    volatile bool on_cpu;           // Running, or context not yet saved
+    int lock_depth;                 // Big kernel lock nesting
+    
+    // Scheduling class (see scheduler.h)
+    uint32_t policy;                // SCHED_NORMAL, SCHED_FIFO, SCHED_RR, SCHED_DEADLINE
+    uint32_t rt_priority;           // Real-time level (0 = highest)
+    uint64_t dl_runtime;            // Deadline: budget per period (ticks)
+    uint64_t dl_deadline;           // Deadline: relative deadline (ticks)
+    uint64_t dl_period;             // Deadline: period (ticks)
+    uint64_t dl_budget;             // Runtime left in the current period
+    uint64_t dl_abs_deadline;       // Absolute deadline of the current period
+    uint64_t dl_period_start;       // Tick the current period began
+    bool dl_throttled;              // Budget used up, waiting for next period
+    
+    timer_event_t sleep_timer;      // Wakes us from sleep or a block timeout
+    bool timed_out;                 // Last wait ended by the timer
     
     // Process relationships
     uint32_t parent_pid;            // Parent process ID
+    struct process* parent;         // Parent process (NULL once orphaned)
+    struct process* children;       // First child, newest first
+    struct process* sibling_next;   // Next child of our parent
+    struct process* sibling_prev;   // Previous child of our parent
     int exit_status;                // Exit status (for zombie processes)
+    wait_queue_t child_exit;        // Woken when a child becomes a zombie
     
-    // File descriptors (per-process)
-    void* fd_table;                 // Pointer to process's file descriptor table
+    registers_t* syscall_regs;      // Trap frame of the system call in progress
+    struct syscall_stat* syscall_stats; // Per system call timing, from the first call
     
     struct process* next;           // Next process in queue
     struct process* prev;           // Previous process in queue
     
+    // Process registry
+    struct process* pid_next;       // Next in our PID hash bucket
+    struct process* tasks_next;     // Next in the all-process list
+    struct process* tasks_prev;     // Previous in the all-process list
+    struct process* dead_next;      // Next in the list waiting to be freed
+    volatile uint32_t refs;         // The registry and each process_find_by_pid() caller
+    
     void (*entry_point)(void);      // Entry point for new processes
 } process_t;
 
-// Maximum number of processes
-#define MAX_PROCESSES 64
+// PIDs are allocated below this and reused once the allocator wraps
+#define PID_MAX 32768
 #define KERNEL_STACK_SIZE 8192  // 8KB kernel stack per process
 #define DEFAULT_QUANTUM 10      // Default time quantum (in timer ticks)
 
+// Priority levels: 0 is highest, PRIO_IDLE is reserved for the idle process
+#define PRIO_LEVELS     32
+#define PRIO_IDLE       (PRIO_LEVELS - 1)
+#define PRIO_BOOST_MAX  3       // Most levels an interactive process gains
+#define PRIO_BACKGROUND (PRIO_IDLE - 1)  // Background kernel threads
+#define MAX_QUANTUM     20      // Quantum at level 0 (ticks)
+#define MIN_QUANTUM     2       // Quantum at the lowest normal level
+
 // Process management functions
 void process_init(void);
 process_t* process_create(const char* name, void (*entry_point)(void), uint32_t priority);
+process_t* process_create_idle(uint32_t cpu, void* stack, size_t stack_size);
+process_t* kthread_create(const char* name, void (*fn)(void*), void* arg, uint32_t priority);
 void process_destroy(process_t* process);
 void process_yield(void);
 void process_sleep(uint32_t ticks);
 void process_block(void);
+bool process_block_timeout(uint32_t ticks);
+bool process_schedule_timeout(uint32_t ticks);
 void process_unblock(process_t* process);
 void process_exit(int status);
 
 // Helper functions for fork/exec
-process_t* allocate_process_struct(void);
+process_t* allocate_process_struct(mm_t* mm);
 void free_process_struct(process_t* process);
-process_t* find_zombie_child(uint32_t parent_pid);
+process_t* find_zombie_child(process_t* parent);
+process_t* process_find_by_pid(uint32_t pid);
+process_t* process_get(process_t* proc);
+void process_put(process_t* proc);
+bool process_has_children(process_t* parent);
+void process_set_parent(process_t* child, process_t* parent);
+void process_orphan_children(process_t* parent);
+void process_wake_parent(process_t* proc);
+void process_queue_dead(process_t* process);
+void process_reap(void);
+void process_reaper_thread(void* arg);
+void process_wake_reaper(void);
+uint32_t process_count(void);
 void ready_queue_push(process_t* proc);
+void ready_queue_remove(process_t* proc);
+process_t* ready_queue_pop(void);
+bool ready_queue_should_preempt(process_t* current);
+bool try_to_wake_up(process_t* proc, uint32_t states);
+uint32_t process_quantum(process_t* proc);
+process_t* process_next(process_t* prev);
+mm_t* process_get_mm(uint32_t pid);
+mm_t* process_next_mm(uint32_t pid, uint32_t* next);
 
 // Context switching
 void context_switch(context_t* old_context, context_t* new_context);
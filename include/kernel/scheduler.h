@@ -1,12 +1,46 @@
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
+#include <stdint.h>
+
+// Scheduling policies, highest class first
+#define SCHED_NORMAL    0   // O(1) priority arrays with interactivity boost
+#define SCHED_FIFO      1   // Real-time, runs until it blocks
+#define SCHED_RR        2   // Real-time, round-robin within a level
+#define SCHED_DEADLINE  3   // Earliest deadline first with budget enforcement
+
+#define RT_PRIO_LEVELS  32      // Real-time levels, 0 is highest
+#define RR_QUANTUM      10      // SCHED_RR time slice (ticks)
+
+// Deadline bandwidth in fixed point: DL_BW_UNIT is one full CPU. Leaving
+// headroom keeps real-time and normal processes from starving.
+#define DL_BW_UNIT      (1ULL << 20)
+#define DL_BW_LIMIT     (DL_BW_UNIT * 95 / 100)
+
+// Scheduling attributes for sched_setattr()
+typedef struct sched_attr {
+    uint32_t policy;
+    uint32_t priority;      // SCHED_NORMAL 0-30, SCHED_FIFO/RR 0-31 (0 = highest)
+    uint64_t runtime_ms;    // SCHED_DEADLINE: CPU time per period
+    uint64_t deadline_ms;   // SCHED_DEADLINE: relative deadline
+    uint64_t period_ms;     // SCHED_DEADLINE: period (0 = same as deadline)
+} sched_attr_t;
+
+struct process;
+
 // Scheduler functions
 void scheduler_init(void);
 void scheduler_enable(void);
 void scheduler_disable(void);
 void schedule(void);
+void schedule_tail(void);
 void scheduler_tick(void);
 void scheduler_stats(void);
+void scheduler_resched(void);
+
+// Scheduling classes
+int sched_setattr(struct process* proc, const sched_attr_t* attr);
+int sched_getattr(struct process* proc, sched_attr_t* attr);
+void sched_process_exit(struct process* proc);
 
 #endif // SCHEDULER_H
\ No newline at end of file
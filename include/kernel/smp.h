@@ -0,0 +1,84 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tss.h"
+#include "spinlock.h"
+
+// Symmetric multiprocessing: per-CPU data, AP bring-up and IPIs
+
+#define MAX_CPUS            16
+#define CPU_GDT_ENTRIES     7       // Null, kernel/user code+data, TSS (2)
+
+// Where smp_init() copies the real-mode AP startup code
+#define AP_TRAMPOLINE_ADDR  0x8000
+
+struct process;
+
+// Per-CPU data. In the kernel %gs:0 points at the owning structure, so
+// this_cpu() is a single load on any CPU. User code has a GS base of its
+// own, swapped in and out with SWAPGS at every ring 3 boundary.
+typedef struct cpu {
+    struct cpu* self;               // Must stay first
+    uint64_t syscall_stack;         // Kernel stack top for SYSCALL (offset 8)
+    uint64_t user_rsp;              // User RSP during SYSCALL entry (offset 16)
+    uint32_t id;                    // Logical CPU number (0 = boot CPU)
+    uint32_t apic_id;               // Local APIC ID
+    struct process* current;        // Process running on this CPU
+    struct process* idle;           // This CPU's idle process
+    struct process* prev;           // Process being switched away from
+    uint64_t* page_table;           // Address space loaded in CR3
+    volatile bool online;           // Finished bring-up, taking work
+    uint64_t ipis_received;
+    uint64_t tick_next;             // ktime of the next timer interrupt
+    bool tick_stopped;              // Idle with the periodic tick off
+    uint64_t timer_irqs;            // Local timer interrupts taken
+    uint64_t idle_wakeups;          // Times the idle loop left hlt
+    uint32_t softirq_pending;       // Raised softirqs, one bit each
+    bool in_softirq;                // Running softirqs (interrupts on)
+    struct process* fpu_owner;      // Whose FPU state is in the registers
+    uint64_t gdt[CPU_GDT_ENTRIES];  // Own GDT: the TSS descriptor differs
+    tss_t tss;
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+extern uint32_t cpu_count;
+
+// This CPU's data
+static inline cpu_t* this_cpu(void) {
+    cpu_t* cpu;
+    asm volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Process running on this CPU
+#define current_process (this_cpu()->current)
+
+// Point GS at the boot CPU's data; must run before anything else
+void smp_early_init(void);
+
+// Parse the MADT and start every application processor
+void smp_init(void);
+
+// Number of CPUs that finished bring-up
+uint32_t smp_online_cpus(void);
+
+// Interrupt another CPU so it reschedules
+void smp_send_reschedule(uint32_t cpu);
+
+// Invalidate a page in an address space on every CPU that may cache it
+void smp_flush_tlb_page(uint64_t* pml4, uint64_t virt);
+
+// Move every CPU still lazily using an address space off it before its
+// page tables are freed
+void smp_leave_mm(uint64_t* pml4);
+
+// Big kernel lock: serializes system calls and page faults across CPUs.
+// Recursive per process and dropped across schedule().
+void lock_kernel(void);
+void unlock_kernel(void);
+void release_kernel_lock(struct process* proc);
+void reacquire_kernel_lock(struct process* proc);
+
+#endif // SMP_H
@@ -0,0 +1,39 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "isr.h"
+
+// Deferred interrupt work. A handler does the part that cannot wait
+// with interrupts off, then raises a softirq for the rest; pending
+// softirqs run on the way out of the interrupt with interrupts back on.
+// Softirqs still cannot sleep. Work that needs process context (locks
+// that block, the big kernel lock) goes to a workqueue instead.
+
+typedef enum {
+    SOFTIRQ_TIMER,                  // Expire the timer wheel
+    NR_SOFTIRQS
+} softirq_nr_t;
+
+// A round of softirqs that keeps raising more is repeated at most this
+// often; the rest waits for the next interrupt
+#define SOFTIRQ_RESTARTS    8
+
+// Install the handler for a softirq
+void open_softirq(softirq_nr_t nr, void (*handler)(void), const char* name);
+
+// Mark a softirq pending on this CPU
+void raise_softirq(softirq_nr_t nr);
+
+// Run this CPU's pending softirqs, from isr_handler() after the hard
+// handler. Does nothing if the interrupted code had interrupts disabled.
+void do_softirq(registers_t* regs);
+
+// True while this CPU is inside do_softirq()
+bool in_softirq(void);
+
+// Print per-softirq counts and cycles
+void softirq_print_stats(void);
+
+#endif // SOFTIRQ_H
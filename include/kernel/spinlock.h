@@ -0,0 +1,53 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+// Test-and-test-and-set spinlock
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+// Handle IPIs that were posted while this CPU spins (see smp.c). A CPU
+// waiting for a lock with interrupts off still answers TLB shootdowns,
+// so two CPUs can never wait on each other forever.
+void smp_handle_pending(void);
+
+static inline void spin_init(spinlock_t* lock) {
+    lock->locked = 0;
+}
+
+static inline bool spin_trylock(spinlock_t* lock) {
+    return __sync_lock_test_and_set(&lock->locked, 1) == 0;
+}
+
+static inline void spin_lock(spinlock_t* lock) {
+    while (!spin_trylock(lock)) {
+        while (lock->locked) {
+            smp_handle_pending();
+            cpu_relax();
+        }
+    }
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+// Lock with interrupts disabled; returns the flags for spin_unlock_irqrestore
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock) {
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif // SPINLOCK_H
@@ -2,6 +2,7 @@
 #define SYSCALL_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "isr.h"
 
 // System call numbers
@@ -23,14 +24,70 @@
 #define SYS_KILL    16
 #define SYS_PIPE    17
 #define SYS_DUP2    18
+#define SYS_SHMGET  19
+#define SYS_SHMAT   20
+#define SYS_SHMDT   21
+#define SYS_SHMCTL  22
+#define SYS_MADVISE 23
+#define SYS_SCHED_SETATTR 24
+#define SYS_SCHED_GETATTR 25
+#define SYS_CLOCK_GETTIME 26
+#define SYS_CLONE   27
+#define SYS_FUTEX   28
+#define SYS_ARCH_PRCTL 29
+#define SYS_GETTID  30
+#define SYS_GETCPU  31
+#define SYS_RING_SETUP 32
+#define SYS_RING_ENTER 33
+#define SYS_READV   34
+#define SYS_WRITEV  35
+#define SYS_PREAD   36
+#define SYS_PWRITE  37
+#define SYS_SYSTRACE 38
+#define SYS_SENDFILE 39
+#define SYS_SPLICE  40
+
+// Size of the system call table
+#define MAX_SYSCALLS 64
+
+// One buffer of a readv()/writev() call
+typedef struct {
+    void* base;
+    uint64_t len;
+} iovec_t;
+
+#define IOV_MAX 64                      // Most buffers in one call
+
+// clone() flags
+#define CLONE_VM             0x00000100  // Share the address space
+#define CLONE_SETTLS         0x00080000  // Set the FS base from 'tls'
+#define CLONE_CHILD_CLEARTID 0x00200000  // Clear and wake 'ctid' on exit
+
+// arch_prctl() codes
+#define ARCH_SET_GS 0x1001
+#define ARCH_SET_FS 0x1002
+#define ARCH_GET_FS 0x1003
+#define ARCH_GET_GS 0x1004
 
 // Initialize system call interface
 void init_syscalls(void);
 
-// System call handler
+// Enable SYSCALL/SYSRET on this CPU (init_syscalls() does the boot CPU)
+void syscall_init_cpu(void);
+
+// System call handler, for INT 0x80 and SYSCALL alike
 void syscall_handler(registers_t* regs);
 
-// User-space system call wrappers (for future use)
+// Run a system call for the current process without trapping, for work
+// the kernel does on its behalf (io_ring). Needs the big kernel lock.
+uint64_t syscall_invoke(uint64_t num, uint64_t arg1, uint64_t arg2, uint64_t arg3);
+
+// True if reading or writing 'count' bytes on 'fd' could sleep now
+bool syscall_fd_may_block(uint64_t fd, bool write, uint64_t count);
+
+// User-space system call wrappers (for future use). These use INT 0x80,
+// which works from kernel-mode test code too; SYSCALL always returns to
+// ring 3, so only ring 3 code may use it.
 static inline uint64_t syscall0(uint64_t num) {
     uint64_t ret;
     asm volatile(
@@ -75,4 +132,29 @@ static inline uint64_t syscall3(uint64_t num, uint64_t arg1, uint64_t arg2, uint
     return ret;
 }
 
+static inline uint64_t syscall4(uint64_t num, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4) {
+    uint64_t ret;
+    register uint64_t r10 asm("r10") = arg4;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(num), "D"(arg1), "S"(arg2), "d"(arg3), "r"(r10)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline uint64_t syscall5(uint64_t num, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    uint64_t ret;
+    register uint64_t r10 asm("r10") = arg4;
+    register uint64_t r8 asm("r8") = arg5;
+    asm volatile(
+        "int $0x80"
+        : "=a"(ret)
+        : "a"(num), "D"(arg1), "S"(arg2), "d"(arg3), "r"(r10), "r"(r8)
+        : "memory"
+    );
+    return ret;
+}
+
 #endif // SYSCALL_H
\ No newline at end of file
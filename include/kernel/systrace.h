@@ -0,0 +1,85 @@
+#ifndef SYSTRACE_H
+#define SYSTRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "syscall.h"
+
+// System call accounting and tracing. Every call through
+// syscall_handler() is timed in TSC cycles, from entry to return, and
+// counted per system call number both system-wide and in the calling
+// process: calls, total, fastest, slowest and a log2 histogram. Time
+// spent waiting for the big kernel lock or asleep in the call counts.
+//
+// Tracing is opt-in: while it is on, each call from the followed process
+// (or from every process) also leaves an event in a ring buffer, which
+// a user tool drains with SYS_SYSTRACE. When the ring is full the oldest
+// events are overwritten; the gap shows in the sequence numbers.
+
+#define SYSTRACE_HIST_BUCKETS 32        // Bucket i: [2^i, 2^(i+1)) cycles
+#define SYSTRACE_RING_SIZE    256       // Events kept (power of two)
+
+// SYS_SYSTRACE operations
+#define SYSTRACE_ENABLE       0         // arg = PID to follow, 0 for all
+#define SYSTRACE_DISABLE      1
+#define SYSTRACE_READ         2         // arg = events buffer, arg2 = room
+#define SYSTRACE_STATS        3         // arg = PID or 0 for the system,
+                                        // arg2 = MAX_SYSCALLS stats
+#define SYSTRACE_RESET        4         // Clear the system-wide stats
+
+typedef struct syscall_stat {
+    uint64_t count;
+    uint64_t total;                     // Cycles, summed over count
+    uint64_t min;
+    uint64_t max;
+    uint32_t hist[SYSTRACE_HIST_BUCKETS];
+} syscall_stat_t;
+
+typedef struct {
+    uint64_t seq;                       // Position in the trace, from 0
+    uint64_t start;                     // TSC at entry
+    uint64_t cycles;                    // Entry to return
+    uint32_t pid;
+    uint32_t nr;
+    uint64_t args[5];
+    int64_t ret;
+} systrace_event_t;
+
+struct process;
+
+// Time the call from 'start' (a TSC value) and record it. Called from
+// syscall_handler() under the big kernel lock.
+void systrace_account(struct process* proc, uint64_t nr, const uint64_t* args,
+                      uint64_t ret, uint64_t start);
+
+// SYS_SYSTRACE
+int64_t systrace_ctl(uint64_t op, uint64_t arg, uint64_t arg2);
+
+// Drop a process's statistics (teardown)
+void systrace_release(struct process* proc);
+
+// Name of a system call number, or NULL
+const char* systrace_name(uint64_t nr);
+
+// Print the system-wide table
+void systrace_print_stats(void);
+
+// User space side
+static inline int64_t systrace_enable(uint32_t pid) {
+    return (int64_t)syscall2(SYS_SYSTRACE, SYSTRACE_ENABLE, pid);
+}
+
+static inline int64_t systrace_disable(void) {
+    return (int64_t)syscall1(SYS_SYSTRACE, SYSTRACE_DISABLE);
+}
+
+// Take up to 'max' of the oldest unread events; returns how many
+static inline int64_t systrace_read(systrace_event_t* events, uint32_t max) {
+    return (int64_t)syscall3(SYS_SYSTRACE, SYSTRACE_READ, (uint64_t)events, max);
+}
+
+static inline int64_t systrace_stats(uint32_t pid, syscall_stat_t* stats) {
+    return (int64_t)syscall3(SYS_SYSTRACE, SYSTRACE_STATS, pid, (uint64_t)stats);
+}
+
+#endif // SYSTRACE_H
@@ -0,0 +1,101 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <stdint.h>
+#include "clocksource.h"
+
+// Virtual system calls. Every user address space gets three read-only
+// pages at fixed addresses:
+//
+//   VDSO_VVAR_ADDR   clock data shared by all processes, kept up to date
+//                    by the kernel under a sequence count
+//   VDSO_IDENT_ADDR  this address space's process ID
+//   VDSO_TEXT_ADDR   code that reads the two pages above
+//
+// so asking for the time, the PID or the CPU costs a function call
+// instead of a trip into the kernel. The code is part of the kernel
+// image; the data page lists where each function landed.
+
+#define VDSO_VVAR_ADDR      0x40000000  // USER_VDSO_START in vmm.h
+#define VDSO_IDENT_ADDR     (VDSO_VVAR_ADDR + 0x1000)
+#define VDSO_TEXT_ADDR      (VDSO_VVAR_ADDR + 0x2000)
+#define VDSO_TEXT_PAGES     2
+
+// How the vDSO reads the clock; VDSO_CLOCK_NONE falls back to the
+// system call (the HPET and PIT are not readable from user mode)
+#define VDSO_CLOCK_NONE     0
+#define VDSO_CLOCK_TSC      1
+
+// Entry points, indexed in vdso_data_t.sym
+typedef enum {
+    VDSO_SYM_CLOCK_GETTIME,
+    VDSO_SYM_GETTIMEOFDAY,
+    VDSO_SYM_GETPID,
+    VDSO_SYM_GETCPU,
+    VDSO_NR_SYMS
+} vdso_sym_t;
+
+// The shared data page. The clock fields mirror the kernel's
+// clocksource: ns = base_ns + ((counter - base_cycles) & mask) * mult >> 32.
+typedef struct {
+    volatile uint32_t seq;          // Odd while the kernel is updating
+    uint32_t clock_mode;
+    uint64_t base_cycles;
+    uint64_t base_ns;
+    uint64_t mult;
+    uint64_t mask;
+    uint32_t have_rdtscp;           // TSC_AUX holds the CPU number
+    uint32_t reserved;
+    uint64_t sym[VDSO_NR_SYMS];     // User address of each entry point
+} vdso_data_t;
+
+// The per-address-space page
+typedef struct {
+    uint64_t pid;                   // Shared by all threads, like getpid()
+} vdso_ident_t;
+
+typedef struct {
+    int64_t tv_sec;
+    int64_t tv_usec;
+} timeval_t;
+
+struct process;
+
+// Build the shared pages; before the first user address space
+void vdso_init(void);
+
+// Put this CPU's number in TSC_AUX (vdso_init() does the boot CPU)
+void vdso_init_cpu(void);
+
+// Map the pages into a fresh address space (process creation, exec)
+int vdso_map(struct process* proc);
+
+// fork: the child's copied address space gets its own identity page
+int vdso_fork(struct process* child);
+
+// Publish the clocksource's base and scale
+void vdso_update_clock(uint32_t mode, uint64_t base_cycles, uint64_t base_ns,
+                       uint64_t mult, uint64_t mask);
+
+// Callers for ring 3 code
+static inline int vdso_clock_gettime(uint32_t clock_id, timespec_t* ts) {
+    const vdso_data_t* vd = (const vdso_data_t*)VDSO_VVAR_ADDR;
+    return ((int (*)(uint32_t, timespec_t*))vd->sym[VDSO_SYM_CLOCK_GETTIME])(clock_id, ts);
+}
+
+static inline int vdso_gettimeofday(timeval_t* tv, void* tz) {
+    const vdso_data_t* vd = (const vdso_data_t*)VDSO_VVAR_ADDR;
+    return ((int (*)(timeval_t*, void*))vd->sym[VDSO_SYM_GETTIMEOFDAY])(tv, tz);
+}
+
+static inline uint64_t vdso_getpid(void) {
+    const vdso_data_t* vd = (const vdso_data_t*)VDSO_VVAR_ADDR;
+    return ((uint64_t (*)(void))vd->sym[VDSO_SYM_GETPID])();
+}
+
+static inline int vdso_getcpu(uint32_t* cpu, uint32_t* node) {
+    const vdso_data_t* vd = (const vdso_data_t*)VDSO_VVAR_ADDR;
+    return ((int (*)(uint32_t*, uint32_t*))vd->sym[VDSO_SYM_GETCPU])(cpu, node);
+}
+
+#endif // VDSO_H
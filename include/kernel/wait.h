@@ -0,0 +1,93 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "timer.h"
+#include "spinlock.h"
+
+struct process;
+
+// One sleeper on a wait queue, lives on the sleeper's stack
+typedef struct wait_entry {
+    struct process* proc;
+    struct wait_entry* next;
+    struct wait_entry* prev;
+    bool queued;
+} wait_entry_t;
+
+// FIFO of processes waiting for a condition
+typedef struct wait_queue {
+    spinlock_t lock;
+    wait_entry_t* head;
+    wait_entry_t* tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, NULL, NULL }
+
+void wait_queue_init(wait_queue_t* wq);
+
+// Queue the current process and mark it blocked before the caller
+// re-checks its condition, so a wakeup on another CPU between the check
+// and the switch just makes it runnable again instead of being lost
+void prepare_to_wait(wait_queue_t* wq, wait_entry_t* entry);
+
+// Back to running and off the queue once the condition holds
+void finish_wait(wait_queue_t* wq, wait_entry_t* entry);
+
+// Switch away after prepare_to_wait(), for at most 'timeout' ticks (0 =
+// no timeout). Called and returns with interrupts disabled. Returns
+// false if the timeout expired.
+bool wait_schedule(uint64_t timeout);
+
+// Wake the first sleeper, or every sleeper
+void wake_up(wait_queue_t* wq);
+void wake_up_all(wait_queue_t* wq);
+
+// Block until 'condition' is true. The condition is re-checked with
+// interrupts disabled after each wakeup.
+#define wait_event(wq, condition)                                   \
+    do {                                                            \
+        uint64_t __wait_flags = irq_save();                         \
+        wait_entry_t __wait_entry = { NULL, NULL, NULL, false };    \
+        while (1) {                                                 \
+            prepare_to_wait(&(wq), &__wait_entry);                  \
+            if (condition) {                                        \
+                break;                                              \
+            }                                                       \
+            wait_schedule(0);                                       \
+        }                                                           \
+        finish_wait(&(wq), &__wait_entry);                          \
+        irq_restore(__wait_flags);                                  \
+    } while (0)
+
+// Like wait_event, giving up after 'ticks'. Evaluates to the ticks left
+// (at least 1) if the condition came true, or 0 on timeout.
+#define wait_event_timeout(wq, condition, ticks)                    \
+    ({                                                              \
+        uint64_t __wait_flags = irq_save();                         \
+        wait_entry_t __wait_entry = { NULL, NULL, NULL, false };    \
+        uint64_t __wait_end = timer_get_ticks() + (ticks);          \
+        uint64_t __wait_left = 1;                                   \
+        while (1) {                                                 \
+            prepare_to_wait(&(wq), &__wait_entry);                  \
+            if (condition) {                                        \
+                break;                                              \
+            }                                                       \
+            uint64_t __wait_now = timer_get_ticks();                \
+            if (__wait_now >= __wait_end) {                         \
+                __wait_left = 0;                                    \
+                break;                                              \
+            }                                                       \
+            wait_schedule(__wait_end - __wait_now);                 \
+        }                                                           \
+        finish_wait(&(wq), &__wait_entry);                          \
+        if (__wait_left && __wait_end > timer_get_ticks()) {        \
+            __wait_left = __wait_end - timer_get_ticks();           \
+        }                                                           \
+        irq_restore(__wait_flags);                                  \
+        __wait_left;                                                \
+    })
+
+#endif // WAIT_H
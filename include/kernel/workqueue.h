@@ -0,0 +1,53 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+#include "wait.h"
+
+// Workqueues: deferred work run by a kernel thread, so unlike a softirq
+// it may sleep, take the big kernel lock or touch slow devices. Queuing
+// is safe from interrupt handlers. A work item is queued at most once
+// until it starts running; queuing it again before then is a no-op.
+
+struct process;
+
+typedef struct work {
+    void (*func)(struct work* work);
+    struct work* next;
+    volatile bool pending;          // On a queue, not started yet
+} work_t;
+
+#define WORK_INIT(fn) { (fn), NULL, false }
+
+typedef struct workqueue {
+    const char* name;
+    spinlock_t lock;
+    work_t* head;
+    work_t* tail;
+    wait_queue_t wait;              // The worker sleeps here when idle
+    struct process* worker;
+    uint64_t queued;
+    uint64_t run;
+} workqueue_t;
+
+#define WORKQUEUE_INIT(n) { (n), SPINLOCK_INIT, NULL, NULL, WAIT_QUEUE_INIT, NULL, 0, 0 }
+
+// Start the shared "events" queue's worker. Work queued earlier waits
+// for it.
+void workqueue_init(void);
+
+// A queue with its own worker thread at 'priority'
+workqueue_t* workqueue_create(const char* name, uint32_t priority);
+
+// Queue work; false if it was already pending
+bool queue_work(workqueue_t* wq, work_t* work);
+
+// Queue work on the shared queue
+bool schedule_work(work_t* work);
+
+// Print per-queue counts
+void workqueue_print_stats(void);
+
+#endif // WORKQUEUE_H
@@ -0,0 +1,17 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fast LZ77-class compressor (LZ4-style block format)
+
+// Compress len bytes of src into dst. Returns the compressed size, or 0
+// if the output would not fit in dst_cap bytes.
+size_t lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_cap);
+
+// Decompress into dst. Returns the decompressed size, or -1 on corrupt
+// input or if the output would overflow dst_cap bytes.
+int lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_cap);
+
+#endif // LZ_H
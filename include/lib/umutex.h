@@ -0,0 +1,47 @@
+#ifndef UMUTEX_H
+#define UMUTEX_H
+
+#include <stdint.h>
+#include "syscall.h"
+#include "futex.h"
+
+// Mutex for threads sharing memory, built on a futex word (after
+// Drepper, "Futexes Are Tricky"): 0 = unlocked, 1 = locked, 2 = locked
+// and somebody may be sleeping. Taking a free lock and releasing one
+// nobody waits for are one atomic instruction each; only contention
+// enters the kernel.
+typedef struct {
+    volatile uint32_t state;
+} umutex_t;
+
+#define UMUTEX_INIT { 0 }
+
+static inline void umutex_lock(umutex_t* m) {
+    uint32_t c = __sync_val_compare_and_swap(&m->state, 0, 1);
+    if (c == 0) {
+        return;
+    }
+    
+    // Mark the lock contended and sleep until it is handed back
+    if (c != 2) {
+        c = __sync_lock_test_and_set(&m->state, 2);
+    }
+    while (c != 0) {
+        syscall4(SYS_FUTEX, (uint64_t)&m->state, FUTEX_WAIT, 2, 0);
+        c = __sync_lock_test_and_set(&m->state, 2);
+    }
+}
+
+static inline int umutex_trylock(umutex_t* m) {
+    return __sync_bool_compare_and_swap(&m->state, 0, 1);
+}
+
+static inline void umutex_unlock(umutex_t* m) {
+    // 2 -> 1 means there may be sleepers: release and wake one
+    if (__sync_fetch_and_sub(&m->state, 1) != 1) {
+        __sync_lock_release(&m->state);
+        syscall4(SYS_FUTEX, (uint64_t)&m->state, FUTEX_WAKE, 1, 0);
+    }
+}
+
+#endif // UMUTEX_H
@@ -0,0 +1,40 @@
+#ifndef CMA_H
+#define CMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Contiguous memory allocator for device (DMA) buffers. A region is
+// reserved at boot ("cma=<size>" on the command line). While no device
+// needs it, the region holds movable user pages, which are migrated out
+// when a buffer is allocated.
+
+#define CMA_DEFAULT_SIZE    (4 * 1024 * 1024)
+#define CMA_MAX_ALIGN_PAGES 512     // Buffers are size-aligned up to 2MB
+
+// Bus address as seen by a device (identity mapped: equals physical)
+typedef uint64_t dma_addr_t;
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t failures;
+    uint64_t pages_in_use;      // Pages held by DMA buffers
+    uint64_t pages_migrated;    // User pages moved out of the region
+    uint64_t migrate_failures;
+} cma_stats_t;
+
+// Reserve the region (after the PMM and heap are up)
+void cma_init(void);
+
+// Allocate a zeroed, physically contiguous buffer below 4GB aligned to
+// its size (up to 2MB). Returns the kernel address; *dma_handle gets
+// the bus address.
+void* dma_alloc_coherent(size_t size, dma_addr_t* dma_handle);
+
+// Free a buffer from dma_alloc_coherent()
+void dma_free_coherent(void* vaddr, size_t size, dma_addr_t dma_handle);
+
+// Statistics
+void cma_get_stats(cma_stats_t* stats);
+
+#endif // CMA_H
@@ -0,0 +1,41 @@
+#ifndef KSM_H
+#define KSM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Kernel samepage merging: a background scanner that finds identical
+// private user pages and maps them to a single read-only frame with
+// copy-on-write (PAGE_COW) semantics.
+
+#define KSM_STABLE_BUCKETS   256     // Hash buckets for merged pages
+#define KSM_UNSTABLE_SIZE    1024    // Candidates remembered per pass
+
+// Default tuning
+#define KSM_PAGES_TO_SCAN    128     // Pages examined per run
+#define KSM_SLEEP_MS         100     // Delay between runs
+
+typedef struct {
+    uint64_t pages_shared;      // Frames backing merged pages
+    uint64_t pages_sharing;     // Mappings of those frames
+    uint64_t pages_scanned;
+    uint64_t full_scans;
+    uint64_t merges;
+} ksm_stats_t;
+
+// Tune the scanner: enable/disable, batch size and interval
+void ksm_set_params(bool run, uint32_t pages_to_scan, uint32_t sleep_ms);
+bool ksm_is_running(void);
+
+// Body of the "ksmd" kernel thread: scans one batch per interval
+void ksm_thread(void* arg);
+
+// Scan a batch of pages now
+void ksm_scan(size_t pages);
+
+// Statistics
+void ksm_get_stats(ksm_stats_t* stats);
+void ksm_print_stats(void);
+
+#endif // KSM_H
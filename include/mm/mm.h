@@ -0,0 +1,69 @@
+#ifndef MM_H
+#define MM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "spinlock.h"
+
+// Address spaces. Every process has an mm; threads made by clone() share
+// their creator's, so the page table, the regions mapped in it and the
+// file descriptor table live here and go away with the last user.
+
+// VMA flags
+#define VMA_READ    (1 << 0)
+#define VMA_WRITE   (1 << 1)
+#define VMA_EXEC    (1 << 2)
+#define VMA_ANON    (1 << 3)   // Missing pages fault in as zeroed memory
+#define VMA_SHARED  (1 << 4)   // Shared memory segment
+
+// A mapped region [start, end) of user space
+typedef struct vma {
+    uint64_t start;
+    uint64_t end;
+    uint32_t flags;
+    struct vma* next;               // Next region, sorted by address
+} vma_t;
+
+typedef struct mm {
+    uint64_t* page_table;           // PML4 base loaded in CR3 (NULL: kernel only)
+    vma_t* vmas;                    // Mapped regions, sorted by address
+    
+    uint64_t heap_start;            // Start of heap (for sbrk)
+    uint64_t heap_current;          // Current heap end
+    uint64_t heap_max;              // Maximum heap size
+    
+    struct shm_attach* shm_list;    // Attached shared memory segments
+    struct io_ring* io_ring;        // Batched I/O ring, if set up
+    size_t pages_allocated;         // Number of pages this address space owns
+    void* fd_table;                 // File descriptor table
+    
+    volatile uint32_t users;        // Processes sharing this mm
+    spinlock_t lock;                // Protects the VMA list
+    struct mm* dead_next;           // Queued by mm_put_async()
+} mm_t;
+
+// Allocate an empty mm with one user and no page table
+mm_t* mm_create(void);
+
+// Take and drop references. The last mm_put() detaches shared memory and
+// frees the page table, VMAs and file descriptor table.
+mm_t* mm_get(mm_t* mm);
+void mm_put(mm_t* mm);
+
+// mm_put() for callers that can't tear an address space down (reclaim
+// and scanners, with interrupts off or locks held): the last reference
+// leaves it to the reaper thread, which calls mm_reap()
+void mm_put_async(mm_t* mm);
+void mm_reap(void);
+bool mm_reap_pending(void);
+
+// Region bookkeeping. mm_add_vma() fails on overlap.
+int mm_add_vma(mm_t* mm, uint64_t start, uint64_t end, uint32_t flags);
+int mm_remove_vma(mm_t* mm, uint64_t start);
+int mm_resize_vma(mm_t* mm, uint64_t start, uint64_t end);
+vma_t* mm_find_vma(mm_t* mm, uint64_t addr);
+int mm_dup_vmas(mm_t* dst, mm_t* src);
+void mm_clear_vmas(mm_t* mm);
+
+#endif // MM_H
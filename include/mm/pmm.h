@@ -3,11 +3,19 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 // Physical Memory Manager - manages physical page allocation
 
 #define PAGE_SIZE 4096
 #define PAGE_SHIFT 12
+#define PMM_MAX_COLORS 64
+#define PMM_CMA_ALIGN  512      // CMA region granularity in pages (2MB)
+
+// Background page zeroing
+#define PMM_ZERO_BATCH    64    // Pages cleared per run
+#define PMM_ZERO_BUSY_MS  10    // Delay between runs while pages are left
+#define PMM_ZERO_IDLE_MS  1000  // Delay once every free page is clear
 
 // Page aligned addresses
 #define PAGE_ALIGN_DOWN(x) ((x) & ~(PAGE_SIZE - 1))
@@ -19,6 +27,20 @@ void pmm_init(uint64_t memory_size);
 // Allocate a single physical page
 void* pmm_alloc_page(void);
 
+// Allocate a page of the cache color at *cursor, advancing the cursor
+void* pmm_alloc_page_color(uint32_t* cursor);
+void pmm_cache_geometry(uint32_t* colors, uint32_t* ways);
+bool pmm_set_coloring(bool enabled);
+
+// Allocate a page that may later be migrated (private user data)
+void* pmm_alloc_page_movable(uint32_t* cursor);
+
+// Contiguous memory area support
+void* pmm_reserve_cma(size_t count);
+int pmm_alloc_page_at(void* page);
+bool pmm_page_is_cma(void* page);
+void pmm_get_cma_stats(size_t* total_pages, size_t* free_pages);
+
 // Free a physical page
 void pmm_free_page(void* page);
 
@@ -28,7 +50,19 @@ void* pmm_alloc_pages(size_t count);
 // Free multiple contiguous pages
 void pmm_free_pages(void* page, size_t count);
 
+// Reference counting for pages shared between address spaces.
+// A freshly allocated page starts with one reference.
+int pmm_page_ref(void* page);
+void pmm_page_unref(void* page);
+uint32_t pmm_page_refcount(void* page);
+
 // Get memory statistics
 void pmm_get_stats(size_t* total_pages, size_t* free_pages, size_t* used_pages);
 
+// Clear free pages ahead of allocation; pmm_zero_thread() is the body of
+// the "kzerod" kernel thread
+size_t pmm_zero_pages(size_t max);
+void pmm_zero_thread(void* arg);
+void pmm_get_zero_stats(size_t* zeroed_pages, uint64_t* hits, uint64_t* misses);
+
 #endif // PMM_H
\ No newline at end of file
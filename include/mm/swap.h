@@ -0,0 +1,64 @@
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "process.h"
+#include "pmm.h"
+#include "vmm.h"
+
+// Compressed in-memory swap. Cold anonymous user pages are compressed
+// into a kmalloc pool and their PTE is replaced by a non-present swap
+// entry: slot number in the address bits plus PAGE_SWAPPED.
+
+#define SWAP_MAX_SLOTS      32768
+#define SWAP_POOL_LIMIT     (8 * 1024 * 1024)   // Compressed bytes held at most
+#define SWAP_MAX_COMPRESSED (PAGE_SIZE * 3 / 4)  // Keep pages that compress worse
+
+// Default reclaim watermarks (free pages)
+#define SWAP_LOW_WATERMARK  256     // Start reclaiming below 1MB free
+#define SWAP_HIGH_WATERMARK 1024    // Reclaim until 4MB free
+
+// Swap entry encoding (PTE flags kept: writable, user, NX)
+#define SWAP_ENTRY_FLAGS    (PAGE_WRITABLE | PAGE_USER | PAGE_NX)
+#define SWAP_ENTRY(slot, pte) (((uint64_t)(slot) << 12) | ((pte) & SWAP_ENTRY_FLAGS) | PAGE_SWAPPED)
+#define SWAP_ENTRY_SLOT(pte)  (((pte) & ~PAGE_NX) >> 12)
+#define IS_SWAP_ENTRY(pte)    (!((pte) & PAGE_PRESENT) && ((pte) & PAGE_SWAPPED))
+
+typedef struct {
+    uint64_t pages_out;         // Pages compressed and evicted
+    uint64_t pages_in;          // Pages faulted back in
+    uint64_t pages_stored;      // Slots currently in use
+    uint64_t zero_pages;        // Stored pages that were all zero
+    uint64_t bytes_stored;      // Compressed bytes in the pool
+    uint64_t incompressible;    // Eviction attempts rejected
+    uint64_t lazyfree_dropped;  // MADV_FREE pages discarded without saving
+    uint64_t reclaim_runs;
+    uint64_t swapin_cycles;     // Total TSC cycles spent in swap-in
+    uint64_t swapin_cycles_max;
+} swap_stats_t;
+
+// Initialize the swap slot table
+void swap_init(void);
+
+// Set the free page watermarks that drive reclaim
+void swap_set_watermarks(size_t low, size_t high);
+
+// Called by the PMM on allocation: reclaim if free memory is low
+void swap_balance(size_t free_pages);
+
+// Evict up to target pages. Returns the number of pages freed.
+size_t swap_reclaim(size_t target);
+
+// Bring a swapped page back in. Returns 0 on success.
+int swap_in(process_t* process, uint64_t virt, uint64_t* pte);
+
+// Reference management for swap entries copied/dropped with page tables
+int swap_entry_dup(uint64_t entry);
+void swap_entry_free(uint64_t entry);
+
+// Statistics
+void swap_get_stats(swap_stats_t* stats);
+void swap_print_stats(void);
+
+#endif // SWAP_H
@@ -19,13 +19,36 @@
 #define PAGE_GLOBAL     (1 << 8)
 #define PAGE_NX         (1ULL << 63)
 
+// Software-defined PTE bits (ignored by the MMU)
+#define PAGE_SHARED     (1 << 9)   // Frame is shared, not copied on fork
+#define PAGE_SWAPPED    (1 << 10)  // Non-present: entry refers to a swap slot
+#define PAGE_COW        (1 << 10)  // Present: read-only, copy on write
+#define PAGE_LAZYFREE   (1 << 11)  // MADV_FREE: may be dropped if still clean
+#define PAGE_PINNED     (1ULL << 52) // With PAGE_SHARED: kernel frame, never counted or freed
+
 // Standard user space memory layout
 #define USER_STACK_TOP    0x00007FFFFFFFE000  // Just below kernel space
 #define USER_STACK_SIZE   0x100000            // 1MB stack
 #define USER_HEAP_START   0x400000            // After typical ELF load address
 #define USER_CODE_START   0x100000            // Default code location
+#define USER_SHM_START    0x20000000          // Shared memory attach region
+#define USER_SHM_END      0x40000000
+#define USER_VDSO_START   0x40000000          // vDSO pages (vdso.h)
+#define USER_RING_START   0x40100000          // I/O ring (io_ring.h)
+#define USER_SPACE_END    0x0000800000000000  // End of canonical lower half
 #define KERNEL_BASE       0xFFFF800000000000  // Higher half kernel
 
+// Page fault error code bits
+#define PF_PRESENT  (1 << 0)  // Page not present
+#define PF_WRITE    (1 << 1)  // Write access
+#define PF_USER     (1 << 2)  // User mode
+#define PF_RESERVED (1 << 3)  // Reserved bit set
+#define PF_FETCH    (1 << 4)  // Instruction fetch
+
+// madvise() advice values
+#define MADV_DONTNEED     4                   // Free now, refault as zero
+#define MADV_FREE         8                   // Contents no longer needed
+
 // Page table indices from virtual address
 #define PML4_INDEX(addr) (((addr) >> 39) & 0x1FF)
 #define PDPT_INDEX(addr) (((addr) >> 30) & 0x1FF)
@@ -47,16 +70,38 @@ void vmm_unmap_page(uint64_t* pml4, uint64_t virt);
 // Get physical address from virtual
 uint64_t vmm_get_physical(uint64_t* pml4, uint64_t virt);
 
+// Get the page table entry for a virtual address (NULL if no page table)
+uint64_t* vmm_get_pte(uint64_t* pml4, uint64_t virt);
+
+// Walk user page tables: next present PT at or above *addr
+uint64_t* vmm_next_pt(uint64_t* pml4, uint64_t* addr);
+
+// Write-protect a live user PTE (still holding 'entry') before reading
+// the page from another CPU. Returns the protected entry, or 0 if the
+// page changed hands or was written meanwhile.
+uint64_t vmm_pte_wrprotect(uint64_t* pml4, uint64_t* pte, uint64_t virt, uint64_t entry);
+
+// Undo vmm_pte_wrprotect() unless the PTE has changed since
+void vmm_pte_restore(uint64_t* pte, uint64_t prot, uint64_t entry);
+
 // Switch to a different address space
 void vmm_switch_address_space(uint64_t* pml4);
 
 // Process-specific memory functions
 int vmm_alloc_user_pages(process_t* process, uint64_t virt_addr, size_t count);
+size_t vmm_free_user_pages(process_t* process, uint64_t virt_addr, size_t count);
+void vmm_lazyfree_user_pages(process_t* process, uint64_t virt_addr, size_t count);
 int vmm_setup_user_stack(process_t* process);
 int vmm_setup_user_heap(process_t* process);
 
+// Resolve a user page fault (swap-in, demand-zero heap pages). Returns 0 if handled.
+int vmm_handle_fault(process_t* process, uint64_t addr, uint64_t error);
+
 // Address space cloning for fork
 uint64_t* vmm_clone_address_space(uint64_t* parent_pml4);
 void vmm_clear_user_space(uint64_t* pml4);
 
+// Release every user mapping and page table below KERNEL_BASE
+void vmm_free_user_mappings(uint64_t* pml4);
+
 #endif // VMM_H
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include "../include/acpi.h"
+#include "../include/multiboot.h"
+#include "../include/terminal.h"
+#include "../include/string.h"
+
+// Root System Description Pointer
+typedef struct {
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;           // 0 = ACPI 1.0, 2 = ACPI 2.0+
+    uint32_t rsdt_address;
+    // ACPI 2.0+
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+// Common header of every system description table
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_t;
+
+// Multiple APIC Description Table
+typedef struct {
+    acpi_sdt_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__((packed)) acpi_madt_t;
+
+#define MADT_FLAG_PCAT_COMPAT   0x1
+
+// MADT entry types
+#define MADT_LAPIC              0
+#define MADT_IOAPIC             1
+#define MADT_OVERRIDE           2
+#define MADT_LAPIC_OVERRIDE     5
+
+#define MADT_LAPIC_ENABLED      0x1
+
+static const acpi_sdt_t* root_table = NULL;
+static bool root_is_xsdt = false;
+static acpi_info_t acpi_info;
+
+// Sum of all bytes must be zero
+static bool acpi_checksum(const void* table, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)table;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+// Search a physical range for the RSDP signature on 16-byte boundaries
+static const acpi_rsdp_t* acpi_scan_rsdp(uint64_t start, uint64_t end) {
+    for (uint64_t addr = start; addr < end; addr += 16) {
+        const acpi_rsdp_t* rsdp = (const acpi_rsdp_t*)addr;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum(rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+// Prefer the bootloader's copy; fall back to the BIOS areas
+static const acpi_rsdp_t* acpi_find_rsdp(void) {
+    const acpi_rsdp_t* rsdp = (const acpi_rsdp_t*)multiboot_acpi_rsdp();
+    if (rsdp) {
+        return rsdp;
+    }
+    
+    // First KB of the EBDA, whose segment is stored at 0x40E in the BIOS
+    // data area. GCC takes a constant address this low for an offset from
+    // NULL and warns about the read, so the base goes through a register.
+    uint64_t bda = 0x400;
+    asm("" : "+r"(bda));
+    uint64_t ebda = (uint64_t)(*(volatile uint16_t*)(bda + 0x0E)) << 4;
+    if (ebda) {
+        rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+        if (rsdp) {
+            return rsdp;
+        }
+    }
+    return acpi_scan_rsdp(0xE0000, 0x100000);
+}
+
+// Find a table through the RSDT/XSDT
+const void* acpi_find_table(const char* signature) {
+    if (!root_table) {
+        return NULL;
+    }
+    
+    size_t entry_size = root_is_xsdt ? 8 : 4;
+    size_t count = (root_table->length - sizeof(acpi_sdt_t)) / entry_size;
+    const uint8_t* entries = (const uint8_t*)root_table + sizeof(acpi_sdt_t);
+    
+    for (size_t i = 0; i < count; i++) {
+        uint64_t addr = root_is_xsdt ? *(const uint64_t*)(entries + i * 8)
+                                     : *(const uint32_t*)(entries + i * 4);
+        const acpi_sdt_t* table = (const acpi_sdt_t*)addr;
+        if (table && memcmp(table->signature, signature, 4) == 0 &&
+            acpi_checksum(table, table->length)) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+// Record CPUs, I/O APICs and IRQ overrides from the MADT
+static void acpi_parse_madt(const acpi_madt_t* madt) {
+    acpi_info.lapic_base = madt->lapic_address;
+    acpi_info.legacy_pic = madt->flags & MADT_FLAG_PCAT_COMPAT;
+    
+    const uint8_t* entry = madt->entries;
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    
+    while (entry + 2 <= end && entry[1] >= 2) {
+        switch (entry[0]) {
+            case MADT_LAPIC:
+                // processor id, APIC id, flags
+                if ((*(const uint32_t*)(entry + 4) & MADT_LAPIC_ENABLED) &&
+                    acpi_info.cpu_count < ACPI_MAX_CPUS) {
+                    acpi_info.cpu_apic_ids[acpi_info.cpu_count++] = entry[3];
+                }
+                break;
+            
+            case MADT_IOAPIC:
+                if (acpi_info.ioapic_count < ACPI_MAX_IOAPICS) {
+                    acpi_ioapic_t* io = &acpi_info.ioapics[acpi_info.ioapic_count++];
+                    io->id = entry[2];
+                    io->address = *(const uint32_t*)(entry + 4);
+                    io->gsi_base = *(const uint32_t*)(entry + 8);
+                }
+                break;
+            
+            case MADT_OVERRIDE:
+                if (acpi_info.override_count < ACPI_MAX_OVERRIDES) {
+                    acpi_override_t* o = &acpi_info.overrides[acpi_info.override_count++];
+                    o->irq = entry[3];
+                    o->gsi = *(const uint32_t*)(entry + 4);
+                    o->flags = *(const uint16_t*)(entry + 8);
+                }
+                break;
+            
+            case MADT_LAPIC_OVERRIDE:
+                acpi_info.lapic_base = *(const uint64_t*)(entry + 4);
+                break;
+        }
+        entry += entry[1];
+    }
+}
+
+// Locate ACPI tables and parse the MADT
+bool acpi_init(void) {
+    memset(&acpi_info, 0, sizeof(acpi_info));
+    
+    const acpi_rsdp_t* rsdp = acpi_find_rsdp();
+    if (!rsdp) {
+        terminal_writestring("ACPI: no RSDP found\n");
+        return false;
+    }
+    
+    if (rsdp->revision >= 2 && rsdp->xsdt_address) {
+        root_table = (const acpi_sdt_t*)rsdp->xsdt_address;
+        root_is_xsdt = true;
+    } else {
+        root_table = (const acpi_sdt_t*)(uint64_t)rsdp->rsdt_address;
+        root_is_xsdt = false;
+    }
+    
+    const acpi_madt_t* madt = (const acpi_madt_t*)acpi_find_table("APIC");
+    if (!madt) {
+        terminal_writestring("ACPI: no MADT, assuming one CPU\n");
+        return false;
+    }
+    
+    acpi_parse_madt(madt);
+    return acpi_info.cpu_count > 0;
+}
+
+// Parsed MADT contents
+const acpi_info_t* acpi_get_info(void) {
+    return &acpi_info;
+}
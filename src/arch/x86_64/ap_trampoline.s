@@ -0,0 +1,97 @@
+# Application processor startup code
+# smp_init() copies everything between ap_trampoline_start and
+# ap_trampoline_end to AP_TRAMPOLINE_ADDR and fills in the data block at
+# the end. A startup IPI starts each AP here in 16-bit real mode; it
+# climbs through protected mode into long mode on the kernel page tables
+# and calls ap_entry(ap_cpu) on the stack it was given.
+
+.set AP_BASE, 0x8000
+
+# Labels are addressed as (label - ap_trampoline_start + AP_BASE): their
+# location in the copy, since the code is not run where it was linked.
+
+.global ap_trampoline_start
+.global ap_trampoline_end
+.global ap_cr3
+.global ap_stack
+.global ap_entry
+.global ap_cpu
+
+.section .text
+.code16
+ap_trampoline_start:
+    cli
+    cld
+    xor %ax, %ax
+    mov %ax, %ds
+    
+    # Temporary GDT with 32-bit and 64-bit code segments
+    lgdtl (ap_gdt_ptr - ap_trampoline_start + AP_BASE)
+    
+    mov %cr0, %eax
+    or $1, %eax                     # PE
+    mov %eax, %cr0
+    ljmpl $0x08, $(ap_protected_mode - ap_trampoline_start + AP_BASE)
+
+.code32
+ap_protected_mode:
+    mov $0x10, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %ss
+    
+    # PAE is required for long mode
+    mov %cr4, %eax
+    or $(1 << 5), %eax
+    mov %eax, %cr4
+    
+    # Same page tables as the boot CPU
+    mov (ap_cr3 - ap_trampoline_start + AP_BASE), %eax
+    mov %eax, %cr3
+    
+    # EFER.LME
+    mov $0xC0000080, %ecx
+    rdmsr
+    or $(1 << 8), %eax
+    wrmsr
+    
+    # PG | WP, matching enable_paging
+    mov %cr0, %eax
+    or $0x80010000, %eax
+    mov %eax, %cr0
+    ljmp $0x18, $(ap_long_mode - ap_trampoline_start + AP_BASE)
+
+.code64
+ap_long_mode:
+    mov $0x10, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %ss
+    
+    mov (ap_stack - ap_trampoline_start + AP_BASE), %rsp
+    mov (ap_cpu - ap_trampoline_start + AP_BASE), %rdi
+    mov (ap_entry - ap_trampoline_start + AP_BASE), %rax
+    call *%rax
+    
+    # ap_entry never returns
+1:  cli
+    hlt
+    jmp 1b
+
+.align 8
+ap_gdt:
+    .quad 0                         # Null
+    .quad 0x00CF9A000000FFFF        # 0x08: 32-bit code
+    .quad 0x00CF92000000FFFF        # 0x10: data
+    .quad 0x00AF9A000000FFFF        # 0x18: 64-bit code
+ap_gdt_ptr:
+    .word ap_gdt_ptr - ap_gdt - 1
+    .long ap_gdt - ap_trampoline_start + AP_BASE
+
+# Filled in by smp_init() before each startup IPI
+.align 8
+ap_cr3:     .quad 0                 # Kernel PML4
+ap_stack:   .quad 0                 # Top of the AP's boot (idle) stack
+ap_entry:   .quad 0                 # ap_main
+ap_cpu:     .quad 0                 # cpu_t for this AP
+ap_trampoline_end:
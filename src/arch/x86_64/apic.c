@@ -0,0 +1,237 @@
+#include "../include/apic.h"
+#include "../include/vmm.h"
+#include "../include/ports.h"
+#include "../include/cpu.h"
+#include "../include/multiboot.h"
+#include "../include/timer.h"
+
+extern uint64_t* pml4;  // From kernel.c
+
+// Local APIC register offsets
+#define LAPIC_ID        0x020
+#define LAPIC_TPR       0x080
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0
+#define LAPIC_ICR_LOW   0x300
+#define LAPIC_ICR_HIGH  0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_TIMER_ONESHOT     0x00000
+#define LAPIC_TIMER_PERIODIC    0x20000
+#define LAPIC_TIMER_TSC_DEADLINE 0x40000
+#define LAPIC_TIMER_DIV_16      0x3
+
+// x2APIC: the same registers as MSRs 0x800 + offset / 16, and a single
+// 64-bit ICR with the full destination ID in the high half
+#define X2APIC_MSR_BASE         0x800
+#define X2APIC_MSR_EOI          0x80B
+#define X2APIC_MSR_ICR          0x830
+#define APIC_BASE_X2APIC        (1ULL << 10)
+#define APIC_BASE_ENABLE        (1ULL << 11)
+
+#define MSR_TSC_DEADLINE        0x6E0
+#define CPUID_TSC_DEADLINE      (1 << 24)   // CPUID.1:ECX
+
+// Interrupt command register fields
+#define ICR_FIXED               0x00000
+#define ICR_INIT                0x00500
+#define ICR_STARTUP             0x00600
+#define ICR_PENDING             0x01000
+#define ICR_ASSERT              0x04000
+#define ICR_LEVEL               0x08000
+
+#define CALIBRATE_MS            10
+#define ONESHOT_MAX_NS          4000000000ULL   // Keeps the count math in 64 bits
+
+static volatile uint32_t* lapic = NULL;
+static bool x2apic = false;
+static bool tsc_deadline = false;
+static uint32_t lapic_timer_hz = 0;     // Timer counts per second (divide by 16)
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    if (x2apic) {
+        return (uint32_t)rdmsr(X2APIC_MSR_BASE + reg / 16);
+    }
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    if (x2apic) {
+        wrmsr(X2APIC_MSR_BASE + reg / 16, value);
+    } else {
+        lapic[reg / 4] = value;
+    }
+}
+
+// Rough microsecond delay: each write to the POST port takes about 1us.
+// Used only during AP startup, before the tick is trustworthy.
+static void apic_delay_us(uint32_t us) {
+    for (uint32_t i = 0; i < us; i++) {
+        outb(0x80, 0);
+    }
+}
+
+// Wait for the previous IPI to leave the local APIC. The x2APIC has no
+// delivery status bit: a write to the ICR is accepted when it completes.
+static void lapic_wait_icr(void) {
+    if (x2apic) {
+        return;
+    }
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        cpu_relax();
+    }
+}
+
+static void lapic_send_icr(uint32_t apic_id, uint32_t low) {
+    if (x2apic) {
+        wrmsr(X2APIC_MSR_ICR, ((uint64_t)apic_id << 32) | low);
+        return;
+    }
+    lapic_wait_icr();
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, low);
+}
+
+// Map the local APIC registers (uncached) into the kernel address space.
+// x2APIC mode is used when the CPU has it, unless "nox2apic" is given.
+bool lapic_init(uint64_t base) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(edx & (1 << 9)) || !base) {
+        return false;
+    }
+    
+    if (vmm_map_page(pml4, base, base, PAGE_WRITABLE | PAGE_CACHE_DISABLE) < 0) {
+        return false;
+    }
+    lapic = (volatile uint32_t*)base;
+    x2apic = (ecx & (1 << 21)) && !cmdline_param("nox2apic");
+    tsc_deadline = ecx & CPUID_TSC_DEADLINE;
+    lapic_enable();
+    return true;
+}
+
+// Enable the APIC (in x2APIC mode if chosen) and route spurious
+// interrupts to their own vector
+void lapic_enable(void) {
+    if (x2apic) {
+        wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE | APIC_BASE_X2APIC);
+    }
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+bool lapic_is_x2apic(void) {
+    return x2apic;
+}
+
+uint32_t lapic_id(void) {
+    if (!lapic) {
+        return 0;
+    }
+    return x2apic ? lapic_read(LAPIC_ID) : lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    if (x2apic) {
+        wrmsr(X2APIC_MSR_EOI, 0);
+    } else {
+        lapic[LAPIC_EOI / 4] = 0;
+    }
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    uint64_t flags = irq_save();
+    lapic_send_icr(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+    irq_restore(flags);
+}
+
+// INIT, wait 10ms, then two startup IPIs 200us apart (the MP spec
+// sequence; modern CPUs start on the first SIPI and ignore the second)
+void lapic_start_ap(uint32_t apic_id, uint8_t vector) {
+    lapic_send_icr(apic_id, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+    apic_delay_us(200);
+    lapic_send_icr(apic_id, ICR_INIT | ICR_LEVEL);
+    apic_delay_us(10000);
+    
+    for (int i = 0; i < 2; i++) {
+        lapic_send_icr(apic_id, ICR_STARTUP | vector);
+        apic_delay_us(200);
+    }
+    lapic_wait_icr();
+}
+
+// Measure the timer's count rate against PIT channel 2. Channel 0 keeps
+// running the tick meanwhile.
+void lapic_timer_calibrate(void) {
+    pit_oneshot_start(CALIBRATE_MS);
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    
+    while (!pit_oneshot_done()) {
+        cpu_relax();
+    }
+    
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    lapic_timer_hz = elapsed * (1000 / CALIBRATE_MS);
+}
+
+// Start the calling CPU's timer firing LAPIC_TIMER_VECTOR 'hz' times a
+// second. Returns false if the timer was never calibrated.
+bool lapic_timer_start(uint32_t hz) {
+    if (!lapic_timer_hz || !hz) {
+        return false;
+    }
+    
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_hz / hz);
+    return true;
+}
+
+// Fire LAPIC_TIMER_VECTOR once, 'ns' nanoseconds from now. Delays longer
+// than the counter holds fire early; the handler just re-arms.
+void lapic_timer_oneshot(uint64_t ns) {
+    if (ns > ONESHOT_MAX_NS) {
+        ns = ONESHOT_MAX_NS;
+    }
+    uint64_t count = ns * (lapic_timer_hz / 1000) / 1000000;
+    if (count > 0xFFFFFFFF) {
+        count = 0xFFFFFFFF;
+    } else if (count == 0) {
+        count = 1;
+    }
+    
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, (uint32_t)count);
+}
+
+bool lapic_has_tsc_deadline(void) {
+    return tsc_deadline;
+}
+
+// Fire LAPIC_TIMER_VECTOR once the TSC reaches 'tsc'. A deadline already
+// in the past fires immediately.
+void lapic_timer_deadline(uint64_t tsc) {
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | LAPIC_TIMER_VECTOR);
+    
+    // The LVT write must land before the deadline MSR is armed
+    asm volatile("mfence" ::: "memory");
+    wrmsr(MSR_TSC_DEADLINE, tsc ? tsc : 1);
+}
+
+// Stop the calling CPU's timer, whatever its mode
+void lapic_timer_stop(void) {
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    if (tsc_deadline) {
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    }
+}
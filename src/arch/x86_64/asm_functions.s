@@ -25,7 +25,27 @@
 .global isr20
 .global irq0
 .global irq1
+.global irq2
+.global irq3
+.global irq4
+.global irq5
+.global irq6
+.global irq7
+.global irq8
+.global irq9
+.global irq10
+.global irq11
+.global irq12
+.global irq13
+.global irq14
+.global irq15
 .global isr128
+.global isr_return
+.global syscall_entry
+.global lapic_timer
+.global ipi_reschedule
+.global ipi_tlb
+.global spurious
 
 load_gdt:
     lgdt (%rdi)
@@ -33,8 +53,7 @@ load_gdt:
     mov %ax, %ds
     mov %ax, %es
     mov %ax, %fs
-    mov %ax, %gs
-    mov %ax, %ss
+    mov %ax, %ss               # not %gs: that would reset the per-CPU base
     pushq $0x08
     pushq $.reload_cs
     retfq
@@ -48,7 +67,7 @@ load_idt:
 enable_paging:
     mov %rdi, %cr3
     mov %cr0, %rax
-    mov $0x80000001, %rbx
+    mov $0x80010001, %rbx      # PG | WP | PE: ring 0 honours read-only pages
     or %rbx, %rax
     mov %rax, %cr0
     ret
@@ -182,7 +201,17 @@ isr20:
     pushq $20
     jmp isr_common_stub
 
+# GS: in the kernel GS_BASE points at this CPU's data and
+# KERNEL_GS_BASE holds the user's base; SWAPGS exchanges them on every
+# entry from and return to ring 3, told apart by the RPL of the saved CS.
+# Nothing user code does to GS can reach the kernel's base.
+
 isr_common_stub:
+    # Frame so far: interrupt number, error code, rip, cs
+    testb $3, 24(%rsp)
+    jz 1f
+    swapgs
+1:
     # Save all registers
     pushq %rax
     pushq %rcx
@@ -204,6 +233,10 @@ isr_common_stub:
     mov %rsp, %rdi
     call isr_handler
 
+isr_return:
+    # No interrupt may come in between SWAPGS and iretq
+    cli
+    
     # Restore all registers
     popq %r15
     popq %r14
@@ -221,6 +254,10 @@ isr_common_stub:
     popq %rcx
     popq %rax
 
+    testb $3, 24(%rsp)
+    jz 1f
+    swapgs
+1:
     # Clean up error code and interrupt number
     addq $16, %rsp
     sti
@@ -239,9 +276,205 @@ irq1:
     pushq $33
     jmp isr_common_stub
 
+irq2:
+    cli
+    pushq $0
+    pushq $34
+    jmp isr_common_stub
+
+irq3:
+    cli
+    pushq $0
+    pushq $35
+    jmp isr_common_stub
+
+irq4:
+    cli
+    pushq $0
+    pushq $36
+    jmp isr_common_stub
+
+irq5:
+    cli
+    pushq $0
+    pushq $37
+    jmp isr_common_stub
+
+irq6:
+    cli
+    pushq $0
+    pushq $38
+    jmp isr_common_stub
+
+irq7:
+    cli
+    pushq $0
+    pushq $39
+    jmp isr_common_stub
+
+irq8:
+    cli
+    pushq $0
+    pushq $40
+    jmp isr_common_stub
+
+irq9:
+    cli
+    pushq $0
+    pushq $41
+    jmp isr_common_stub
+
+irq10:
+    cli
+    pushq $0
+    pushq $42
+    jmp isr_common_stub
+
+irq11:
+    cli
+    pushq $0
+    pushq $43
+    jmp isr_common_stub
+
+irq12:
+    cli
+    pushq $0
+    pushq $44
+    jmp isr_common_stub
+
+irq13:
+    cli
+    pushq $0
+    pushq $45
+    jmp isr_common_stub
+
+irq14:
+    cli
+    pushq $0
+    pushq $46
+    jmp isr_common_stub
+
+irq15:
+    cli
+    pushq $0
+    pushq $47
+    jmp isr_common_stub
+
+# Local APIC timer and inter-processor interrupts (see apic.h)
+lapic_timer:
+    cli
+    pushq $0
+    pushq $240
+    jmp isr_common_stub
+
+ipi_reschedule:
+    cli
+    pushq $0
+    pushq $241
+    jmp isr_common_stub
+
+ipi_tlb:
+    cli
+    pushq $0
+    pushq $242
+    jmp isr_common_stub
+
+spurious:
+    cli
+    pushq $0
+    pushq $255
+    jmp isr_common_stub
+
 # System call handler (INT 0x80 = 128)
 isr128:
     cli
     pushq $0
     pushq $128
     jmp isr_common_stub
+
+# SYSCALL entry. The CPU leaves the user RIP in RCX and RFLAGS in R11,
+# loads the kernel CS/SS from STAR and clears IF (FMASK), but keeps the
+# user stack and the user's GS base. SWAPGS comes first: only then does
+# %gs reach this CPU's data and the kernel stack.
+#
+# The frame built here has the same layout as an INT 0x80 frame, so
+# syscall_handler(), clone() and signal code see no difference, and a
+# return that SYSRET cannot do safely leaves through iretq instead.
+
+# Offsets in cpu_t (smp.h)
+.set CPU_SYSCALL_STACK, 8
+.set CPU_USER_RSP, 16
+
+# User selectors (GDT entries 3 and 4, RPL 3)
+.set USER_DATA_SEL, 0x1B
+.set USER_CODE_SEL, 0x23
+
+syscall_entry:
+    swapgs
+    movq %rsp, %gs:CPU_USER_RSP
+    movq %gs:CPU_SYSCALL_STACK, %rsp
+    
+    # What INT 0x80 would have pushed
+    pushq $USER_DATA_SEL    # ss
+    pushq %gs:CPU_USER_RSP  # rsp
+    pushq %r11              # rflags
+    pushq $USER_CODE_SEL    # cs
+    pushq %rcx              # rip
+    pushq $0                # error code
+    pushq $128              # interrupt number
+    
+    # Same order as isr_common_stub
+    pushq %rax
+    pushq %rcx
+    pushq %rdx
+    pushq %rbx
+    pushq %rbp
+    pushq %rsi
+    pushq %rdi
+    pushq %r8
+    pushq %r9
+    pushq %r10
+    pushq %r11
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    
+    # Straight to the system call, then the same preemption point an
+    # interrupt return has
+    mov %rsp, %rdi
+    call syscall_handler
+    call scheduler_resched
+    cli
+    
+    # SYSRET to a non-canonical RIP would fault in ring 0 on the user
+    # stack; let iretq deal with it in ring 3 (isr_return swaps GS back)
+    movq 136(%rsp), %rcx    # rip
+    movq %rcx, %r11
+    shlq $16, %r11
+    sarq $16, %r11
+    cmpq %rcx, %r11
+    jne isr_return
+    
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %r11
+    popq %r10
+    popq %r9
+    popq %r8
+    popq %rdi
+    popq %rsi
+    popq %rbp
+    popq %rbx
+    popq %rdx
+    addq $8, %rsp           # rcx: SYSRET takes the RIP from it
+    popq %rax
+    addq $16, %rsp          # interrupt number and error code
+    popq %rcx               # rip
+    addq $8, %rsp           # cs
+    popq %r11               # rflags
+    popq %rsp               # user rsp (ss is implied)
+    swapgs
+    sysretq
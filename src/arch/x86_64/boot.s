@@ -33,9 +33,9 @@ _start:
     push $0
     popf
     
-    # Pass multiboot info to kernel_main
-    push %rbx                       # Multiboot info structure
-    push %rax                       # Multiboot magic number
+    # Pass multiboot info to kernel_main(magic, info)
+    mov %eax, %edi                  # Multiboot magic number
+    mov %ebx, %esi                  # Multiboot info structure
     
     # Call kernel
     call kernel_main
@@ -44,8 +44,10 @@ load_new_context:
     movq 32(%rsi), %rbx     # rbx
     movq 40(%rsi), %rbp     # rbp
     
-    # Restore RFLAGS
+    # Restore RFLAGS, but keep interrupts off: the run queue lock is
+    # still held and schedule()/schedule_tail() re-enable them
     movq 64(%rsi), %rax     # rflags
+    andq $~0x200, %rax      # clear IF
     pushq %rax
     popfq
     
@@ -61,8 +63,14 @@ load_new_context:
 .type process_entry_trampoline, @function
 
 process_entry_trampoline:
-    # The entry point address is in %rdi (first argument)
-    call *%rdi
+    # process_create() left the entry point on top of the stack
+    popq %r12
+    
+    # Finish the switch that got us here (drops the run queue lock)
+    call schedule_tail
+    sti
+    
+    call *%r12
     
     # Process returned, call exit
     movq $0, %rdi           # Exit status 0
@@ -70,4 +78,34 @@ process_entry_trampoline:
     
     # Should never reach here
 1:  hlt
-    jmp 1b
\ No newline at end of file
+    jmp 1b
+
+# Entry point for kernel threads
+.global kthread_entry_trampoline
+.type kthread_entry_trampoline, @function
+
+kthread_entry_trampoline:
+    # kthread_create() left the function in r12 and its argument in r13
+    call schedule_tail
+    sti
+    
+    movq %r13, %rdi
+    call *%r12
+    
+    # Thread function returned
+    movq $0, %rdi
+    call process_exit
+    
+1:  hlt
+    jmp 1b
+
+# First return of a thread made by clone()
+.global clone_return_trampoline
+.type clone_return_trampoline, @function
+
+clone_return_trampoline:
+    # sys_clone() left a copy of its caller's trap frame on top of the
+    # stack, with RAX zeroed and RSP pointing at the new user stack. The
+    # interrupt return path restores it and swaps GS back to the user's.
+    call schedule_tail
+    jmp isr_return
\ No newline at end of file
@@ -0,0 +1,262 @@
+#include "../include/fpu.h"
+#include "../include/process.h"
+#include "../include/isr.h"
+#include "../include/cpu.h"
+#include "../include/kmalloc.h"
+#include "../include/string.h"
+#include "../include/terminal.h"
+#include "../include/panic.h"
+
+// Control register bits
+#define CR0_MP          (1 << 1)    // WAIT/FWAIT honours TS
+#define CR0_EM          (1 << 2)    // No x87: every FPU instruction traps
+#define CR0_TS          (1 << 3)    // Task switched: next FPU use traps
+#define CR0_NE          (1 << 5)    // Native x87 error reporting
+#define CR4_OSFXSR      (1 << 9)    // FXSAVE/FXRSTOR and SSE
+#define CR4_OSXMMEXCPT  (1 << 10)   // Unmasked SSE exceptions raise #XM
+#define CR4_OSXSAVE     (1 << 18)   // XSAVE family and XCR0
+
+// CPUID feature bits
+#define CPUID_1_EDX_FXSR        (1 << 24)
+#define CPUID_1_ECX_XSAVE       (1 << 26)
+#define CPUID_D1_EAX_XSAVEOPT   (1 << 0)
+
+// XCR0 components we hand to user space: x87, SSE, AVX and the three
+// AVX-512 parts
+#define XFEATURE_USER_MASK  0xE7ULL
+
+#define FXSAVE_SIZE     512
+#define FPU_ALIGN       64          // XSAVE wants 64, FXSAVE 16
+#define FPU_NM_VECTOR   7           // Device not available
+
+// Initial x87 control word and MXCSR: every exception masked
+#define FCW_INIT        0x037F
+#define MXCSR_INIT      0x1F80
+
+typedef enum {
+    FPU_FXSAVE,
+    FPU_XSAVE,
+    FPU_XSAVEOPT
+} fpu_method_t;
+
+static fpu_method_t fpu_method = FPU_FXSAVE;
+static uint64_t fpu_xcr0 = 0;
+static uint32_t fpu_size = FXSAVE_SIZE;
+
+// Reloads taken through #NM and saves at switch time, all CPUs
+static uint64_t fpu_loads = 0;
+static uint64_t fpu_saves = 0;
+
+// Load XCR0
+static inline void xsetbv(uint32_t index, uint64_t value) {
+    asm volatile("xsetbv" : : "c"(index), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+// Clear and set CR0.TS
+static inline void clts(void) {
+    asm volatile("clts" : : : "memory");
+}
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+// Write the registers to a save area. XSAVEOPT skips components still
+// in their initial state or unchanged since they were loaded from it.
+static void fpu_save(void* area) {
+    switch (fpu_method) {
+        case FPU_XSAVEOPT:
+            asm volatile("xsaveopt64 (%0)" : : "r"(area), "a"(-1), "d"(-1) : "memory");
+            break;
+        case FPU_XSAVE:
+            asm volatile("xsave64 (%0)" : : "r"(area), "a"(-1), "d"(-1) : "memory");
+            break;
+        default:
+            asm volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+            break;
+    }
+}
+
+// Load the registers from a save area
+static void fpu_restore(void* area) {
+    if (fpu_method == FPU_FXSAVE) {
+        asm volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+    } else {
+        asm volatile("xrstor64 (%0)" : : "r"(area), "a"(-1), "d"(-1) : "memory");
+    }
+}
+
+// A save area in the initial state. kmalloc() only aligns to 8, so the
+// block is over-allocated and the pointer to free sits just below the
+// area. With XSAVE a zero header marks every component as initial;
+// MXCSR is loaded from the area regardless, so it gets its default.
+static void* fpu_state_alloc(void) {
+    uint8_t* block = (uint8_t*)kzalloc(fpu_size + FPU_ALIGN + sizeof(void*));
+    if (!block) {
+        return NULL;
+    }
+    
+    uintptr_t area = ((uintptr_t)block + sizeof(void*) + FPU_ALIGN - 1) & ~(uintptr_t)(FPU_ALIGN - 1);
+    ((void**)area)[-1] = block;
+    *(uint16_t*)(area + 0) = FCW_INIT;
+    *(uint32_t*)(area + 24) = MXCSR_INIT;
+    return (void*)area;
+}
+
+// Free an area from fpu_state_alloc()
+static void fpu_state_free(void* area) {
+    kfree(((void**)area)[-1]);
+}
+
+// #NM: the running process wants the registers. Kernel code never uses
+// them, so a trap from ring 0 is a bug.
+static void fpu_trap(registers_t* regs) {
+    if ((regs->cs & 3) == 0) {
+        panic_with_regs("FPU used in kernel mode", regs);
+    }
+    
+    process_t* proc = process_get_current();
+    if (!proc->fpu_state) {
+        proc->fpu_state = fpu_state_alloc();
+        if (!proc->fpu_state) {
+            panic_with_regs("No memory for FPU state", regs);
+        }
+    }
+    
+    clts();
+    fpu_restore(proc->fpu_state);
+    this_cpu()->fpu_owner = proc;
+    __sync_fetch_and_add(&fpu_loads, 1);
+}
+
+// Set up this CPU: FPU present with native errors, SSE on, XCR0 loaded,
+// and TS set so the first use traps
+static void fpu_init_cpu(void) {
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (fpu_method != FPU_FXSAVE) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    write_cr4(cr4);
+    if (fpu_method != FPU_FXSAVE) {
+        xsetbv(0, fpu_xcr0);
+    }
+    
+    asm volatile("fninit");
+    this_cpu()->fpu_owner = NULL;
+    stts();
+}
+
+// Helper to print a decimal number
+static void print_dec(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
+// Pick the save method and state size on the boot CPU
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_1_EDX_FXSR)) {
+        panic("FPU: FXSAVE/FXRSTOR not supported");
+    }
+    
+    if (ecx & CPUID_1_ECX_XSAVE) {
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        fpu_xcr0 = (((uint64_t)edx << 32) | eax) & XFEATURE_USER_MASK;
+        cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+        fpu_method = (eax & CPUID_D1_EAX_XSAVEOPT) ? FPU_XSAVEOPT : FPU_XSAVE;
+    }
+    
+    fpu_init_cpu();
+    
+    // With XCR0 loaded, CPUID reports the area size it needs
+    if (fpu_method != FPU_FXSAVE) {
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        fpu_size = ebx;
+    }
+    
+    register_interrupt_handler(FPU_NM_VECTOR, fpu_trap);
+    fpu_print_stats();
+}
+
+// Application processors use what the boot CPU picked
+void fpu_init_ap(void) {
+    fpu_init_cpu();
+}
+
+// Called only for the owner, so only processes that used the registers
+// since their last switch pay for a save
+void fpu_switch_out(process_t* prev) {
+    fpu_save(prev->fpu_state);
+    this_cpu()->fpu_owner = NULL;
+    stts();
+    __sync_fetch_and_add(&fpu_saves, 1);
+}
+
+// The parent is running; if it owns the registers they hold its newest
+// state, and saving it leaves them loaded
+int fpu_copy(process_t* child, process_t* parent) {
+    if (!parent->fpu_state) {
+        return 0;
+    }
+    
+    child->fpu_state = fpu_state_alloc();
+    if (!child->fpu_state) {
+        return -1;
+    }
+    
+    uint64_t flags = irq_save();
+    if (this_cpu()->fpu_owner == parent) {
+        fpu_save(parent->fpu_state);
+    }
+    irq_restore(flags);
+    
+    memcpy(child->fpu_state, parent->fpu_state, fpu_size);
+    return 0;
+}
+
+// A process that is not running never owns the registers, so only exec
+// (the caller is current) has ownership to give up
+void fpu_release(process_t* proc) {
+    uint64_t flags = irq_save();
+    if (this_cpu()->fpu_owner == proc) {
+        this_cpu()->fpu_owner = NULL;
+        stts();
+    }
+    irq_restore(flags);
+    
+    if (proc->fpu_state) {
+        fpu_state_free(proc->fpu_state);
+        proc->fpu_state = NULL;
+    }
+}
+
+// Print the save method, state size and traffic
+void fpu_print_stats(void) {
+    static const char* methods[] = { "FXSAVE", "XSAVE", "XSAVEOPT" };
+    
+    terminal_writestring("FPU: lazy switching with ");
+    terminal_writestring(methods[fpu_method]);
+    terminal_writestring(", ");
+    print_dec(fpu_size);
+    terminal_writestring("-byte state");
+    if (fpu_xcr0 & (1 << 2)) {
+        terminal_writestring(", AVX");
+    }
+    if (fpu_xcr0 & (1 << 5)) {
+        terminal_writestring(", AVX-512");
+    }
+    terminal_writestring("; ");
+    print_dec(fpu_loads);
+    terminal_writestring(" loads, ");
+    print_dec(fpu_saves);
+    terminal_writestring(" saves\n");
+}
@@ -0,0 +1,130 @@
+#include "../include/ioapic.h"
+#include "../include/acpi.h"
+#include "../include/vmm.h"
+#include "../include/spinlock.h"
+
+extern uint64_t* pml4;  // From kernel.c
+
+// Indirect register access: select with IOREGSEL, then use IOWIN
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WIN          0x10
+
+#define IOAPIC_REG_VER      0x01
+#define IOAPIC_REG_REDTBL   0x10    // Two 32-bit registers per input
+
+// Redirection entry fields (low half)
+#define REDIR_ACTIVE_LOW    (1 << 13)
+#define REDIR_LEVEL         (1 << 15)
+#define REDIR_MASKED        (1 << 16)
+
+// MPS INTI flags from interrupt source overrides
+#define INTI_POLARITY_MASK  0x3
+#define INTI_POLARITY_LOW   0x3
+#define INTI_TRIGGER_MASK   0xC
+#define INTI_TRIGGER_LEVEL  0xC
+
+typedef struct {
+    volatile uint32_t* regs;
+    uint32_t gsi_base;
+    uint32_t inputs;            // Redirection entries
+} ioapic_t;
+
+static ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+static spinlock_t ioapic_lock = SPINLOCK_INIT;  // IOREGSEL/IOWIN pairs
+
+static uint32_t ioapic_read(ioapic_t* io, uint32_t reg) {
+    io->regs[IOAPIC_REGSEL / 4] = reg;
+    return io->regs[IOAPIC_WIN / 4];
+}
+
+static void ioapic_write(ioapic_t* io, uint32_t reg, uint32_t value) {
+    io->regs[IOAPIC_REGSEL / 4] = reg;
+    io->regs[IOAPIC_WIN / 4] = value;
+}
+
+// Map every I/O APIC and mask all inputs until drivers ask for them
+bool ioapic_init(void) {
+    const acpi_info_t* info = acpi_get_info();
+    
+    for (uint32_t i = 0; i < info->ioapic_count; i++) {
+        uint64_t base = info->ioapics[i].address;
+        if (vmm_map_page(pml4, base, base, PAGE_WRITABLE | PAGE_CACHE_DISABLE) < 0) {
+            continue;
+        }
+        
+        ioapic_t* io = &ioapics[ioapic_count++];
+        io->regs = (volatile uint32_t*)base;
+        io->gsi_base = info->ioapics[i].gsi_base;
+        io->inputs = ((ioapic_read(io, IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+        
+        for (uint32_t pin = 0; pin < io->inputs; pin++) {
+            ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, REDIR_MASKED);
+            ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2 + 1, 0);
+        }
+    }
+    
+    return ioapic_count > 0;
+}
+
+// GSI an ISA IRQ arrives on, with its INTI flags (0 = ISA defaults:
+// active high, edge triggered)
+static uint32_t ioapic_isa_gsi(uint8_t irq, uint16_t* flags) {
+    const acpi_info_t* info = acpi_get_info();
+    for (uint32_t i = 0; i < info->override_count; i++) {
+        if (info->overrides[i].irq == irq) {
+            *flags = info->overrides[i].flags;
+            return info->overrides[i].gsi;
+        }
+    }
+    *flags = 0;
+    return irq;
+}
+
+// The I/O APIC handling a GSI, or NULL
+static ioapic_t* ioapic_for_gsi(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].inputs) {
+            return &ioapics[i];
+        }
+    }
+    return NULL;
+}
+
+// Program the redirection entry for an ISA IRQ (fixed delivery,
+// physical destination)
+int ioapic_route_isa(uint8_t irq, uint8_t vector, uint32_t apic_id) {
+    uint16_t flags;
+    uint32_t gsi = ioapic_isa_gsi(irq, &flags);
+    ioapic_t* io = ioapic_for_gsi(gsi);
+    if (!io) {
+        return -1;
+    }
+    
+    uint32_t low = vector;
+    if ((flags & INTI_POLARITY_MASK) == INTI_POLARITY_LOW) {
+        low |= REDIR_ACTIVE_LOW;
+    }
+    if ((flags & INTI_TRIGGER_MASK) == INTI_TRIGGER_LEVEL) {
+        low |= REDIR_LEVEL;
+    }
+    
+    uint32_t pin = gsi - io->gsi_base;
+    uint64_t lock_flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2 + 1, apic_id << 24);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, low);
+    spin_unlock_irqrestore(&ioapic_lock, lock_flags);
+    return 0;
+}
+
+void ioapic_mask_isa(uint8_t irq) {
+    uint16_t flags;
+    uint32_t gsi = ioapic_isa_gsi(irq, &flags);
+    ioapic_t* io = ioapic_for_gsi(gsi);
+    if (io) {
+        uint32_t pin = gsi - io->gsi_base;
+        uint64_t lock_flags = spin_lock_irqsave(&ioapic_lock);
+        ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, REDIR_MASKED);
+        spin_unlock_irqrestore(&ioapic_lock, lock_flags);
+    }
+}
@@ -0,0 +1,268 @@
+#include "../include/irq.h"
+#include "../include/apic.h"
+#include "../include/ioapic.h"
+#include "../include/smp.h"
+#include "../include/ports.h"
+#include "../include/panic.h"
+#include "../include/terminal.h"
+#include "../include/multiboot.h"
+#include "../include/cpu.h"
+#include "../include/timer.h"
+
+// 8259 ports and commands
+#define PIC1_COMMAND    0x20
+#define PIC1_DATA       0x21
+#define PIC2_COMMAND    0xA0
+#define PIC2_DATA       0xA1
+#define PIC_EOI         0x20
+#define PIC_READ_ISR    0x0B
+#define PIC_CASCADE_IRQ 2
+
+// Per-vector descriptor
+typedef struct {
+    isr_t handler;
+    const char* name;
+    uint32_t flags;
+    uint8_t line;                   // ISA IRQ number (IRQ_FLAG_ISA)
+    uint64_t count;
+    uint64_t spurious;
+    uint64_t eoi_cycles;            // Entry to EOI, summed over count
+    uint64_t eoi_cycles_max;
+    uint64_t off_cycles_max;        // Entry to handler return, interrupts off
+} irq_desc_t;
+
+static irq_desc_t irq_descs[256];
+static bool irq_ioapic = false;     // ISA IRQs go through the I/O APIC
+static uint16_t pic_mask = 0xFFFF;  // Masked 8259 lines
+static uint16_t isa_enabled = 0;    // Lines with a handler, unmasked
+
+// Write the mask registers of both 8259s
+static void pic_write_mask(void) {
+    outb(PIC1_DATA, pic_mask & 0xFF);
+    outb(PIC2_DATA, pic_mask >> 8);
+}
+
+// An 8259 raises IRQ 7 (or 15) when a request goes away before it is
+// acknowledged. Such an interrupt has no in-service bit and must not be
+// acknowledged, except that the master still needs its cascade EOI.
+static bool pic_spurious(uint8_t line) {
+    if (line == 7) {
+        outb(PIC1_COMMAND, PIC_READ_ISR);
+        return !(inb(PIC1_COMMAND) & 0x80);
+    }
+    if (line == 15) {
+        outb(PIC2_COMMAND, PIC_READ_ISR);
+        if (!(inb(PIC2_COMMAND) & 0x80)) {
+            outb(PIC1_COMMAND, PIC_EOI);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void pic_eoi(uint8_t line) {
+    if (line >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+// Remap the 8259s to vectors 32-47 and mask every line
+void irq_init(void) {
+    // ICW1 - Initialize PICs
+    outb(PIC1_COMMAND, 0x11);
+    outb(PIC2_COMMAND, 0x11);
+    
+    // ICW2 - Set interrupt vector offset
+    outb(PIC1_DATA, IRQ_BASE);
+    outb(PIC2_DATA, IRQ_BASE + 8);
+    
+    // ICW3 - Set up cascade
+    outb(PIC1_DATA, 1 << PIC_CASCADE_IRQ);
+    outb(PIC2_DATA, PIC_CASCADE_IRQ);
+    
+    // ICW4 - Set mode
+    outb(PIC1_DATA, 0x01);  // 8086 mode
+    outb(PIC2_DATA, 0x01);
+    
+    // Everything masked until a driver registers; the cascade line
+    // opens with the first slave IRQ
+    pic_mask = 0xFFFF;
+    pic_write_mask();
+    
+    for (uint8_t line = 0; line < ISA_IRQS; line++) {
+        irq_descs[IRQ_BASE + line].flags = IRQ_FLAG_ISA;
+        irq_descs[IRQ_BASE + line].line = line;
+    }
+    irq_descs[LAPIC_SPURIOUS_VECTOR].flags = IRQ_FLAG_SPURIOUS;
+    irq_descs[LAPIC_SPURIOUS_VECTOR].name = "spurious";
+}
+
+// Unmask an ISA line on whichever controller is in charge
+static void irq_unmask(uint8_t irq) {
+    isa_enabled |= 1 << irq;
+    if (irq_ioapic) {
+        ioapic_route_isa(irq, IRQ_BASE + irq, cpus[0].apic_id);
+        return;
+    }
+    
+    pic_mask &= ~(1 << irq);
+    if (irq >= 8) {
+        pic_mask &= ~(1 << PIC_CASCADE_IRQ);
+    }
+    pic_write_mask();
+}
+
+void irq_mask(uint8_t irq) {
+    uint64_t flags = irq_save();
+    isa_enabled &= ~(1 << irq);
+    if (irq_ioapic) {
+        ioapic_mask_isa(irq);
+    } else {
+        pic_mask |= 1 << irq;
+        pic_write_mask();
+    }
+    irq_restore(flags);
+}
+
+bool irq_enable_ioapic(void) {
+    if (cmdline_param("noapic") || !ioapic_init()) {
+        return false;
+    }
+    
+    uint64_t flags = irq_save();
+    pic_mask = 0xFFFF;
+    pic_write_mask();
+    irq_ioapic = true;
+    
+    for (uint8_t irq = 0; irq < ISA_IRQS; irq++) {
+        if (isa_enabled & (1 << irq)) {
+            irq_unmask(irq);
+        }
+    }
+    irq_restore(flags);
+    return true;
+}
+
+void irq_register(uint8_t irq, isr_t handler, const char* name) {
+    uint64_t flags = irq_save();
+    irq_descs[IRQ_BASE + irq].handler = handler;
+    irq_descs[IRQ_BASE + irq].name = name;
+    irq_unmask(irq);
+    irq_restore(flags);
+}
+
+void irq_register_lapic(uint8_t vector, isr_t handler, const char* name) {
+    irq_descs[vector].handler = handler;
+    irq_descs[vector].name = name;
+    irq_descs[vector].flags = IRQ_FLAG_LAPIC;
+}
+
+// Raw handler with no acknowledgement (exceptions, system calls)
+void register_interrupt_handler(uint8_t n, isr_t handler) {
+    irq_descs[n].handler = handler;
+}
+
+// Charge the entry-to-EOI time to a vector
+static void irq_account(irq_desc_t* desc, uint64_t entry) {
+    uint64_t cycles = rdtsc() - entry;
+    __sync_fetch_and_add(&desc->count, 1);
+    __sync_fetch_and_add(&desc->eoi_cycles, cycles);
+    if (cycles > desc->eoi_cycles_max) {
+        desc->eoi_cycles_max = cycles;
+    }
+}
+
+void irq_dispatch(registers_t* regs) {
+    uint64_t entry = rdtsc();
+    irq_desc_t* desc = &irq_descs[regs->int_no];
+    
+    if (desc->flags & IRQ_FLAG_SPURIOUS) {
+        __sync_fetch_and_add(&desc->spurious, 1);
+        return;
+    }
+    
+    if (desc->flags & IRQ_FLAG_ISA) {
+        if (!irq_ioapic && pic_spurious(desc->line)) {
+            __sync_fetch_and_add(&desc->spurious, 1);
+            return;
+        }
+        if (irq_ioapic) {
+            lapic_eoi();
+        } else {
+            pic_eoi(desc->line);
+        }
+        irq_account(desc, entry);
+    } else if (desc->flags & IRQ_FLAG_LAPIC) {
+        lapic_eoi();
+        irq_account(desc, entry);
+    }
+    
+    // Whatever the handler wakes must not run without a tick
+    tick_irq_enter();
+    
+    if (desc->handler) {
+        desc->handler(regs);
+        
+        // Worst case for the part that cannot be deferred
+        uint64_t off = rdtsc() - entry;
+        if (off > desc->off_cycles_max) {
+            desc->off_cycles_max = off;
+        }
+    } else if (regs->int_no < IRQ_BASE) {
+        exception_handler(regs);
+    } else {
+        terminal_writestring("Unhandled interrupt: ");
+        // TODO: Print interrupt number
+        terminal_writestring("\n");
+    }
+}
+
+// Helper to print a decimal number
+static void print_dec(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
+void irq_print_stats(void) {
+    terminal_writestring("Interrupts (ISA IRQs via ");
+    terminal_writestring(irq_ioapic ? "I/O APIC" : "8259");
+    terminal_writestring(", local APIC in ");
+    terminal_writestring(lapic_is_x2apic() ? "x2APIC" : "xAPIC");
+    terminal_writestring(" mode):\n");
+    
+    for (int v = IRQ_BASE; v < 256; v++) {
+        irq_desc_t* desc = &irq_descs[v];
+        if (!desc->count && !desc->spurious) {
+            continue;
+        }
+        
+        terminal_writestring("  ");
+        print_dec(v);
+        terminal_writestring(" ");
+        terminal_writestring(desc->name ? desc->name : "?");
+        terminal_writestring(": ");
+        print_dec(desc->count);
+        if (desc->count) {
+            terminal_writestring(", entry to EOI avg ");
+            print_dec(desc->eoi_cycles / desc->count);
+            terminal_writestring(" max ");
+            print_dec(desc->eoi_cycles_max);
+            terminal_writestring(", irqs off max ");
+            print_dec(desc->off_cycles_max);
+            terminal_writestring(" cycles");
+        }
+        if (desc->spurious) {
+            terminal_writestring(", ");
+            print_dec(desc->spurious);
+            terminal_writestring(" spurious");
+        }
+        terminal_writestring("\n");
+    }
+}
@@ -1,28 +1,32 @@
 #include "../include/tss.h"
 #include "../include/terminal.h"
+#include "../include/smp.h"
 #include <stdint.h>
 
-// Global TSS instance
-tss_t tss;
-
 // Default kernel stack (used when no process-specific stack)
 static uint8_t default_kernel_stack[8192] __attribute__((aligned(16)));
 
-// Initialize the TSS
-void tss_init(void) {
+// Set up one CPU's TSS with 'stack' as its initial kernel stack
+void tss_init_cpu(tss_t* tss, uint64_t stack) {
     // Clear the TSS structure
-    uint8_t* tss_ptr = (uint8_t*)&tss;
+    uint8_t* tss_ptr = (uint8_t*)tss;
     for (size_t i = 0; i < sizeof(tss_t); i++) {
         tss_ptr[i] = 0;
     }
     
     // Set up the kernel stack pointer (RSP0)
     // This will be used when transitioning from ring 3 to ring 0
-    tss.rsp0 = (uint64_t)(default_kernel_stack + sizeof(default_kernel_stack));
+    tss->rsp0 = stack;
     
     // Set I/O permission bitmap offset to beyond TSS size
     // This effectively disables I/O permissions
-    tss.iomap_base = sizeof(tss_t);
+    tss->iomap_base = sizeof(tss_t);
+}
+
+// Initialize the boot CPU's TSS
+void tss_init(void) {
+    tss_init_cpu(&this_cpu()->tss,
+                 (uint64_t)(default_kernel_stack + sizeof(default_kernel_stack)));
     
     // We could set up IST (Interrupt Stack Table) entries here
     // for special handlers like NMI, double fault, etc.
@@ -33,12 +37,15 @@ void tss_init(void) {
     terminal_writestring("\n");
 }
 
-// Set the kernel stack for ring 0
+// Set the kernel stack for ring 0 on this CPU, for interrupts and for
+// SYSCALL alike
 void tss_set_kernel_stack(uint64_t stack) {
-    tss.rsp0 = stack;
+    cpu_t* cpu = this_cpu();
+    cpu->tss.rsp0 = stack;
+    cpu->syscall_stack = stack;
 }
 
-// Get the current kernel stack
+// Get this CPU's current kernel stack
 uint64_t tss_get_kernel_stack(void) {
-    return tss.rsp0;
+    return this_cpu()->tss.rsp0;
 }
\ No newline at end of file
@@ -8,8 +8,8 @@
 // Segment selectors
 #define KERNEL_CODE_SEL 0x08  // GDT entry 1
 #define KERNEL_DATA_SEL 0x10  // GDT entry 2
-#define USER_CODE_SEL   0x1B  // GDT entry 3 | RPL 3
-#define USER_DATA_SEL   0x23  // GDT entry 4 | RPL 3
+#define USER_DATA_SEL   0x1B  // GDT entry 3 | RPL 3
+#define USER_CODE_SEL   0x23  // GDT entry 4 | RPL 3
 
 // Switch current process to user mode
 void switch_to_user_mode(void* entry_point, void* user_stack) {
@@ -39,8 +39,9 @@ void switch_to_user_mode(void* entry_point, void* user_stack) {
         "mov %1, %%ax\n"         // Load user data segment
         "mov %%ax, %%ds\n"
         "mov %%ax, %%es\n"
-        "mov %%ax, %%fs\n"
-        "mov %%ax, %%gs\n"
+        "mov %%ax, %%fs\n"      // Not %gs: that would reset this_cpu()'s base
+        "cli\n"                  // No interrupt between SWAPGS and iretq
+        "swapgs\n"               // User GS base in, this CPU's data out
         "iretq\n"                // Return to user mode
         :
         : "r"(user_stack), "i"(USER_DATA_SEL), "i"(USER_CODE_SEL), "r"(entry_point)
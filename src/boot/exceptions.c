@@ -2,13 +2,8 @@
 #include "../include/isr.h"
 #include "../include/terminal.h"
 #include "../include/panic.h"
-
-// Page fault error code bits
-#define PF_PRESENT  (1 << 0)  // Page not present
-#define PF_WRITE    (1 << 1)  // Write access
-#define PF_USER     (1 << 2)  // User mode
-#define PF_RESERVED (1 << 3)  // Reserved bit set
-#define PF_FETCH    (1 << 4)  // Instruction fetch
+#include "../include/process.h"
+#include "../include/vmm.h"
 
 // Helper to print a number in hex
 static void print_hex_value(uint64_t value) {
@@ -32,6 +27,15 @@ void page_fault_handler(registers_t* regs) {
     // Analyze the error code
     uint32_t error = regs->err_code;
     
+    // Give the VMM a chance to resolve the fault (demand paging); like
+    // system calls it runs under the big kernel lock
+    lock_kernel();
+    int handled = vmm_handle_fault(process_get_current(), faulting_address, error);
+    unlock_kernel();
+    if (handled == 0) {
+        return;
+    }
+    
     terminal_writestring("\n\n================================================================================\n");
     terminal_writestring("                                PAGE FAULT\n");
     terminal_writestring("================================================================================\n\n");
@@ -74,10 +78,9 @@ void page_fault_handler(registers_t* regs) {
     terminal_writestring("\n");
     
     // In the future, we would:
-    // 1. Check if this is a valid page that needs to be loaded (demand paging)
-    // 2. Check if this is a stack growth situation
-    // 3. Check if this is a copy-on-write page
-    // 4. Kill the process if it's an invalid access
+    // 1. Check if this is a stack growth situation
+    // 2. Check if this is a copy-on-write page
+    // 3. Kill the process if it's an invalid access
     
     // For now, panic with full register dump
     panic_with_regs("Unhandled page fault", regs);
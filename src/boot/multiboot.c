@@ -0,0 +1,106 @@
+#include "../include/multiboot.h"
+#include "../include/terminal.h"
+
+// Multiboot2 tag header
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+} __attribute__((packed)) multiboot_tag_t;
+
+static char cmdline[CMDLINE_MAX];
+static const void* acpi_rsdp = NULL;
+
+// Parse the boot information passed by the bootloader
+void multiboot_init(uint32_t magic, uint64_t info_addr) {
+    cmdline[0] = '\0';
+    
+    if (magic != MULTIBOOT2_BOOTLOADER_MAGIC || !info_addr) {
+        terminal_writestring("Multiboot: no boot information\n");
+        return;
+    }
+    
+    // Fixed part: total_size, reserved. Tags follow, 8-byte aligned.
+    uint32_t total_size = *(uint32_t*)info_addr;
+    uint64_t addr = info_addr + 8;
+    uint64_t end = info_addr + total_size;
+    
+    while (addr + sizeof(multiboot_tag_t) <= end) {
+        multiboot_tag_t* tag = (multiboot_tag_t*)addr;
+        if (tag->type == MULTIBOOT_TAG_TYPE_END || tag->size < sizeof(multiboot_tag_t)) {
+            break;
+        }
+        
+        if (tag->type == MULTIBOOT_TAG_TYPE_CMDLINE) {
+            const char* src = (const char*)(addr + sizeof(multiboot_tag_t));
+            size_t len = tag->size - sizeof(multiboot_tag_t);
+            size_t i;
+            for (i = 0; i < len && i < CMDLINE_MAX - 1 && src[i]; i++) {
+                cmdline[i] = src[i];
+            }
+            cmdline[i] = '\0';
+        } else if (tag->type == MULTIBOOT_TAG_TYPE_ACPI_NEW ||
+                   (tag->type == MULTIBOOT_TAG_TYPE_ACPI_OLD && !acpi_rsdp)) {
+            acpi_rsdp = (const void*)(addr + sizeof(multiboot_tag_t));
+        }
+        
+        addr += (tag->size + 7) & ~7;
+    }
+}
+
+// Get the full kernel command line
+const char* multiboot_cmdline(void) {
+    return cmdline;
+}
+
+// Get the ACPI RSDP copy from the boot information
+const void* multiboot_acpi_rsdp(void) {
+    return acpi_rsdp;
+}
+
+// Look up a command line parameter
+const char* cmdline_param(const char* key) {
+    const char* p = cmdline;
+    
+    while (*p) {
+        while (*p == ' ') p++;
+        
+        // Compare this token against the key
+        const char* k = key;
+        const char* t = p;
+        while (*k && *t == *k) {
+            k++;
+            t++;
+        }
+        
+        if (!*k && (*t == '=' || *t == ' ' || *t == '\0')) {
+            return *t == '=' ? t + 1 : t;
+        }
+        
+        while (*p && *p != ' ') p++;
+    }
+    
+    return NULL;
+}
+
+// Parse a size parameter
+uint64_t cmdline_size(const char* key, uint64_t default_value) {
+    const char* v = cmdline_param(key);
+    if (!v || *v < '0' || *v > '9') {
+        return default_value;
+    }
+    
+    uint64_t value = 0;
+    while (*v >= '0' && *v <= '9') {
+        value = value * 10 + (*v - '0');
+        v++;
+    }
+    
+    switch (*v) {
+        case 'G': case 'g': value <<= 30; break;
+        case 'M': case 'm': value <<= 20; break;
+        case 'K': case 'k': value <<= 10; break;
+        default: break;
+    }
+    
+    return value;
+}
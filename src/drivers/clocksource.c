@@ -0,0 +1,250 @@
+#include "../include/clocksource.h"
+#include "../include/timer.h"
+#include "../include/acpi.h"
+#include "../include/vmm.h"
+#include "../include/cpu.h"
+#include "../include/terminal.h"
+#include "../include/vdso.h"
+
+// From kernel.c
+extern uint64_t* pml4;
+
+#define CALIBRATE_MS        10
+#define CLOCK_SHIFT         32      // ns = cycles * mult >> CLOCK_SHIFT
+#define TSC_SHIFT           24      // cycles = ns * tsc_per_ns >> TSC_SHIFT
+
+// CPUID.80000007H:EDX
+#define CPUID_INVARIANT_TSC (1 << 8)
+
+// HPET registers
+#define HPET_CAP            0x000   // Bits 63:32 = period in femtoseconds
+#define HPET_CONFIG         0x010
+#define HPET_COUNTER        0x0F0
+#define HPET_CAP_64BIT      (1 << 13)
+#define HPET_ENABLE         0x1
+#define FSEC_PER_SEC        1000000000000000ULL
+
+// ACPI HPET description table
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+    uint32_t block_id;
+    uint8_t address_space;          // Generic address structure
+    uint8_t bit_width;
+    uint8_t bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+    uint8_t hpet_number;
+    uint16_t min_tick;
+    uint8_t page_protection;
+} __attribute__((packed)) acpi_hpet_t;
+
+typedef struct clocksource {
+    const char* name;
+    uint64_t (*read)(void);
+    uint64_t mask;                  // Counter width
+    uint64_t freq;                  // Counts per second
+    uint64_t mult;
+} clocksource_t;
+
+static volatile uint64_t* hpet = NULL;
+static uint64_t tsc_per_ns = 0;     // Inverse of the TSC's mult
+
+static uint64_t tsc_read(void) {
+    return rdtsc();
+}
+
+static uint64_t hpet_read(void) {
+    return hpet[HPET_COUNTER / 8];
+}
+
+static uint64_t pit_read(void) {
+    return timer_get_ticks();
+}
+
+static clocksource_t clocksource_tsc = { "tsc", tsc_read, ~0ULL, 0, 0 };
+static clocksource_t clocksource_hpet = { "hpet", hpet_read, ~0ULL, 0, 0 };
+static clocksource_t clocksource_pit = { "pit", pit_read, ~0ULL, 0, 0 };
+
+// The clock is base_ns plus the counter's progress since base_cycles.
+// The boot CPU moves the base forward each tick under a sequence count;
+// readers retry if they saw an update in progress.
+static clocksource_t* clock = &clocksource_pit;
+static volatile uint32_t clock_seq = 0;
+static uint64_t clock_base_cycles = 0;
+static uint64_t clock_base_ns = 0;
+
+static void clocksource_set_freq(clocksource_t* cs, uint64_t freq) {
+    cs->freq = freq;
+    cs->mult = (NSEC_PER_SEC << CLOCK_SHIFT) / freq;
+}
+
+static uint64_t cycles_to_ns(const clocksource_t* cs, uint64_t cycles) {
+    return (uint64_t)(((unsigned __int128)cycles * cs->mult) >> CLOCK_SHIFT);
+}
+
+// Map and start the HPET main counter
+static bool hpet_init(void) {
+    const acpi_hpet_t* table = (const acpi_hpet_t*)acpi_find_table("HPET");
+    if (!table || table->address_space != 0) {
+        return false;               // Absent, or not memory mapped
+    }
+    if (vmm_map_page(pml4, table->address, table->address,
+                     PAGE_WRITABLE | PAGE_CACHE_DISABLE) < 0) {
+        return false;
+    }
+    
+    hpet = (volatile uint64_t*)table->address;
+    uint64_t cap = hpet[HPET_CAP / 8];
+    uint32_t period_fs = cap >> 32;
+    if (period_fs == 0) {
+        hpet = NULL;
+        return false;
+    }
+    
+    if (!(cap & HPET_CAP_64BIT)) {
+        clocksource_hpet.mask = 0xFFFFFFFF;
+    }
+    clocksource_set_freq(&clocksource_hpet, FSEC_PER_SEC / period_fs);
+    hpet[HPET_CONFIG / 8] |= HPET_ENABLE;
+    return true;
+}
+
+// TSC rate over CALIBRATE_MS, timed by the HPET if there is one and by
+// PIT channel 2 otherwise
+static uint64_t tsc_calibrate(void) {
+    uint64_t start, end;
+    
+    if (hpet) {
+        uint64_t span = clocksource_hpet.freq * CALIBRATE_MS / 1000;
+        uint64_t h0 = hpet_read();
+        start = rdtsc();
+        while (((hpet_read() - h0) & clocksource_hpet.mask) < span) {
+            cpu_relax();
+        }
+        end = rdtsc();
+    } else {
+        pit_oneshot_start(CALIBRATE_MS);
+        start = rdtsc();
+        while (!pit_oneshot_done()) {
+            cpu_relax();
+        }
+        end = rdtsc();
+    }
+    
+    return (end - start) * (1000 / CALIBRATE_MS);
+}
+
+static bool tsc_invariant(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000007) {
+        return false;
+    }
+    cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+    return edx & CPUID_INVARIANT_TSC;
+}
+
+// Helper to print a decimal number
+static void print_dec(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
+void clocksource_init(void) {
+    clocksource_set_freq(&clocksource_pit, timer_get_frequency());
+    clocksource_t* best = &clocksource_pit;
+    
+    if (hpet_init()) {
+        best = &clocksource_hpet;
+    }
+    if (tsc_invariant()) {
+        clocksource_set_freq(&clocksource_tsc, tsc_calibrate());
+        tsc_per_ns = (clocksource_tsc.freq << TSC_SHIFT) / NSEC_PER_SEC;
+        best = &clocksource_tsc;
+    }
+    
+    // Switch over without a jump in the clock
+    uint64_t flags = irq_save();
+    uint64_t now = ktime_get_ns();
+    clock_seq++;
+    __sync_synchronize();
+    clock = best;
+    clock_base_cycles = best->read();
+    clock_base_ns = now;
+    vdso_update_clock(best == &clocksource_tsc ? VDSO_CLOCK_TSC : VDSO_CLOCK_NONE,
+                      clock_base_cycles, clock_base_ns, best->mult, best->mask);
+    __sync_synchronize();
+    clock_seq++;
+    irq_restore(flags);
+    
+    terminal_writestring("Clocksource: ");
+    terminal_writestring(best->name);
+    terminal_writestring(" at ");
+    print_dec(best->freq / 1000);
+    terminal_writestring(" kHz\n");
+}
+
+uint64_t ktime_get_ns(void) {
+    uint32_t seq;
+    uint64_t ns;
+    
+    do {
+        seq = clock_seq;
+        __sync_synchronize();
+        uint64_t delta = (clock->read() - clock_base_cycles) & clock->mask;
+        ns = clock_base_ns + cycles_to_ns(clock, delta);
+        __sync_synchronize();
+    } while ((seq & 1) || seq != clock_seq);
+    
+    return ns;
+}
+
+void clocksource_update(void) {
+    if (clock->mask == ~0ULL) {
+        return;                     // 64-bit counters do not wrap
+    }
+    
+    uint64_t now = clock->read();
+    uint64_t delta = (now - clock_base_cycles) & clock->mask;
+    
+    clock_seq++;
+    __sync_synchronize();
+    clock_base_ns += cycles_to_ns(clock, delta);
+    clock_base_cycles = now;
+    __sync_synchronize();
+    clock_seq++;
+}
+
+const char* clocksource_name(void) {
+    return clock->name;
+}
+
+bool clocksource_highres(void) {
+    return clock != &clocksource_pit;
+}
+
+// TSC value at which ktime_get_ns() reaches 'ns', for TSC-deadline
+// timers. Only meaningful while the TSC is the clocksource.
+bool ktime_to_tsc(uint64_t ns, uint64_t* tsc) {
+    if (clock != &clocksource_tsc) {
+        return false;
+    }
+    uint64_t delta = ns > clock_base_ns ? ns - clock_base_ns : 0;
+    *tsc = clock_base_cycles +
+           (uint64_t)(((unsigned __int128)delta * tsc_per_ns) >> TSC_SHIFT);
+    return true;
+}
@@ -5,17 +5,37 @@
 #include <stdbool.h>
 #include "../include/ports.h"
 #include "../include/terminal.h"
-#include "../include/isr.h"
+#include "../include/irq.h"
 #include "../include/keyboard.h"
+#include "../include/process.h"
+#include "../include/wait.h"
+#include "../include/workqueue.h"
+#include "../include/smp.h"
 
 #define KEYBOARD_DATA_PORT 0x60
-#define IRQ1 33  // Keyboard IRQ
+#define KEYBOARD_IRQ 1
+#define KBD_RAW_SIZE 64
+
+// Scancodes the interrupt handler has read but the worker has not yet
+// translated, with the process each interrupted (the Ctrl+C target).
+// The handler is the only writer and the worker the only reader.
+typedef struct {
+    uint8_t scancode;
+    int pid;
+} kbd_raw_t;
+
+static kbd_raw_t kbd_raw[KBD_RAW_SIZE];
+static volatile uint8_t kbd_raw_read = 0;
+static volatile uint8_t kbd_raw_write = 0;
 
 // Keyboard buffer (simple circular buffer)
 static char kbd_buffer[256];
 static uint8_t kbd_read_pos = 0;
 static uint8_t kbd_write_pos = 0;
 
+// Processes blocked in keyboard_wait()
+static wait_queue_t kbd_wait = WAIT_QUEUE_INIT;
+
 // Control key state
 static bool ctrl_pressed = false;
 static bool alt_pressed = false;
@@ -45,11 +65,9 @@ static char kbd_us[128] = {
     '-', 0, 0, 0, '+', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
-// Keyboard interrupt handler
-static void keyboard_callback(registers_t* regs) {
-    (void)regs;  // Unused parameter
-    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
-    
+// Translate one scancode: track modifiers, switch terminals, buffer and
+// echo characters. Runs on the events worker.
+static void keyboard_scancode(uint8_t scancode, int pid) {
     // Handle control key state
     if (scancode == KEY_CTRL) {
         ctrl_pressed = true;
@@ -116,12 +134,12 @@ static void keyboard_callback(registers_t* regs) {
                 // Check for Ctrl+C
                 if (ctrl_pressed && (c == 'c' || c == 'C')) {
                     terminal_writestring("^C\n");
-                    // Send SIGINT to foreground process
+                    // Send SIGINT to the process the key interrupted
                     extern void signal_send(int pid, int sig);
-                    extern process_t* process_get_current(void);
-                    process_t* current = process_get_current();
-                    if (current && current->pid != 1) {  // Don't kill init
-                        signal_send(current->pid, 2);  // SIGINT
+                    if (pid != 1) {  // Don't kill init
+                        lock_kernel();
+                        signal_send(pid, 2);  // SIGINT
+                        unlock_kernel();
                     }
                     return;
                 }
@@ -142,6 +160,41 @@ static void keyboard_callback(registers_t* regs) {
     }
 }
 
+// Process everything the interrupt handler has queued, then wake readers
+static void keyboard_work_fn(work_t* work) {
+    (void)work;
+    
+    while (kbd_raw_read != kbd_raw_write) {
+        kbd_raw_t raw = kbd_raw[kbd_raw_read];
+        __sync_synchronize();
+        kbd_raw_read = (kbd_raw_read + 1) % KBD_RAW_SIZE;
+        keyboard_scancode(raw.scancode, raw.pid);
+    }
+    
+    // Wake a reader waiting for input
+    if (kbd_read_pos != kbd_write_pos) {
+        wake_up_all(&kbd_wait);
+    }
+}
+
+static work_t keyboard_work = WORK_INIT(keyboard_work_fn);
+
+// Keyboard interrupt handler: read the scancode and leave the rest, which
+// may echo, redraw a whole terminal or signal a process, to the worker
+static void keyboard_callback(registers_t* regs) {
+    (void)regs;  // Unused parameter
+    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+    
+    uint8_t next_write = (kbd_raw_write + 1) % KBD_RAW_SIZE;
+    if (next_write != kbd_raw_read) {  // Dropped if the worker is far behind
+        kbd_raw[kbd_raw_write].scancode = scancode;
+        kbd_raw[kbd_raw_write].pid = process_get_current()->pid;
+        __sync_synchronize();
+        kbd_raw_write = next_write;
+    }
+    schedule_work(&keyboard_work);
+}
+
 // Check if keyboard has character available
 bool keyboard_has_char(void) {
     return kbd_read_pos != kbd_write_pos;
@@ -158,9 +211,14 @@ char keyboard_getchar(void) {
     return c;
 }
 
+// Block the current process until a character is available
+void keyboard_wait(void) {
+    wait_event(kbd_wait, kbd_read_pos != kbd_write_pos);
+}
+
 // Initialize keyboard and register interrupt handler
 void init_keyboard() {
     kbd_read_pos = 0;
     kbd_write_pos = 0;
-    register_interrupt_handler(IRQ1, keyboard_callback);
+    irq_register(KEYBOARD_IRQ, keyboard_callback, "keyboard");
 }
\ No newline at end of file
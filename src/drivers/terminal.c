@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "../include/ports.h"
+#include "../include/spinlock.h"
 
 // VGA text mode constants
 #define VGA_WIDTH 80
@@ -36,6 +37,7 @@ volatile uint16_t* const VGA_BUFFER = (uint16_t*) VGA_MEMORY;
 static size_t terminal_row;
 static size_t terminal_column;
 static uint8_t terminal_color;
+static spinlock_t terminal_lock = SPINLOCK_INIT;  // Keeps CPUs' lines apart
 
 // Function to calculate string length
 static size_t strlen(const char* str) {
@@ -69,7 +71,8 @@ static void terminal_scroll(void) {
 // Check if virtual terminals are enabled
 static int vt_enabled = 0;
 
-void terminal_putchar(char c) {
+// Output one character (terminal_lock held)
+static void terminal_putchar_locked(char c) {
     // If VT enabled, use VT putchar
     if (vt_enabled) {
         extern void vt_putchar(char c);
@@ -104,10 +107,18 @@ void terminal_putchar(char c) {
     }
 }
 
+void terminal_putchar(char c) {
+    uint64_t flags = spin_lock_irqsave(&terminal_lock);
+    terminal_putchar_locked(c);
+    spin_unlock_irqrestore(&terminal_lock, flags);
+}
+
 void terminal_write(const char* data, size_t size) {
+    uint64_t flags = spin_lock_irqsave(&terminal_lock);
     for (size_t i = 0; i < size; i++) {
-        terminal_putchar(data[i]);
+        terminal_putchar_locked(data[i]);
     }
+    spin_unlock_irqrestore(&terminal_lock, flags);
 }
 
 void terminal_writestring(const char* data) {
@@ -3,47 +3,448 @@
 #include "../include/ports.h"
 #include "../include/terminal.h"
 #include "../include/scheduler.h"
+#include "../include/process.h"
+#include "../include/cpu.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+#include "../include/irq.h"
+#include "../include/apic.h"
+#include "../include/clocksource.h"
+#include "../include/multiboot.h"
+#include "../include/string.h"
+#include "../include/softirq.h"
 
 // PIT (Programmable Interval Timer) constants
 #define PIT_CHANNEL0_DATA 0x40
 #define PIT_CHANNEL1_DATA 0x41
 #define PIT_CHANNEL2_DATA 0x42
 #define PIT_COMMAND 0x43
+#define PIT_GATE_PORT 0x61     // Channel 2 gate (bit 0) and output (bit 5)
 
 #define PIT_FREQUENCY 1193180  // Base frequency of PIT
 
+// Timer wheel: WHEEL_LEVELS levels of WHEEL_SIZE slots. Level n holds
+// timers due within WHEEL_SIZE^(n+1) ticks; when the lower level wraps,
+// the next slot up is cascaded down. Adding, removing and expiring a
+// timer are all O(1) no matter how many are pending.
+#define WHEEL_BITS    6
+#define WHEEL_SIZE    (1 << WHEEL_BITS)
+#define WHEEL_MASK    (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS  4
+#define WHEEL_MAX     ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
 // Timer state
 static uint64_t timer_ticks = 0;
 static uint32_t timer_frequency = 0;
 
-// Get system uptime in ticks
+static timer_event_t* wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t wheel_clock = 0;        // Next tick the wheel will process
+static spinlock_t wheel_lock = SPINLOCK_INIT;
+static timer_event_t* volatile wheel_running;  // Callback in progress
+
+// Tickless mode: each CPU's local APIC timer is a one-shot armed for its
+// next tick, and an idle CPU arms it for the next wheel expiry instead
+// (the boot CPU, which runs the wheel) or not at all (the others).
+// Jiffies are then derived from ktime rather than counted.
+static bool tick_nohz = false;
+static bool tick_use_deadline = false;  // TSC-deadline rather than a count
+static bool tick_lapic = false;         // Boot CPU ticks off its local APIC
+static uint64_t tick_period_ns = 0;
+static int64_t tick_offset_ns = 0;      // Keeps jiffies continuous at the switch
+
+#define NO_EVENT    (~0ULL)
+
+// Tickless jiffies, and the ktime at which a given jiffy starts
+static uint64_t nohz_ticks(void) {
+    return (ktime_get_ns() + tick_offset_ns) / tick_period_ns;
+}
+
+static uint64_t tick_to_ns(uint64_t tick) {
+    return tick * tick_period_ns - tick_offset_ns;
+}
+
+// Put a timer in the slot matching how far away it is
+static void wheel_insert(timer_event_t* timer) {
+    uint64_t expires = timer->expires;
+    if (expires < wheel_clock) {
+        expires = wheel_clock;          // Already due, fire on the next tick
+    }
+    uint64_t delta = expires - wheel_clock;
+    if (delta > WHEEL_MAX) {
+        expires = wheel_clock + WHEEL_MAX;  // Re-cascaded until really due
+        delta = WHEEL_MAX;
+    }
+    
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    timer_event_t** slot = &wheel[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    
+    timer->next = *slot;
+    if (*slot) {
+        (*slot)->pprev = &timer->next;
+    }
+    *slot = timer;
+    timer->pprev = slot;
+    timer->pending = true;
+}
+
+// Unlink a timer from whichever slot holds it
+static void wheel_remove(timer_event_t* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->pending = false;
+}
+
+// Move one slot's timers down to the levels below. Returns the slot index
+// so the caller knows whether this level wrapped too.
+static int wheel_cascade(int level) {
+    int index = (wheel_clock >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer_event_t* timer = wheel[level][index];
+    wheel[level][index] = NULL;
+    
+    while (timer) {
+        timer_event_t* next = timer->next;
+        wheel_insert(timer);
+        timer = next;
+    }
+    return index;
+}
+
+// Fire every timer due up to the current tick, as the timer softirq.
+// The lock is dropped around each callback so it can add, delete and
+// wake freely.
+static void wheel_run(void) {
+    uint64_t flags = spin_lock_irqsave(&wheel_lock);
+    while (wheel_clock <= timer_ticks) {
+        int index = wheel_clock & WHEEL_MASK;
+        if (index == 0) {
+            int level = 1;
+            while (level < WHEEL_LEVELS && wheel_cascade(level) == 0) {
+                level++;
+            }
+        }
+        
+        timer_event_t* timer = wheel[0][index];
+        wheel[0][index] = NULL;
+        wheel_clock++;
+        
+        // Callbacks may re-arm their timer; it lands in a later slot
+        while (timer) {
+            timer_event_t* next = timer->next;
+            timer->next = NULL;
+            timer->pprev = NULL;
+            timer->pending = false;
+            wheel_running = timer;
+            spin_unlock_irqrestore(&wheel_lock, flags);
+            timer->callback(timer->data);
+            flags = spin_lock_irqsave(&wheel_lock);
+            wheel_running = NULL;
+            timer = next;
+        }
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+// First tick with a timer to fire or a slot to cascade, or NO_EVENT.
+// Level 0 slots hold exact expiries; a timer in a higher level needs a
+// wakeup when its slot cascades. Wheel lock held.
+static uint64_t wheel_next_tick(void) {
+    uint64_t next = NO_EVENT;
+    
+    for (int i = 0; i < WHEEL_SIZE; i++) {
+        if (wheel[0][(wheel_clock + i) & WHEEL_MASK]) {
+            next = wheel_clock + i;
+            break;
+        }
+    }
+    
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        uint64_t pos = wheel_clock >> shift;
+        for (int i = 1; i <= WHEEL_SIZE; i++) {
+            if (wheel[level][(pos + i) & WHEEL_MASK]) {
+                uint64_t when = (pos + i) << shift;
+                if (when < next) {
+                    next = when;
+                }
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+// Pick the expiry in [expires, expires + slack] with the most trailing
+// zero bits, so timers with overlapping windows land on the same tick
+static uint64_t timer_apply_slack(uint64_t expires, uint64_t slack) {
+    uint64_t limit = expires + slack;
+    uint64_t mask = expires ^ limit;
+    if (!slack || !mask) {
+        return expires;
+    }
+    
+    int bit = 63 - __builtin_clzll(mask);
+    return limit & ~((1ULL << bit) - 1);
+}
+
+// Prepare a timer for use
+void timer_event_init(timer_event_t* timer, void (*callback)(void* data), void* data) {
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+    timer->pending = false;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// Arm (or re-arm) a timer to fire at an absolute tick
+void timer_add(timer_event_t* timer, uint64_t expires) {
+    timer_add_slack(timer, expires, 0);
+}
+
+// Arm a timer that may fire up to 'slack' ticks late. If the boot CPU is
+// idle with its timer set past the new expiry, kick it to re-arm.
+void timer_add_slack(timer_event_t* timer, uint64_t expires, uint64_t slack) {
+    uint64_t flags = spin_lock_irqsave(&wheel_lock);
+    if (timer->pending) {
+        wheel_remove(timer);
+    }
+    timer->expires = timer_apply_slack(expires, slack);
+    wheel_insert(timer);
+    bool kick = tick_nohz && cpus[0].tick_stopped &&
+                tick_to_ns(timer->expires) < cpus[0].tick_next;
+    spin_unlock_irqrestore(&wheel_lock, flags);
+    
+    if (kick) {
+        smp_send_reschedule(0);
+    }
+}
+
+// Cancel a timer. Returns true if it had not fired yet. The wheel runs
+// on the boot CPU; if the callback is in progress there, other CPUs wait
+// for it to finish so the caller can free what the timer points at.
+bool timer_del(timer_event_t* timer) {
+    uint64_t flags = spin_lock_irqsave(&wheel_lock);
+    bool pending = timer->pending;
+    if (pending) {
+        wheel_remove(timer);
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+    
+    if (this_cpu()->id != 0) {
+        while (wheel_running == timer) {
+            cpu_relax();
+        }
+    }
+    return pending;
+}
+
+// Get system uptime in ticks. Without a periodic tick nobody counts
+// them, so they come from the clock.
 uint64_t timer_get_ticks(void) {
+    if (tick_nohz) {
+        return nohz_ticks();
+    }
     return timer_ticks;
 }
 
 // Get uptime in milliseconds
 uint64_t timer_get_ms(void) {
-    return (timer_ticks * 1000) / timer_frequency;
+    return (timer_get_ticks() * 1000) / timer_frequency;
+}
+
+// Get the tick frequency
+uint32_t timer_get_frequency(void) {
+    return timer_frequency;
 }
 
-// Sleep for specified milliseconds
+// Convert milliseconds to ticks, rounding up
+uint64_t timer_ms_to_ticks(uint64_t ms) {
+    return (ms * timer_frequency + 999) / 1000;
+}
+
+// Sleep for specified milliseconds. Processes block on the timer wheel;
+// only code running before the scheduler (or as idle) polls the clock.
 void sleep_ms(uint32_t ms) {
+    process_t* self = process_get_current();
+    if (self && self->pid != 0) {
+        process_sleep((uint32_t)timer_ms_to_ticks(ms));
+        return;
+    }
+    
     uint64_t start = timer_get_ms();
     while (timer_get_ms() - start < ms) {
         asm volatile("hlt");  // Save CPU while waiting
     }
 }
 
-// Timer interrupt handler
+// Arm the local timer to fire at ktime 'when'
+static void tick_program(uint64_t when) {
+    uint64_t tsc;
+    if (tick_use_deadline && ktime_to_tsc(when, &tsc)) {
+        lapic_timer_deadline(tsc);
+        return;
+    }
+    
+    uint64_t now = ktime_get_ns();
+    lapic_timer_oneshot(when > now ? when - now : 0);
+}
+
+// Arm the next tick one period after the last, skipping missed ones. An
+// interrupt that came early just re-arms the same tick.
+static void tick_program_next(cpu_t* cpu) {
+    uint64_t now = ktime_get_ns();
+    if (now >= cpu->tick_next) {
+        if (now - cpu->tick_next < tick_period_ns) {
+            cpu->tick_next += tick_period_ns;
+        } else {
+            cpu->tick_next = now + tick_period_ns;
+        }
+    }
+    tick_program(cpu->tick_next);
+}
+
+// Interrupt entry: a CPU woken from tickless idle needs its tick back
+// before whatever the interrupt wakes starts running
+void tick_irq_enter(void) {
+    cpu_t* cpu = this_cpu();
+    if (cpu->tick_stopped) {
+        cpu->tick_stopped = false;
+        cpu->tick_next = ktime_get_ns() + tick_period_ns;
+        tick_program(cpu->tick_next);
+    }
+}
+
+// Idle loops call this instead of hlt. In tickless mode the tick stops
+// until the next timer on the wheel (boot CPU) or until something else
+// wakes the CPU (any other).
+void timer_idle(void) {
+    cpu_t* cpu = this_cpu();
+    
+    asm volatile("cli");
+    if (tick_nohz) {
+        // Under the wheel lock, so timer_add() sees either the old
+        // tick or the final wakeup time
+        spin_lock(&wheel_lock);
+        uint64_t next = cpu->id == 0 ? wheel_next_tick() : NO_EVENT;
+        cpu->tick_next = next == NO_EVENT ? NO_EVENT : tick_to_ns(next);
+        cpu->tick_stopped = true;
+        spin_unlock(&wheel_lock);
+        
+        if (next == NO_EVENT) {
+            lapic_timer_stop();
+        } else {
+            tick_program(cpu->tick_next);
+        }
+    }
+    
+    // sti takes effect after hlt starts, so no wakeup slips in between
+    asm volatile("sti; hlt");
+    cpu->idle_wakeups++;
+}
+
+// One tick on this CPU. The boot CPU also keeps time and has the wheel
+// run.
+static void timer_tick(void) {
+    cpu_t* cpu = this_cpu();
+    cpu->timer_irqs++;
+    
+    if (cpu->id == 0) {
+        timer_ticks = tick_nohz ? nohz_ticks() : timer_ticks + 1;
+        clocksource_update();
+        
+        // Callbacks run on the way out with interrupts back on, before
+        // the preemption check
+        raise_softirq(SOFTIRQ_TIMER);
+    }
+    
+    // Charge the tick; a switch it calls for waits for interrupt exit
+    scheduler_tick();
+    
+    if (tick_nohz && !cpu->tick_stopped) {
+        tick_program_next(cpu);
+    }
+}
+
+// PIT interrupt handler (boot CPU until the local APIC timer takes over)
 static void timer_callback(registers_t* regs) {
     (void)regs;  // Unused
-    timer_ticks++;
+    timer_tick();
+}
+
+// Local APIC timer interrupt handler, every CPU
+static void lapic_timer_callback(registers_t* regs) {
+    (void)regs;
+    timer_tick();
+}
+
+bool timer_use_lapic(void) {
+    irq_register_lapic(LAPIC_TIMER_VECTOR, lapic_timer_callback, "lapic timer");
+    if (!lapic_timer_start(timer_frequency)) {
+        return false;
+    }
+    irq_mask(0);
+    tick_lapic = true;
+    return true;
+}
+
+void timer_start_ap(void) {
+    lapic_timer_start(timer_frequency);
+}
+
+// Go tickless if the boot CPU ticks off its local APIC and the clock is
+// finer than the tick. Each CPU leaves periodic mode at its next tick.
+void timer_enable_nohz(void) {
+    const char* nohz = cmdline_param("nohz");
+    if (!tick_lapic || !clocksource_highres() || (nohz && memcmp(nohz, "off", 3) == 0)) {
+        terminal_writestring("Tick: periodic\n");
+        return;
+    }
     
-    // Trigger scheduler tick
-    scheduler_tick();
+    tick_period_ns = NSEC_PER_SEC / timer_frequency;
+    tick_use_deadline = lapic_has_tsc_deadline() &&
+                        memcmp(clocksource_name(), "tsc", 4) == 0;
+    tick_offset_ns = (int64_t)(timer_ticks * tick_period_ns) - (int64_t)ktime_get_ns();
+    __sync_synchronize();
+    tick_nohz = true;
+    
+    terminal_writestring("Tick: tickless idle, ");
+    terminal_writestring(timer_tick_mode());
+    terminal_writestring("\n");
+}
+
+const char* timer_tick_mode(void) {
+    if (!tick_nohz) {
+        return "periodic";
+    }
+    return tick_use_deadline ? "TSC-deadline" : "LAPIC one-shot";
+}
+
+// Count 'ms' (at most 54) down on PIT channel 2 in one-shot mode. The
+// speaker stays off; channel 0 keeps running the tick.
+void pit_oneshot_start(uint32_t ms) {
+    uint16_t count = PIT_FREQUENCY * ms / 1000;
     
-    // Send End of Interrupt to PIC
-    outb(0x20, 0x20);
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2_DATA, count & 0xFF);
+    outb(PIT_CHANNEL2_DATA, count >> 8);
+    
+    // Restart the count by toggling the gate
+    uint8_t gate = inb(PIT_GATE_PORT) & ~0x01;
+    outb(PIT_GATE_PORT, gate);
+    outb(PIT_GATE_PORT, gate | 0x01);
+}
+
+// Output goes high when the count reaches zero
+bool pit_oneshot_done(void) {
+    return inb(PIT_GATE_PORT) & 0x20;
 }
 
 // Initialize the timer
@@ -61,7 +462,8 @@ void init_timer(uint32_t frequency) {
     outb(PIT_CHANNEL0_DATA, (divisor >> 8) & 0xFF);  // High byte
     
     // Register timer callback for IRQ0
-    register_interrupt_handler(IRQ0, timer_callback);
+    irq_register(0, timer_callback, "timer");
+    open_softirq(SOFTIRQ_TIMER, wheel_run, "timer");
     
     terminal_writestring("Timer initialized at ");
     // TODO: Print frequency
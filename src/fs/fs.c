@@ -8,8 +8,8 @@ static ramfs_t ramfs;
 static fs_ops_t ramfs_ops;
 
 // Forward declarations
-static int ramfs_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
-static int ramfs_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
+static int ramfs_read(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer);
+static int ramfs_write(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer);
 static void ramfs_open(fs_node_t* node);
 static void ramfs_close(fs_node_t* node);
 static fs_dirent_t* ramfs_readdir(fs_node_t* node, uint32_t index);
@@ -90,11 +90,11 @@ fs_node_t* fs_root(void) {
 }
 
 // Generic filesystem operations
-int fs_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+int fs_read(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer) {
     return ramfs_ops.read(node, offset, size, buffer);
 }
 
-int fs_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+int fs_write(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer) {
     return ramfs_ops.write(node, offset, size, buffer);
 }
 
@@ -115,7 +115,7 @@ fs_node_t* fs_finddir(fs_node_t* node, char* name) {
 }
 
 // RAM filesystem implementation
-static int ramfs_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+static int ramfs_read(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer) {
     if (node->type != FS_TYPE_FILE) return -1;
     if (offset >= node->size) return 0;
     
@@ -151,9 +151,15 @@ static int ramfs_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t*
     return bytes_read;
 }
 
-static int ramfs_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+static int ramfs_write(fs_node_t* node, uint64_t offset, uint32_t size, uint8_t* buffer) {
     if (node->type != FS_TYPE_FILE) return -1;
     
+    // Files cannot outgrow the block pool
+    if (offset >= FS_MAX_FILE_SIZE) return -1;
+    if (size > FS_MAX_FILE_SIZE - offset) {
+        size = FS_MAX_FILE_SIZE - offset;
+    }
+    
     // Allocate blocks as needed
     if (node->first_block == (uint32_t)-1) {
         node->first_block = allocate_block();
@@ -0,0 +1,174 @@
+#include "../include/futex.h"
+#include "../include/process.h"
+#include "../include/mm.h"
+#include "../include/vmm.h"
+#include "../include/wait.h"
+#include "../include/timer.h"
+#include "../include/spinlock.h"
+
+// A sleeper, on its own kernel stack while it waits
+typedef struct futex_waiter {
+    process_t* proc;
+    uint64_t key;
+    struct futex_waiter* next;
+    struct futex_waiter* prev;
+    bool queued;
+} futex_waiter_t;
+
+typedef struct {
+    spinlock_t lock;
+    futex_waiter_t* head;
+    futex_waiter_t* tail;
+} futex_bucket_t;
+
+static futex_bucket_t futex_hash[FUTEX_HASH_SIZE];
+static futex_stats_t futex_stats;
+
+// Physical address of the word. Two mappings of the same page (threads,
+// shared memory) give the same key. A user page that is not present yet
+// is touched so the fault handler brings it in. Kernel memory is
+// identity mapped, so anything outside the table keys by its address.
+static uint64_t futex_key(volatile uint32_t* uaddr) {
+    process_t* self = process_get_current();
+    uint64_t* pml4 = self->mm->page_table;
+    uint64_t addr = (uint64_t)uaddr;
+    if (!pml4) {
+        return addr;
+    }
+    
+    uint64_t phys = vmm_get_physical(pml4, addr);
+    if (!phys && mm_find_vma(self->mm, addr)) {
+        (void)*uaddr;
+        phys = vmm_get_physical(pml4, addr);
+    }
+    return phys ? phys : addr;
+}
+
+static futex_bucket_t* futex_bucket(uint64_t key) {
+    // Words are 4-byte aligned; mix in the page number too
+    uint64_t hash = (key >> 2) ^ (key >> 12);
+    return &futex_hash[hash % FUTEX_HASH_SIZE];
+}
+
+// Append a waiter to its bucket
+static void futex_queue(futex_bucket_t* hb, futex_waiter_t* waiter) {
+    waiter->next = NULL;
+    waiter->prev = hb->tail;
+    if (hb->tail) {
+        hb->tail->next = waiter;
+    } else {
+        hb->head = waiter;
+    }
+    hb->tail = waiter;
+    waiter->queued = true;
+}
+
+// Unlink a waiter if a wakeup has not already done so
+static void futex_unqueue(futex_bucket_t* hb, futex_waiter_t* waiter) {
+    if (!waiter->queued) {
+        return;
+    }
+    
+    if (waiter->prev) {
+        waiter->prev->next = waiter->next;
+    } else {
+        hb->head = waiter->next;
+    }
+    if (waiter->next) {
+        waiter->next->prev = waiter->prev;
+    } else {
+        hb->tail = waiter->prev;
+    }
+    waiter->next = NULL;
+    waiter->prev = NULL;
+    waiter->queued = false;
+}
+
+// Sleep on a word. The value is compared under the bucket lock: a waker
+// changes the word before taking the lock, so either we see the new
+// value here or it finds us queued.
+int futex_wait(volatile uint32_t* uaddr, uint32_t val, uint64_t timeout_ms) {
+    process_t* self = process_get_current();
+    uint64_t key = futex_key(uaddr);
+    futex_bucket_t* hb = futex_bucket(key);
+    futex_waiter_t waiter = { self, key, NULL, NULL, false };
+    futex_stats.waits++;
+    
+    uint64_t flags = irq_save();
+    spin_lock(&hb->lock);
+    if (*uaddr != val) {
+        spin_unlock(&hb->lock);
+        irq_restore(flags);
+        futex_stats.eagain++;
+        return -1;  // EAGAIN
+    }
+    futex_queue(hb, &waiter);
+    if (self->pid != 0) {
+        self->state = PROCESS_STATE_BLOCKED;
+    }
+    spin_unlock(&hb->lock);
+    
+    bool woken = wait_schedule(timeout_ms ? timer_ms_to_ticks(timeout_ms) : 0);
+    
+    // Still queued means nobody woke us
+    spin_lock(&hb->lock);
+    if (waiter.queued) {
+        futex_unqueue(hb, &waiter);
+        woken = false;
+    }
+    spin_unlock(&hb->lock);
+    if (self->pid != 0) {
+        self->state = PROCESS_STATE_RUNNING;
+    }
+    irq_restore(flags);
+    
+    if (!woken) {
+        futex_stats.timeouts++;
+        return -1;  // ETIMEDOUT
+    }
+    return 0;
+}
+
+// Wake sleepers on a word in the order they went to sleep. Waiters whose
+// timeout already fired are dropped without counting.
+int futex_wake(volatile uint32_t* uaddr, uint32_t nr) {
+    uint64_t key = futex_key(uaddr);
+    futex_bucket_t* hb = futex_bucket(key);
+    int woken = 0;
+    futex_stats.wakes++;
+    
+    uint64_t flags = spin_lock_irqsave(&hb->lock);
+    futex_waiter_t* waiter = hb->head;
+    while (waiter && (uint32_t)woken < nr) {
+        futex_waiter_t* next = waiter->next;
+        if (waiter->key == key) {
+            futex_unqueue(hb, waiter);
+            if (try_to_wake_up(waiter->proc, STATE_BIT(PROCESS_STATE_BLOCKED))) {
+                timer_del(&waiter->proc->sleep_timer);
+                woken++;
+            }
+        }
+        waiter = next;
+    }
+    spin_unlock_irqrestore(&hb->lock, flags);
+    
+    futex_stats.woken += woken;
+    return woken;
+}
+
+// Called by an exiting thread. pthread_join() style waiters sleep on the
+// TID word until it reads zero.
+void futex_exit(process_t* proc) {
+    volatile uint32_t* tid = proc->clear_child_tid;
+    if (!tid) {
+        return;
+    }
+    
+    proc->clear_child_tid = NULL;
+    *tid = 0;
+    futex_wake(tid, 1);
+}
+
+const futex_stats_t* futex_get_stats(void) {
+    return &futex_stats;
+}
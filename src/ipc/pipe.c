@@ -1,6 +1,7 @@
 #include "../include/pipe.h"
 #include "../include/kmalloc.h"
 #include "../include/scheduler.h"
+#include "../include/process.h"
 #include "../include/string.h"
 
 // Create a new pipe
@@ -13,6 +14,8 @@ pipe_t* pipe_create(void) {
     pipe->count = 0;
     pipe->reader_closed = 0;
     pipe->writer_closed = 0;
+    wait_queue_init(&pipe->readers);
+    wait_queue_init(&pipe->writers);
     
     return pipe;
 }
@@ -23,33 +26,34 @@ void pipe_destroy(pipe_t* pipe) {
     // For now, just mark as invalid
     pipe->reader_closed = 1;
     pipe->writer_closed = 1;
+    wake_up_all(&pipe->readers);
+    wake_up_all(&pipe->writers);
 }
 
-// Read from pipe
+// Read from pipe. Blocks until data arrives, then returns what is
+// available (up to count) rather than waiting for a full buffer.
 int pipe_read(pipe_t* pipe, void* buffer, size_t count) {
     if (!pipe || pipe->reader_closed) return -1;
     
     uint8_t* buf = (uint8_t*)buffer;
     size_t bytes_read = 0;
     
-    while (bytes_read < count) {
-        // If pipe is empty
-        if (pipe->count == 0) {
-            // If writer closed and pipe empty, EOF
-            if (pipe->writer_closed) {
-                break;
-            }
-            // Otherwise block waiting for data
-            // In real implementation, would yield CPU
-            continue;
-        }
-        
-        // Read one byte
+    // Empty pipe with a live writer: sleep until it writes
+    wait_event(pipe->readers, pipe->count > 0 || pipe->writer_closed);
+    
+    uint64_t flags = irq_save();
+    while (bytes_read < count && pipe->count > 0) {
         buf[bytes_read++] = pipe->buffer[pipe->read_pos];
         pipe->read_pos = (pipe->read_pos + 1) % PIPE_SIZE;
         pipe->count--;
     }
     
+    // Room was made, let blocked writers continue
+    if (bytes_read > 0) {
+        wake_up_all(&pipe->writers);
+    }
+    irq_restore(flags);
+    
     return bytes_read;
 }
 
@@ -64,18 +68,104 @@ int pipe_write(pipe_t* pipe, const void* buffer, size_t count) {
     size_t bytes_written = 0;
     
     while (bytes_written < count) {
-        // If pipe is full
-        if (pipe->count == PIPE_SIZE) {
-            // Block waiting for space
-            // In real implementation, would yield CPU
-            continue;
+        // Full pipe: sleep until a reader makes room
+        wait_event(pipe->writers, pipe->count < PIPE_SIZE || pipe->reader_closed);
+        if (pipe->reader_closed) {
+            break;
         }
         
-        // Write one byte
-        pipe->buffer[pipe->write_pos] = buf[bytes_written++];
-        pipe->write_pos = (pipe->write_pos + 1) % PIPE_SIZE;
-        pipe->count++;
+        uint64_t flags = irq_save();
+        while (bytes_written < count && pipe->count < PIPE_SIZE) {
+            pipe->buffer[pipe->write_pos] = buf[bytes_written++];
+            pipe->write_pos = (pipe->write_pos + 1) % PIPE_SIZE;
+            pipe->count++;
+        }
+        wake_up_all(&pipe->readers);
+        irq_restore(flags);
     }
     
     return bytes_written;
-}
\ No newline at end of file
+}
+
+// Fill the pipe from 'actor' without a bounce buffer. Like pipe_write(),
+// waits for room until 'count' bytes are in.
+int pipe_splice_in(pipe_t* pipe, size_t count, pipe_actor_t actor, void* data) {
+    if (!pipe || pipe->writer_closed || pipe->reader_closed) return -1;
+    
+    size_t moved = 0;
+    while (moved < count) {
+        wait_event(pipe->writers, pipe->count < PIPE_SIZE || pipe->reader_closed);
+        if (pipe->reader_closed) {
+            break;
+        }
+        
+        // Free space runs from write_pos to the end of the buffer, then wraps
+        uint64_t flags = irq_save();
+        size_t len = PIPE_SIZE - pipe->write_pos;
+        if (len > PIPE_SIZE - pipe->count) {
+            len = PIPE_SIZE - pipe->count;
+        }
+        if (len > count - moved) {
+            len = count - moved;
+        }
+        
+        int n = actor(data, pipe->buffer + pipe->write_pos, len);
+        if (n > 0) {
+            pipe->write_pos = (pipe->write_pos + n) % PIPE_SIZE;
+            pipe->count += n;
+            moved += n;
+            wake_up_all(&pipe->readers);
+        }
+        irq_restore(flags);
+        
+        // The source ran dry or failed
+        if (n < (int)len) {
+            if (n < 0 && moved == 0) {
+                return -1;
+            }
+            break;
+        }
+    }
+    
+    return moved;
+}
+
+// Drain the pipe into 'actor' without a bounce buffer. Like pipe_read(),
+// waits for data once and then takes what is there.
+int pipe_splice_out(pipe_t* pipe, size_t count, pipe_actor_t actor, void* data) {
+    if (!pipe || pipe->reader_closed) return -1;
+    
+    wait_event(pipe->readers, pipe->count > 0 || pipe->writer_closed);
+    
+    size_t moved = 0;
+    int n = 0;
+    uint64_t flags = irq_save();
+    while (moved < count && pipe->count > 0) {
+        // Data runs from read_pos to the end of the buffer, then wraps
+        size_t len = PIPE_SIZE - pipe->read_pos;
+        if (len > pipe->count) {
+            len = pipe->count;
+        }
+        if (len > count - moved) {
+            len = count - moved;
+        }
+        
+        n = actor(data, pipe->buffer + pipe->read_pos, len);
+        if (n <= 0) {
+            break;
+        }
+        pipe->read_pos = (pipe->read_pos + n) % PIPE_SIZE;
+        pipe->count -= n;
+        moved += n;
+        if (n < (int)len) {
+            break;
+        }
+    }
+    
+    if (moved > 0) {
+        wake_up_all(&pipe->writers);
+    }
+    irq_restore(flags);
+    
+    return (n < 0 && moved == 0) ? -1 : (int)moved;
+}
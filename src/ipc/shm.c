@@ -0,0 +1,280 @@
+#include "../include/shm.h"
+#include "../include/process.h"
+#include "../include/mm.h"
+#include "../include/vmm.h"
+#include "../include/pmm.h"
+#include "../include/kmalloc.h"
+#include "../include/terminal.h"
+
+// Shared memory segment. Each frame holds one reference for the segment
+// itself plus one for every address space it is mapped into.
+typedef struct {
+    int used;
+    int key;
+    size_t size;
+    size_t npages;
+    void** frames;
+    uint32_t nattch;
+    uint32_t creator_pid;
+    int removed;            // IPC_RMID requested
+} shm_segment_t;
+
+static shm_segment_t segments[SHM_MAX_SEGMENTS];
+
+// Validate a segment id
+static shm_segment_t* shm_lookup(int shmid) {
+    if (shmid < 0 || shmid >= SHM_MAX_SEGMENTS || !segments[shmid].used) {
+        return NULL;
+    }
+    return &segments[shmid];
+}
+
+// Release a segment's frames once nobody can reach it any more
+static void shm_release(shm_segment_t* seg) {
+    for (size_t i = 0; i < seg->npages; i++) {
+        if (seg->frames[i]) {
+            pmm_page_unref(seg->frames[i]);
+        }
+    }
+    kfree(seg->frames);
+    seg->frames = NULL;
+    seg->used = 0;
+}
+
+// Drop one attach, destroying the segment if it was removed
+static void shm_put(shm_segment_t* seg) {
+    if (seg->nattch > 0) {
+        seg->nattch--;
+    }
+    if (seg->removed && seg->nattch == 0) {
+        shm_release(seg);
+    }
+}
+
+// Create or look up a segment
+int shm_get(int key, size_t size, int flags) {
+    // Look for an existing segment with this key
+    if (key != IPC_PRIVATE) {
+        for (int i = 0; i < SHM_MAX_SEGMENTS; i++) {
+            shm_segment_t* seg = &segments[i];
+            if (seg->used && !seg->removed && seg->key == key) {
+                if ((flags & IPC_CREAT) && (flags & IPC_EXCL)) {
+                    return -1;  // EEXIST
+                }
+                if (size > seg->size) {
+                    return -1;  // EINVAL
+                }
+                return i;
+            }
+        }
+        
+        if (!(flags & IPC_CREAT)) {
+            return -1;  // ENOENT
+        }
+    }
+    
+    if (size == 0 || size > SHM_MAX_SIZE) {
+        return -1;
+    }
+    
+    // Find free slot
+    int shmid = -1;
+    for (int i = 0; i < SHM_MAX_SEGMENTS; i++) {
+        if (!segments[i].used) {
+            shmid = i;
+            break;
+        }
+    }
+    
+    if (shmid == -1) return -1;  // ENOSPC
+    
+    shm_segment_t* seg = &segments[shmid];
+    seg->npages = PAGE_ALIGN_UP(size) / PAGE_SIZE;
+    seg->frames = (void**)kzalloc(seg->npages * sizeof(void*));
+    if (!seg->frames) return -1;
+    
+    // Frames don't need to be contiguous, allocate them one at a time
+    for (size_t i = 0; i < seg->npages; i++) {
+        seg->frames[i] = pmm_alloc_page();
+        if (!seg->frames[i]) {
+            shm_release(seg);
+            return -1;  // ENOMEM
+        }
+    }
+    
+    seg->used = 1;
+    seg->key = key;
+    seg->size = size;
+    seg->nattch = 0;
+    seg->removed = 0;
+    seg->creator_pid = process_get_pid();
+    
+    return shmid;
+}
+
+// Check whether [addr, addr + size) overlaps any attachment in mm
+static shm_attach_t* shm_find_overlap(mm_t* mm, uint64_t addr, uint64_t size) {
+    for (shm_attach_t* att = mm->shm_list; att; att = att->next) {
+        shm_segment_t* seg = &segments[att->shmid];
+        uint64_t att_end = att->addr + seg->npages * PAGE_SIZE;
+        if (addr < att_end && att->addr < addr + size) {
+            return att;
+        }
+    }
+    return NULL;
+}
+
+// Map a segment into a process's address space
+uint64_t shm_attach(process_t* proc, int shmid, uint64_t addr) {
+    shm_segment_t* seg = shm_lookup(shmid);
+    if (!proc || !seg || seg->removed) {
+        return (uint64_t)-1;
+    }
+    
+    mm_t* mm = proc->mm;
+    uint64_t size = seg->npages * PAGE_SIZE;
+    
+    if (addr == 0) {
+        // Pick the first free range in the shared memory region
+        addr = USER_SHM_START;
+        shm_attach_t* att;
+        while ((att = shm_find_overlap(mm, addr, size)) != NULL) {
+            addr = att->addr + segments[att->shmid].npages * PAGE_SIZE;
+        }
+    } else if ((addr & (PAGE_SIZE - 1)) || shm_find_overlap(mm, addr, size)) {
+        return (uint64_t)-1;
+    }
+    
+    if (addr < USER_SHM_START || addr + size > USER_SHM_END) {
+        return (uint64_t)-1;
+    }
+    
+    shm_attach_t* record = (shm_attach_t*)kmalloc(sizeof(shm_attach_t));
+    if (!record) return (uint64_t)-1;
+    if (mm_add_vma(mm, addr, addr + size, VMA_READ | VMA_WRITE | VMA_SHARED) < 0) {
+        kfree(record);
+        return (uint64_t)-1;
+    }
+    
+    // Map every frame, taking a reference for this address space
+    for (size_t i = 0; i < seg->npages; i++) {
+        uint64_t virt = addr + i * PAGE_SIZE;
+        if (pmm_page_ref(seg->frames[i]) < 0 ||
+            vmm_map_page(mm->page_table, virt, (uint64_t)seg->frames[i],
+                         PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_SHARED) < 0) {
+            // Undo the pages mapped so far
+            for (size_t j = 0; j < i; j++) {
+                vmm_unmap_page(mm->page_table, addr + j * PAGE_SIZE);
+                pmm_page_unref(seg->frames[j]);
+            }
+            mm_remove_vma(mm, addr);
+            kfree(record);
+            return (uint64_t)-1;
+        }
+    }
+    
+    record->shmid = shmid;
+    record->addr = addr;
+    record->next = mm->shm_list;
+    mm->shm_list = record;
+    seg->nattch++;
+    
+    return addr;
+}
+
+// Unmap an attachment and drop its frame references
+static void shm_unmap(mm_t* mm, shm_attach_t* att) {
+    shm_segment_t* seg = &segments[att->shmid];
+    
+    for (size_t i = 0; i < seg->npages; i++) {
+        uint64_t virt = att->addr + i * PAGE_SIZE;
+        if (vmm_get_physical(mm->page_table, virt)) {
+            vmm_unmap_page(mm->page_table, virt);
+            pmm_page_unref(seg->frames[i]);
+        }
+    }
+    
+    shm_put(seg);
+}
+
+// Detach the segment mapped at addr
+int shm_detach(process_t* proc, uint64_t addr) {
+    if (!proc) return -1;
+    
+    shm_attach_t** link = &proc->mm->shm_list;
+    while (*link) {
+        shm_attach_t* att = *link;
+        if (att->addr == addr) {
+            *link = att->next;
+            shm_unmap(proc->mm, att);
+            mm_remove_vma(proc->mm, addr);
+            kfree(att);
+            return 0;
+        }
+        link = &att->next;
+    }
+    
+    return -1;  // EINVAL
+}
+
+// Segment control
+int shm_ctl(int shmid, int cmd, shmid_ds_t* buf) {
+    shm_segment_t* seg = shm_lookup(shmid);
+    if (!seg) return -1;
+    
+    switch (cmd) {
+        case IPC_STAT:
+            if (!buf) return -1;
+            buf->key = seg->key;
+            buf->size = seg->size;
+            buf->creator_pid = seg->creator_pid;
+            buf->nattch = seg->nattch;
+            return 0;
+            
+        case IPC_RMID:
+            // Frames are freed once the last attached process lets go
+            seg->removed = 1;
+            if (seg->nattch == 0) {
+                shm_release(seg);
+            }
+            return 0;
+            
+        default:
+            return -1;
+    }
+}
+
+// Duplicate attachments into a forked child's address space. The frames
+// themselves are shared by vmm_clone_address_space() because they are
+// mapped PAGE_SHARED, and the VMAs were copied with the rest.
+void shm_fork(mm_t* parent, mm_t* child) {
+    child->shm_list = NULL;
+    
+    for (shm_attach_t* att = parent->shm_list; att; att = att->next) {
+        shm_attach_t* copy = (shm_attach_t*)kmalloc(sizeof(shm_attach_t));
+        if (!copy) break;
+        
+        copy->shmid = att->shmid;
+        copy->addr = att->addr;
+        copy->next = child->shm_list;
+        child->shm_list = copy;
+        segments[att->shmid].nattch++;
+    }
+}
+
+// Detach everything when the address space goes away or execs
+void shm_exit(mm_t* mm) {
+    if (!mm) return;
+    
+    while (mm->shm_list) {
+        shm_attach_t* att = mm->shm_list;
+        mm->shm_list = att->next;
+        
+        if (mm->page_table) {
+            shm_unmap(mm, att);
+        } else {
+            shm_put(&segments[att->shmid]);
+        }
+        kfree(att);
+    }
+}
@@ -64,6 +64,8 @@ void signal_send(int pid, int sig) {
             terminal_writestring("[SIGNAL] Unknown signal\n");
             break;
     }
+    
+    process_put(proc);
 }
 
 // Handle pending signals for current process
@@ -0,0 +1,359 @@
+#include "../include/io_ring.h"
+#include "../include/process.h"
+#include "../include/mm.h"
+#include "../include/vmm.h"
+#include "../include/pmm.h"
+#include "../include/kmalloc.h"
+#include "../include/workqueue.h"
+#include "../include/wait.h"
+#include "../include/smp.h"
+#include "../include/string.h"
+#include "../include/terminal.h"
+
+// Kernel side of a ring
+typedef struct io_ring {
+    io_ring_shared_t* shared;           // Kernel address of the shared pages
+    io_ring_sqe_t* sqes;
+    io_ring_cqe_t* cqes;
+    uint32_t pages;
+    uint32_t sq_mask;                   // Sizes as set up; the shared copies
+    uint32_t cq_mask;                   // are user-writable and only informational
+    spinlock_t lock;                    // Posting completions
+    wait_queue_t cq_wait;               // ring_enter() waiting for completions
+    volatile uint32_t inflight;         // Chains with a worker
+    volatile uint32_t refs;             // The address space and each chain
+} io_ring_t;
+
+// The rest of a chain, handed to a worker
+typedef struct {
+    work_t work;                        // Must stay first
+    io_ring_t* ring;
+    mm_t* mm;                           // Submitter's address space
+    uint32_t count;
+    io_ring_sqe_t sqes[];
+} io_ring_work_t;
+
+static workqueue_t* io_ring_wq[IO_RING_WORKERS];
+static uint32_t io_ring_wq_count = 0;
+static uint32_t io_ring_wq_next = 0;
+
+// All rings
+static uint64_t io_ring_submitted = 0;
+static uint64_t io_ring_completed = 0;
+static uint64_t io_ring_punted = 0;
+static uint64_t io_ring_enters = 0;
+
+// Helper to print a decimal number
+static void print_dec(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
+// Free the ring with its last reference. Mappings hold their own
+// references to the pages.
+static void io_ring_put(io_ring_t* ring) {
+    if (__sync_sub_and_fetch(&ring->refs, 1) != 0) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < ring->pages; i++) {
+        pmm_page_unref((uint8_t*)ring->shared + i * PAGE_SIZE);
+    }
+    kfree(ring);
+}
+
+// Completions ready for user space
+static uint32_t io_ring_ready(io_ring_t* ring) {
+    return ring->shared->cq_tail - ring->shared->cq_head;
+}
+
+// Post a completion and wake a waiting ring_enter()
+static void io_ring_post(io_ring_t* ring, uint64_t user_data, int64_t res) {
+    io_ring_shared_t* sh = ring->shared;
+    
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    if (sh->cq_tail - sh->cq_head > ring->cq_mask) {
+        sh->cq_overflow++;
+    } else {
+        io_ring_cqe_t* cqe = &ring->cqes[sh->cq_tail & ring->cq_mask];
+        cqe->user_data = user_data;
+        cqe->res = res;
+        __sync_synchronize();
+        sh->cq_tail++;
+    }
+    spin_unlock_irqrestore(&ring->lock, flags);
+    
+    __sync_fetch_and_add(&io_ring_completed, 1);
+    wake_up(&ring->cq_wait);
+}
+
+// Could this request sleep if issued now?
+static bool io_ring_would_block(const io_ring_sqe_t* sqe) {
+    switch (sqe->opcode) {
+        case IO_RING_OP_READ:
+            return syscall_fd_may_block(sqe->fd, false, sqe->len);
+        case IO_RING_OP_WRITE:
+            return syscall_fd_may_block(sqe->fd, true, sqe->len);
+        default:
+            return false;
+    }
+}
+
+// Carry out a request as the system call it stands for
+static int64_t io_ring_issue(const io_ring_sqe_t* sqe) {
+    switch (sqe->opcode) {
+        case IO_RING_OP_NOP:
+            return 0;
+        case IO_RING_OP_READ:
+            return (int64_t)syscall_invoke(SYS_READ, sqe->fd, sqe->addr, sqe->len);
+        case IO_RING_OP_WRITE:
+            return (int64_t)syscall_invoke(SYS_WRITE, sqe->fd, sqe->addr, sqe->len);
+        case IO_RING_OP_OPEN:
+            return (int64_t)syscall_invoke(SYS_OPEN, sqe->addr, sqe->len, 0);
+        case IO_RING_OP_CLOSE:
+            return (int64_t)syscall_invoke(SYS_CLOSE, sqe->fd, 0, 0);
+        case IO_RING_OP_PIPE:
+            return (int64_t)syscall_invoke(SYS_PIPE, sqe->addr, 0, 0);
+        default:
+            return -1;  // EINVAL
+    }
+}
+
+// Issue a request and post its result; false if it failed
+static bool io_ring_run_one(io_ring_t* ring, const io_ring_sqe_t* sqe) {
+    int64_t res = io_ring_issue(sqe);
+    io_ring_post(ring, sqe->user_data, res);
+    return res >= 0;
+}
+
+// Worker: run the rest of a chain in the submitter's address space, so
+// its buffers and file descriptors are the ones the requests name
+static void io_ring_worker(work_t* work) {
+    io_ring_work_t* w = (io_ring_work_t*)work;
+    process_t* self = process_get_current();
+    mm_t* own = self->mm;
+    
+    self->mm = w->mm;
+    uint64_t flags = irq_save();
+    this_cpu()->page_table = w->mm->page_table;
+    vmm_switch_address_space(w->mm->page_table);
+    irq_restore(flags);
+    
+    lock_kernel();
+    uint32_t i = 0;
+    while (i < w->count && io_ring_run_one(w->ring, &w->sqes[i])) {
+        i++;
+    }
+    for (i++; i < w->count; i++) {
+        io_ring_post(w->ring, w->sqes[i].user_data, -1);  // Chain broken
+    }
+    unlock_kernel();
+    
+    // Back to borrowing whatever is loaded
+    self->mm = own;
+    
+    __sync_fetch_and_sub(&w->ring->inflight, 1);
+    wake_up(&w->ring->cq_wait);
+    io_ring_put(w->ring);
+    mm_put_async(w->mm);  // Outside the BKL; the reaper tears it down
+    kfree(w);
+}
+
+// Hand SQEs [first, first + count) to a worker
+static void io_ring_punt(io_ring_t* ring, mm_t* mm, uint32_t first, uint32_t count) {
+    uint32_t mask = ring->sq_mask;
+    io_ring_work_t* w = NULL;
+    if (io_ring_wq_count) {
+        w = (io_ring_work_t*)kmalloc(sizeof(io_ring_work_t) + count * sizeof(io_ring_sqe_t));
+    }
+    if (!w) {
+        for (uint32_t i = 0; i < count; i++) {
+            io_ring_post(ring, ring->sqes[(first + i) & mask].user_data, -1);  // ENOMEM
+        }
+        return;
+    }
+    
+    w->work = (work_t)WORK_INIT(io_ring_worker);
+    w->ring = ring;
+    w->mm = mm_get(mm);
+    w->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        w->sqes[i] = ring->sqes[(first + i) & mask];
+    }
+    
+    __sync_fetch_and_add(&ring->refs, 1);
+    __sync_fetch_and_add(&ring->inflight, 1);
+    __sync_fetch_and_add(&io_ring_punted, 1);
+    queue_work(io_ring_wq[io_ring_wq_next++ % io_ring_wq_count], &w->work);
+}
+
+// Run a chain of 'count' SQEs from 'first' inline until one would sleep;
+// that one and the rest go to a worker
+static void io_ring_submit_chain(io_ring_t* ring, mm_t* mm, uint32_t first, uint32_t count) {
+    uint32_t mask = ring->sq_mask;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        io_ring_sqe_t sqe = ring->sqes[(first + i) & mask];
+        if (io_ring_would_block(&sqe)) {
+            io_ring_punt(ring, mm, first + i, count - i);
+            return;
+        }
+        if (!io_ring_run_one(ring, &sqe)) {
+            for (i++; i < count; i++) {
+                io_ring_post(ring, ring->sqes[(first + i) & mask].user_data, -1);  // Chain broken
+            }
+            return;
+        }
+    }
+}
+
+// A queue per worker so one sleeping request does not hold up the rest
+void io_ring_init(void) {
+    for (uint32_t i = 0; i < IO_RING_WORKERS; i++) {
+        workqueue_t* wq = workqueue_create("io_ring", 1);
+        if (!wq) {
+            break;
+        }
+        io_ring_wq[io_ring_wq_count++] = wq;
+    }
+    if (!io_ring_wq_count) {
+        terminal_writestring("I/O ring: no workers, blocking requests will fail\n");
+    }
+}
+
+// Allocate the shared pages and map them at IO_RING_ADDR
+int64_t io_ring_setup(process_t* proc, uint32_t entries) {
+    mm_t* mm = proc->mm;
+    if (!mm->page_table || mm->io_ring) {
+        return -1;  // Kernel thread, or one ring already
+    }
+    if (entries == 0 || entries > IO_RING_MAX_ENTRIES || (entries & (entries - 1))) {
+        return -1;  // EINVAL
+    }
+    
+    uint32_t sqes_offset = sizeof(io_ring_shared_t);
+    uint32_t cqes_offset = sqes_offset + entries * sizeof(io_ring_sqe_t);
+    uint32_t size = cqes_offset + 2 * entries * sizeof(io_ring_cqe_t);
+    uint32_t pages = PAGE_ALIGN_UP(size) / PAGE_SIZE;
+    
+    if (mm_add_vma(mm, IO_RING_ADDR, IO_RING_ADDR + pages * PAGE_SIZE,
+                   VMA_READ | VMA_WRITE | VMA_SHARED) < 0) {
+        return -1;  // The parent's ring, inherited through fork
+    }
+    
+    io_ring_t* ring = (io_ring_t*)kzalloc(sizeof(io_ring_t));
+    uint8_t* mem = ring ? (uint8_t*)pmm_alloc_pages(pages) : NULL;
+    if (!mem) {
+        kfree(ring);
+        mm_remove_vma(mm, IO_RING_ADDR);
+        return -1;  // ENOMEM
+    }
+    
+    ring->shared = (io_ring_shared_t*)mem;
+    ring->pages = pages;
+    ring->sq_mask = entries - 1;
+    ring->cq_mask = 2 * entries - 1;
+    ring->refs = 1;
+    spin_init(&ring->lock);
+    wait_queue_init(&ring->cq_wait);
+    
+    io_ring_shared_t* sh = ring->shared;
+    sh->sq_entries = entries;
+    sh->cq_entries = 2 * entries;
+    sh->sqes_offset = sqes_offset;
+    sh->cqes_offset = cqes_offset;
+    ring->sqes = IO_RING_SQES(sh);
+    ring->cqes = IO_RING_CQES(sh);
+    
+    // Both sides see the same frames; each mapping holds a reference
+    for (uint32_t i = 0; i < pages; i++) {
+        uint8_t* page = mem + i * PAGE_SIZE;
+        if (pmm_page_ref(page) < 0) {
+            io_ring_put(ring);
+            return -1;
+        }
+        if (vmm_map_page(mm->page_table, IO_RING_ADDR + i * PAGE_SIZE, (uint64_t)page,
+                         PAGE_WRITABLE | PAGE_USER | PAGE_SHARED) < 0) {
+            pmm_page_unref(page);
+            io_ring_put(ring);
+            return -1;
+        }
+    }
+    
+    mm->io_ring = ring;
+    return IO_RING_ADDR;
+}
+
+// Take the queued SQEs in chains, then wait for completions if asked
+int64_t io_ring_enter(process_t* proc, uint32_t to_submit, uint32_t min_complete) {
+    io_ring_t* ring = proc->mm->io_ring;
+    if (!ring) {
+        return -1;
+    }
+    
+    io_ring_shared_t* sh = ring->shared;
+    uint32_t mask = ring->sq_mask;
+    uint32_t head = sh->sq_head;
+    uint32_t queued = sh->sq_tail - head;
+    __sync_synchronize();
+    if (queued > mask + 1) {
+        return -1;  // Corrupt tail
+    }
+    if (to_submit > queued) {
+        to_submit = queued;
+    }
+    
+    uint32_t done = 0;
+    while (done < to_submit) {
+        uint32_t count = 1;
+        while (done + count < to_submit &&
+               (ring->sqes[(head + count - 1) & mask].flags & IO_RING_LINK)) {
+            count++;
+        }
+        io_ring_submit_chain(ring, proc->mm, head, count);
+        head += count;
+        done += count;
+    }
+    
+    // The slots are free for reuse
+    __sync_synchronize();
+    sh->sq_head = head;
+    __sync_fetch_and_add(&io_ring_submitted, done);
+    __sync_fetch_and_add(&io_ring_enters, 1);
+    
+    if (min_complete) {
+        wait_event(ring->cq_wait, io_ring_ready(ring) >= min_complete || ring->inflight == 0);
+    }
+    return done;
+}
+
+// The user mapping goes with the address space; the ring itself stays
+// until the last worker holding it is done
+void io_ring_exit(mm_t* mm) {
+    io_ring_t* ring = mm->io_ring;
+    if (ring) {
+        mm->io_ring = NULL;
+        io_ring_put(ring);
+    }
+}
+
+// Print totals across all rings
+void io_ring_print_stats(void) {
+    terminal_writestring("I/O rings: ");
+    print_dec(io_ring_enters);
+    terminal_writestring(" enters, ");
+    print_dec(io_ring_submitted);
+    terminal_writestring(" submitted, ");
+    print_dec(io_ring_completed);
+    terminal_writestring(" completed, ");
+    print_dec(io_ring_punted);
+    terminal_writestring(" chains to ");
+    print_dec(io_ring_wq_count);
+    terminal_writestring(" workers\n");
+}
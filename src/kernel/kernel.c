@@ -19,8 +19,26 @@
 #include "../include/usermode.h"
 #include "../include/pmm.h"
 #include "../include/vmm.h"
+#include "../include/swap.h"
+#include "../include/ksm.h"
+#include "../include/cpu.h"
+#include "../include/cma.h"
+#include "../include/string.h"
+#include "../include/multiboot.h"
 #include "../include/elf.h"
+#include "../include/smp.h"
+#include "../include/apic.h"
+#include "../include/irq.h"
+#include "../include/clocksource.h"
+#include "../include/futex.h"
+#include "../include/umutex.h"
 #include "../include/scheduler.h"
+#include "../include/softirq.h"
+#include "../include/workqueue.h"
+#include "../include/fpu.h"
+#include "../include/vdso.h"
+#include "../include/io_ring.h"
+#include "../include/systrace.h"
 #include "../include/../userspace/hello_binary.h"
 
 // External assembly functions
@@ -33,7 +51,6 @@ void init_gdt(void);
 void init_idt(void);
 void init_paging(void);
 void init_keyboard(void);
-void init_pic(void);
 void test_fork_exec(void);
 void fork_test_main(void);
 void test_shell(void);
@@ -133,6 +150,1501 @@ void test_memory_process(void) {
     }
 }
 
+// Swap stress test: grow the heap to twice the size of physical memory,
+// fill every page, then read it all back through compressed swap
+void test_swap_process(void) {
+    size_t total_pages;
+    pmm_get_stats(&total_pages, NULL, NULL);
+    size_t pages = total_pages * 2;
+    const size_t chunk = 256;
+    
+    terminal_writestring("[Swap Test] Overcommitting physical memory 2x\n");
+    
+    uint64_t* base = NULL;
+    for (size_t done = 0; done < pages; done += chunk) {
+        uint64_t* ptr;
+        asm volatile(
+            "mov $6, %%rax\n"      // SYS_SBRK
+            "mov %1, %%rdi\n"
+            "int $0x80\n"
+            "mov %%rax, %0"
+            : "=r"(ptr) : "r"(chunk * PAGE_SIZE) : "rax", "rdi"
+        );
+        if (ptr == (uint64_t*)-1) {
+            terminal_writestring("[Swap Test] sbrk failed\n");
+            process_exit(1);
+        }
+        if (!base) base = ptr;
+        
+        // Compressible pattern unique to each page
+        for (size_t p = done; p < done + chunk; p++) {
+            uint64_t* page = base + p * (PAGE_SIZE / 8);
+            for (int i = 0; i < PAGE_SIZE / 8; i++) {
+                page[i] = ((uint64_t)p << 32) | (i & 15);
+            }
+        }
+    }
+    
+    size_t bad = 0;
+    for (size_t p = 0; p < pages; p++) {
+        uint64_t* page = base + p * (PAGE_SIZE / 8);
+        for (int i = 0; i < PAGE_SIZE / 8; i++) {
+            if (page[i] != (((uint64_t)p << 32) | (i & 15))) {
+                bad++;
+                break;
+            }
+        }
+    }
+    
+    terminal_writestring(bad ? "[Swap Test] FAILED: corrupted pages\n"
+                             : "[Swap Test] PASSED: all pages intact\n");
+    swap_print_stats();
+    process_exit(bad ? 1 : 0);
+}
+
+// Helper to print a decimal number
+static void print_dec(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
+// Cache coloring benchmark parameters
+#define COLOR_POOL_PAGES  4096   // Frames churned to fragment memory
+#define COLOR_MAX_SET     1024   // Largest working set (pages)
+#define COLOR_ROUNDS      16
+
+static void* color_pool[COLOR_POOL_PAGES];
+static void* color_set[COLOR_MAX_SET];
+
+// Stream over a working set one cache line at a time, returning cycles
+static uint64_t color_stream(size_t count) {
+    volatile uint64_t sum = 0;
+    uint64_t start = rdtsc();
+    
+    for (int r = 0; r < COLOR_ROUNDS; r++) {
+        for (size_t p = 0; p < count; p++) {
+            uint64_t* page = (uint64_t*)color_set[p];
+            for (int i = 0; i < PAGE_SIZE / 8; i += 8) {
+                sum += page[i];
+            }
+        }
+    }
+    
+    return rdtsc() - start;
+}
+
+// Largest number of working set pages that share one color
+static size_t color_max_load(size_t count, uint32_t colors) {
+    uint32_t load[PMM_MAX_COLORS] = {0};
+    size_t max = 0;
+    
+    for (size_t p = 0; p < count; p++) {
+        uint32_t c = ((uint64_t)color_set[p] / PAGE_SIZE) % colors;
+        if (++load[c] > max) {
+            max = load[c];
+        }
+    }
+    return max;
+}
+
+// Allocate a working set, stream over it, report and free it
+static void color_run(const char* label, size_t count, uint32_t colors, bool colored) {
+    bool old = pmm_set_coloring(colored);
+    uint32_t cursor = 0;
+    
+    for (size_t p = 0; p < count; p++) {
+        color_set[p] = pmm_alloc_page_color(&cursor);
+    }
+    
+    color_stream(count);  // Warm up
+    uint64_t cycles = color_stream(count);
+    
+    terminal_writestring(label);
+    print_dec(cycles / (COLOR_ROUNDS * count));
+    terminal_writestring(" cycles/page, max pages per color ");
+    print_dec(color_max_load(count, colors));
+    terminal_writestring("\n");
+    
+    for (size_t p = 0; p < count; p++) {
+        if (color_set[p]) pmm_free_page(color_set[p]);
+    }
+    pmm_set_coloring(old);
+}
+
+// Compare streaming over a cache-sized working set allocated from
+// fragmented memory with and without page coloring
+void test_cache_coloring(void) {
+    uint32_t colors, ways;
+    pmm_cache_geometry(&colors, &ways);
+    
+    terminal_writestring("\n=== Cache Coloring Benchmark ===\n");
+    if (colors <= 1) {
+        terminal_writestring("No cache geometry from CPUID, coloring unavailable\n");
+        return;
+    }
+    
+    size_t count = (size_t)colors * ways;
+    if (count > COLOR_MAX_SET) count = COLOR_MAX_SET;
+    
+    terminal_writestring("Colors: ");
+    print_dec(colors);
+    terminal_writestring(", ways: ");
+    print_dec(ways);
+    terminal_writestring(", working set: ");
+    print_dec(count);
+    terminal_writestring(" pages\n");
+    
+    // Fragment memory: allocate a pool and free a pseudo-random half
+    bool old = pmm_set_coloring(false);
+    for (size_t p = 0; p < COLOR_POOL_PAGES; p++) {
+        color_pool[p] = pmm_alloc_page();
+    }
+    pmm_set_coloring(old);
+    
+    uint32_t seed = 12345;
+    for (size_t p = 0; p < COLOR_POOL_PAGES; p++) {
+        seed = seed * 1103515245 + 12345;
+        if (((seed >> 16) & 1) && color_pool[p]) {
+            pmm_free_page(color_pool[p]);
+            color_pool[p] = NULL;
+        }
+    }
+    
+    color_run("Lowest free: ", count, colors, false);
+    color_run("Colored:     ", count, colors, true);
+    
+    for (size_t p = 0; p < COLOR_POOL_PAGES; p++) {
+        if (color_pool[p]) pmm_free_page(color_pool[p]);
+    }
+}
+
+// CMA test: fragment ordinary memory, let user pages spill into the CMA
+// region, then allocate large contiguous DMA buffers
+#define CMA_TEST_USER_PAGES 1024
+
+void test_cma_process(void) {
+    terminal_writestring("\n=== CMA Fragmentation Test ===\n");
+    
+    // Take almost all ordinary memory (staying above the reclaim
+    // watermark), then give back every 16th page. Pages are chained
+    // through their first word.
+    uint64_t* chain = NULL;
+    for (;;) {
+        size_t free_pages, cma_free;
+        pmm_get_stats(NULL, &free_pages, NULL);
+        pmm_get_cma_stats(NULL, &cma_free);
+        if (free_pages - cma_free <= SWAP_LOW_WATERMARK + 64) break;
+        
+        uint64_t* page = (uint64_t*)pmm_alloc_page();
+        if (!page) break;
+        *page = (uint64_t)chain;
+        chain = page;
+    }
+    
+    uint64_t* kept = NULL;
+    for (size_t n = 0; chain; n++) {
+        uint64_t* next = (uint64_t*)*chain;
+        if (n % 16 == 0) {
+            pmm_free_page(chain);
+        } else {
+            *chain = (uint64_t)kept;
+            kept = chain;
+        }
+        chain = next;
+    }
+    
+    void* big = pmm_alloc_pages(256);
+    terminal_writestring(big ? "pmm_alloc_pages(1MB): succeeded\n"
+                             : "pmm_alloc_pages(1MB): failed (fragmented)\n");
+    if (big) pmm_free_pages(big, 256);
+    
+    // User heap pages are movable and may borrow the region
+    uint64_t* heap;
+    asm volatile(
+        "mov $6, %%rax\n"      // SYS_SBRK
+        "mov %1, %%rdi\n"
+        "int $0x80\n"
+        "mov %%rax, %0"
+        : "=r"(heap) : "r"((uint64_t)CMA_TEST_USER_PAGES * PAGE_SIZE) : "rax", "rdi"
+    );
+    
+    size_t in_cma = 0;
+    if (heap != (uint64_t*)-1) {
+        process_t* self = process_get_current();
+        for (size_t p = 0; p < CMA_TEST_USER_PAGES; p++) {
+            heap[p * (PAGE_SIZE / 8)] = p ^ 0x5A5A;
+            uint64_t phys = vmm_get_physical(self->mm->page_table, (uint64_t)&heap[p * (PAGE_SIZE / 8)]);
+            if (pmm_page_is_cma((void*)PAGE_ALIGN_DOWN(phys))) in_cma++;
+        }
+    }
+    terminal_writestring("User pages placed in CMA region: ");
+    print_dec(in_cma);
+    terminal_writestring("\n");
+    
+    // Large contiguous buffers, size aligned
+    static const size_t sizes[] = { 1024 * 1024, 2 * 1024 * 1024, 4 * 1024 * 1024 };
+    void* bufs[3];
+    dma_addr_t handles[3];
+    bool ok = true;
+    
+    for (int i = 0; i < 3; i++) {
+        bufs[i] = dma_alloc_coherent(sizes[i], &handles[i]);
+        size_t align = sizes[i] < 2 * 1024 * 1024 ? sizes[i] : 2 * 1024 * 1024;
+        
+        terminal_writestring("dma_alloc_coherent(");
+        print_dec(sizes[i] >> 20);
+        terminal_writestring("MB): ");
+        if (!bufs[i]) {
+            terminal_writestring("failed\n");
+            ok = false;
+            continue;
+        }
+        if (handles[i] % align) ok = false;
+        terminal_writestring(handles[i] % align ? "misaligned\n" : "ok\n");
+        memset(bufs[i], 0xAB, sizes[i]);
+    }
+    
+    for (int i = 0; i < 3; i++) {
+        if (bufs[i]) dma_free_coherent(bufs[i], sizes[i], handles[i]);
+    }
+    
+    // Migrated user pages must still hold their data
+    if (heap != (uint64_t*)-1) {
+        for (size_t p = 0; p < CMA_TEST_USER_PAGES; p++) {
+            if (heap[p * (PAGE_SIZE / 8)] != (p ^ 0x5A5A)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    
+    cma_stats_t stats;
+    cma_get_stats(&stats);
+    terminal_writestring("Pages migrated: ");
+    print_dec(stats.pages_migrated);
+    terminal_writestring(ok ? "\n[CMA Test] PASSED\n" : "\n[CMA Test] FAILED\n");
+    
+    while (kept) {
+        uint64_t* next = (uint64_t*)*kept;
+        pmm_free_page(kept);
+        kept = next;
+    }
+    process_exit(ok ? 0 : 1);
+}
+
+// Scheduling latency test: CPU hogs keep the normal class saturated
+// while whichever hog is running wakes the test process every
+// LAT_PERIOD_MS; the test records the time from wakeup until it runs
+#define LAT_HOGS       3
+#define LAT_SAMPLES    16
+#define LAT_PERIOD_MS  30
+
+static process_t* lat_sleeper;
+static volatile bool lat_waiting;
+static volatile bool lat_done;
+static volatile uint64_t lat_next_wake;
+static volatile uint64_t lat_wake_ns;
+
+static void lat_hog(void) {
+    while (!lat_done) {
+        asm volatile("cli");
+        if (lat_waiting && timer_get_ms() >= lat_next_wake &&
+            lat_sleeper->state == PROCESS_STATE_BLOCKED) {
+            lat_waiting = false;
+            lat_wake_ns = ktime_get_ns();
+            process_unblock(lat_sleeper);
+        }
+        asm volatile("sti");
+        scheduler_resched();
+    }
+    process_exit(0);
+}
+
+// Sleep and get woken LAT_SAMPLES times under one scheduling class
+static void lat_round(const char* label, const sched_attr_t* attr) {
+    if (syscall2(SYS_SCHED_SETATTR, 0, (uint64_t)attr) != 0) {
+        terminal_writestring("sched_setattr failed\n");
+        return;
+    }
+    
+    uint64_t min = ~0ULL, max = 0, total = 0;
+    for (int i = 0; i < LAT_SAMPLES; i++) {
+        asm volatile("cli");
+        lat_next_wake = timer_get_ms() + LAT_PERIOD_MS;
+        lat_waiting = true;
+        process_block();
+        
+        uint64_t delta = ktime_get_ns() - lat_wake_ns;
+        if (delta < min) min = delta;
+        if (delta > max) max = delta;
+        total += delta;
+    }
+    
+    terminal_writestring(label);
+    terminal_writestring("min ");
+    print_dec(min);
+    terminal_writestring(" avg ");
+    print_dec(total / LAT_SAMPLES);
+    terminal_writestring(" max ");
+    print_dec(max);
+    terminal_writestring(" ns\n");
+}
+
+void test_sched_latency_process(void) {
+    terminal_writestring("\n=== Wakeup Latency Under Load ===\n");
+    
+    lat_sleeper = process_get_current();
+    lat_done = false;
+    lat_waiting = false;
+    
+    process_t* hogs[LAT_HOGS];
+    for (int i = 0; i < LAT_HOGS; i++) {
+        hogs[i] = process_create("LatHog", lat_hog, 0);
+    }
+    
+    sched_attr_t normal = { .policy = SCHED_NORMAL, .priority = 10 };
+    sched_attr_t fifo = { .policy = SCHED_FIFO, .priority = 0 };
+    lat_round("SCHED_NORMAL: ", &normal);
+    lat_round("SCHED_FIFO:   ", &fifo);
+    
+    // Admission control: a second half-CPU deadline task must not fit
+    sched_attr_t dl = { .policy = SCHED_DEADLINE, .runtime_ms = 20,
+                        .deadline_ms = 40, .period_ms = 40 };
+    bool first = syscall2(SYS_SCHED_SETATTR, 0, (uint64_t)&dl) == 0;
+    bool second = hogs[0] &&
+                  syscall2(SYS_SCHED_SETATTR, hogs[0]->pid, (uint64_t)&dl) == 0;
+    terminal_writestring(first && !second ? "Deadline admission: ok\n"
+                                          : "Deadline admission: FAILED\n");
+    
+    syscall2(SYS_SCHED_SETATTR, 0, (uint64_t)&normal);
+    lat_done = true;
+    scheduler_stats();
+    process_exit(first && !second ? 0 : 1);
+}
+
+// SMP scaling test: a fixed amount of CPU-bound work, first done by one
+// worker and then split across one worker per CPU. Idle CPUs pick the
+// workers up by stealing, so the second round should finish about
+// cpu_count times faster.
+#define SCALE_WORK  (1ULL << 27)
+
+static volatile uint64_t scale_chunk;
+static volatile uint32_t scale_running;
+static wait_queue_t scale_done = WAIT_QUEUE_INIT;
+
+static void scale_worker(void) {
+    volatile uint64_t sink = 0;
+    for (uint64_t i = 0; i < scale_chunk; i++) {
+        sink += i;
+    }
+    
+    if (__sync_sub_and_fetch(&scale_running, 1) == 0) {
+        wake_up(&scale_done);
+    }
+    process_exit(0);
+}
+
+// Run the work on 'workers' processes; returns elapsed nanoseconds
+static uint64_t scale_round(uint32_t workers) {
+    scale_chunk = SCALE_WORK / workers;
+    scale_running = workers;
+    uint64_t start = ktime_get_ns();
+    
+    for (uint32_t i = 0; i < workers; i++) {
+        if (!process_create("ScaleWorker", scale_worker, 1)) {
+            __sync_sub_and_fetch(&scale_running, 1);
+        }
+    }
+    wait_event(scale_done, scale_running == 0);
+    
+    return ktime_get_ns() - start;
+}
+
+void test_smp_scaling_process(void) {
+    terminal_writestring("\n=== SMP Scaling ===\n");
+    
+    uint32_t cpus_online = smp_online_cpus();
+    uint64_t one = scale_round(1);
+    uint64_t all = scale_round(cpus_online);
+    
+    terminal_writestring("1 worker:  ");
+    print_dec(one / NSEC_PER_USEC);
+    terminal_writestring(" us\n");
+    print_dec(cpus_online);
+    terminal_writestring(" workers: ");
+    print_dec(all / NSEC_PER_USEC);
+    terminal_writestring(" us\nSpeedup: ");
+    print_dec(all ? one * 100 / all : 0);
+    terminal_writestring("% of one CPU\n");
+    
+    scheduler_stats();
+    process_exit(0);
+}
+
+// Idle wakeup rate: sleep for a while and count how often each CPU left
+// hlt, and how many of its timer interrupts there were. Boot with
+// "nohz=off" to compare against the periodic tick.
+#define WAKEUP_SAMPLE_MS  5000
+
+void test_idle_wakeups_process(void) {
+    terminal_writestring("\n=== Idle Wakeups (tick: ");
+    terminal_writestring(timer_tick_mode());
+    terminal_writestring(") ===\n");
+    
+    uint32_t cpus_online = smp_online_cpus();
+    uint64_t wakeups[MAX_CPUS], irqs[MAX_CPUS];
+    for (uint32_t i = 0; i < cpus_online; i++) {
+        wakeups[i] = cpus[i].idle_wakeups;
+        irqs[i] = cpus[i].timer_irqs;
+    }
+    
+    sleep_ms(WAKEUP_SAMPLE_MS);
+    
+    for (uint32_t i = 0; i < cpus_online; i++) {
+        terminal_writestring("CPU ");
+        print_dec(i);
+        terminal_writestring(": ");
+        print_dec((cpus[i].idle_wakeups - wakeups[i]) * 1000 / WAKEUP_SAMPLE_MS);
+        terminal_writestring(" wakeups/s, ");
+        print_dec((cpus[i].timer_irqs - irqs[i]) * 1000 / WAKEUP_SAMPLE_MS);
+        terminal_writestring(" timer interrupts/s\n");
+    }
+    process_exit(0);
+}
+
+// Process churn: run thousands of processes that exit at once, a batch at
+// a time, then check that every one of them was freed and its PID
+// returned to the allocator
+#define CHURN_PROCS  4000
+#define CHURN_BATCH  50
+
+static volatile uint32_t churn_running;
+static wait_queue_t churn_done = WAIT_QUEUE_INIT;
+
+static void churn_worker(void) {
+    if (__sync_sub_and_fetch(&churn_running, 1) == 0) {
+        wake_up(&churn_done);
+    }
+    process_exit(0);
+}
+
+void test_process_churn_process(void) {
+    terminal_writestring("\n=== Process Churn ===\n");
+    
+    process_reap();
+    uint32_t before = process_count();
+    uint32_t created = 0, peak = 0, max_pid = 0;
+    uint64_t start = ktime_get_ns();
+    
+    while (created < CHURN_PROCS) {
+        uint32_t batch = 0;
+        churn_running = CHURN_BATCH;
+        for (; batch < CHURN_BATCH; batch++) {
+            process_t* proc = process_create("Churn", churn_worker, 1);
+            if (!proc) {
+                break;
+            }
+            if (proc->pid > max_pid) {
+                max_pid = proc->pid;
+            }
+        }
+        __sync_sub_and_fetch(&churn_running, CHURN_BATCH - batch);
+        created += batch;
+        
+        if (process_count() > peak) {
+            peak = process_count();
+        }
+        wait_event(churn_done, churn_running == 0);
+        if (batch < CHURN_BATCH) {
+            terminal_writestring("Out of PIDs or memory\n");
+            break;
+        }
+    }
+    
+    uint64_t elapsed = ktime_get_ns() - start;
+    sleep_ms(100);  // Let the last workers leave their CPUs
+    process_reap();
+    
+    print_dec(created);
+    terminal_writestring(" processes in ");
+    print_dec(elapsed / NSEC_PER_MSEC);
+    terminal_writestring(" ms, highest PID ");
+    print_dec(max_pid);
+    terminal_writestring("\nRegistered: ");
+    print_dec(before);
+    terminal_writestring(" before, ");
+    print_dec(peak);
+    terminal_writestring(" peak, ");
+    print_dec(process_count());
+    terminal_writestring(" after\n");
+    process_exit(0);
+}
+
+// Kernel threads: create a batch of kernel tasks with process_create()
+// and then with kthread_create(), and report what each costs to create
+// and how many physical pages it takes. The tasks wait to be released,
+// so none has exited and been freed while we count.
+#define SPAWN_TASKS  32
+
+static volatile bool spawn_go;
+static wait_queue_t spawn_start = WAIT_QUEUE_INIT;
+
+static void spawn_worker(void) {
+    wait_event(spawn_start, spawn_go);
+    churn_worker();
+}
+
+static void spawn_kthread_worker(void* arg) {
+    (void)arg;
+    spawn_worker();
+}
+
+static void spawn_measure(const char* label, bool kthread) {
+    size_t free_before, free_after;
+    uint32_t created = 0;
+    
+    spawn_go = false;
+    churn_running = SPAWN_TASKS;
+    pmm_get_stats(NULL, &free_before, NULL);
+    uint64_t start = ktime_get_ns();
+    for (int i = 0; i < SPAWN_TASKS; i++) {
+        process_t* proc = kthread ? kthread_create("kworker", spawn_kthread_worker, NULL, 1)
+                                  : process_create("Spawn", spawn_worker, 1);
+        if (proc) {
+            created++;
+        }
+    }
+    uint64_t elapsed = ktime_get_ns() - start;
+    pmm_get_stats(NULL, &free_after, NULL);
+    
+    terminal_writestring(label);
+    print_dec(created ? elapsed / created : 0);
+    terminal_writestring(" ns, ");
+    print_dec(created && free_before > free_after ? (free_before - free_after) / created : 0);
+    terminal_writestring(" pages per task\n");
+    
+    // Let them go and wait for them all to exit
+    __sync_sub_and_fetch(&churn_running, SPAWN_TASKS - created);
+    spawn_go = true;
+    wake_up_all(&spawn_start);
+    wait_event(churn_done, churn_running == 0);
+}
+
+void test_kthread_process(void) {
+    terminal_writestring("\n=== Kernel Threads ===\n");
+    
+    spawn_measure("process_create(): ", false);
+    spawn_measure("kthread_create():  ", true);
+    
+    size_t zeroed;
+    uint64_t hits, misses;
+    pmm_get_zero_stats(&zeroed, &hits, &misses);
+    terminal_writestring("Pre-zeroed free pages: ");
+    print_dec(zeroed);
+    terminal_writestring(", allocations served zeroed: ");
+    print_dec(hits);
+    terminal_writestring(" of ");
+    print_dec(hits + misses);
+    terminal_writestring("\n");
+    process_exit(0);
+}
+
+// Threads: time clone() against process_create(), which builds a whole
+// address space per task, then have threads bump a shared counter under
+// a user-space mutex. Taking and dropping the lock with nobody else
+// around should not make a single futex call.
+#define THREAD_BATCH       32
+#define THREAD_ROUNDS      8
+#define THREAD_WORKERS     4
+#define THREAD_ITERATIONS  20000
+#define THREAD_STACK_SIZE  8192
+
+static umutex_t thread_lock = UMUTEX_INIT;
+static volatile uint64_t thread_counter;
+
+// Start fn(arg) in a thread on its own stack. The child comes back from
+// clone() with only our registers, so it finds fn and arg in r12/r13 and
+// exits when fn returns. 'ctid' reads zero once it is gone.
+static uint64_t thread_spawn(void (*fn)(void*), void* arg, void* stack_top, volatile uint32_t* ctid) {
+    uint64_t ret;
+    register uint64_t r10 asm("r10") = (uint64_t)ctid;
+    asm volatile(
+        "mov %[fn], %%r12\n"
+        "mov %[arg], %%r13\n"
+        "int $0x80\n"
+        "test %%rax, %%rax\n"
+        "jnz 1f\n"
+        "mov %%r13, %%rdi\n"
+        "call *%%r12\n"
+        "mov $1, %%rax\n"      // SYS_EXIT
+        "xor %%rdi, %%rdi\n"
+        "int $0x80\n"
+        "1:"
+        : "=a"(ret)
+        : "a"((uint64_t)SYS_CLONE), "D"((uint64_t)(CLONE_VM | CLONE_CHILD_CLEARTID)),
+          "S"(stack_top), "d"(0), "r"(r10), [fn] "r"(fn), [arg] "r"(arg)
+        : "r12", "r13", "memory", "cc"
+    );
+    return ret;
+}
+
+// Sleep until a thread's TID word is cleared
+static void thread_join(volatile uint32_t* ctid) {
+    uint32_t tid;
+    while ((tid = *ctid) != 0) {
+        syscall4(SYS_FUTEX, (uint64_t)ctid, FUTEX_WAIT, tid, 0);
+    }
+}
+
+static void thread_noop(void* arg) {
+    (void)arg;
+}
+
+static void thread_counter_worker(void* arg) {
+    (void)arg;
+    for (int i = 0; i < THREAD_ITERATIONS; i++) {
+        umutex_lock(&thread_lock);
+        thread_counter++;
+        umutex_unlock(&thread_lock);
+    }
+}
+
+void test_threads_process(void) {
+    terminal_writestring("\n=== Threads ===\n");
+    
+    static volatile uint32_t tids[THREAD_BATCH];
+    uint8_t* stacks = (uint8_t*)kmalloc(THREAD_BATCH * THREAD_STACK_SIZE);
+    if (!stacks) {
+        terminal_writestring("Out of memory\n");
+        process_exit(0);
+    }
+    
+    // Creation cost: only the create calls are timed
+    uint64_t thread_ns = 0, process_ns = 0;
+    uint32_t threads = 0, processes = 0;
+    for (int round = 0; round < THREAD_ROUNDS; round++) {
+        for (int i = 0; i < THREAD_BATCH; i++) {
+            uint64_t start = ktime_get_ns();
+            uint64_t tid = thread_spawn(thread_noop, NULL, stacks + (i + 1) * THREAD_STACK_SIZE, &tids[i]);
+            thread_ns += ktime_get_ns() - start;
+            if ((int64_t)tid > 0) {
+                threads++;
+            }
+        }
+        for (int i = 0; i < THREAD_BATCH; i++) {
+            thread_join(&tids[i]);
+        }
+        
+        churn_running = THREAD_BATCH;
+        for (int i = 0; i < THREAD_BATCH; i++) {
+            uint64_t start = ktime_get_ns();
+            process_t* proc = process_create("Spawn", churn_worker, 1);
+            process_ns += ktime_get_ns() - start;
+            if (proc) {
+                processes++;
+            } else {
+                __sync_sub_and_fetch(&churn_running, 1);
+            }
+        }
+        wait_event(churn_done, churn_running == 0);
+    }
+    
+    terminal_writestring("clone():          ");
+    print_dec(threads ? thread_ns / threads : 0);
+    terminal_writestring(" ns per thread\nprocess_create(): ");
+    print_dec(processes ? process_ns / processes : 0);
+    terminal_writestring(" ns per process\n");
+    
+    // Contended: every increment must survive
+    const futex_stats_t* stats = futex_get_stats();
+    uint64_t waits = stats->waits, wakes = stats->wakes;
+    thread_counter = 0;
+    for (int i = 0; i < THREAD_WORKERS; i++) {
+        thread_spawn(thread_counter_worker, NULL, stacks + (i + 1) * THREAD_STACK_SIZE, &tids[i]);
+    }
+    for (int i = 0; i < THREAD_WORKERS; i++) {
+        thread_join(&tids[i]);
+    }
+    terminal_writestring("Counter: ");
+    print_dec(thread_counter);
+    terminal_writestring(thread_counter == (uint64_t)THREAD_WORKERS * THREAD_ITERATIONS ? " (ok)" : " (LOST UPDATES)");
+    terminal_writestring(", futex waits ");
+    print_dec(stats->waits - waits);
+    terminal_writestring(", wakes ");
+    print_dec(stats->wakes - wakes);
+    terminal_writestring("\n");
+    
+    // Uncontended: no system calls at all
+    waits = stats->waits;
+    wakes = stats->wakes;
+    uint64_t start = ktime_get_ns();
+    for (int i = 0; i < THREAD_ITERATIONS; i++) {
+        umutex_lock(&thread_lock);
+        umutex_unlock(&thread_lock);
+    }
+    uint64_t elapsed = ktime_get_ns() - start;
+    terminal_writestring("Uncontended lock/unlock: ");
+    print_dec(elapsed / THREAD_ITERATIONS);
+    terminal_writestring(" ns, futex calls ");
+    print_dec(stats->waits - waits + stats->wakes - wakes);
+    terminal_writestring("\n");
+    
+    // Every thread has been joined, and a thread's TID word is only
+    // cleared in the kernel on its way out, so the stacks are unused
+    kfree(stacks);
+    process_exit(0);
+}
+
+// Ring 3 tests: each runs a task in new processes on stacks of its own
+// and reports through globals. A process has left its stack for good
+// once it is out of the registry.
+#define USER_TEST_MAX 4
+
+static void (*user_test_task)(void);
+static uint8_t* user_test_stacks;
+static size_t user_test_stack_size;
+static volatile uint32_t user_test_slot;
+static volatile uint32_t user_test_started;
+static volatile uint32_t user_test_pids[USER_TEST_MAX];
+
+static void user_test_entry(void) {
+    uint32_t slot = __sync_fetch_and_add(&user_test_slot, 1);
+    user_test_pids[slot] = process_get_pid();
+    __sync_fetch_and_add(&user_test_started, 1);
+    switch_to_user_mode((void*)user_test_task, user_test_stacks + (slot + 1) * user_test_stack_size);
+}
+
+// Run 'task' in 'count' processes and wait until all of them are gone.
+// Returns how many could be created.
+static uint32_t user_test_run(const char* name, void (*task)(void), uint32_t count, size_t stack_size) {
+    if (count > USER_TEST_MAX) {
+        count = USER_TEST_MAX;
+    }
+    user_test_stacks = (uint8_t*)kmalloc(count * stack_size);
+    if (!user_test_stacks) {
+        terminal_writestring("Out of memory\n");
+        return 0;
+    }
+    
+    user_test_task = task;
+    user_test_stack_size = stack_size;
+    user_test_slot = 0;
+    user_test_started = 0;
+    uint32_t created = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (process_create(name, user_test_entry, 1)) {
+            created++;
+        }
+    }
+    if (!created) {
+        terminal_writestring("Could not create the test task\n");
+    }
+    
+    while (user_test_started < created) {
+        sleep_ms(10);
+    }
+    for (uint32_t i = 0; i < created; i++) {
+        process_t* proc;
+        while ((proc = process_find_by_pid(user_test_pids[i]))) {
+            process_put(proc);
+            sleep_ms(10);
+        }
+    }
+    
+    kfree(user_test_stacks);
+    user_test_stacks = NULL;
+    return created;
+}
+
+// Lazy FPU switching: user processes each keep their own value in xmm0
+// across sleeps, so their state is saved and reloaded whenever another
+// one runs in between. The other test processes never touch the FPU and
+// should add no saves or loads.
+#define FPU_TASKS       4
+#define FPU_ROUNDS      50
+#define FPU_STACK_SIZE  4096
+
+static volatile uint32_t fpu_failed;
+
+// Runs in ring 3: put our PID in xmm0 and check it after every sleep
+static void fpu_user_task(void) {
+    uint64_t left;
+    asm volatile(
+        "mov $4, %%rax\n"      // SYS_GETPID
+        "int $0x80\n"
+        "mov %%rax, %%rbx\n"
+        "movq %%rbx, %%xmm0\n"
+        "mov %1, %%r12\n"
+        "1:\n"
+        "mov $5, %%rax\n"      // SYS_SLEEP
+        "mov $1, %%rdi\n"      // 1ms
+        "int $0x80\n"
+        "movq %%xmm0, %%rax\n"
+        "cmp %%rbx, %%rax\n"
+        "jne 2f\n"
+        "dec %%r12\n"
+        "jnz 1b\n"
+        "2:\n"
+        "mov %%r12, %0"
+        : "=r"(left) : "i"(FPU_ROUNDS) : "rax", "rbx", "rdi", "r12", "memory"
+    );
+    if (left) {
+        __sync_fetch_and_add(&fpu_failed, 1);
+    }
+    
+    asm volatile(
+        "mov $1, %%rax\n"      // SYS_EXIT
+        "xor %%rdi, %%rdi\n"
+        "int $0x80"
+        : : : "rax", "rdi"
+    );
+}
+
+void test_fpu_process(void) {
+    terminal_writestring("\n=== Lazy FPU ===\n");
+    fpu_print_stats();
+    
+    fpu_failed = 0;
+    uint32_t ran = user_test_run("FpuUser", fpu_user_task, FPU_TASKS, FPU_STACK_SIZE);
+    
+    terminal_writestring("xmm0 kept by ");
+    print_dec(ran - fpu_failed);
+    terminal_writestring(" of ");
+    print_dec(FPU_TASKS);
+    terminal_writestring(" tasks\n");
+    fpu_print_stats();
+    process_exit(0);
+}
+
+// System call entry: getpid round trips from ring 3 through INT 0x80
+// and through SYSCALL, timed with the TSC
+#define SYSCALL_BENCH_ROUNDS  10000
+#define SYSCALL_BENCH_STACK   4096
+
+static volatile uint64_t syscall_bench_int;
+static volatile uint64_t syscall_bench_fast;
+
+// Runs in ring 3
+static void syscall_bench_task(void) {
+    uint64_t ret;
+    uint64_t start = rdtsc();
+    for (int i = 0; i < SYSCALL_BENCH_ROUNDS; i++) {
+        asm volatile("int $0x80" : "=a"(ret) : "a"((uint64_t)SYS_GETPID) : "memory");
+    }
+    syscall_bench_int = rdtsc() - start;
+    
+    start = rdtsc();
+    for (int i = 0; i < SYSCALL_BENCH_ROUNDS; i++) {
+        asm volatile("syscall" : "=a"(ret) : "a"((uint64_t)SYS_GETPID) : "rcx", "r11", "memory");
+    }
+    syscall_bench_fast = rdtsc() - start;
+    
+    asm volatile("syscall" : : "a"((uint64_t)SYS_EXIT), "D"(0ULL) : "rcx", "r11", "memory");
+}
+
+void test_syscall_bench_process(void) {
+    terminal_writestring("\n=== System Call Entry ===\n");
+    
+    if (!user_test_run("SyscallBench", syscall_bench_task, 1, SYSCALL_BENCH_STACK)) {
+        process_exit(0);
+    }
+    
+    terminal_writestring("getpid via INT 0x80: ");
+    print_dec(syscall_bench_int / SYSCALL_BENCH_ROUNDS);
+    terminal_writestring(" cycles\ngetpid via SYSCALL:  ");
+    print_dec(syscall_bench_fast / SYSCALL_BENCH_ROUNDS);
+    terminal_writestring(" cycles\n");
+    process_exit(0);
+}
+
+// vDSO: clock_gettime, getpid and getcpu from ring 3 through the shared
+// pages and through SYSCALL, timed with the TSC
+#define VDSO_BENCH_ROUNDS  10000
+#define VDSO_BENCH_STACK   4096
+
+enum { VDSO_BENCH_TIME, VDSO_BENCH_PID, VDSO_BENCH_CPU, VDSO_BENCH_CALLS };
+
+static volatile uint64_t vdso_bench_fast[VDSO_BENCH_CALLS];
+static volatile uint64_t vdso_bench_slow[VDSO_BENCH_CALLS];
+static volatile bool vdso_bench_pid_ok;
+static volatile bool vdso_bench_time_ok;
+
+// Runs in ring 3
+static void vdso_bench_task(void) {
+    timespec_t ts, prev;
+    uint32_t cpu;
+    uint64_t ret;
+    
+    uint64_t start = rdtsc();
+    for (int i = 0; i < VDSO_BENCH_ROUNDS; i++) {
+        vdso_clock_gettime(CLOCK_MONOTONIC, &ts);
+    }
+    vdso_bench_fast[VDSO_BENCH_TIME] = rdtsc() - start;
+    
+    start = rdtsc();
+    for (int i = 0; i < VDSO_BENCH_ROUNDS; i++) {
+        asm volatile("syscall" : "=a"(ret) : "a"((uint64_t)SYS_CLOCK_GETTIME), "D"((uint64_t)CLOCK_MONOTONIC),
+                     "S"(&ts) : "rcx", "r11", "memory");
+    }
+    vdso_bench_slow[VDSO_BENCH_TIME] = rdtsc() - start;
+    
+    start = rdtsc();
+    for (int i = 0; i < VDSO_BENCH_ROUNDS; i++) {
+        ret = vdso_getpid();
+    }
+    vdso_bench_fast[VDSO_BENCH_PID] = rdtsc() - start;
+    uint64_t pid = ret;
+    
+    start = rdtsc();
+    for (int i = 0; i < VDSO_BENCH_ROUNDS; i++) {
+        asm volatile("syscall" : "=a"(ret) : "a"((uint64_t)SYS_GETPID) : "rcx", "r11", "memory");
+    }
+    vdso_bench_slow[VDSO_BENCH_PID] = rdtsc() - start;
+    vdso_bench_pid_ok = pid == ret;
+    
+    start = rdtsc();
+    for (int i = 0; i < VDSO_BENCH_ROUNDS; i++) {
+        vdso_getcpu(&cpu, NULL);
+    }
+    vdso_bench_fast[VDSO_BENCH_CPU] = rdtsc() - start;
+    
+    start = rdtsc();
+    for (int i = 0; i < VDSO_BENCH_ROUNDS; i++) {
+        asm volatile("syscall" : "=a"(ret) : "a"((uint64_t)SYS_GETCPU) : "rcx", "r11", "memory");
+    }
+    vdso_bench_slow[VDSO_BENCH_CPU] = rdtsc() - start;
+    
+    // The vDSO clock and the kernel's must never run backwards
+    // against each other
+    bool ok = true;
+    for (int i = 0; i < VDSO_BENCH_ROUNDS && ok; i++) {
+        asm volatile("syscall" : "=a"(ret) : "a"((uint64_t)SYS_CLOCK_GETTIME), "D"((uint64_t)CLOCK_MONOTONIC),
+                     "S"(&prev) : "rcx", "r11", "memory");
+        vdso_clock_gettime(CLOCK_MONOTONIC, &ts);
+        ok = ts.tv_sec > prev.tv_sec || (ts.tv_sec == prev.tv_sec && ts.tv_nsec >= prev.tv_nsec);
+    }
+    vdso_bench_time_ok = ok;
+    
+    asm volatile("syscall" : : "a"((uint64_t)SYS_EXIT), "D"(0ULL) : "rcx", "r11", "memory");
+}
+
+void test_vdso_process(void) {
+    static const char* names[VDSO_BENCH_CALLS] = { "clock_gettime", "getpid", "getcpu" };
+    
+    terminal_writestring("\n=== vDSO ===\n");
+    
+    if (!user_test_run("VdsoBench", vdso_bench_task, 1, VDSO_BENCH_STACK)) {
+        process_exit(0);
+    }
+    
+    terminal_writestring("Clocksource: ");
+    terminal_writestring(clocksource_name());
+    terminal_writestring("\n");
+    for (int i = 0; i < VDSO_BENCH_CALLS; i++) {
+        terminal_writestring(names[i]);
+        terminal_writestring(": ");
+        print_dec(vdso_bench_fast[i] / VDSO_BENCH_ROUNDS);
+        terminal_writestring(" cycles via vDSO, ");
+        print_dec(vdso_bench_slow[i] / VDSO_BENCH_ROUNDS);
+        terminal_writestring(" via SYSCALL\n");
+    }
+    terminal_writestring(vdso_bench_pid_ok ? "PIDs agree\n" : "PID MISMATCH\n");
+    terminal_writestring(vdso_bench_time_ok ? "Clocks agree\n" : "vDSO CLOCK WENT BACKWARDS\n");
+    process_exit(0);
+}
+
+// I/O ring: small file writes one system call each against one ring
+// entry for all of them, then a pipe read that has to wait for a worker
+// and a chain cut short by a failure
+#define RING_BENCH_WRITES  32
+#define RING_BENCH_STACK   4096
+
+static volatile uint64_t ring_bench_single;
+static volatile uint64_t ring_bench_batched;
+static volatile bool ring_bench_pipe_ok;
+static volatile bool ring_bench_link_ok;
+static volatile bool ring_bench_failed;
+
+// Wait for 'n' completions and check each against 'expect', in order;
+// false on a mismatch
+static bool ring_bench_reap(io_ring_shared_t* ring, uint32_t n, const int64_t* expect) {
+    for (uint32_t i = 0; i < n; i++) {
+        io_ring_cqe_t* cqe;
+        while (!(cqe = ring_peek_cqe(ring))) {
+            ring_enter(0, 1);
+        }
+        bool ok = cqe->user_data == i && cqe->res == expect[i];
+        ring_cqe_seen(ring);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs in ring 3
+static void ring_bench_task(void) {
+    static const char line[] = "ring test line\n";
+    static const char path[] = "/ringtest";
+    static int64_t expect[RING_BENCH_WRITES];
+    char buf[16];
+    int pipefd[2];
+    
+    io_ring_shared_t* ring = ring_setup(64);
+    int fd = (int)syscall3(SYS_OPEN, (uint64_t)path, 0, 0);
+    if (!ring || fd < 0) {
+        ring_bench_failed = true;
+        syscall1(SYS_EXIT, 1);
+    }
+    
+    uint64_t start = rdtsc();
+    for (int i = 0; i < RING_BENCH_WRITES; i++) {
+        syscall3(SYS_WRITE, fd, (uint64_t)line, sizeof(line) - 1);
+    }
+    ring_bench_single = rdtsc() - start;
+    
+    start = rdtsc();
+    for (int i = 0; i < RING_BENCH_WRITES; i++) {
+        io_ring_sqe_t* sqe = ring_get_sqe(ring);
+        sqe->opcode = IO_RING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)line;
+        sqe->len = sizeof(line) - 1;
+        sqe->user_data = i;
+        ring_push_sqe(ring);
+        expect[i] = sizeof(line) - 1;
+    }
+    ring_enter(RING_BENCH_WRITES, RING_BENCH_WRITES);
+    ring_bench_batched = rdtsc() - start;
+    ring_bench_failed = !ring_bench_reap(ring, RING_BENCH_WRITES, expect);
+    
+    // The read finds the pipe empty and goes to a worker; the write in
+    // the same submission fills it
+    syscall1(SYS_PIPE, (uint64_t)pipefd);
+    io_ring_sqe_t* sqe = ring_get_sqe(ring);
+    sqe->opcode = IO_RING_OP_READ;
+    sqe->fd = pipefd[0];
+    sqe->addr = (uint64_t)buf;
+    sqe->len = sizeof(line) - 1;
+    sqe->user_data = 0;
+    ring_push_sqe(ring);
+    sqe = ring_get_sqe(ring);
+    sqe->opcode = IO_RING_OP_WRITE;
+    sqe->fd = pipefd[1];
+    sqe->addr = (uint64_t)line;
+    sqe->len = sizeof(line) - 1;
+    sqe->user_data = 1;
+    ring_push_sqe(ring);
+    ring_enter(2, 2);
+    
+    // Completion order is not fixed here; both must be full-length
+    bool ok = true;
+    for (int i = 0; i < 2; i++) {
+        io_ring_cqe_t* cqe;
+        while (!(cqe = ring_peek_cqe(ring))) {
+            ring_enter(0, 1);
+        }
+        ok = ok && cqe->res == (int64_t)(sizeof(line) - 1);
+        ring_cqe_seen(ring);
+    }
+    ring_bench_pipe_ok = ok && buf[0] == line[0] && buf[sizeof(line) - 2] == '\n';
+    
+    // A read on a closed descriptor fails, so the write linked after it
+    // must not run
+    sqe = ring_get_sqe(ring);
+    sqe->opcode = IO_RING_OP_READ;
+    sqe->fd = 15;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = 1;
+    sqe->flags = IO_RING_LINK;
+    sqe->user_data = 0;
+    ring_push_sqe(ring);
+    sqe = ring_get_sqe(ring);
+    sqe->opcode = IO_RING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = 1;
+    ring_push_sqe(ring);
+    ring_enter(2, 2);
+    expect[0] = -1;
+    expect[1] = -1;
+    ring_bench_link_ok = ring_bench_reap(ring, 2, expect);
+    
+    syscall1(SYS_CLOSE, fd);
+    syscall1(SYS_EXIT, 0);
+}
+
+void test_io_ring_process(void) {
+    terminal_writestring("\n=== I/O Ring ===\n");
+    
+    ring_bench_failed = false;
+    if (!user_test_run("RingBench", ring_bench_task, 1, RING_BENCH_STACK)) {
+        process_exit(0);
+    }
+    
+    if (ring_bench_failed) {
+        terminal_writestring("Ring setup or completions FAILED\n");
+    }
+    print_dec(RING_BENCH_WRITES);
+    terminal_writestring(" writes: ");
+    print_dec(ring_bench_single);
+    terminal_writestring(" cycles as system calls, ");
+    print_dec(ring_bench_batched);
+    terminal_writestring(" through the ring\n");
+    terminal_writestring(ring_bench_pipe_ok ? "Pipe read completed by a worker\n" : "Pipe read FAILED\n");
+    terminal_writestring(ring_bench_link_ok ? "Failed link cancelled the chain\n" : "Linked chain FAILED\n");
+    io_ring_print_stats();
+    process_exit(0);
+}
+
+// Vectored and positional I/O: a record written as three pieces with
+// one writev() against one write() each, then pread()/pwrite() checked
+// to leave the file position alone
+#define VECIO_BENCH_ROUNDS 32
+#define VECIO_BENCH_STACK  4096
+
+static volatile uint64_t vecio_bench_single;
+static volatile uint64_t vecio_bench_vectored;
+static volatile bool vecio_bench_vec_ok;
+static volatile bool vecio_bench_pos_ok;
+static volatile bool vecio_bench_range_ok;
+static volatile bool vecio_bench_failed;
+
+// Runs in ring 3
+static void vecio_bench_task(void) {
+    static const char path[] = "/vectest";
+    static char head[] = "id=";
+    static char body[] = "0042";
+    static char tail[] = ";\n";
+    const uint64_t rec = sizeof(head) + sizeof(body) + sizeof(tail) - 3;
+    char a[8], b[8];
+    int pipefd[2];
+    
+    int fd = (int)syscall3(SYS_OPEN, (uint64_t)path, 0, 0);
+    int fd2 = (int)syscall3(SYS_OPEN, (uint64_t)path, 0, 0);
+    if (fd < 0 || fd2 < 0) {
+        vecio_bench_failed = true;
+        syscall1(SYS_EXIT, 1);
+    }
+    
+    iovec_t iov[3] = {
+        { head, sizeof(head) - 1 },
+        { body, sizeof(body) - 1 },
+        { tail, sizeof(tail) - 1 },
+    };
+    
+    uint64_t start = rdtsc();
+    for (int i = 0; i < VECIO_BENCH_ROUNDS; i++) {
+        syscall3(SYS_WRITE, fd, (uint64_t)head, sizeof(head) - 1);
+        syscall3(SYS_WRITE, fd, (uint64_t)body, sizeof(body) - 1);
+        syscall3(SYS_WRITE, fd, (uint64_t)tail, sizeof(tail) - 1);
+    }
+    vecio_bench_single = rdtsc() - start;
+    
+    bool ok = true;
+    start = rdtsc();
+    for (int i = 0; i < VECIO_BENCH_ROUNDS; i++) {
+        ok = ok && syscall3(SYS_WRITEV, fd, (uint64_t)iov, 3) == rec;
+    }
+    vecio_bench_vectored = rdtsc() - start;
+    
+    // The second descriptor reads the first record back split differently
+    iovec_t in[2] = { { a, 5 }, { b, 4 } };
+    ok = ok && syscall3(SYS_READV, fd2, (uint64_t)in, 2) == rec;
+    vecio_bench_vec_ok = ok && a[0] == 'i' && a[4] == '0' && b[0] == '4' && b[3] == '\n';
+    
+    // Overwrite the start; the next plain write must still append
+    uint64_t end = 2 * VECIO_BENCH_ROUNDS * rec;
+    ok = syscall4(SYS_PWRITE, fd, (uint64_t)"ID", 2, 0) == 2;
+    ok = ok && syscall3(SYS_WRITE, fd, (uint64_t)"Z", 1) == 1;
+    ok = ok && syscall4(SYS_PREAD, fd, (uint64_t)a, 2, 0) == 2 && a[0] == 'I' && a[1] == 'D';
+    ok = ok && syscall4(SYS_PREAD, fd, (uint64_t)b, 1, end) == 1 && b[0] == 'Z';
+    
+    // ...and the second descriptor carries on where readv() stopped
+    ok = ok && syscall3(SYS_READ, fd2, (uint64_t)a, 1) == 1 && a[0] == 'i';
+    vecio_bench_pos_ok = ok;
+    
+    // Offsets are 64 bits all the way down: this one must not wrap to 0.
+    // Pipes have no position.
+    syscall1(SYS_PIPE, (uint64_t)pipefd);
+    vecio_bench_range_ok = (int64_t)syscall4(SYS_PWRITE, fd, (uint64_t)"!", 1, 1ULL << 32) < 0 &&
+                           (int64_t)syscall4(SYS_PREAD, pipefd[0], (uint64_t)a, 1, 0) < 0 &&
+                           syscall4(SYS_PREAD, fd, (uint64_t)a, 1, 0) == 1 && a[0] == 'I';
+    
+    syscall1(SYS_CLOSE, pipefd[0]);
+    syscall1(SYS_CLOSE, pipefd[1]);
+    syscall1(SYS_CLOSE, fd2);
+    syscall1(SYS_CLOSE, fd);
+    syscall1(SYS_EXIT, 0);
+}
+
+void test_vecio_process(void) {
+    terminal_writestring("\n=== Vectored and Positional I/O ===\n");
+    
+    vecio_bench_failed = false;
+    if (!user_test_run("VecioBench", vecio_bench_task, 1, VECIO_BENCH_STACK)) {
+        process_exit(0);
+    }
+    
+    if (vecio_bench_failed) {
+        terminal_writestring("Could not open the test file\n");
+    } else {
+        print_dec(VECIO_BENCH_ROUNDS);
+        terminal_writestring(" records: ");
+        print_dec(vecio_bench_single);
+        terminal_writestring(" cycles as three writes each, ");
+        print_dec(vecio_bench_vectored);
+        terminal_writestring(" as one writev\n");
+        terminal_writestring(vecio_bench_vec_ok ? "writev/readv transferred every buffer\n" : "writev/readv FAILED\n");
+        terminal_writestring(vecio_bench_pos_ok ? "pread/pwrite left the file position alone\n" : "pread/pwrite FAILED\n");
+        terminal_writestring(vecio_bench_range_ok ? "Large offsets and pipes rejected\n" : "Offset checks FAILED\n");
+    }
+    process_exit(0);
+}
+
+// System call tracing: a ring 3 task traces itself through a small
+// file and pipe pipeline, reads the trace back and copies out its own
+// per system call statistics
+#define TRACE_TEST_EVENTS 32
+#define TRACE_TEST_STACK  8192
+
+static systrace_event_t trace_test_events[TRACE_TEST_EVENTS];
+static syscall_stat_t trace_test_stats[MAX_SYSCALLS];
+static volatile int64_t trace_test_count;
+static volatile int64_t trace_test_stats_ret;
+
+// Runs in ring 3
+static void trace_test_task(void) {
+    static const char path[] = "/tracetest";
+    static const char line[] = "traced\n";
+    char buf[8];
+    int pipefd[2];
+    
+    uint32_t pid = (uint32_t)syscall0(SYS_GETPID);
+    systrace_enable(pid);
+    
+    int fd = (int)syscall3(SYS_OPEN, (uint64_t)path, 0, 0);
+    for (int i = 0; i < 4; i++) {
+        syscall3(SYS_WRITE, fd, (uint64_t)line, sizeof(line) - 1);
+    }
+    syscall1(SYS_CLOSE, fd);
+    syscall1(SYS_PIPE, (uint64_t)pipefd);
+    syscall3(SYS_WRITE, pipefd[1], (uint64_t)line, sizeof(line) - 1);
+    syscall3(SYS_READ, pipefd[0], (uint64_t)buf, sizeof(buf));
+    syscall1(SYS_SLEEP, 10);
+    syscall1(SYS_CLOSE, pipefd[0]);
+    syscall1(SYS_CLOSE, pipefd[1]);
+    
+    systrace_disable();
+    trace_test_count = systrace_read(trace_test_events, TRACE_TEST_EVENTS);
+    trace_test_stats_ret = systrace_stats(pid, trace_test_stats);
+    syscall1(SYS_EXIT, 0);
+}
+
+// Small arguments in decimal, addresses in hex
+static void trace_print_arg(uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    if (value < 0x10000) {
+        print_dec(value);
+        return;
+    }
+    
+    char buf[19];
+    int i = 18;
+    buf[i] = '\0';
+    while (value) {
+        buf[--i] = digits[value & 0xF];
+        value >>= 4;
+    }
+    buf[--i] = 'x';
+    buf[--i] = '0';
+    terminal_writestring(&buf[i]);
+}
+
+void test_systrace_process(void) {
+    terminal_writestring("\n=== System Call Trace ===\n");
+    
+    if (!user_test_run("TraceTest", trace_test_task, 1, TRACE_TEST_STACK)) {
+        process_exit(0);
+    }
+    
+    // strace style: [pid] name(args) = ret <cycles>
+    for (int64_t i = 0; i < trace_test_count; i++) {
+        const systrace_event_t* ev = &trace_test_events[i];
+        const char* name = systrace_name(ev->nr);
+        
+        terminal_writestring("[");
+        print_dec(ev->pid);
+        terminal_writestring("] ");
+        terminal_writestring(name ? name : "?");
+        terminal_writestring("(");
+        for (int a = 0; a < 3; a++) {
+            if (a) {
+                terminal_writestring(", ");
+            }
+            trace_print_arg(ev->args[a]);
+        }
+        terminal_writestring(") = ");
+        if (ev->ret < 0) {
+            terminal_writestring("-");
+            print_dec(-ev->ret);
+        } else {
+            trace_print_arg(ev->ret);
+        }
+        terminal_writestring(" <");
+        print_dec(ev->cycles);
+        terminal_writestring(">\n");
+    }
+    if (trace_test_count < 0) {
+        terminal_writestring("Reading the trace FAILED\n");
+    }
+    
+    // Where the task's time went
+    if (trace_test_stats_ret < 0) {
+        terminal_writestring("Per-process statistics FAILED\n");
+    } else {
+        uint64_t slowest = 0;
+        for (uint32_t nr = 1; nr < MAX_SYSCALLS; nr++) {
+            if (trace_test_stats[nr].total > trace_test_stats[slowest].total) {
+                slowest = nr;
+            }
+        }
+        terminal_writestring("Most time in ");
+        terminal_writestring(systrace_name(slowest) ? systrace_name(slowest) : "?");
+        terminal_writestring(": ");
+        print_dec(trace_test_stats[slowest].count);
+        terminal_writestring(" calls, ");
+        print_dec(trace_test_stats[slowest].total);
+        terminal_writestring(" cycles\n");
+    }
+    systrace_print_stats();
+    process_exit(0);
+}
+
+// sendfile/splice: copy a file through a user buffer against one
+// sendfile, then move part of it into a pipe and out again with splice
+#define SPLICE_BENCH_SIZE  8192
+#define SPLICE_BENCH_CHUNK 512
+#define SPLICE_BENCH_STACK 8192
+
+static volatile uint64_t splice_bench_copy;
+static volatile uint64_t splice_bench_sendfile;
+static volatile bool splice_bench_sendfile_ok;
+static volatile bool splice_bench_splice_ok;
+static volatile bool splice_bench_checks_ok;
+static volatile bool splice_bench_failed;
+
+// True if the first 'len' bytes of 'fd' are the test pattern from
+// 'offset' on
+static bool splice_bench_verify(int fd, uint64_t offset, uint64_t len) {
+    char buf[SPLICE_BENCH_CHUNK];
+    uint64_t done = 0;
+    while (done < len) {
+        uint64_t want = len - done < sizeof(buf) ? len - done : sizeof(buf);
+        if (syscall4(SYS_PREAD, fd, (uint64_t)buf, want, done) != want) {
+            return false;
+        }
+        for (uint64_t i = 0; i < want; i++) {
+            if (buf[i] != (char)('a' + (offset + done + i) % 26)) {
+                return false;
+            }
+        }
+        done += want;
+    }
+    return true;
+}
+
+// Runs in ring 3
+static void splice_bench_task(void) {
+    char buf[SPLICE_BENCH_CHUNK];
+    int pipefd[2];
+    
+    int src = (int)syscall3(SYS_OPEN, (uint64_t)"/splicesrc", 0, 0);
+    int copy = (int)syscall3(SYS_OPEN, (uint64_t)"/splicecopy", 0, 0);
+    int sent = (int)syscall3(SYS_OPEN, (uint64_t)"/splicesent", 0, 0);
+    int piped = (int)syscall3(SYS_OPEN, (uint64_t)"/splicepiped", 0, 0);
+    if (src < 0 || copy < 0 || sent < 0 || piped < 0 || (int64_t)syscall1(SYS_PIPE, (uint64_t)pipefd) < 0) {
+        splice_bench_failed = true;
+        syscall1(SYS_EXIT, 1);
+    }
+    
+    for (uint64_t off = 0; off < SPLICE_BENCH_SIZE; off += sizeof(buf)) {
+        for (uint64_t i = 0; i < sizeof(buf); i++) {
+            buf[i] = 'a' + (off + i) % 26;
+        }
+        syscall3(SYS_WRITE, src, (uint64_t)buf, sizeof(buf));
+    }
+    
+    // Through user memory: a read and a write per chunk
+    uint64_t off = 0;
+    uint64_t start = rdtsc();
+    while (off < SPLICE_BENCH_SIZE) {
+        int64_t n = (int64_t)syscall4(SYS_PREAD, src, (uint64_t)buf, sizeof(buf), off);
+        if (n <= 0) {
+            break;
+        }
+        syscall3(SYS_WRITE, copy, (uint64_t)buf, n);
+        off += n;
+    }
+    splice_bench_copy = rdtsc() - start;
+    
+    // One system call for the lot; the offset is ours, not src's
+    off = 0;
+    start = rdtsc();
+    int64_t n = (int64_t)syscall4(SYS_SENDFILE, sent, src, (uint64_t)&off, SPLICE_BENCH_SIZE);
+    splice_bench_sendfile = rdtsc() - start;
+    splice_bench_sendfile_ok = n == SPLICE_BENCH_SIZE && off == SPLICE_BENCH_SIZE &&
+                               splice_bench_verify(sent, 0, SPLICE_BENCH_SIZE);
+    
+    // File to pipe and pipe to file, starting partway into the source
+    off = 1000;
+    bool ok = syscall5(SYS_SPLICE, src, (uint64_t)&off, pipefd[1], 0, 3000) == 3000 && off == 4000;
+    ok = ok && syscall5(SYS_SPLICE, pipefd[0], 0, piped, 0, 3000) == 3000;
+    splice_bench_splice_ok = ok && splice_bench_verify(piped, 1000, 3000);
+    
+    // Pipes take no offset, and splice needs a pipe on one side
+    off = 0;
+    splice_bench_checks_ok = (int64_t)syscall5(SYS_SPLICE, pipefd[0], (uint64_t)&off, piped, 0, 1) < 0 &&
+                             (int64_t)syscall5(SYS_SPLICE, src, 0, piped, 0, 1) < 0;
+    
+    syscall1(SYS_CLOSE, pipefd[0]);
+    syscall1(SYS_CLOSE, pipefd[1]);
+    syscall1(SYS_CLOSE, piped);
+    syscall1(SYS_CLOSE, sent);
+    syscall1(SYS_CLOSE, copy);
+    syscall1(SYS_CLOSE, src);
+    syscall1(SYS_EXIT, 0);
+}
+
+void test_splice_process(void) {
+    terminal_writestring("\n=== sendfile/splice ===\n");
+    
+    splice_bench_failed = false;
+    if (!user_test_run("SpliceBench", splice_bench_task, 1, SPLICE_BENCH_STACK)) {
+        process_exit(0);
+    }
+    
+    if (splice_bench_failed) {
+        terminal_writestring("Could not open the test files\n");
+    } else {
+        print_dec(SPLICE_BENCH_SIZE);
+        terminal_writestring(" bytes: ");
+        print_dec(splice_bench_copy);
+        terminal_writestring(" cycles through a user buffer, ");
+        print_dec(splice_bench_sendfile);
+        terminal_writestring(" with sendfile\n");
+        terminal_writestring(splice_bench_sendfile_ok ? "sendfile copied the file\n" : "sendfile FAILED\n");
+        terminal_writestring(splice_bench_splice_ok ? "File to pipe to file with splice\n" : "splice FAILED\n");
+        terminal_writestring(splice_bench_checks_ok ? "Bad splice arguments rejected\n" : "splice checks FAILED\n");
+    }
+    process_exit(0);
+}
+
 // Test process using system calls
 void test_syscall_process(void) {
     // Test write syscall
@@ -284,15 +1796,25 @@ extern void isr19(void);
 extern void isr20(void);
 extern void irq0(void);
 extern void irq1(void);
+extern void irq2(void);
+extern void irq3(void);
+extern void irq4(void);
+extern void irq5(void);
+extern void irq6(void);
+extern void irq7(void);
+extern void irq8(void);
+extern void irq9(void);
+extern void irq10(void);
+extern void irq11(void);
+extern void irq12(void);
+extern void irq13(void);
+extern void irq14(void);
+extern void irq15(void);
 extern void isr128(void);  // INT 0x80 syscall
-
-// Interrupt handler table
-static isr_t interrupt_handlers[256] = { 0 };
-
-// Register an interrupt handler
-void register_interrupt_handler(uint8_t n, isr_t handler) {
-    interrupt_handlers[n] = handler;
-}
+extern void lapic_timer(void);
+extern void ipi_reschedule(void);
+extern void ipi_tlb(void);
+extern void spurious(void);
 
 // Set up a GDT entry
 void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
@@ -304,11 +1826,12 @@ void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_
     gdt[num].access = access;
 }
 
-// Set up a TSS descriptor (uses 2 GDT entries in long mode)
-void gdt_set_tss(int num, uint64_t base, uint32_t limit) {
+// Set up a TSS descriptor (uses 2 GDT entries in long mode) in any
+// CPU's GDT
+static void gdt_write_tss(struct gdt_entry* table, int num, uint64_t base, uint32_t limit) {
     // TSS descriptor is 16 bytes (uses two GDT entries)
-    struct gdt_entry* tss_low = &gdt[num];
-    struct gdt_entry* tss_high = &gdt[num + 1];
+    struct gdt_entry* tss_low = &table[num];
+    struct gdt_entry* tss_high = &table[num + 1];
     
     // Low 64 bits
     tss_low->limit_low = limit & 0xFFFF;
@@ -327,6 +1850,11 @@ void gdt_set_tss(int num, uint64_t base, uint32_t limit) {
     tss_high->base_high = 0;
 }
 
+// Set up a TSS descriptor in the boot CPU's GDT
+void gdt_set_tss(int num, uint64_t base, uint32_t limit) {
+    gdt_write_tss(gdt, num, base, limit);
+}
+
 // Initialize GDT
 void init_gdt(void) {
     gp.limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
@@ -335,16 +1863,16 @@ void init_gdt(void) {
     gdt_set_gate(0, 0, 0, 0, 0);                // Null segment
     gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xAF); // Kernel code segment (ring 0)
     gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF); // Kernel data segment (ring 0)
-    gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA, 0xAF); // User code segment (ring 3)
-    gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF); // User data segment (ring 3)
+    // SYSRET loads user SS and CS from consecutive entries, data first
+    gdt_set_gate(3, 0, 0xFFFFFFFF, 0xF2, 0xCF); // User data segment (ring 3)
+    gdt_set_gate(4, 0, 0xFFFFFFFF, 0xFA, 0xAF); // User code segment (ring 3)
     
     // TSS will be set up after GDT is loaded
     
     load_gdt((uintptr_t)&gp);
     
     // Now set up TSS (entries 5-6)
-    extern tss_t tss;
-    gdt_set_tss(5, (uint64_t)&tss, sizeof(tss_t) - 1);
+    gdt_set_tss(5, (uint64_t)&this_cpu()->tss, sizeof(tss_t) - 1);
     
     // Reload GDT to include TSS
     load_gdt((uintptr_t)&gp);
@@ -353,6 +1881,25 @@ void init_gdt(void) {
     asm volatile("ltr %0" : : "r"((uint16_t)0x28));
 }
 
+// Give an application processor its own GDT: the shared segments plus a
+// descriptor for its own TSS, which needs a private copy because ltr
+// marks the descriptor busy
+void init_gdt_ap(cpu_t* cpu) {
+    struct gdt_entry* table = (struct gdt_entry*)cpu->gdt;
+    for (int i = 0; i < 5; i++) {
+        table[i] = gdt[i];
+    }
+    
+    tss_init_cpu(&cpu->tss, (uint64_t)cpu->idle->kernel_stack + cpu->idle->kernel_stack_size);
+    gdt_write_tss(table, 5, (uint64_t)&cpu->tss, sizeof(tss_t) - 1);
+    
+    struct gdt_ptr ap_gp;
+    ap_gp.limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
+    ap_gp.base = (uintptr_t)table;
+    load_gdt((uintptr_t)&ap_gp);
+    asm volatile("ltr %0" : : "r"((uint16_t)0x28));
+}
+
 // Set up an IDT entry
 void idt_set_gate(uint8_t num, uintptr_t base, uint16_t sel, uint8_t flags) {
     idt[num].offset_low = base & 0xFFFF;
@@ -398,34 +1945,36 @@ void init_idt(void) {
     // Map hardware IRQs (32-47)
     idt_set_gate(32, (uintptr_t)irq0, 0x08, 0x8E);  // Timer
     idt_set_gate(33, (uintptr_t)irq1, 0x08, 0x8E);  // Keyboard
+    idt_set_gate(34, (uintptr_t)irq2, 0x08, 0x8E);
+    idt_set_gate(35, (uintptr_t)irq3, 0x08, 0x8E);
+    idt_set_gate(36, (uintptr_t)irq4, 0x08, 0x8E);
+    idt_set_gate(37, (uintptr_t)irq5, 0x08, 0x8E);
+    idt_set_gate(38, (uintptr_t)irq6, 0x08, 0x8E);
+    idt_set_gate(39, (uintptr_t)irq7, 0x08, 0x8E);
+    idt_set_gate(40, (uintptr_t)irq8, 0x08, 0x8E);
+    idt_set_gate(41, (uintptr_t)irq9, 0x08, 0x8E);
+    idt_set_gate(42, (uintptr_t)irq10, 0x08, 0x8E);
+    idt_set_gate(43, (uintptr_t)irq11, 0x08, 0x8E);
+    idt_set_gate(44, (uintptr_t)irq12, 0x08, 0x8E);
+    idt_set_gate(45, (uintptr_t)irq13, 0x08, 0x8E);
+    idt_set_gate(46, (uintptr_t)irq14, 0x08, 0x8E);
+    idt_set_gate(47, (uintptr_t)irq15, 0x08, 0x8E);
     
     // System call - Note: 0xEE instead of 0x8E to allow user mode access (DPL=3)
     idt_set_gate(128, (uintptr_t)isr128, 0x08, 0xEE); // INT 0x80
-
+    
+    // Local APIC timer and inter-processor interrupts
+    idt_set_gate(LAPIC_TIMER_VECTOR, (uintptr_t)lapic_timer, 0x08, 0x8E);
+    idt_set_gate(IPI_RESCHEDULE_VECTOR, (uintptr_t)ipi_reschedule, 0x08, 0x8E);
+    idt_set_gate(IPI_TLB_VECTOR, (uintptr_t)ipi_tlb, 0x08, 0x8E);
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, (uintptr_t)spurious, 0x08, 0x8E);
+    
     load_idt((uintptr_t)&ip);
 }
 
-// Initialize the 8259 PIC
-void init_pic(void) {
-    // ICW1 - Initialize PICs
-    outb(0x20, 0x11);  // Master PIC command port
-    outb(0xA0, 0x11);  // Slave PIC command port
-    
-    // ICW2 - Set interrupt vector offset
-    outb(0x21, 0x20);  // Master PIC vector offset (32)
-    outb(0xA1, 0x28);  // Slave PIC vector offset (40)
-    
-    // ICW3 - Set up cascade
-    outb(0x21, 0x04);  // Tell master PIC there's slave at IRQ2
-    outb(0xA1, 0x02);  // Tell slave PIC its cascade identity
-    
-    // ICW4 - Set mode
-    outb(0x21, 0x01);  // 8086 mode
-    outb(0xA1, 0x01);
-    
-    // OCW1 - Mask interrupts (enable timer and keyboard)
-    outb(0x21, 0xFC);  // Master PIC: Enable IRQ0 (timer) and IRQ1 (keyboard)
-    outb(0xA1, 0xFF);  // Slave PIC: Disable all
+// The IDT is shared; application processors just load it
+void init_idt_ap(void) {
+    load_idt((uintptr_t)&ip);
 }
 
 // Set up paging for 64-bit long mode
@@ -442,46 +1991,54 @@ void init_paging(void) {
 
 // ISR handler
 void isr_handler(registers_t* regs) {
-    // Handle CPU exceptions (0-31)
-    if (regs->int_no < 32) {
-        exception_handler(regs);
+    irq_dispatch(regs);
+    
+    // An interrupt that arrived during softirqs leaves them, and the
+    // preemption check, to the interrupt they interrupted
+    if (in_softirq()) {
         return;
     }
+    do_softirq(regs);
     
-    // Handle other interrupts
-    if (interrupt_handlers[regs->int_no] != 0) {
-        isr_t handler = interrupt_handlers[regs->int_no];
-        handler(regs);
-    } else {
-        terminal_writestring("Unhandled interrupt: ");
-        // TODO: Print interrupt number
-        terminal_writestring("\n");
-    }
+    // Returning from an interrupt or syscall is a preemption point
+    scheduler_resched();
 }
 
 // Kernel main function
-void kernel_main(void) {
+void kernel_main(uint32_t multiboot_magic, uint64_t multiboot_info) {
+    // Per-CPU data first: locks and the current process pointer use it
+    smp_early_init();
+    
     // Initialize core systems
     init_vga();
     terminal_writestring("SimpleOS v0.2 - Now with Multitasking!\n");
     terminal_writestring("=====================================\n\n");
     
+    multiboot_init(multiboot_magic, multiboot_info);
+    
     // Initialize physical memory manager
     // For now, assume we have 64MB of physical memory starting at 2MB
     // This is a simple assumption - real OS would get this from multiboot
     pmm_init(64 * 1024 * 1024);  // 64MB
+    swap_init();
+    cma_init();
+    vdso_init();        // Before the first user address space
     
     init_gdt();
     tss_init();  // Initialize TSS before loading GDT with TSS
-    init_pic();
+    irq_init();
     init_idt();
     init_exceptions();  // Initialize exception handlers
+    fpu_init();         // SSE/AVX for user mode, switched lazily
     init_paging();
     init_timer(100);  // 100 Hz = 10ms ticks
     
     // Initialize process and scheduling
     process_init();
     scheduler_init();
+    smp_init();
+    clocksource_init();
+    timer_enable_nohz();
     
     init_keyboard();
     init_syscalls();  // Initialize system call interface
@@ -495,6 +2052,15 @@ void kernel_main(void) {
     // Enable interrupts
     asm volatile("sti");
     
+    // Background kernel threads
+    workqueue_init();
+    io_ring_init();
+    if (!kthread_create("reaper", process_reaper_thread, NULL, PRIO_BACKGROUND) ||
+        !kthread_create("ksmd", ksm_thread, NULL, PRIO_BACKGROUND) ||
+        !kthread_create("kzerod", pmm_zero_thread, NULL, PRIO_BACKGROUND)) {
+        panic("Failed to start kernel threads!");
+    }
+    
     // Create test processes
     process_t* p1 = process_create("TestProc1", test_process_1, 1);
     process_t* p2 = process_create("TestProc2", test_process_2, 1);
@@ -509,7 +2075,17 @@ void kernel_main(void) {
     terminal_writestring("You should see processes interleaving their output.\n");
     terminal_writestring("Commands: 'p' = process list, 's' = scheduler stats, 'f' = test page fault\n");
     terminal_writestring("          't' = test syscall, 'u' = test user mode, 'e' = test ELF loader\n");
-    terminal_writestring("          'F' = test fork/exec, 'S' = start shell\n\n");
+    terminal_writestring("          'F' = test fork/exec, 'S' = start shell\n");
+    terminal_writestring("          'z' = swap stress test, 'Z' = swap stats\n");
+    terminal_writestring("          'k' = KSM stats, 'K' = start/stop KSM\n");
+    terminal_writestring("          'c' = cache coloring benchmark, 'd' = CMA test\n");
+    terminal_writestring("          'r' = real-time wakeup latency test, 'm' = SMP scaling test\n");
+    terminal_writestring("          'i' = interrupt stats, 'w' = idle wakeup rate\n");
+    terminal_writestring("          'n' = process churn test, 'h' = threads and futex test\n");
+    terminal_writestring("          'j' = kernel thread cost, 'x' = lazy FPU test\n");
+    terminal_writestring("          'g' = system call entry benchmark, 'v' = vDSO benchmark\n");
+    terminal_writestring("          'o' = I/O ring test, 'l' = readv/writev and pread/pwrite test\n");
+    terminal_writestring("          'y' = system call trace and statistics, 'b' = sendfile/splice test\n\n");
     
     // Enable scheduler - this will switch to first process
     scheduler_enable();
@@ -556,11 +2132,71 @@ void kernel_main(void) {
             } else if (c == 'S') {
                 // Start shell via init
                 test_shell();
+            } else if (c == 'z') {
+                // Overcommit memory through compressed swap
+                process_create("SwapTest", test_swap_process, 1);
+            } else if (c == 'Z') {
+                swap_print_stats();
+            } else if (c == 'd') {
+                // Contiguous DMA allocation after fragmentation
+                process_create("CmaTest", test_cma_process, 1);
+            } else if (c == 'c') {
+                test_cache_coloring();
+            } else if (c == 'r') {
+                // Real-time wakeup latency with every CPU busy
+                process_create("LatencyTest", test_sched_latency_process, 1);
+            } else if (c == 'm') {
+                // Same work on one CPU, then spread over all of them
+                process_create("SmpTest", test_smp_scaling_process, 1);
+            } else if (c == 'i') {
+                irq_print_stats();
+                softirq_print_stats();
+                workqueue_print_stats();
+            } else if (c == 'w') {
+                // Measure how often idle CPUs wake up
+                process_create("IdleWakeups", test_idle_wakeups_process, 1);
+            } else if (c == 'n') {
+                // Create and reap thousands of short-lived processes
+                process_create("ChurnTest", test_process_churn_process, 1);
+            } else if (c == 'j') {
+                // Kernel threads versus full processes for kernel work
+                process_create("KthreadTest", test_kthread_process, 1);
+            } else if (c == 'x') {
+                // User processes keeping values in SSE registers
+                process_create("FpuTest", test_fpu_process, 1);
+            } else if (c == 'g') {
+                // INT 0x80 against SYSCALL for a null system call
+                process_create("SyscallBench", test_syscall_bench_process, 1);
+            } else if (c == 'v') {
+                // Time, PID and CPU queries without entering the kernel
+                process_create("VdsoTest", test_vdso_process, 1);
+            } else if (c == 'o') {
+                // Batched file and pipe I/O through a shared ring
+                process_create("RingTest", test_io_ring_process, 1);
+            } else if (c == 'l') {
+                // Scatter-gather and positioned file I/O
+                process_create("VecioTest", test_vecio_process, 1);
+            } else if (c == 'y') {
+                // strace-style trace of a small pipeline, then per-call timing
+                process_create("TraceTest", test_systrace_process, 1);
+            } else if (c == 'b') {
+                // File, pipe and console transfers without a user buffer
+                process_create("SpliceTest", test_splice_process, 1);
+            } else if (c == 'h') {
+                // Threads sharing an address space, futex-based mutex
+                process_create("ThreadTest", test_threads_process, 1);
+            } else if (c == 'k') {
+                ksm_print_stats();
+            } else if (c == 'K') {
+                // Toggle the samepage merging scanner
+                ksm_set_params(!ksm_is_running(), 0, KSM_SLEEP_MS);
+                ksm_print_stats();
             }
         }
         
-        // Halt CPU until next interrupt
-        asm volatile("hlt");
+        // Halt until the next interrupt; the reaper thread frees
+        // processes that exited
+        timer_idle();
     }
 }
 
@@ -6,6 +6,13 @@
 #include "../include/tss.h"
 #include "../include/vmm.h"
 #include "../include/pmm.h"
+#include "../include/futex.h"
+#include "../include/timer.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+#include "../include/fpu.h"
+#include "../include/vdso.h"
+#include "../include/systrace.h"
 
 // From syscall.c
 extern void init_process_fd_table(process_t* proc);
@@ -13,92 +20,256 @@ extern void init_process_fd_table(process_t* proc);
 // Assembly functions
 extern void context_switch(context_t* old_context, context_t* new_context);
 extern void process_entry_trampoline(void);
+extern void kthread_entry_trampoline(void);
 
-// Process table
-process_t* process_table[MAX_PROCESSES];
-static uint32_t next_pid = 1;
+// Process registry: every process is on the all-process list and in a
+// PID hash that doubles once it averages two processes per bucket. PIDs
+// come from a bitmap; the cursor only wraps back to reuse freed ones
+// after reaching PID_MAX, so a PID is not handed out again right away.
+#define PID_HASH_MIN 64
 
-// Scheduler queues
-static process_t* ready_queue_head = NULL;
-static process_t* ready_queue_tail = NULL;
-process_t* current_process = NULL;
+static process_t* pid_hash_initial[PID_HASH_MIN];
+static process_t** pid_hash = pid_hash_initial;
+static uint32_t pid_hash_size = PID_HASH_MIN;
+static uint64_t pid_map[PID_MAX / 64];
+static uint32_t last_pid = 0;
+static process_t* process_list;       // All processes, idle first
+static process_t* process_list_tail;
+static uint32_t nr_processes = 0;
+static uint32_t next_page_color = 0;  // Staggers processes' color cursors
+static spinlock_t process_table_lock = SPINLOCK_INIT;
 
-// Idle process
+// Processes that have left their CPU for good, waiting to be freed by
+// the reaper thread
+static process_t* dead_list;
+static spinlock_t dead_lock = SPINLOCK_INIT;
+static wait_queue_t reaper_wait = WAIT_QUEUE_INIT;
+
+// Idle process, and the kernel's address space: the idle processes and
+// kernel threads share it. It has no page table, so switching to them
+// leaves the previous process's tables loaded (lazy TLB).
 static process_t idle_process;
+static mm_t kernel_mm = { .users = 1, .lock = SPINLOCK_INIT };
 static uint8_t idle_stack[KERNEL_STACK_SIZE] __attribute__((aligned(16)));
 
-// Helper: Add process to ready queue
-void ready_queue_push(process_t* proc) {
-    proc->next = NULL;
-    proc->prev = ready_queue_tail;
+static void process_timeout(void* data);
+
+// Idle process - runs when nothing else is ready
+static void idle_task(void) {
+    while (1) {
+        timer_idle();
+    }
+}
+
+// Take the next free PID after the last one handed out. Full bitmap
+// words are skipped whole. Returns 0 if every PID is in use.
+static uint32_t pid_alloc(void) {
+    uint32_t pid = last_pid;
+    
+    for (uint32_t scanned = 0; scanned < PID_MAX; scanned++) {
+        pid = (pid + 1) % PID_MAX;
+        if (pid % 64 == 0 && pid_map[pid / 64] == ~0ULL) {
+            pid += 63;
+            scanned += 63;
+            continue;
+        }
+        if (!(pid_map[pid / 64] & (1ULL << (pid % 64)))) {
+            pid_map[pid / 64] |= 1ULL << (pid % 64);
+            last_pid = pid;
+            return pid;
+        }
+    }
+    return 0;
+}
+
+static void pid_free(uint32_t pid) {
+    pid_map[pid / 64] &= ~(1ULL << (pid % 64));
+}
+
+// Link a process into its PID hash bucket (lock held)
+static void pid_hash_add(process_t* proc) {
+    uint32_t bucket = proc->pid & (pid_hash_size - 1);
+    proc->pid_next = pid_hash[bucket];
+    pid_hash[bucket] = proc;
+}
+
+static void pid_hash_del(process_t* proc) {
+    process_t** link = &pid_hash[proc->pid & (pid_hash_size - 1)];
+    while (*link && *link != proc) {
+        link = &(*link)->pid_next;
+    }
+    if (*link) {
+        *link = proc->pid_next;
+    }
+    proc->pid_next = NULL;
+}
+
+// Double the PID hash. The new table is allocated without the lock
+// held; if that fails the chains just get longer.
+static void pid_hash_grow(void) {
+    uint32_t size = pid_hash_size * 2;
+    process_t** table = (process_t**)kzalloc(size * sizeof(process_t*));
+    if (!table) {
+        return;
+    }
     
-    if (ready_queue_tail) {
-        ready_queue_tail->next = proc;
-    } else {
-        ready_queue_head = proc;
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    if (pid_hash_size * 2 != size) {
+        // Someone else grew it first
+        spin_unlock_irqrestore(&process_table_lock, flags);
+        kfree(table);
+        return;
+    }
+    
+    process_t** old = pid_hash;
+    pid_hash = table;
+    pid_hash_size = size;
+    for (process_t* p = process_list; p; p = p->tasks_next) {
+        pid_hash_add(p);
+    }
+    spin_unlock_irqrestore(&process_table_lock, flags);
+    
+    if (old != pid_hash_initial) {
+        kfree(old);
     }
-    ready_queue_tail = proc;
 }
 
-// Helper: Remove process from ready queue
-static void ready_queue_remove(process_t* proc) {
-    if (proc->prev) {
-        proc->prev->next = proc->next;
-    } else {
-        ready_queue_head = proc->next;
+// Wake a parent that may be sleeping in wait() for this process (lock
+// held)
+static void process_wake_parent_locked(process_t* proc) {
+    if (proc->parent) {
+        wake_up_all(&proc->parent->child_exit);
+    }
+}
+
+// Detach a process from its parent's children list (lock held). A
+// parent in wait() may have just run out of children.
+static void process_unlink_child(process_t* proc) {
+    if (!proc->parent) {
+        return;
     }
     
-    if (proc->next) {
-        proc->next->prev = proc->prev;
+    process_wake_parent_locked(proc);
+    if (proc->sibling_prev) {
+        proc->sibling_prev->sibling_next = proc->sibling_next;
     } else {
-        ready_queue_tail = proc->prev;
+        proc->parent->children = proc->sibling_next;
+    }
+    if (proc->sibling_next) {
+        proc->sibling_next->sibling_prev = proc->sibling_prev;
+    }
+    proc->parent = NULL;
+    proc->sibling_next = NULL;
+    proc->sibling_prev = NULL;
+}
+
+// Nobody will wait for these children any more: zombies are freed now
+// and the rest clean up after themselves when they exit (lock held)
+static void process_orphan_children_locked(process_t* parent) {
+    process_t* child = parent->children;
+    parent->children = NULL;
+    
+    while (child) {
+        process_t* next = child->sibling_next;
+        child->parent = NULL;
+        child->parent_pid = 0;
+        child->sibling_next = NULL;
+        child->sibling_prev = NULL;
+        if (child->state == PROCESS_STATE_ZOMBIE) {
+            process_queue_dead(child);
+        }
+        child = next;
+    }
+}
+
+// Give a new process a PID and add it to the registry
+static int process_table_insert(process_t* proc) {
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    
+    uint32_t pid = pid_alloc();
+    if (!pid) {
+        spin_unlock_irqrestore(&process_table_lock, flags);
+        return -1;
     }
+    proc->pid = pid;
+    proc->tgid = pid;
+    proc->page_color = next_page_color++;
+    proc->refs = 1;                     // The registry's
+    pid_hash_add(proc);
     
-    proc->next = NULL;
-    proc->prev = NULL;
+    proc->tasks_next = NULL;
+    proc->tasks_prev = process_list_tail;
+    process_list_tail->tasks_next = proc;
+    process_list_tail = proc;
+    
+    bool grow = ++nr_processes > pid_hash_size * 2;
+    spin_unlock_irqrestore(&process_table_lock, flags);
+    
+    if (grow) {
+        pid_hash_grow();
+    }
+    return 0;
 }
 
-// Helper: Get next ready process
-process_t* ready_queue_pop(void) {
-    process_t* proc = ready_queue_head;
-    if (proc) {
-        ready_queue_remove(proc);
+// Drop a process from the registry and release its PID
+static void process_table_remove(process_t* proc) {
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    
+    pid_hash_del(proc);
+    if (proc->tasks_prev) {
+        proc->tasks_prev->tasks_next = proc->tasks_next;
     }
-    return proc;
+    if (proc->tasks_next) {
+        proc->tasks_next->tasks_prev = proc->tasks_prev;
+    } else {
+        process_list_tail = proc->tasks_prev;
+    }
+    
+    process_unlink_child(proc);
+    process_orphan_children_locked(proc);
+    pid_free(proc->pid);
+    nr_processes--;
+    
+    spin_unlock_irqrestore(&process_table_lock, flags);
 }
 
-// Idle process - runs when nothing else is ready
-static void idle_task(void) {
-    while (1) {
-        asm volatile("hlt");
+// Wait until a process's last context switch away from it has finished,
+// so its kernel stack is no longer in use on another CPU
+static void process_wait_off_cpu(process_t* proc) {
+    while (proc->on_cpu) {
+        cpu_relax();
     }
 }
 
 // Initialize process management
 void process_init(void) {
-    // Clear process table
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_table[i] = NULL;
-    }
-    
     // Initialize idle process
     idle_process.pid = 0;
     strcpy(idle_process.name, "idle");
     idle_process.state = PROCESS_STATE_READY;
     idle_process.kernel_stack = idle_stack;
     idle_process.kernel_stack_size = KERNEL_STACK_SIZE;
-    idle_process.priority = 255;  // Lowest priority
-    idle_process.ticks_total = 0;
+    idle_process.priority = PRIO_IDLE;  // Lowest level, never queued
+    idle_process.sum_exec_runtime = 0;
     idle_process.ticks_remaining = 1;
     idle_process.entry_point = idle_task;
+    idle_process.mm = &kernel_mm;
     
     // Set up idle process context
     idle_process.context.rsp = (uint64_t)(idle_stack + KERNEL_STACK_SIZE);
     idle_process.context.rip = (uint64_t)idle_task;
     idle_process.context.rflags = 0x202;  // Interrupts enabled
     
-    // Idle process is always in table[0]
-    process_table[0] = &idle_process;
+    // Idle process heads the process list and owns PID 0; it is the
+    // boot CPU's idle
+    pid_map[0] = 1;
+    pid_hash_add(&idle_process);
+    process_list = &idle_process;
+    process_list_tail = &idle_process;
+    nr_processes = 1;
+    idle_process.on_cpu = true;
+    this_cpu()->idle = &idle_process;
+    this_cpu()->current = &idle_process;
     
     // Initialize idle process fd table
     init_process_fd_table(&idle_process);
@@ -106,22 +277,30 @@ void process_init(void) {
     terminal_writestring("Process management initialized\n");
 }
 
-// Create a new process
-process_t* process_create(const char* name, void (*entry_point)(void), uint32_t priority) {
-    // Find free slot
-    int slot = -1;
-    for (int i = 1; i < MAX_PROCESSES; i++) {
-        if (process_table[i] == NULL) {
-            slot = i;
-            break;
-        }
-    }
-    
-    if (slot == -1) {
-        terminal_writestring("Error: Process table full\n");
+// Create the idle process for an application processor. It runs on the
+// CPU's boot stack, shares the kernel mm and is never queued or
+// entered in the process table.
+process_t* process_create_idle(uint32_t cpu, void* stack, size_t stack_size) {
+    process_t* idle = (process_t*)kzalloc(sizeof(process_t));
+    if (!idle) {
         return NULL;
     }
     
+    idle->pid = 0;
+    strcpy(idle->name, "idle");
+    idle->state = PROCESS_STATE_RUNNING;
+    idle->kernel_stack = stack;
+    idle->kernel_stack_size = stack_size;
+    idle->priority = PRIO_IDLE;
+    idle->ticks_remaining = 1;
+    idle->cpu = cpu;
+    idle->on_cpu = true;
+    idle->mm = mm_get(&kernel_mm);
+    return idle;
+}
+
+// Create a new process
+process_t* process_create(const char* name, void (*entry_point)(void), uint32_t priority) {
     // Allocate PCB
     process_t* proc = (process_t*)kzalloc(sizeof(process_t));
     if (!proc) {
@@ -138,19 +317,24 @@ process_t* process_create(const char* name, void (*entry_point)(void), uint32_t
     }
     
     // Initialize PCB
-    proc->pid = next_pid++;
     strncpy(proc->name, name, 31);
     proc->name[31] = '\0';
     proc->state = PROCESS_STATE_READY;
     proc->kernel_stack_size = KERNEL_STACK_SIZE;
-    proc->priority = priority;
-    proc->ticks_total = 0;
-    proc->ticks_remaining = DEFAULT_QUANTUM;
+    proc->priority = priority < PRIO_IDLE ? priority : PRIO_IDLE - 1;
+    proc->sum_exec_runtime = 0;
+    proc->ticks_remaining = process_quantum(proc);
     proc->entry_point = entry_point;
+    timer_event_init(&proc->sleep_timer, process_timeout, proc);
+    wait_queue_init(&proc->child_exit);
     
     // Create separate address space for the process
-    proc->page_table = vmm_create_address_space();
-    if (!proc->page_table) {
+    proc->mm = mm_create();
+    if (proc->mm) {
+        proc->mm->page_table = vmm_create_address_space();
+    }
+    if (!proc->mm || !proc->mm->page_table) {
+        mm_put(proc->mm);
         kfree(proc->kernel_stack);
         kfree(proc);
         panic("process_create: Failed to create address space");
@@ -159,7 +343,7 @@ process_t* process_create(const char* name, void (*entry_point)(void), uint32_t
     
     // Set up user stack
     if (vmm_setup_user_stack(proc) < 0) {
-        vmm_destroy_address_space(proc->page_table);
+        mm_put(proc->mm);
         kfree(proc->kernel_stack);
         kfree(proc);
         panic("process_create: Failed to set up user stack");
@@ -168,15 +352,14 @@ process_t* process_create(const char* name, void (*entry_point)(void), uint32_t
     
     // Set up user heap
     if (vmm_setup_user_heap(proc) < 0) {
-        vmm_destroy_address_space(proc->page_table);
+        mm_put(proc->mm);
         kfree(proc->kernel_stack);
         kfree(proc);
         panic("process_create: Failed to set up user heap");
         return NULL;
     }
     
-    // Initialize memory statistics
-    proc->pages_allocated = 0;
+    // Memory statistics: pages_allocated already counts the user stack
     proc->page_faults = 0;
     
     // Set up initial context
@@ -198,7 +381,19 @@ process_t* process_create(const char* name, void (*entry_point)(void), uint32_t
     proc->context.rbp = 0;
     
     // Add to process table
-    process_table[slot] = proc;
+    if (process_table_insert(proc) < 0) {
+        mm_put(proc->mm);
+        kfree(proc->kernel_stack);
+        kfree(proc);
+        terminal_writestring("Error: Process table full\n");
+        return NULL;
+    }
+    
+    // Map the vDSO now that the process has its PID
+    if (vdso_map(proc) < 0) {
+        panic("process_create: Failed to map the vDSO");
+        return NULL;
+    }
     
     // Initialize file descriptor table
     init_process_fd_table(proc);
@@ -215,6 +410,33 @@ process_t* process_create(const char* name, void (*entry_point)(void), uint32_t
     return proc;
 }
 
+// Create a kernel thread running fn(arg). Unlike process_create() it
+// gets no address space, user stack or heap, only a kernel stack: it
+// runs in the kernel mm, and switching to it does not touch CR3.
+process_t* kthread_create(const char* name, void (*fn)(void*), void* arg, uint32_t priority) {
+    process_t* proc = allocate_process_struct(mm_get(&kernel_mm));
+    if (!proc) {
+        return NULL;
+    }
+    
+    strncpy(proc->name, name, 31);
+    proc->name[31] = '\0';
+    proc->priority = priority < PRIO_IDLE ? priority : PRIO_IDLE - 1;
+    proc->ticks_remaining = process_quantum(proc);
+    
+    // kthread_entry_trampoline finds the function in r12 and its
+    // argument in r13, which context_switch() restores
+    proc->context.rsp = (uint64_t)proc->kernel_stack + KERNEL_STACK_SIZE;
+    proc->context.rip = (uint64_t)kthread_entry_trampoline;
+    proc->context.rflags = 0x202;
+    proc->context.r12 = (uint64_t)fn;
+    proc->context.r13 = (uint64_t)arg;
+    
+    proc->state = PROCESS_STATE_READY;
+    ready_queue_push(proc);
+    return proc;
+}
+
 // Destroy a process
 void process_destroy(process_t* process) {
     if (!process || process == &idle_process) {
@@ -225,36 +447,53 @@ void process_destroy(process_t* process) {
     if (process->state == PROCESS_STATE_READY) {
         ready_queue_remove(process);
     }
+    sched_process_exit(process);
+    timer_del(&process->sleep_timer);
     
-    // Remove from process table
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i] == process) {
-            process_table[i] = NULL;
-            break;
-        }
-    }
+    process_table_remove(process);
+    process_wait_off_cpu(process);
     
-    // Free resources
+    // Whoever looked it up meanwhile still has it
+    process_put(process);
+}
+
+// Free what a process still holds once it is out of the registry and
+// off its CPU and the last reference has gone
+static void process_free(process_t* process) {
     if (process->kernel_stack) {
         kfree(process->kernel_stack);
     }
+    fpu_release(process);
+    systrace_release(process);
     
-    // Free file descriptor table
-    if (process->fd_table) {
-        kfree(process->fd_table);
-    }
-    
-    // Free page table and address space
-    if (process->page_table) {
-        vmm_destroy_address_space(process->page_table);
-    }
+    // The address space and fd table go with the last thread using them
+    mm_put(process->mm);
     
     kfree(process);
 }
 
+// Take another reference to a process the caller already has
+process_t* process_get(process_t* proc) {
+    if (proc) {
+        __sync_fetch_and_add(&proc->refs, 1);
+    }
+    return proc;
+}
+
+// Drop a reference; the last one frees the process
+void process_put(process_t* proc) {
+    if (!proc || proc == &idle_process) {
+        return;
+    }
+    if (__sync_sub_and_fetch(&proc->refs, 1) == 0) {
+        process_free(proc);
+    }
+}
+
 // Get current process
 process_t* process_get_current(void) {
-    return current_process ? current_process : &idle_process;
+    process_t* current = current_process;
+    return current ? current : &idle_process;
 }
 
 // Get current PID
@@ -278,7 +517,7 @@ process_state_t process_get_state(process_t* process) {
 void process_yield(void) {
     // Update TSS with current process's kernel stack
     process_t* current = process_get_current();
-    if (current && current != &idle_process) {
+    if (current && current->pid != 0) {
         tss_set_kernel_stack((uint64_t)current->kernel_stack + current->kernel_stack_size);
     }
     
@@ -288,33 +527,94 @@ void process_yield(void) {
 
 // Block current process
 void process_block(void) {
-    if (current_process && current_process != &idle_process) {
-        current_process->state = PROCESS_STATE_BLOCKED;
+    process_t* self = current_process;
+    if (self && self->pid != 0) {
+        self->state = PROCESS_STATE_BLOCKED;
         schedule();
     }
 }
 
-// Unblock a process
+// Unblock a process. The wake itself (and its interactivity boost) is
+// done by the scheduler, which settles races with other wakers.
 void process_unblock(process_t* process) {
-    if (process && process->state == PROCESS_STATE_BLOCKED) {
-        process->state = PROCESS_STATE_READY;
-        ready_queue_push(process);
+    if (process && try_to_wake_up(process, STATE_BIT(PROCESS_STATE_BLOCKED))) {
+        timer_del(&process->sleep_timer);
+    }
+}
+
+// Timer wheel callback: a sleep or block timeout expired
+static void process_timeout(void* data) {
+    process_t* process = (process_t*)data;
+    process->timed_out = true;
+    if (!try_to_wake_up(process, STATE_BIT(PROCESS_STATE_SLEEPING) |
+                                 STATE_BIT(PROCESS_STATE_BLOCKED))) {
+        process->timed_out = false;  // Someone else woke it first
+    }
+}
+
+// Sleep for a number of ticks. The process leaves the run queue entirely
+// until the timer wheel wakes it.
+void process_sleep(uint32_t ticks) {
+    process_t* self = current_process;
+    if (!self || self->pid == 0 || ticks == 0) {
+        return;
+    }
+    
+    asm volatile("cli");
+    self->timed_out = false;
+    self->state = PROCESS_STATE_SLEEPING;
+    timer_add_slack(&self->sleep_timer, timer_get_ticks() + ticks,
+                    ticks >> TIMER_SLACK_SHIFT);
+    schedule();
+}
+
+// Switch away for at most 'ticks' after the caller has already set its
+// state (wait queues do so before re-checking their condition). Returns
+// false if the timeout expired before a wakeup.
+bool process_schedule_timeout(uint32_t ticks) {
+    process_t* self = current_process;
+    if (!self || self->pid == 0) {
+        return false;
+    }
+    
+    self->timed_out = false;
+    timer_add(&self->sleep_timer, timer_get_ticks() + ticks);
+    schedule();
+    
+    timer_del(&self->sleep_timer);
+    return !self->timed_out;
+}
+
+// Block the current process for at most 'ticks'. Like process_block(),
+// the caller disables interrupts before checking its wait condition.
+// Returns false if the timeout expired before process_unblock().
+bool process_block_timeout(uint32_t ticks) {
+    process_t* self = current_process;
+    if (!self || self->pid == 0) {
+        return false;
     }
+    
+    self->state = PROCESS_STATE_BLOCKED;
+    return process_schedule_timeout(ticks);
 }
 
 // Exit current process
 void process_exit(int status) {
     (void)status;  // TODO: Handle exit status
     
-    if (current_process && current_process != &idle_process) {
+    process_t* self = current_process;
+    if (self && self->pid != 0) {
         terminal_writestring("Process exiting: ");
-        terminal_writestring(current_process->name);
+        terminal_writestring(self->name);
         terminal_writestring("\n");
         
-        current_process->state = PROCESS_STATE_TERMINATED;
+        futex_exit(self);
+        process_orphan_children(self);
+        self->state = PROCESS_STATE_TERMINATED;
+        process_wake_parent(self);
         
-        // Clean up will happen later
-        // For now, just schedule next process
+        // schedule_tail() queues us for process_reap() once we're off
+        // the CPU
         schedule();
         
         // Should never return
@@ -322,20 +622,83 @@ void process_exit(int status) {
     }
 }
 
+// Iterate over live processes: pass NULL to get the first one. 'prev'
+// must still be in the registry; code that can't guarantee that (it
+// may sleep, or runs beside the reaper) walks by PID with
+// process_next_mm() instead.
+process_t* process_next(process_t* prev) {
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    process_t* next = prev ? prev->tasks_next : process_list;
+    spin_unlock_irqrestore(&process_table_lock, flags);
+    return next;
+}
+
+// First process from 'proc' on with a user address space, pinned for
+// the caller (lock held). A registered process holds a reference to its
+// mm, so taking another here is safe.
+static mm_t* process_pin_mm_locked(process_t* proc, uint32_t* pid) {
+    for (; proc; proc = proc->tasks_next) {
+        if (proc->mm && proc->mm->page_table) {
+            *pid = proc->pid;
+            return mm_get(proc->mm);
+        }
+    }
+    return NULL;
+}
+
+// The address space of live process 'pid', pinned with mm_get(). NULL if
+// the process is gone or kernel-only.
+mm_t* process_get_mm(uint32_t pid) {
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    process_t* proc = pid_hash[pid & (pid_hash_size - 1)];
+    while (proc && proc->pid != pid) {
+        proc = proc->pid_next;
+    }
+    
+    mm_t* mm = NULL;
+    if (proc && proc->mm && proc->mm->page_table) {
+        mm = mm_get(proc->mm);
+    }
+    spin_unlock_irqrestore(&process_table_lock, flags);
+    return mm;
+}
+
+// Step a scan over user address spaces: the pinned mm of the first
+// process after 'pid' in the registry (the first of all for 0), whose
+// PID goes in *next. NULL at the end, or if 'pid' has gone meanwhile.
+// Release the result with mm_put_async() or mm_put().
+mm_t* process_next_mm(uint32_t pid, uint32_t* next) {
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    process_t* proc = process_list;
+    if (pid) {
+        proc = pid_hash[pid & (pid_hash_size - 1)];
+        while (proc && proc->pid != pid) {
+            proc = proc->pid_next;
+        }
+        proc = proc ? proc->tasks_next : NULL;
+    }
+    
+    mm_t* mm = process_pin_mm_locked(proc, next);
+    spin_unlock_irqrestore(&process_table_lock, flags);
+    return mm;
+}
+
+// Number of processes in the registry, idle included
+uint32_t process_count(void) {
+    return nr_processes;
+}
+
 // Print all processes (for debugging)
 void process_print_all(void) {
     terminal_writestring("\nProcess List:\n");
     terminal_writestring("PID  Name                     State      Ticks\n");
     terminal_writestring("---  ----------------------  ---------  ------\n");
     
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_t* proc = process_table[i];
-        if (proc) {
-            // TODO: Implement proper printing with formatting
-            terminal_writestring("  ");
-            terminal_writestring(proc->name);
-            terminal_writestring("\n");
-        }
+    for (process_t* proc = process_next(NULL); proc; proc = process_next(proc)) {
+        // TODO: Implement proper printing with formatting
+        terminal_writestring("  ");
+        terminal_writestring(proc->name);
+        terminal_writestring("\n");
     }
 }
 
@@ -359,41 +722,42 @@ static void strncpy(char* dest, const char* src, size_t n) {
 
 // Helper functions for fork/exec
 
-// Allocate a new process structure
-process_t* allocate_process_struct(void) {
-    // Find free slot
-    int slot = -1;
-    for (int i = 1; i < MAX_PROCESSES; i++) {
-        if (process_table[i] == NULL) {
-            slot = i;
-            break;
-        }
-    }
-    
-    if (slot == -1) {
-        return NULL;  // No free slots
-    }
-    
+// Allocate a new process structure. It takes over the caller's reference
+// to 'mm' (a thread); with NULL it gets a fresh mm with an empty fd table
+// and no page table yet (fork).
+process_t* allocate_process_struct(mm_t* mm) {
     // Allocate PCB
     process_t* proc = (process_t*)kzalloc(sizeof(process_t));
     if (!proc) {
+        mm_put(mm);
         return NULL;
     }
     
     // Allocate kernel stack
     proc->kernel_stack = kmalloc(KERNEL_STACK_SIZE);
-    if (!proc->kernel_stack) {
+    proc->mm = mm ? mm : mm_create();
+    if (!proc->kernel_stack || !proc->mm) {
+        kfree(proc->kernel_stack);
+        mm_put(proc->mm);
         kfree(proc);
         return NULL;
     }
     
     // Assign PID and add to table
-    proc->pid = next_pid++;
+    if (process_table_insert(proc) < 0) {
+        kfree(proc->kernel_stack);
+        mm_put(proc->mm);
+        kfree(proc);
+        return NULL;  // Out of PIDs
+    }
     proc->kernel_stack_size = KERNEL_STACK_SIZE;
-    process_table[slot] = proc;
+    timer_event_init(&proc->sleep_timer, process_timeout, proc);
+    wait_queue_init(&proc->child_exit);
     
     // Initialize file descriptor table
-    init_process_fd_table(proc);
+    if (!mm) {
+        init_process_fd_table(proc);
+    }
     
     return proc;
 }
@@ -402,34 +766,123 @@ process_t* allocate_process_struct(void) {
 void free_process_struct(process_t* process) {
     if (!process) return;
     
-    // Remove from process table
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i] == process) {
-            process_table[i] = NULL;
-            break;
-        }
-    }
+    process_table_remove(process);
+    sched_process_exit(process);
+    timer_del(&process->sleep_timer);
+    process_wait_off_cpu(process);
     
-    // Free resources
-    if (process->kernel_stack) {
-        kfree(process->kernel_stack);
+    process_put(process);
+}
+
+// Look up a live process by PID. The result is pinned, since the reaper
+// may free the process at any time; release it with process_put().
+process_t* process_find_by_pid(uint32_t pid) {
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    process_t* proc = pid_hash[pid & (pid_hash_size - 1)];
+    while (proc && proc->pid != pid) {
+        proc = proc->pid_next;
+    }
+    process_get(proc);
+    spin_unlock_irqrestore(&process_table_lock, flags);
+    return proc;
+}
+
+// Check whether a process has any children, running or exited
+bool process_has_children(process_t* parent) {
+    return parent->children != NULL;
+}
+
+// Find a zombie child process
+process_t* find_zombie_child(process_t* parent) {
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    process_t* child = parent->children;
+    while (child && child->state != PROCESS_STATE_ZOMBIE) {
+        child = child->sibling_next;
+    }
+    spin_unlock_irqrestore(&process_table_lock, flags);
+    return child;
+}
+
+// Make a new process the child of another (fork)
+void process_set_parent(process_t* child, process_t* parent) {
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    child->parent = parent;
+    child->parent_pid = parent->pid;
+    child->sibling_prev = NULL;
+    child->sibling_next = parent->children;
+    if (parent->children) {
+        parent->children->sibling_prev = child;
+    }
+    parent->children = child;
+    spin_unlock_irqrestore(&process_table_lock, flags);
+}
+
+// Tell the parent a child has exited, whichever way it went
+void process_wake_parent(process_t* proc) {
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    process_wake_parent_locked(proc);
+    spin_unlock_irqrestore(&process_table_lock, flags);
+}
+
+// Let go of a process's children when it exits
+void process_orphan_children(process_t* parent) {
+    uint64_t flags = spin_lock_irqsave(&process_table_lock);
+    process_orphan_children_locked(parent);
+    spin_unlock_irqrestore(&process_table_lock, flags);
+}
+
+// Hand a process that will never run again to process_reap(). Called
+// from schedule_tail() once an exited process is off its CPU, and for
+// zombies whose parent is gone.
+void process_queue_dead(process_t* process) {
+    uint64_t flags = spin_lock_irqsave(&dead_lock);
+    process->dead_next = dead_list;
+    dead_list = process;
+    spin_unlock_irqrestore(&dead_lock, flags);
+    
+    wake_up(&reaper_wait);
+}
+
+// Free every process queued by process_queue_dead(). Runs in process
+// context (the reaper thread, or a test that wants an exact count),
+// since destroying a process takes locks the scheduler may hold. The
+// teardown reaches shm and the other BKL-protected tables, so it runs
+// under the big kernel lock like the system calls that use them.
+void process_reap(void) {
+    if (!dead_list) {
+        return;
     }
     
-    if (process->page_table) {
-        vmm_destroy_address_space(process->page_table);
-    }
+    uint64_t flags = spin_lock_irqsave(&dead_lock);
+    process_t* proc = dead_list;
+    dead_list = NULL;
+    spin_unlock_irqrestore(&dead_lock, flags);
     
-    kfree(process);
+    lock_kernel();
+    while (proc) {
+        process_t* next = proc->dead_next;
+        process_destroy(proc);
+        proc = next;
+    }
+    unlock_kernel();
 }
 
-// Find a zombie child process
-process_t* find_zombie_child(uint32_t parent_pid) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_t* proc = process_table[i];
-        if (proc && proc->parent_pid == parent_pid && 
-            proc->state == PROCESS_STATE_ZOMBIE) {
-            return proc;
-        }
+// Address spaces also come here to be torn down (mm_put_async())
+void process_wake_reaper(void) {
+    wake_up(&reaper_wait);
+}
+
+// Body of the "reaper" kernel thread
+void process_reaper_thread(void* arg) {
+    (void)arg;
+    
+    while (1) {
+        wait_event(reaper_wait, dead_list != NULL || mm_reap_pending());
+        process_reap();
+        
+        // mm_destroy() detaches shm segments and the I/O ring
+        lock_kernel();
+        mm_reap();
+        unlock_kernel();
     }
-    return NULL;
 }
\ No newline at end of file
@@ -1,23 +1,855 @@
 #include "../include/process.h"
+#include "../include/scheduler.h"
 #include "../include/timer.h"
+#include "../include/clocksource.h"
 #include "../include/terminal.h"
 #include "../include/panic.h"
 #include "../include/vmm.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+#include "../include/fpu.h"
 
 // External assembly function
 extern void context_switch(context_t* old_context, context_t* new_context);
 
 // Scheduler state
 static bool scheduler_enabled = false;
-static uint64_t schedule_count = 0;
 
-// External references
-extern process_t* current_process;
-extern process_t* process_table[];
-process_t* ready_queue_pop(void);
-void ready_queue_push(process_t* proc);
+// Enqueue flags
+#define ENQUEUE_WAKEUP  0x1         // Newly runnable (created or woken)
+#define ENQUEUE_HEAD    0x2         // Preempted, keeps its place in line
 
-// Round-robin scheduler
+// Priority array: one FIFO per level and a bitmap of non-empty levels
+typedef struct prio_array {
+    uint32_t bitmap;                 // Bit n set if level n is non-empty
+    uint32_t count;
+    process_t* head[PRIO_LEVELS];
+    process_t* tail[PRIO_LEVELS];
+} prio_array_t;
+
+#define NUM_SCHED_CLASSES 3
+
+// Per-CPU run queue. Each class keeps its queued processes here; the
+// lock also covers the owning CPU's switch in progress (schedule() holds
+// it until schedule_tail() runs on the other side).
+typedef struct runqueue {
+    spinlock_t lock;
+    uint32_t cpu;
+    bool need_resched;              // A wakeup or the tick wants a switch
+    
+    prio_array_t fair_arrays[2];
+    prio_array_t* fair_active;
+    prio_array_t* fair_expired;
+    
+    prio_array_t rt_array;
+    
+    process_t* dl_head;             // Runnable, sorted by deadline
+    process_t* dl_throttled;        // Out of budget until next period
+    uint32_t dl_count;
+    
+    uint64_t schedule_count;
+    uint64_t steals;                // Processes pulled from other CPUs
+    uint64_t picks[NUM_SCHED_CLASSES];
+} runqueue_t;
+
+static runqueue_t runqueues[MAX_CPUS];
+
+#define this_rq()   (&runqueues[this_cpu()->id])
+#define task_rq(p)  (&runqueues[(p)->cpu])
+
+// A scheduling class owns the run queue for one group of policies.
+// Classes are consulted in order: deadline, real-time, then normal.
+typedef struct sched_class {
+    const char* name;
+    void (*enqueue)(runqueue_t* rq, process_t* proc, int flags);
+    void (*dequeue)(runqueue_t* rq, process_t* proc);
+    process_t* (*pick_next)(runqueue_t* rq);
+    bool (*has_ready)(runqueue_t* rq);
+    bool (*preempts)(runqueue_t* rq, process_t* curr);  // Queued task beats curr (same class)
+    bool (*task_tick)(runqueue_t* rq, process_t* curr); // True if curr must give up the CPU
+} sched_class_t;
+
+// Append (or prepend) a process to one level of a priority array
+static void prio_array_enqueue(prio_array_t* array, process_t* proc, uint32_t level, bool head) {
+    if (head && array->head[level]) {
+        proc->prev = NULL;
+        proc->next = array->head[level];
+        array->head[level]->prev = proc;
+        array->head[level] = proc;
+    } else {
+        proc->next = NULL;
+        proc->prev = array->tail[level];
+        if (array->tail[level]) {
+            array->tail[level]->next = proc;
+        } else {
+            array->head[level] = proc;
+        }
+        array->tail[level] = proc;
+    }
+    
+    array->bitmap |= 1U << level;
+    array->count++;
+    proc->rq_array = array;
+    proc->rq_level = level;
+    proc->on_rq = true;
+}
+
+// Unlink a process from the priority array holding it
+static void prio_array_dequeue(process_t* proc) {
+    prio_array_t* array = proc->rq_array;
+    if (!array) {
+        return;
+    }
+    
+    uint32_t level = proc->rq_level;
+    if (proc->prev) {
+        proc->prev->next = proc->next;
+    } else {
+        array->head[level] = proc->next;
+    }
+    
+    if (proc->next) {
+        proc->next->prev = proc->prev;
+    } else {
+        array->tail[level] = proc->prev;
+    }
+    
+    if (!array->head[level]) {
+        array->bitmap &= ~(1U << level);
+    }
+    array->count--;
+    
+    proc->next = NULL;
+    proc->prev = NULL;
+    proc->rq_array = NULL;
+    proc->on_rq = false;
+}
+
+// Dequeue hook shared by the array-based classes
+static void prio_class_dequeue(runqueue_t* rq, process_t* proc) {
+    (void)rq;
+    prio_array_dequeue(proc);
+}
+
+// Highest priority process in an array, still queued
+static process_t* prio_array_first(prio_array_t* array) {
+    return array->bitmap ? array->head[__builtin_ctz(array->bitmap)] : NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Normal class: O(1) active/expired arrays with interactivity boost.
+// Processes that use up their quantum move to the expired array; when the
+// active array drains the two are swapped.
+// ---------------------------------------------------------------------------
+
+// Effective level: static priority raised by the interactivity boost
+static uint32_t fair_level(process_t* proc) {
+    uint32_t prio = proc->priority < PRIO_IDLE ? proc->priority : PRIO_IDLE - 1;
+    return prio > proc->boost ? prio - proc->boost : 0;
+}
+
+// A preempted process goes back in front of its level with the rest of
+// its quantum; one whose quantum ran out was queued by fair_task_tick()
+static void fair_enqueue(runqueue_t* rq, process_t* proc, int flags) {
+    prio_array_enqueue(rq->fair_active, proc, fair_level(proc), flags & ENQUEUE_HEAD);
+}
+
+static process_t* fair_pick_next(runqueue_t* rq) {
+    if (!rq->fair_active->count && rq->fair_expired->count) {
+        prio_array_t* tmp = rq->fair_active;
+        rq->fair_active = rq->fair_expired;
+        rq->fair_expired = tmp;
+    }
+    
+    process_t* proc = prio_array_first(rq->fair_active);
+    if (proc) {
+        prio_array_dequeue(proc);
+    }
+    return proc;
+}
+
+static bool fair_has_ready(runqueue_t* rq) {
+    return rq->fair_active->count || rq->fair_expired->count;
+}
+
+static bool fair_preempts(runqueue_t* rq, process_t* curr) {
+    if (!rq->fair_active->bitmap) {
+        return false;
+    }
+    return (uint32_t)__builtin_ctz(rq->fair_active->bitmap) < fair_level(curr);
+}
+
+// Quantum expiry: the boost wears off and the process waits in the
+// expired array for everyone else to get their turn. Boosted (interactive)
+// processes stay in the active array so they keep beating CPU hogs.
+static bool fair_task_tick(runqueue_t* rq, process_t* curr) {
+    if (curr->ticks_remaining > 0) {
+        curr->ticks_remaining--;
+    }
+    if (curr->ticks_remaining > 0) {
+        return false;
+    }
+    
+    if (curr->boost > 0) {
+        curr->boost--;
+    }
+    curr->ticks_remaining = process_quantum(curr);
+    curr->state = PROCESS_STATE_READY;
+    prio_array_enqueue(curr->boost ? rq->fair_active : rq->fair_expired, curr, fair_level(curr), false);
+    return true;
+}
+
+static sched_class_t fair_sched_class = {
+    .name = "normal",
+    .enqueue = fair_enqueue,
+    .dequeue = prio_class_dequeue,
+    .pick_next = fair_pick_next,
+    .has_ready = fair_has_ready,
+    .preempts = fair_preempts,
+    .task_tick = fair_task_tick,
+};
+
+// ---------------------------------------------------------------------------
+// Real-time class: fixed priority levels that always beat normal processes.
+// SCHED_FIFO runs until it blocks; SCHED_RR rotates within its level.
+// ---------------------------------------------------------------------------
+
+static void rt_enqueue(runqueue_t* rq, process_t* proc, int flags) {
+    prio_array_enqueue(&rq->rt_array, proc, proc->rt_priority, flags & ENQUEUE_HEAD);
+}
+
+static process_t* rt_pick_next(runqueue_t* rq) {
+    process_t* proc = prio_array_first(&rq->rt_array);
+    if (proc) {
+        prio_array_dequeue(proc);
+    }
+    return proc;
+}
+
+static bool rt_has_ready(runqueue_t* rq) {
+    return rq->rt_array.count != 0;
+}
+
+static bool rt_preempts(runqueue_t* rq, process_t* curr) {
+    if (!rq->rt_array.bitmap) {
+        return false;
+    }
+    return (uint32_t)__builtin_ctz(rq->rt_array.bitmap) < curr->rt_priority;
+}
+
+// Round-robin slice expiry moves the process behind its peers
+static bool rt_task_tick(runqueue_t* rq, process_t* curr) {
+    if (curr->policy != SCHED_RR) {
+        return false;
+    }
+    if (curr->ticks_remaining > 0) {
+        curr->ticks_remaining--;
+    }
+    if (curr->ticks_remaining > 0) {
+        return false;
+    }
+    
+    curr->ticks_remaining = RR_QUANTUM;
+    if (!rq->rt_array.head[curr->rt_priority]) {
+        return false;  // Alone at its level, keep running
+    }
+    curr->state = PROCESS_STATE_READY;
+    prio_array_enqueue(&rq->rt_array, curr, curr->rt_priority, false);
+    return true;
+}
+
+static sched_class_t rt_sched_class = {
+    .name = "rt",
+    .enqueue = rt_enqueue,
+    .dequeue = prio_class_dequeue,
+    .pick_next = rt_pick_next,
+    .has_ready = rt_has_ready,
+    .preempts = rt_preempts,
+    .task_tick = rt_task_tick,
+};
+
+// ---------------------------------------------------------------------------
+// Deadline class: earliest deadline first. Each process gets dl_runtime
+// ticks every dl_period, enforced by a constant bandwidth server: when the
+// budget runs out the process is throttled until its next period, so an
+// overrunning task can't steal time admitted to the others. Deadline
+// processes stay on the CPU they were admitted on.
+// ---------------------------------------------------------------------------
+
+static spinlock_t dl_bw_lock = SPINLOCK_INIT;   // Nests inside run queue locks
+static uint64_t dl_total_bw = 0;         // Admitted bandwidth (DL_BW_UNIT = 1 CPU)
+static uint64_t dl_misses = 0;           // Deadlines passed with budget left
+
+// Bandwidth of a runtime/period pair in fixed point
+static uint64_t dl_bandwidth(uint64_t runtime, uint64_t period) {
+    return (runtime * DL_BW_UNIT) / period;
+}
+
+// Unlink from a doubly linked list headed by *head
+static void dl_list_remove(process_t** head, process_t* proc) {
+    if (proc->prev) {
+        proc->prev->next = proc->next;
+    } else {
+        *head = proc->next;
+    }
+    if (proc->next) {
+        proc->next->prev = proc->prev;
+    }
+    proc->next = NULL;
+    proc->prev = NULL;
+}
+
+// Insert into the EDF queue keeping it sorted by absolute deadline
+static void dl_insert(runqueue_t* rq, process_t* proc) {
+    process_t* prev = NULL;
+    process_t* pos = rq->dl_head;
+    while (pos && pos->dl_abs_deadline <= proc->dl_abs_deadline) {
+        prev = pos;
+        pos = pos->next;
+    }
+    
+    proc->prev = prev;
+    proc->next = pos;
+    if (pos) {
+        pos->prev = proc;
+    }
+    if (prev) {
+        prev->next = proc;
+    } else {
+        rq->dl_head = proc;
+    }
+}
+
+// Start a fresh period at 'now' with a full budget
+static void dl_replenish(process_t* proc, uint64_t now) {
+    proc->dl_period_start = now;
+    proc->dl_abs_deadline = now + proc->dl_deadline;
+    proc->dl_budget = proc->dl_runtime;
+}
+
+static void dl_enqueue(runqueue_t* rq, process_t* proc, int flags) {
+    rq->dl_count++;
+    if (proc->dl_throttled) {
+        proc->prev = NULL;
+        proc->next = rq->dl_throttled;
+        if (rq->dl_throttled) {
+            rq->dl_throttled->prev = proc;
+        }
+        rq->dl_throttled = proc;
+        proc->on_rq = true;
+        return;
+    }
+    
+    // CBS wakeup rule: keep the current deadline only if the leftover
+    // budget still fits the task's bandwidth before that deadline
+    if (flags & ENQUEUE_WAKEUP) {
+        uint64_t now = timer_get_ticks();
+        if (proc->dl_abs_deadline <= now ||
+            proc->dl_budget * proc->dl_deadline > (proc->dl_abs_deadline - now) * proc->dl_runtime) {
+            dl_replenish(proc, now);
+        }
+    }
+    
+    dl_insert(rq, proc);
+    proc->on_rq = true;
+}
+
+static void dl_dequeue(runqueue_t* rq, process_t* proc) {
+    if (!proc->on_rq) {
+        return;
+    }
+    dl_list_remove(proc->dl_throttled ? &rq->dl_throttled : &rq->dl_head, proc);
+    proc->on_rq = false;
+    rq->dl_count--;
+}
+
+static process_t* dl_pick_next(runqueue_t* rq) {
+    process_t* proc = rq->dl_head;
+    if (proc) {
+        dl_dequeue(rq, proc);
+    }
+    return proc;
+}
+
+static bool dl_has_ready(runqueue_t* rq) {
+    return rq->dl_head != NULL;
+}
+
+static bool dl_preempts(runqueue_t* rq, process_t* curr) {
+    return rq->dl_head && rq->dl_head->dl_abs_deadline < curr->dl_abs_deadline;
+}
+
+// Charge one tick of runtime; throttle when the budget is gone
+static bool dl_task_tick(runqueue_t* rq, process_t* curr) {
+    uint64_t now = timer_get_ticks();
+    
+    if (curr->dl_budget > 0) {
+        curr->dl_budget--;
+    }
+    if (now > curr->dl_abs_deadline && curr->dl_budget > 0) {
+        // Late with work left: count it and push the deadline back a period
+        __sync_fetch_and_add(&dl_misses, 1);
+        curr->dl_abs_deadline += curr->dl_period;
+    }
+    if (curr->dl_budget > 0) {
+        return false;
+    }
+    
+    curr->dl_throttled = true;
+    curr->state = PROCESS_STATE_READY;
+    dl_enqueue(rq, curr, 0);
+    return true;
+}
+
+// Move throttled processes whose next period has begun back to the EDF queue
+static void dl_update_throttled(runqueue_t* rq, uint64_t now) {
+    process_t* proc = rq->dl_throttled;
+    while (proc) {
+        process_t* next = proc->next;
+        if (now >= proc->dl_period_start + proc->dl_period) {
+            dl_list_remove(&rq->dl_throttled, proc);
+            proc->dl_throttled = false;
+            dl_replenish(proc, proc->dl_period_start + proc->dl_period);
+            if (proc->dl_abs_deadline <= now) {
+                dl_replenish(proc, now);  // Fell more than a period behind
+            }
+            dl_insert(rq, proc);
+        }
+        proc = next;
+    }
+}
+
+static sched_class_t dl_sched_class = {
+    .name = "deadline",
+    .enqueue = dl_enqueue,
+    .dequeue = dl_dequeue,
+    .pick_next = dl_pick_next,
+    .has_ready = dl_has_ready,
+    .preempts = dl_preempts,
+    .task_tick = dl_task_tick,
+};
+
+// Classes in priority order
+static sched_class_t* const sched_classes[NUM_SCHED_CLASSES] = {
+    &dl_sched_class,
+    &rt_sched_class,
+    &fair_sched_class,
+};
+
+// Class responsible for a process
+static sched_class_t* sched_class_of(process_t* proc) {
+    switch (proc->policy) {
+        case SCHED_DEADLINE:
+            return &dl_sched_class;
+        case SCHED_FIFO:
+        case SCHED_RR:
+            return &rt_sched_class;
+        default:
+            return &fair_sched_class;
+    }
+}
+
+// Time slice for a process: real-time round-robin uses a fixed slice,
+// normal processes get a longer quantum at higher priority
+uint32_t process_quantum(process_t* proc) {
+    if (proc->policy == SCHED_FIFO || proc->policy == SCHED_RR) {
+        return RR_QUANTUM;
+    }
+    uint32_t level = fair_level(proc);
+    return MAX_QUANTUM - level * (MAX_QUANTUM - MIN_QUANTUM) / (PRIO_IDLE - 1);
+}
+
+// Processes queued on a run queue, for load balancing
+static uint32_t rq_load(runqueue_t* rq) {
+    return rq->fair_arrays[0].count + rq->fair_arrays[1].count +
+           rq->rt_array.count + rq->dl_count;
+}
+
+// Lock the run queue a process belongs to. The process may be pulled to
+// another CPU while we wait, so check again once the lock is held.
+static runqueue_t* task_rq_lock(process_t* proc, uint64_t* flags) {
+    while (1) {
+        runqueue_t* rq = task_rq(proc);
+        *flags = spin_lock_irqsave(&rq->lock);
+        if (rq == task_rq(proc)) {
+            return rq;
+        }
+        spin_unlock_irqrestore(&rq->lock, *flags);
+    }
+}
+
+// Check whether a queued process outranks the one running on rq's CPU
+static bool rq_should_preempt(runqueue_t* rq, process_t* current) {
+    if (!current || current->pid == 0) {
+        for (size_t i = 0; i < NUM_SCHED_CLASSES; i++) {
+            if (sched_classes[i]->has_ready(rq)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    sched_class_t* own = sched_class_of(current);
+    for (size_t i = 0; i < NUM_SCHED_CLASSES; i++) {
+        if (sched_classes[i] == own) {
+            return own->preempts(rq, current);
+        }
+        if (sched_classes[i]->has_ready(rq)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Check whether a queued process outranks the one running on this CPU
+bool ready_queue_should_preempt(process_t* current) {
+    runqueue_t* rq = this_rq();
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    bool preempt = rq_should_preempt(rq, current);
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return preempt;
+}
+
+// Idle CPU other than 'except', or -1
+static int find_idle_cpu(uint32_t except) {
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        process_t* curr = cpus[i].current;
+        if (i != except && cpus[i].online && curr && curr->pid == 0 &&
+            rq_load(&runqueues[i]) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// After queueing on rq (locked): preempt its CPU if the new arrival wins,
+// otherwise nudge an idle CPU to come and steal it
+static void check_preempt(runqueue_t* rq) {
+    process_t* curr = cpus[rq->cpu].current;
+    if (rq_should_preempt(rq, curr)) {
+        rq->need_resched = true;
+        smp_send_reschedule(rq->cpu);
+        return;
+    }
+    
+    int idle = find_idle_cpu(rq->cpu);
+    if (idle >= 0) {
+        runqueues[idle].need_resched = true;
+        smp_send_reschedule(idle);
+    }
+}
+
+// Least loaded online CPU, for placing a new process
+static uint32_t sched_select_cpu(void) {
+    uint32_t best = this_cpu()->id;
+    uint32_t best_load = ~0U;
+    
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        if (!cpus[i].online) {
+            continue;
+        }
+        process_t* curr = cpus[i].current;
+        uint32_t load = rq_load(&runqueues[i]) + (curr && curr->pid != 0 ? 1 : 0);
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+// Make a newly created process runnable on the least loaded CPU. If it
+// outranks the process running there, the switch happens at the next
+// preemption point.
+void ready_queue_push(process_t* proc) {
+    proc->cpu = sched_select_cpu();
+    
+    runqueue_t* rq = task_rq(proc);
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    sched_class_of(proc)->enqueue(rq, proc, ENQUEUE_WAKEUP);
+    check_preempt(rq);
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// Wake a process if its state is in 'states'. Waking from a sleep or I/O
+// wait earns an interactivity boost, which CPU-bound quanta wear off
+// again. A process that has not finished switching out (it set its
+// state and is on its way into schedule()) simply keeps running.
+// Returns false if the process was not in one of those states.
+bool try_to_wake_up(process_t* proc, uint32_t states) {
+    uint64_t flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    
+    if (!(states & STATE_BIT(proc->state))) {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return false;
+    }
+    
+    if (proc->on_cpu && !proc->on_rq) {
+        proc->state = PROCESS_STATE_RUNNING;
+    } else {
+        proc->state = PROCESS_STATE_READY;
+        if (proc->boost < PRIO_BOOST_MAX) {
+            proc->boost++;
+        }
+        sched_class_of(proc)->enqueue(rq, proc, ENQUEUE_WAKEUP);
+        check_preempt(rq);
+    }
+    
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return true;
+}
+
+// Take a process off its run queue
+void ready_queue_remove(process_t* proc) {
+    uint64_t flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    if (proc->on_rq) {
+        sched_class_of(proc)->dequeue(rq, proc);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// Highest priority ready process from the first non-empty class
+static process_t* pick_next_task(runqueue_t* rq) {
+    for (size_t i = 0; i < NUM_SCHED_CLASSES; i++) {
+        process_t* proc = sched_classes[i]->pick_next(rq);
+        if (proc) {
+            rq->picks[i]++;
+            return proc;
+        }
+    }
+    return NULL;
+}
+
+// Get the highest priority ready process on this CPU
+process_t* ready_queue_pop(void) {
+    runqueue_t* rq = this_rq();
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    process_t* proc = pick_next_task(rq);
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return proc;
+}
+
+// First process in an array that is fully switched out
+static process_t* steal_from_array(prio_array_t* array) {
+    uint32_t bitmap = array->bitmap;
+    while (bitmap) {
+        uint32_t level = __builtin_ctz(bitmap);
+        for (process_t* proc = array->head[level]; proc; proc = proc->next) {
+            if (!proc->on_cpu) {
+                return proc;
+            }
+        }
+        bitmap &= bitmap - 1;
+    }
+    return NULL;
+}
+
+// Work stealing: an idle CPU pulls a waiting process off the busiest
+// run queue. Real-time processes go first, then normal ones (expired
+// before active: they have been off the CPU longest and have the
+// coldest caches); deadline processes stay where they were admitted. The remote lock is
+// only tried, so two CPUs stealing from each other can't deadlock.
+static process_t* steal_task(runqueue_t* rq) {
+    runqueue_t* busiest = NULL;
+    uint32_t max_load = 0;
+    
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        uint32_t load = rq_load(&runqueues[i]);
+        if (i != rq->cpu && load > max_load) {
+            busiest = &runqueues[i];
+            max_load = load;
+        }
+    }
+    if (!busiest || !spin_trylock(&busiest->lock)) {
+        return NULL;
+    }
+    
+    process_t* proc = steal_from_array(&busiest->rt_array);
+    if (!proc) {
+        proc = steal_from_array(busiest->fair_expired);
+    }
+    if (!proc) {
+        proc = steal_from_array(busiest->fair_active);
+    }
+    if (proc) {
+        prio_array_dequeue(proc);
+        proc->cpu = rq->cpu;
+        rq->steals++;
+        rq->picks[proc->policy == SCHED_NORMAL ? 2 : 1]++;
+    }
+    
+    spin_unlock(&busiest->lock);
+    return proc;
+}
+
+// True if another CPU has processes waiting that an idle CPU could take
+static bool other_rq_has_work(runqueue_t* rq) {
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        if (i != rq->cpu && runqueues[i].fair_arrays[0].count +
+            runqueues[i].fair_arrays[1].count + runqueues[i].rt_array.count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Give back a process's deadline bandwidth (dl_bw_lock held)
+static void dl_release_bw(process_t* proc) {
+    if (proc->policy == SCHED_DEADLINE) {
+        dl_total_bw -= dl_bandwidth(proc->dl_runtime, proc->dl_period);
+        proc->policy = SCHED_NORMAL;
+    }
+}
+
+// Give back a dying process's deadline bandwidth
+void sched_process_exit(process_t* proc) {
+    if (proc->policy != SCHED_DEADLINE) {
+        return;
+    }
+    
+    uint64_t flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    dl_dequeue(rq, proc);
+    spin_lock(&dl_bw_lock);
+    dl_release_bw(proc);
+    spin_unlock(&dl_bw_lock);
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// Change a process's scheduling class and parameters. Deadline requests
+// are admitted only while the total deadline bandwidth stays under
+// DL_BW_LIMIT, so every admitted task can meet its deadlines. The limit
+// is one CPU's worth for the whole system, which is conservative now
+// that each deadline process runs wherever it was admitted.
+int sched_setattr(process_t* proc, const sched_attr_t* attr) {
+    if (!proc || !attr || proc->pid == 0 ||
+        proc->state == PROCESS_STATE_ZOMBIE || proc->state == PROCESS_STATE_TERMINATED) {
+        return -1;
+    }
+    
+    uint64_t runtime = 0, deadline = 0, period = 0;
+    switch (attr->policy) {
+        case SCHED_NORMAL:
+            if (attr->priority >= PRIO_IDLE) return -1;
+            break;
+        case SCHED_FIFO:
+        case SCHED_RR:
+            if (attr->priority >= RT_PRIO_LEVELS) return -1;
+            break;
+        case SCHED_DEADLINE:
+            runtime = timer_ms_to_ticks(attr->runtime_ms);
+            deadline = timer_ms_to_ticks(attr->deadline_ms);
+            period = attr->period_ms ? timer_ms_to_ticks(attr->period_ms) : deadline;
+            if (runtime == 0 || runtime > deadline || deadline > period) return -1;
+            break;
+        default:
+            return -1;
+    }
+    
+    uint64_t flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    
+    // Admission control against the bandwidth already handed out
+    spin_lock(&dl_bw_lock);
+    uint64_t old_bw = 0;
+    if (proc->policy == SCHED_DEADLINE) {
+        old_bw = dl_bandwidth(proc->dl_runtime, proc->dl_period);
+    }
+    uint64_t new_bw = period ? dl_bandwidth(runtime, period) : 0;
+    if (dl_total_bw - old_bw + new_bw > DL_BW_LIMIT) {
+        spin_unlock(&dl_bw_lock);
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return -1;
+    }
+    dl_total_bw = dl_total_bw - old_bw + new_bw;
+    spin_unlock(&dl_bw_lock);
+    
+    bool queued = proc->on_rq;
+    if (queued) {
+        sched_class_of(proc)->dequeue(rq, proc);
+    }
+    
+    proc->policy = attr->policy;
+    proc->dl_throttled = false;
+    switch (attr->policy) {
+        case SCHED_NORMAL:
+            proc->priority = attr->priority;
+            break;
+        case SCHED_FIFO:
+        case SCHED_RR:
+            proc->rt_priority = attr->priority;
+            break;
+        case SCHED_DEADLINE:
+            proc->dl_runtime = runtime;
+            proc->dl_deadline = deadline;
+            proc->dl_period = period;
+            proc->dl_throttled = false;
+            dl_replenish(proc, timer_get_ticks());
+            break;
+    }
+    proc->ticks_remaining = process_quantum(proc);
+    
+    if (queued) {
+        sched_class_of(proc)->enqueue(rq, proc, 0);
+    }
+    
+    // The running process may have just lowered itself below a waiter
+    if (rq_should_preempt(rq, cpus[rq->cpu].current)) {
+        rq->need_resched = true;
+        smp_send_reschedule(rq->cpu);
+    }
+    
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return 0;
+}
+
+// Read back a process's scheduling class and parameters
+int sched_getattr(process_t* proc, sched_attr_t* attr) {
+    if (!proc || !attr) {
+        return -1;
+    }
+    
+    uint32_t ms_per_tick = 1000 / timer_get_frequency();
+    attr->policy = proc->policy;
+    attr->priority = (proc->policy == SCHED_FIFO || proc->policy == SCHED_RR)
+                   ? proc->rt_priority : proc->priority;
+    attr->runtime_ms = proc->dl_runtime * ms_per_tick;
+    attr->deadline_ms = proc->dl_deadline * ms_per_tick;
+    attr->period_ms = proc->dl_period * ms_per_tick;
+    return 0;
+}
+
+// Charge the running process for CPU time since it was last charged
+static void update_curr(process_t* curr) {
+    uint64_t now = ktime_get_ns();
+    curr->sum_exec_runtime += now - curr->exec_start;
+    curr->exec_start = now;
+}
+
+// Second half of a context switch, run by the process switched to: the
+// previous process's context is saved now, so other CPUs may run it, or
+// if it exited, free it
+void schedule_tail(void) {
+    cpu_t* cpu = this_cpu();
+    process_t* prev = cpu->prev;
+    bool dead = false;
+    if (prev) {
+        dead = prev->state == PROCESS_STATE_TERMINATED && prev->pid != 0;
+        prev->on_cpu = false;
+        cpu->prev = NULL;
+    }
+    spin_unlock(&runqueues[cpu->id].lock);
+    
+    // Waking the reaper takes run queue locks, so only now
+    if (dead) {
+        process_queue_dead(prev);
+    }
+}
+
+// Run the class pick: the idle process is the implicit lowest level, and
+// an idle CPU steals from the busiest one before settling for it
 void schedule(void) {
     if (!scheduler_enabled) {
         return;
@@ -26,82 +858,136 @@ void schedule(void) {
     // Disable interrupts during scheduling
     asm volatile("cli");
     
-    schedule_count++;
-    
+    cpu_t* cpu = this_cpu();
+    runqueue_t* rq = &runqueues[cpu->id];
     process_t* current = process_get_current();
     process_t* next = NULL;
     
-    // If current process is still runnable, put it back in ready queue
-    if (current && current->state == PROCESS_STATE_RUNNING) {
-        current->state = PROCESS_STATE_READY;
-        ready_queue_push(current);
+    release_kernel_lock(current);
+    spin_lock(&rq->lock);
+    rq->schedule_count++;
+    rq->need_resched = false;
+    
+    // If current process is still runnable, put it back at the front of
+    // its queue (the idle process is never queued)
+    if (current->pid != 0) {
+        if (current->state == PROCESS_STATE_RUNNING) {
+            current->state = PROCESS_STATE_READY;
+            sched_class_of(current)->enqueue(rq, current, ENQUEUE_HEAD);
+        } else if (current->state == PROCESS_STATE_ZOMBIE ||
+                   current->state == PROCESS_STATE_TERMINATED) {
+            spin_lock(&dl_bw_lock);
+            dl_release_bw(current);
+            spin_unlock(&dl_bw_lock);
+        }
     }
     
-    // Get next process from ready queue
-    next = ready_queue_pop();
+    // Get next process from ready queue, or from a busier CPU
+    next = pick_next_task(rq);
+    if (!next) {
+        next = steal_task(rq);
+    }
     
     // If no process is ready, use idle process
     if (!next) {
-        next = process_table[0];  // Idle process
+        next = cpu->idle;
     }
     
+    next->state = PROCESS_STATE_RUNNING;
+    
     // If switching to a different process
     if (current != next) {
-        next->state = PROCESS_STATE_RUNNING;
-        
-        // Update current process pointer
-        current_process = next;
+        update_curr(current);
+        next->exec_start = current->exec_start;
+        next->cpu = cpu->id;
+        next->on_cpu = true;
+        cpu->current = next;
+        cpu->prev = current;
         
-        // Switch page tables if different
-        if (!current || current->page_table != next->page_table) {
-            if (next->page_table) {
-                vmm_switch_address_space(next->page_table);
-            }
+        // Switch page tables if different; kernel-only processes borrow
+        // whichever address space is loaded
+        if (next->mm->page_table && next->mm->page_table != cpu->page_table) {
+            cpu->page_table = next->mm->page_table;
+            vmm_switch_address_space(next->mm->page_table);
         }
         
-        // Perform context switch
-        if (current) {
-            context_switch(&current->context, &next->context);
-        } else {
-            // Initial switch, no old context to save
-            context_switch(NULL, &next->context);
+        // Each thread enters from ring 3 on its own kernel stack and has
+        // its own TLS base. User code can move its GS base without us
+        // (a segment load), so that one is read back.
+        tss_set_kernel_stack((uint64_t)next->kernel_stack + next->kernel_stack_size);
+        if (next->fs_base != current->fs_base) {
+            wrmsr(MSR_FS_BASE, next->fs_base);
         }
+        current->gs_base = rdmsr(MSR_KERNEL_GS_BASE);
+        if (next->gs_base != current->gs_base) {
+            wrmsr(MSR_KERNEL_GS_BASE, next->gs_base);
+        }
+        fpu_switch(current);
+        
+        // Perform context switch; we come back here (possibly on another
+        // CPU) when this process is picked again
+        context_switch(&current->context, &next->context);
+        schedule_tail();
+    } else {
+        spin_unlock(&rq->lock);
     }
     
+    reacquire_kernel_lock(current);
+    
     // Re-enable interrupts
     asm volatile("sti");
 }
 
-// Timer callback for preemptive scheduling
+// Preemption point: switch now if a wakeup or the tick asked for it
+void scheduler_resched(void) {
+    if (this_rq()->need_resched) {
+        schedule();
+    }
+}
+
+// Timer callback for preemptive scheduling, run on every CPU. Only flags
+// the switch: isr_handler() makes it after the softirqs, so timer
+// callbacks and the next tick are not held up behind the new process.
 void scheduler_tick(void) {
     if (!scheduler_enabled) {
         return;
     }
     
+    runqueue_t* rq = this_rq();
     process_t* current = process_get_current();
-    if (!current) {
-        return;
-    }
+    bool resched;
+    
+    spin_lock(&rq->lock);
+    dl_update_throttled(rq, timer_get_ticks());
     
     // Update process statistics
-    current->ticks_total++;
+    update_curr(current);
     
-    // Check if quantum expired
-    if (current->ticks_remaining > 0) {
-        current->ticks_remaining--;
+    if (current->pid == 0) {
+        // The idle process only runs until something becomes ready here
+        // or another CPU has work to spare
+        resched = rq_should_preempt(rq, current) || other_rq_has_work(rq);
+    } else {
+        // The class charges the tick and decides whether the slice is over
+        resched = sched_class_of(current)->task_tick(rq, current) ||
+                  rq_should_preempt(rq, current);
     }
-    
-    // If quantum expired, schedule next process
-    if (current->ticks_remaining == 0) {
-        current->ticks_remaining = DEFAULT_QUANTUM;  // Reset quantum
-        schedule();
+    if (resched) {
+        rq->need_resched = true;
     }
+    spin_unlock(&rq->lock);
 }
 
 // Initialize scheduler
 void scheduler_init(void) {
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        runqueue_t* rq = &runqueues[i];
+        spin_init(&rq->lock);
+        rq->cpu = i;
+        rq->fair_active = &rq->fair_arrays[0];
+        rq->fair_expired = &rq->fair_arrays[1];
+    }
     scheduler_enabled = false;
-    schedule_count = 0;
     terminal_writestring("Scheduler initialized (disabled)\n");
 }
 
@@ -120,10 +1006,59 @@ void scheduler_disable(void) {
     terminal_writestring("Scheduler disabled\n");
 }
 
+// Helper to print a decimal number
+static void print_dec(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
 // Get scheduler statistics
 void scheduler_stats(void) {
+    uint64_t schedule_count = 0;
+    uint64_t picks[NUM_SCHED_CLASSES] = {0};
+    
     terminal_writestring("Scheduler statistics:\n");
+    for (uint32_t c = 0; c < cpu_count; c++) {
+        runqueue_t* rq = &runqueues[c];
+        schedule_count += rq->schedule_count;
+        for (size_t i = 0; i < NUM_SCHED_CLASSES; i++) {
+            picks[i] += rq->picks[i];
+        }
+        
+        terminal_writestring("  CPU ");
+        print_dec(c);
+        terminal_writestring(": ");
+        print_dec(rq->schedule_count);
+        terminal_writestring(" switches, ");
+        print_dec(rq->steals);
+        terminal_writestring(" steals, ");
+        print_dec(rq_load(rq));
+        terminal_writestring(" queued\n");
+    }
+    
     terminal_writestring("  Schedule count: ");
-    // TODO: Print schedule_count
+    print_dec(schedule_count);
+    terminal_writestring("\n");
+    
+    for (size_t i = 0; i < NUM_SCHED_CLASSES; i++) {
+        terminal_writestring("  ");
+        terminal_writestring(sched_classes[i]->name);
+        terminal_writestring(" picks: ");
+        print_dec(picks[i]);
+        terminal_writestring("\n");
+    }
+    
+    terminal_writestring("  Deadline bandwidth: ");
+    print_dec(dl_total_bw * 100 / DL_BW_UNIT);
+    terminal_writestring("% of ");
+    print_dec(DL_BW_LIMIT * 100 / DL_BW_UNIT);
+    terminal_writestring("%, missed deadlines: ");
+    print_dec(dl_misses);
     terminal_writestring("\n");
-}
\ No newline at end of file
+}
@@ -0,0 +1,306 @@
+#include "../include/smp.h"
+#include "../include/apic.h"
+#include "../include/acpi.h"
+#include "../include/process.h"
+#include "../include/scheduler.h"
+#include "../include/irq.h"
+#include "../include/timer.h"
+#include "../include/kmalloc.h"
+#include "../include/ports.h"
+#include "../include/terminal.h"
+#include "../include/string.h"
+#include "../include/cpu.h"
+#include "../include/fpu.h"
+#include "../include/syscall.h"
+#include "../include/vdso.h"
+
+// From kernel.c
+extern uint64_t* pml4;
+extern void init_gdt_ap(cpu_t* cpu);
+extern void init_idt_ap(void);
+
+// AP startup code and its parameter block (ap_trampoline.s)
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_end[];
+extern uint64_t ap_cr3;
+extern uint64_t ap_stack;
+extern uint64_t ap_entry;
+extern uint64_t ap_cpu;
+
+cpu_t cpus[MAX_CPUS];
+uint32_t cpu_count = 1;
+
+// TLB shootdown request, one at a time. SHOOTDOWN_LEAVE_MM instead of an
+// address asks CPUs to drop the address space altogether.
+#define SHOOTDOWN_LEAVE_MM (~0ULL)
+
+static spinlock_t shootdown_lock = SPINLOCK_INIT;
+static uint64_t* volatile shootdown_pml4;
+static volatile uint64_t shootdown_virt;
+static volatile uint32_t shootdown_pending;    // CPUs yet to flush
+
+// Big kernel lock
+static spinlock_t kernel_flag = SPINLOCK_INIT;
+
+// Point GS at the boot CPU's data. Everything that touches this_cpu(),
+// including spinlocks, depends on this. KERNEL_GS_BASE holds the user's
+// base while we are in the kernel; SWAPGS trades the two on the way to
+// and from ring 3.
+void smp_early_init(void) {
+    cpu_t* bsp = &cpus[0];
+    bsp->self = bsp;
+    bsp->id = 0;
+    bsp->online = true;
+    wrmsr(MSR_GS_BASE, (uint64_t)bsp);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+// Switch to the kernel's own page tables. Only ever needed on a CPU
+// that is running a kernel thread or idling on a user address space.
+static void smp_load_kernel_tables(void) {
+    this_cpu()->page_table = pml4;
+    write_cr3((uint64_t)pml4);
+}
+
+// Carry out a shootdown request on this CPU if its tables are the target
+static void smp_shootdown_local(uint64_t* pml4_table, uint64_t virt) {
+    if ((read_cr3() & ~0xFFF) != (uint64_t)pml4_table) {
+        return;
+    }
+    if (virt == SHOOTDOWN_LEAVE_MM) {
+        smp_load_kernel_tables();
+    } else {
+        invlpg(virt);
+    }
+}
+
+// Flush whatever a shootdown asked of this CPU. Runs from the IPI and
+// from spin loops that may have interrupts disabled.
+void smp_handle_pending(void) {
+    if (!shootdown_pending) {
+        return;
+    }
+    
+    uint32_t bit = 1U << this_cpu()->id;
+    if (shootdown_pending & bit) {
+        smp_shootdown_local(shootdown_pml4, shootdown_virt);
+        __sync_fetch_and_and(&shootdown_pending, ~bit);
+    }
+}
+
+// Run a shootdown on every CPU with the address space loaded. A CPU that
+// loads it later starts with a clean TLB anyway.
+static void smp_shootdown(uint64_t* pml4_table, uint64_t virt) {
+    uint64_t flags = irq_save();
+    cpu_t* self = this_cpu();
+    
+    smp_shootdown_local(pml4_table, virt);
+    
+    // The PTE store must be visible before we look at other CPUs' CR3
+    __sync_synchronize();
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        if (i != self->id && cpus[i].online && cpus[i].page_table == pml4_table) {
+            mask |= 1U << i;
+        }
+    }
+    
+    if (mask) {
+        spin_lock(&shootdown_lock);
+        shootdown_pml4 = pml4_table;
+        shootdown_virt = virt;
+        shootdown_pending = mask;
+        for (uint32_t i = 0; i < cpu_count; i++) {
+            if (mask & (1U << i)) {
+                lapic_send_ipi(cpus[i].apic_id, IPI_TLB_VECTOR);
+            }
+        }
+        while (shootdown_pending) {
+            cpu_relax();
+        }
+        spin_unlock(&shootdown_lock);
+    }
+    
+    irq_restore(flags);
+}
+
+// Invalidate a page on every CPU that may cache it
+void smp_flush_tlb_page(uint64_t* pml4_table, uint64_t virt) {
+    smp_shootdown(pml4_table, virt);
+}
+
+// Kernel threads and idle CPUs keep the last user page tables loaded
+// (lazy TLB). Before those tables are freed, every CPU still on them
+// moves to the kernel's.
+void smp_leave_mm(uint64_t* pml4_table) {
+    smp_shootdown(pml4_table, SHOOTDOWN_LEAVE_MM);
+}
+
+// Interrupt another CPU so it notices a newly queued process
+void smp_send_reschedule(uint32_t cpu) {
+    if (cpu < cpu_count && cpu != this_cpu()->id && cpus[cpu].online) {
+        lapic_send_ipi(cpus[cpu].apic_id, IPI_RESCHEDULE_VECTOR);
+    }
+}
+
+uint32_t smp_online_cpus(void) {
+    return cpu_count;
+}
+
+// The waker already flagged our run queue; isr_handler reschedules on
+// the way out
+static void ipi_reschedule_handler(registers_t* regs) {
+    (void)regs;
+    this_cpu()->ipis_received++;
+}
+
+static void ipi_tlb_handler(registers_t* regs) {
+    (void)regs;
+    this_cpu()->ipis_received++;
+    smp_handle_pending();
+}
+
+// First C code on an application processor, entered from the trampoline
+// on its idle stack
+static void ap_main(cpu_t* cpu) {
+    wrmsr(MSR_GS_BASE, (uint64_t)cpu);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+    
+    init_gdt_ap(cpu);
+    init_idt_ap();
+    fpu_init_ap();
+    syscall_init_cpu();
+    vdso_init_cpu();
+    lapic_enable();
+    timer_start_ap();
+    
+    cpu->current = cpu->idle;
+    cpu->page_table = pml4;
+    __sync_synchronize();
+    cpu->online = true;
+    
+    // Idle loop: the local timer and reschedule IPIs pull work in
+    asm volatile("sti");
+    while (1) {
+        timer_idle();
+    }
+}
+
+// Address of a trampoline parameter in the copy below 1MB
+static uint64_t* ap_param(uint64_t* param) {
+    return (uint64_t*)(AP_TRAMPOLINE_ADDR + ((uint8_t*)param - ap_trampoline_start));
+}
+
+// Start one AP and wait for it to check in
+static bool smp_boot_ap(uint32_t apic_id) {
+    cpu_t* cpu = &cpus[cpu_count];
+    void* stack = kmalloc(KERNEL_STACK_SIZE);
+    if (!stack) {
+        return false;
+    }
+    
+    memset(cpu, 0, sizeof(cpu_t));
+    cpu->self = cpu;
+    cpu->id = cpu_count;
+    cpu->apic_id = apic_id;
+    cpu->idle = process_create_idle(cpu->id, stack, KERNEL_STACK_SIZE);
+    if (!cpu->idle) {
+        kfree(stack);
+        return false;
+    }
+    
+    *ap_param(&ap_cr3) = (uint64_t)pml4;
+    *ap_param(&ap_stack) = (uint64_t)stack + KERNEL_STACK_SIZE;
+    *ap_param(&ap_entry) = (uint64_t)ap_main;
+    *ap_param(&ap_cpu) = (uint64_t)cpu;
+    
+    lapic_start_ap(apic_id, AP_TRAMPOLINE_ADDR >> 12);
+    
+    // Give it about 100ms
+    for (int i = 0; i < 100000 && !cpu->online; i++) {
+        outb(0x80, 0);
+    }
+    if (!cpu->online) {
+        terminal_writestring("SMP: an application processor did not start\n");
+        return false;
+    }
+    
+    cpu_count++;
+    return true;
+}
+
+// Find the other CPUs in the MADT and bring them up one at a time (they
+// share the trampoline's parameter block)
+void smp_init(void) {
+    cpus[0].current = process_get_current();
+    cpus[0].page_table = pml4;
+    
+    if (!acpi_init()) {
+        return;
+    }
+    const acpi_info_t* info = acpi_get_info();
+    if (!lapic_init(info->lapic_base)) {
+        terminal_writestring("SMP: no local APIC, running on one CPU\n");
+        return;
+    }
+    cpus[0].apic_id = lapic_id();
+    
+    irq_register_lapic(IPI_RESCHEDULE_VECTOR, ipi_reschedule_handler, "reschedule");
+    irq_register_lapic(IPI_TLB_VECTOR, ipi_tlb_handler, "tlb shootdown");
+    
+    // ISA IRQs to the I/O APIC, and every CPU ticks off its own timer.
+    // Without the I/O APIC the boot CPU stays on the PIT.
+    bool ioapic = irq_enable_ioapic();
+    if (!ioapic) {
+        terminal_writestring("SMP: ISA IRQs stay on the 8259\n");
+    }
+    lapic_timer_calibrate();
+    if (ioapic) {
+        timer_use_lapic();
+    }
+    
+    memcpy((void*)AP_TRAMPOLINE_ADDR, ap_trampoline_start,
+           ap_trampoline_end - ap_trampoline_start);
+    
+    for (uint32_t i = 0; i < info->cpu_count && cpu_count < MAX_CPUS; i++) {
+        if (info->cpu_apic_ids[i] != cpus[0].apic_id) {
+            smp_boot_ap(info->cpu_apic_ids[i]);
+        }
+    }
+    
+    terminal_writestring("SMP: ");
+    if (cpu_count >= 10) {
+        terminal_putchar('0' + cpu_count / 10);
+    }
+    terminal_putchar('0' + cpu_count % 10);
+    terminal_writestring(" CPUs online\n");
+}
+
+// Take the big kernel lock (recursively) for the current process
+void lock_kernel(void) {
+    process_t* self = process_get_current();
+    if (self->lock_depth++ == 0) {
+        spin_lock(&kernel_flag);
+    }
+}
+
+void unlock_kernel(void) {
+    process_t* self = process_get_current();
+    if (--self->lock_depth == 0) {
+        spin_unlock(&kernel_flag);
+    }
+}
+
+// schedule() lets go of the lock while a holder is switched out and
+// takes it back before the holder resumes; the depth stays with it
+void release_kernel_lock(process_t* proc) {
+    if (proc->lock_depth) {
+        spin_unlock(&kernel_flag);
+    }
+}
+
+void reacquire_kernel_lock(process_t* proc) {
+    if (proc->lock_depth) {
+        spin_lock(&kernel_flag);
+    }
+}
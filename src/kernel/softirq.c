@@ -0,0 +1,106 @@
+#include "../include/softirq.h"
+#include "../include/smp.h"
+#include "../include/cpu.h"
+#include "../include/terminal.h"
+
+typedef struct {
+    void (*handler)(void);
+    const char* name;
+    uint64_t count;
+    uint64_t cycles;                // Summed over count
+    uint64_t cycles_max;
+} softirq_action_t;
+
+static softirq_action_t softirq_vec[NR_SOFTIRQS];
+
+// Handlers are installed once at boot
+void open_softirq(softirq_nr_t nr, void (*handler)(void), const char* name) {
+    softirq_vec[nr].handler = handler;
+    softirq_vec[nr].name = name;
+}
+
+// Only this CPU touches its pending mask, so keeping interrupts off
+// around the update is enough
+void raise_softirq(softirq_nr_t nr) {
+    uint64_t flags = irq_save();
+    this_cpu()->softirq_pending |= 1U << nr;
+    irq_restore(flags);
+}
+
+// True while this CPU runs its softirqs
+bool in_softirq(void) {
+    return this_cpu()->in_softirq;
+}
+
+// Run one softirq and charge it its cycles
+static void softirq_run(softirq_action_t* action) {
+    uint64_t start = rdtsc();
+    action->handler();
+    uint64_t cycles = rdtsc() - start;
+    
+    __sync_fetch_and_add(&action->count, 1);
+    __sync_fetch_and_add(&action->cycles, cycles);
+    if (cycles > action->cycles_max) {
+        action->cycles_max = cycles;
+    }
+}
+
+// Called with interrupts disabled. Interrupts that arrive while the
+// handlers run only add pending bits; isr_handler() leaves those to the
+// loop here, which also keeps this CPU from switching processes midway.
+void do_softirq(registers_t* regs) {
+    cpu_t* cpu = this_cpu();
+    if (!cpu->softirq_pending || cpu->in_softirq || !(regs->rflags & (1 << 9))) {
+        return;
+    }
+    
+    cpu->in_softirq = true;
+    for (int round = 0; round < SOFTIRQ_RESTARTS && cpu->softirq_pending; round++) {
+        uint32_t pending = cpu->softirq_pending;
+        cpu->softirq_pending = 0;
+        
+        asm volatile("sti" : : : "memory");
+        while (pending) {
+            int nr = __builtin_ctz(pending);
+            pending &= pending - 1;
+            if (softirq_vec[nr].handler) {
+                softirq_run(&softirq_vec[nr]);
+            }
+        }
+        asm volatile("cli" : : : "memory");
+    }
+    cpu->in_softirq = false;
+}
+
+// Helper to print a decimal number
+static void print_dec(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
+// Print what each softirq has cost
+void softirq_print_stats(void) {
+    terminal_writestring("Softirqs:\n");
+    for (int nr = 0; nr < NR_SOFTIRQS; nr++) {
+        softirq_action_t* action = &softirq_vec[nr];
+        if (!action->count) {
+            continue;
+        }
+        
+        terminal_writestring("  ");
+        terminal_writestring(action->name ? action->name : "?");
+        terminal_writestring(": ");
+        print_dec(action->count);
+        terminal_writestring(", avg ");
+        print_dec(action->cycles / action->count);
+        terminal_writestring(" max ");
+        print_dec(action->cycles_max);
+        terminal_writestring(" cycles\n");
+    }
+}
@@ -13,6 +13,16 @@
 #include "../include/pmm.h"
 #include "../include/fs.h"
 #include "../include/pipe.h"
+#include "../include/shm.h"
+#include "../include/wait.h"
+#include "../include/clocksource.h"
+#include "../include/futex.h"
+#include "../include/cpu.h"
+#include "../include/fpu.h"
+#include "../include/smp.h"
+#include "../include/vdso.h"
+#include "../include/io_ring.h"
+#include "../include/systrace.h"
 
 // System call numbers
 #define SYS_EXIT    1
@@ -33,12 +43,45 @@
 #define SYS_KILL    16
 #define SYS_PIPE    17
 #define SYS_DUP2    18
+#define SYS_SHMGET  19
+#define SYS_SHMAT   20
+#define SYS_SHMDT   21
+#define SYS_SHMCTL  22
+#define SYS_MADVISE 23
+#define SYS_SCHED_SETATTR 24
+#define SYS_SCHED_GETATTR 25
+#define SYS_CLOCK_GETTIME 26
+#define SYS_CLONE   27
+#define SYS_FUTEX   28
+#define SYS_ARCH_PRCTL 29
+#define SYS_GETTID  30
+#define SYS_GETCPU  31
+#define SYS_RING_SETUP 32
+#define SYS_RING_ENTER 33
+#define SYS_READV   34
+#define SYS_WRITEV  35
+#define SYS_PREAD   36
+#define SYS_PWRITE  37
+#define SYS_SYSTRACE 38
+#define SYS_SENDFILE 39
+#define SYS_SPLICE  40
 
 // File descriptors
 #define STDIN   0
 #define STDOUT  1
 #define STDERR  2
 
+// clone() flags
+#define CLONE_VM             0x00000100  // Share the address space
+#define CLONE_SETTLS         0x00080000  // Set the FS base from 'tls'
+#define CLONE_CHILD_CLEARTID 0x00200000  // Clear and wake 'ctid' on exit
+
+// arch_prctl() codes
+#define ARCH_SET_GS 0x1001
+#define ARCH_SET_FS 0x1002
+#define ARCH_GET_FS 0x1003
+#define ARCH_GET_GS 0x1004
+
 // Maximum number of system calls
 #define MAX_SYSCALLS 64
 
@@ -56,93 +99,105 @@ void init_main(void);
 static void string_concat(char* dest, const char* src);
 static void int_to_string(uint32_t num, char* buf);
 
-// System call implementations
+// A new thread's first return to user code (context_switch.s)
+extern void clone_return_trampoline(void);
 
-// sys_exit: Terminate current process
-static uint64_t sys_exit(uint64_t status, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
-    (void)arg2; (void)arg3; (void)arg4; (void)arg5;
-    
+// File descriptor table (per-process)
+#define MAX_FDS 16
+typedef struct {
+    fs_node_t* node;
+    pipe_t* pipe;
+    uint64_t offset;                // File position
+    int flags;
+    int is_pipe;
+} fd_entry_t;
+
+// Get current process's fd table
+static fd_entry_t* get_fd_table(void) {
     process_t* current = process_get_current();
-    if (!current) {
-        return 0;
+    if (!current || !current->mm->fd_table) {
+        return NULL;
+    }
+    return (fd_entry_t*)current->mm->fd_table;
+}
+
+// Stdin, stdout and stderr are the console until dup2() points them
+// somewhere else
+static bool fd_is_console(uint64_t fd, bool write) {
+    if (write ? (fd != STDOUT && fd != STDERR) : fd != STDIN) {
+        return false;
     }
     
-    terminal_writestring("\n[SYSCALL] Process ");
-    terminal_writestring(current->name);
-    terminal_writestring(" exiting with status: ");
-    // TODO: Print status
-    terminal_writestring("\n");
-    
-    // Set exit status and become zombie
-    current->exit_status = (int)status;
-    current->state = PROCESS_STATE_ZOMBIE;
+    fd_entry_t* fd_table = get_fd_table();
+    return !fd_table || (!fd_table[fd].node && !fd_table[fd].pipe);
+}
+
+// Console reads wait for a line; pipes block when empty or too full.
+// Decided by what the descriptor refers to, so it follows dup2().
+bool syscall_fd_may_block(uint64_t fd, bool write, uint64_t count) {
+    if (!write && fd_is_console(fd, false)) {
+        return true;
+    }
     
-    // If we have a parent, we become a zombie
-    // If no parent (PID 0), we can be cleaned up immediately
-    if (current->parent_pid == 0) {
-        process_exit((int)status);
-    } else {
-        // Become zombie and schedule next process
-        schedule();
+    fd_entry_t* fd_table = get_fd_table();
+    if (!fd_table || fd >= MAX_FDS || !fd_table[fd].is_pipe || !fd_table[fd].pipe) {
+        return false;
     }
     
-    // Should never reach here
-    return 0;
+    pipe_t* pipe = fd_table[fd].pipe;
+    if (write) {
+        return !pipe->reader_closed && PIPE_SIZE - pipe->count < count;
+    }
+    return pipe->count == 0 && !pipe->writer_closed;
 }
 
-// sys_write: Write to file descriptor
-static uint64_t sys_write(uint64_t fd, uint64_t buf_ptr, uint64_t count, uint64_t arg4, uint64_t arg5) {
-    (void)arg4; (void)arg5;
-    
-    // Validate parameters
-    if (buf_ptr == 0 || count == 0) {
+// Write to a descriptor: at *pos if given (files only; the position is
+// left alone), otherwise at and past its file position
+static int64_t fd_write(uint64_t fd, const char* buf, uint64_t count, const uint64_t* pos) {
+    if (count == 0) {
         return 0;
     }
     
-    const char* buf = (const char*)buf_ptr;
-    
     // Handle stdout and stderr
-    if (fd == STDOUT || fd == STDERR) {
+    if (fd_is_console(fd, true) && !pos) {
         for (size_t i = 0; i < count; i++) {
             terminal_putchar(buf[i]);
         }
         return count;
     }
     
-    // Handle file descriptors
     fd_entry_t* fd_table = get_fd_table();
-    if (fd_table && fd < MAX_FDS) {
-        if (fd_table[fd].is_pipe && fd_table[fd].pipe) {
-            // Write to pipe
-            return pipe_write(fd_table[fd].pipe, buf, count);
-        } else if (fd_table[fd].node) {
-            // Write to file
-            fs_node_t* node = fd_table[fd].node;
-            int written = fs_write(node, fd_table[fd].offset, count, (uint8_t*)buf);
-            if (written > 0) {
-                fd_table[fd].offset += written;
-            }
-            return written;
+    if (!fd_table || fd >= MAX_FDS) {
+        return -1;
+    }
+    
+    fd_entry_t* entry = &fd_table[fd];
+    if (entry->is_pipe && entry->pipe) {
+        // Pipes have no position
+        return pos ? -1 : pipe_write(entry->pipe, buf, count);
+    } else if (entry->node) {
+        if (count > FS_MAX_FILE_SIZE) {
+            count = FS_MAX_FILE_SIZE;
+        }
+        int written = fs_write(entry->node, pos ? *pos : entry->offset, count, (uint8_t*)buf);
+        if (written > 0 && !pos) {
+            entry->offset += written;
         }
+        return written;
     }
     
     // Unsupported fd
     return -1;
 }
 
-// sys_read: Read from file descriptor
-static uint64_t sys_read(uint64_t fd, uint64_t buf_ptr, uint64_t count, uint64_t arg4, uint64_t arg5) {
-    (void)arg4; (void)arg5;
-    
-    // Validate parameters
-    if (buf_ptr == 0 || count == 0) {
+// Read from a descriptor, positioned like fd_write()
+static int64_t fd_read(uint64_t fd, char* buf, uint64_t count, const uint64_t* pos) {
+    if (count == 0) {
         return 0;
     }
     
-    char* buf = (char*)buf_ptr;
-    
     // Handle stdin
-    if (fd == STDIN) {
+    if (fd_is_console(fd, false) && !pos) {
         size_t read = 0;
         
         // Block until we have input
@@ -158,47 +213,366 @@ static uint64_t sys_read(uint64_t fd, uint64_t buf_ptr, uint64_t count, uint64_t
                     break;
                 }
             } else {
-                // Yield CPU while waiting for input
-                asm volatile("hlt");
+                // Sleep until the keyboard interrupt wakes us
+                keyboard_wait();
             }
         }
         
         return read;
     }
     
-    // Handle file descriptors
     fd_entry_t* fd_table = get_fd_table();
-    if (fd_table && fd < MAX_FDS) {
-        if (fd_table[fd].is_pipe && fd_table[fd].pipe) {
-            // Read from pipe
-            return pipe_read(fd_table[fd].pipe, buf, count);
-        } else if (fd_table[fd].node) {
-            // Read from file
-            fs_node_t* node = fd_table[fd].node;
-            int bytes_read = fs_read(node, fd_table[fd].offset, count, (uint8_t*)buf);
-            if (bytes_read > 0) {
-                fd_table[fd].offset += bytes_read;
-            }
-            return bytes_read;
+    if (!fd_table || fd >= MAX_FDS) {
+        return -1;
+    }
+    
+    fd_entry_t* entry = &fd_table[fd];
+    if (entry->is_pipe && entry->pipe) {
+        return pos ? -1 : pipe_read(entry->pipe, buf, count);
+    } else if (entry->node) {
+        if (count > FS_MAX_FILE_SIZE) {
+            count = FS_MAX_FILE_SIZE;
+        }
+        int bytes_read = fs_read(entry->node, pos ? *pos : entry->offset, count, (uint8_t*)buf);
+        if (bytes_read > 0 && !pos) {
+            entry->offset += bytes_read;
         }
+        return bytes_read;
     }
     
     // Unsupported fd
     return -1;
 }
 
-// sys_getpid: Get current process ID
+// One side of an in-kernel transfer (sendfile, splice)
+typedef struct {
+    fs_node_t* node;                // A file, at *pos
+    uint64_t* pos;
+    pipe_t* pipe;
+    bool console;                   // Output only
+} fd_end_t;
+
+// Resolve a descriptor for fd_transfer(). A file uses *pos if given,
+// otherwise its own position; pipes and the console take no position.
+static int fd_end(uint64_t fd, bool write, uint64_t* pos, fd_end_t* end) {
+    *end = (fd_end_t){ 0 };
+    
+    if (fd_is_console(fd, write)) {
+        if (!write || pos) {
+            return -1;              // Keyboard input is not spliceable
+        }
+        end->console = true;
+        return 0;
+    }
+    
+    fd_entry_t* fd_table = get_fd_table();
+    if (!fd_table || fd >= MAX_FDS) {
+        return -1;
+    }
+    
+    fd_entry_t* entry = &fd_table[fd];
+    if (entry->is_pipe && entry->pipe) {
+        if (pos) {
+            return -1;              // ESPIPE
+        }
+        end->pipe = entry->pipe;
+    } else if (entry->node) {
+        end->node = entry->node;
+        end->pos = pos ? pos : &entry->offset;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// pipe_actor_t: fill the pipe from the file
+static int fd_file_read_actor(void* data, uint8_t* buf, size_t len) {
+    fd_end_t* end = (fd_end_t*)data;
+    int n = fs_read(end->node, *end->pos, len, buf);
+    if (n > 0) {
+        *end->pos += n;
+    }
+    return n;
+}
+
+// pipe_actor_t: drain the pipe into the file
+static int fd_file_write_actor(void* data, uint8_t* buf, size_t len) {
+    fd_end_t* end = (fd_end_t*)data;
+    int n = fs_write(end->node, *end->pos, len, buf);
+    if (n > 0) {
+        *end->pos += n;
+    }
+    return n;
+}
+
+// pipe_actor_t: drain the pipe onto the screen
+static int fd_console_actor(void* data, uint8_t* buf, size_t len) {
+    (void)data;
+    
+    for (size_t i = 0; i < len; i++) {
+        terminal_putchar(buf[i]);
+    }
+    return len;
+}
+
+// Move up to 'count' bytes without passing through user memory. Between
+// a file and a pipe, or from a pipe to the console, the bytes are copied
+// once, straight into or out of the pipe's buffer; anything else goes
+// through a block-sized kernel buffer. A pipe source gives what it has
+// once something is there, like read().
+static int64_t fd_transfer(fd_end_t* in, fd_end_t* out, uint64_t count) {
+    if (count > FS_MAX_FILE_SIZE) {
+        count = FS_MAX_FILE_SIZE;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    
+    if (in->node && out->pipe) {
+        return pipe_splice_in(out->pipe, count, fd_file_read_actor, in);
+    }
+    if (in->pipe && out->node) {
+        return pipe_splice_out(in->pipe, count, fd_file_write_actor, out);
+    }
+    if (in->pipe && out->console) {
+        return pipe_splice_out(in->pipe, count, fd_console_actor, NULL);
+    }
+    if (in->pipe && in->pipe == out->pipe) {
+        return -1;
+    }
+    
+    uint8_t chunk[FS_BLOCK_SIZE];
+    int64_t moved = 0;
+    while ((uint64_t)moved < count) {
+        uint32_t want = count - moved < sizeof(chunk) ? count - moved : sizeof(chunk);
+        int n = in->pipe ? pipe_read(in->pipe, chunk, want)
+                         : fs_read(in->node, *in->pos, want, chunk);
+        if (n <= 0) {
+            if (n < 0 && moved == 0) {
+                return -1;
+            }
+            break;
+        }
+        
+        int written = n;
+        if (out->pipe) {
+            written = pipe_write(out->pipe, chunk, n);
+        } else if (out->node) {
+            written = fs_write(out->node, *out->pos, n, chunk);
+            if (written > 0) {
+                *out->pos += written;
+            }
+        } else {
+            fd_console_actor(NULL, chunk, n);
+        }
+        
+        // A file source only gives up what reached the other side
+        if (in->node && written > 0) {
+            *in->pos += written;
+        }
+        if (written < 0) {
+            return moved ? moved : -1;
+        }
+        moved += written;
+        if (written < n || (in->pipe && in->pipe->count == 0)) {
+            break;
+        }
+    }
+    return moved;
+}
+
+// System call implementations
+
+// sys_exit: Terminate current process
+static uint64_t sys_exit(uint64_t status, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    (void)arg2; (void)arg3; (void)arg4; (void)arg5;
+    
+    process_t* current = process_get_current();
+    if (!current) {
+        return 0;
+    }
+    
+    terminal_writestring("\n[SYSCALL] Process ");
+    terminal_writestring(current->name);
+    terminal_writestring(" exiting with status: ");
+    // TODO: Print status
+    terminal_writestring("\n");
+    
+    // Let a joining thread know we are gone
+    futex_exit(current);
+    
+    // Set exit status and become zombie
+    process_orphan_children(current);
+    current->exit_status = (int)status;
+    current->state = PROCESS_STATE_ZOMBIE;
+    
+    // If we have a parent, we become a zombie
+    // If no parent (PID 0), we can be cleaned up immediately
+    if (current->parent_pid == 0) {
+        process_exit((int)status);
+    } else {
+        // Wake a parent blocked in wait(), then schedule next process
+        process_wake_parent(current);
+        schedule();
+    }
+    
+    // Should never reach here
+    return 0;
+}
+
+// sys_write: Write to file descriptor
+static uint64_t sys_write(uint64_t fd, uint64_t buf_ptr, uint64_t count, uint64_t arg4, uint64_t arg5) {
+    (void)arg4; (void)arg5;
+    
+    if (buf_ptr == 0) {
+        return 0;
+    }
+    return fd_write(fd, (const char*)buf_ptr, count, NULL);
+}
+
+// sys_read: Read from file descriptor
+static uint64_t sys_read(uint64_t fd, uint64_t buf_ptr, uint64_t count, uint64_t arg4, uint64_t arg5) {
+    (void)arg4; (void)arg5;
+    
+    if (buf_ptr == 0) {
+        return 0;
+    }
+    return fd_read(fd, (char*)buf_ptr, count, NULL);
+}
+
+// sys_writev: Write several buffers in order in one call. Each buffer
+// goes out as one write, but a write that sleeps (a full pipe) drops the
+// big kernel lock, so another writer's data may land between buffers.
+// Stops early on a short write.
+static uint64_t sys_writev(uint64_t fd, uint64_t iov_ptr, uint64_t iovcnt, uint64_t arg4, uint64_t arg5) {
+    (void)arg4; (void)arg5;
+    
+    const iovec_t* iov = (const iovec_t*)iov_ptr;
+    if (!iov || iovcnt > IOV_MAX) {
+        return -1;  // EINVAL
+    }
+    
+    int64_t total = 0;
+    for (uint64_t i = 0; i < iovcnt; i++) {
+        if (!iov[i].base && iov[i].len) {
+            return total ? total : -1;  // EFAULT
+        }
+        int64_t n = fd_write(fd, (const char*)iov[i].base, iov[i].len, NULL);
+        if (n < 0) {
+            return total ? total : -1;
+        }
+        total += n;
+        if ((uint64_t)n < iov[i].len) {
+            break;
+        }
+    }
+    return total;
+}
+
+// sys_readv: Fill several buffers in order in one call. Stops early on
+// a short read.
+static uint64_t sys_readv(uint64_t fd, uint64_t iov_ptr, uint64_t iovcnt, uint64_t arg4, uint64_t arg5) {
+    (void)arg4; (void)arg5;
+    
+    const iovec_t* iov = (const iovec_t*)iov_ptr;
+    if (!iov || iovcnt > IOV_MAX) {
+        return -1;  // EINVAL
+    }
+    
+    int64_t total = 0;
+    for (uint64_t i = 0; i < iovcnt; i++) {
+        if (!iov[i].base && iov[i].len) {
+            return total ? total : -1;  // EFAULT
+        }
+        int64_t n = fd_read(fd, (char*)iov[i].base, iov[i].len, NULL);
+        if (n < 0) {
+            return total ? total : -1;
+        }
+        total += n;
+        if ((uint64_t)n < iov[i].len) {
+            break;
+        }
+    }
+    return total;
+}
+
+// sys_pwrite: Write at a 64-bit offset without moving the file position
+static uint64_t sys_pwrite(uint64_t fd, uint64_t buf_ptr, uint64_t count, uint64_t offset, uint64_t arg5) {
+    (void)arg5;
+    
+    if (buf_ptr == 0) {
+        return -1;
+    }
+    return fd_write(fd, (const char*)buf_ptr, count, &offset);
+}
+
+// sys_pread: Read at a 64-bit offset without moving the file position
+static uint64_t sys_pread(uint64_t fd, uint64_t buf_ptr, uint64_t count, uint64_t offset, uint64_t arg5) {
+    (void)arg5;
+    
+    if (buf_ptr == 0) {
+        return -1;
+    }
+    return fd_read(fd, (char*)buf_ptr, count, &offset);
+}
+
+// sys_sendfile: Copy up to 'count' bytes from in_fd to out_fd inside the
+// kernel. With 'offset_ptr' the input is read from *offset_ptr, which is
+// advanced, and in_fd's own position is left alone.
+static uint64_t sys_sendfile(uint64_t out_fd, uint64_t in_fd, uint64_t offset_ptr, uint64_t count, uint64_t arg5) {
+    (void)arg5;
+    
+    fd_end_t in, out;
+    if (fd_end(in_fd, false, (uint64_t*)offset_ptr, &in) < 0 ||
+        fd_end(out_fd, true, NULL, &out) < 0) {
+        return -1;
+    }
+    return fd_transfer(&in, &out, count);
+}
+
+// sys_splice: Move up to 'len' bytes between a pipe and another
+// descriptor inside the kernel. An offset pointer, which must be NULL on
+// the pipe side, positions a file like pread()/pwrite() and is advanced.
+static uint64_t sys_splice(uint64_t fd_in, uint64_t off_in, uint64_t fd_out, uint64_t off_out, uint64_t len) {
+    fd_end_t in, out;
+    if (fd_end(fd_in, false, (uint64_t*)off_in, &in) < 0 ||
+        fd_end(fd_out, true, (uint64_t*)off_out, &out) < 0) {
+        return -1;
+    }
+    if (!in.pipe && !out.pipe) {
+        return -1;  // EINVAL: sendfile() moves between files
+    }
+    return fd_transfer(&in, &out, len);
+}
+
+// sys_getpid: Get current process ID (shared by all its threads)
 static uint64_t sys_getpid(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
     (void)arg1; (void)arg2; (void)arg3; (void)arg4; (void)arg5;
     
+    process_t* current = process_get_current();
+    return current ? current->tgid : 0;
+}
+
+// sys_gettid: Get current thread ID
+static uint64_t sys_gettid(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    (void)arg1; (void)arg2; (void)arg3; (void)arg4; (void)arg5;
+    
     return process_get_pid();
 }
 
+// sys_getcpu: CPU the caller is running on (the vDSO's fallback when
+// there is no RDTSCP)
+static uint64_t sys_getcpu(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    (void)arg1; (void)arg2; (void)arg3; (void)arg4; (void)arg5;
+    
+    return this_cpu()->id;
+}
+
 // sys_sleep: Sleep for milliseconds
 static uint64_t sys_sleep(uint64_t ms, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
     (void)arg2; (void)arg3; (void)arg4; (void)arg5;
     
-    sleep_ms((uint32_t)ms);
+    process_sleep((uint32_t)timer_ms_to_ticks(ms));
     return 0;
 }
 
@@ -211,31 +585,31 @@ static uint64_t sys_sbrk(uint64_t increment, uint64_t arg2, uint64_t arg3, uint6
         return -1;
     }
     
-    uint64_t old_heap = current->heap_current;
+    uint64_t old_heap = current->mm->heap_current;
     
     // If increment is 0, just return current break
     if (increment == 0) {
         return old_heap;
     }
     
-    uint64_t new_heap = current->heap_current + (int64_t)increment;
+    uint64_t new_heap = current->mm->heap_current + (int64_t)increment;
     
     // Check limits
-    if (new_heap > current->heap_max) {
+    if (new_heap > current->mm->heap_max) {
         return -1;  // ENOMEM
     }
     
-    if (new_heap < current->heap_start) {
+    if (new_heap < current->mm->heap_start) {
         return -1;  // Can't go below heap start
     }
     
     if ((int64_t)increment > 0) {
         // Growing heap - allocate new pages as needed
-        uint64_t old_page = current->heap_current & ~(PAGE_SIZE - 1);
+        uint64_t old_page = current->mm->heap_current & ~(PAGE_SIZE - 1);
         uint64_t new_page = (new_heap + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
         
         for (uint64_t page = old_page; page < new_page; page += PAGE_SIZE) {
-            if (page >= current->heap_current) {
+            if (page >= current->mm->heap_current) {
                 // Allocate new page
                 if (vmm_alloc_user_pages(current, page, 1) < 0) {
                     return -1;  // Failed to allocate
@@ -243,14 +617,54 @@ static uint64_t sys_sbrk(uint64_t increment, uint64_t arg2, uint64_t arg3, uint6
             }
         }
     } else {
-        // Shrinking heap - could free pages here
-        // For now, just update the pointer
+        // Shrinking heap - return pages that are now entirely above the break
+        uint64_t first_free = PAGE_ALIGN_UP(new_heap);
+        uint64_t old_end = PAGE_ALIGN_UP(current->mm->heap_current);
+        
+        if (old_end > first_free) {
+            vmm_free_user_pages(current, first_free, (old_end - first_free) / PAGE_SIZE);
+        }
     }
     
-    current->heap_current = new_heap;
+    current->mm->heap_current = new_heap;
+    mm_resize_vma(current->mm, current->mm->heap_start, PAGE_ALIGN_UP(new_heap));
     return old_heap;
 }
 
+// sys_madvise: Release heap pages without moving the break
+static uint64_t sys_madvise(uint64_t addr, uint64_t length, uint64_t advice, uint64_t arg4, uint64_t arg5) {
+    (void)arg4; (void)arg5;
+    
+    process_t* current = process_get_current();
+    if (!current || (addr & (PAGE_SIZE - 1)) || length == 0 || length > ~0ULL - addr) {
+        return -1;  // EINVAL
+    }
+    
+    // Rounding up can still wrap past the top of the address space
+    uint64_t end = PAGE_ALIGN_UP(addr + length);
+    if (end <= addr) {
+        return -1;  // EINVAL
+    }
+    if (addr < current->mm->heap_start || end > PAGE_ALIGN_UP(current->mm->heap_current)) {
+        return -1;  // Only heap spans can be refaulted on demand
+    }
+    
+    switch (advice) {
+        case MADV_DONTNEED:
+            // Touching the range again faults in zeroed pages
+            vmm_free_user_pages(current, addr, (end - addr) / PAGE_SIZE);
+            return 0;
+            
+        case MADV_FREE:
+            // Pages stay mapped until reclaim finds them still clean
+            vmm_lazyfree_user_pages(current, addr, (end - addr) / PAGE_SIZE);
+            return 0;
+            
+        default:
+            return -1;
+    }
+}
+
 // sys_fork: Create a child process
 static uint64_t sys_fork(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
     (void)arg1; (void)arg2; (void)arg3; (void)arg4; (void)arg5;
@@ -265,7 +679,7 @@ static uint64_t sys_fork(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t a
     terminal_writestring("\n");
     
     // Create child process structure
-    process_t* child = allocate_process_struct();
+    process_t* child = allocate_process_struct(NULL);
     if (!child) {
         terminal_writestring("[FORK] Failed to allocate child process\n");
         return -1;  // EAGAIN - no resources
@@ -276,8 +690,9 @@ static uint64_t sys_fork(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t a
     string_concat(child->name, "[child]");
     
     // Clone address space
-    child->page_table = vmm_clone_address_space(parent->page_table);
-    if (!child->page_table) {
+    child->mm->page_table = vmm_clone_address_space(parent->mm->page_table);
+    if (!child->mm->page_table || mm_dup_vmas(child->mm, parent->mm) < 0 ||
+        vdso_fork(child) < 0) {
         terminal_writestring("[FORK] Failed to clone address space\n");
         free_process_struct(child);
         return -1;
@@ -285,30 +700,41 @@ static uint64_t sys_fork(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t a
     
     // Copy process context (registers, etc)
     child->context = parent->context;
+    if (fpu_copy(child, parent) < 0) {
+        free_process_struct(child);
+        return -1;
+    }
     
     // NOTE: Return values are set by the syscall handler in the register context
     // The child will get 0, parent will get child PID when they run
     
     // Copy other process state
-    child->parent_pid = parent->pid;
+    process_set_parent(child, parent);
     child->state = PROCESS_STATE_READY;
     child->priority = parent->priority;
-    child->ticks_remaining = DEFAULT_QUANTUM;
-    child->ticks_total = 0;
+    // Real-time class is inherited; deadline bandwidth is not
+    if (parent->policy == SCHED_FIFO || parent->policy == SCHED_RR) {
+        child->policy = parent->policy;
+        child->rt_priority = parent->rt_priority;
+    }
+    child->ticks_remaining = process_quantum(child);
+    child->sum_exec_runtime = 0;
     
     // Copy memory layout info
-    child->heap_start = parent->heap_start;
-    child->heap_current = parent->heap_current;
-    child->heap_max = parent->heap_max;
+    child->mm->heap_start = parent->mm->heap_start;
+    child->mm->heap_current = parent->mm->heap_current;
+    child->mm->heap_max = parent->mm->heap_max;
+    child->mm->pages_allocated = parent->mm->pages_allocated;
     child->stack_bottom = parent->stack_bottom;
     child->stack_top = parent->stack_top;
-    child->pages_allocated = parent->pages_allocated;
+    child->fs_base = parent->fs_base;
+    child->gs_base = rdmsr(MSR_KERNEL_GS_BASE);
     child->page_faults = 0;
     
     // Copy file descriptor table
-    if (parent->fd_table && child->fd_table) {
-        fd_entry_t* parent_fds = (fd_entry_t*)parent->fd_table;
-        fd_entry_t* child_fds = (fd_entry_t*)child->fd_table;
+    if (parent->mm->fd_table && child->mm->fd_table) {
+        fd_entry_t* parent_fds = (fd_entry_t*)parent->mm->fd_table;
+        fd_entry_t* child_fds = (fd_entry_t*)child->mm->fd_table;
         
         for (int i = 0; i < MAX_FDS; i++) {
             child_fds[i] = parent_fds[i];
@@ -316,6 +742,9 @@ static uint64_t sys_fork(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t a
         }
     }
     
+    // Inherit shared memory attachments
+    shm_fork(parent->mm, child->mm);
+    
     // Add to ready queue
     ready_queue_push(child);
     
@@ -337,34 +766,32 @@ static uint64_t sys_wait(uint64_t status_ptr, uint64_t arg2, uint64_t arg3, uint
     
     terminal_writestring("[WAIT] Process waiting for child\n");
     
-    while (1) {
-        // Look for zombie children
-        process_t* child = find_zombie_child(parent->pid);
-        if (child) {
-            // Found a zombie child
-            if (status_ptr) {
-                int* status = (int*)status_ptr;
-                *status = child->exit_status;
-            }
-            
-            uint32_t child_pid = child->pid;
-            
-            terminal_writestring("[WAIT] Reaping child PID ");
-            // TODO: Print child PID
-            terminal_writestring("\n");
-            
-            // Clean up child
-            free_process_struct(child);
-            
-            return child_pid;
-        }
-        
-        // No zombie children, block and wait
-        parent->state = PROCESS_STATE_WAITING;
-        schedule();  // Switch to another process
-        
-        // When we get here, we've been woken up - check again
+    // Sleep until a child exits (sys_exit wakes us), or fail if there
+    // are no children left to wait for
+    process_t* child = NULL;
+    wait_event(parent->child_exit,
+               (child = find_zombie_child(parent)) != NULL ||
+               !process_has_children(parent));
+    
+    if (!child) {
+        return -1;  // ECHILD
     }
+    
+    if (status_ptr) {
+        int* status = (int*)status_ptr;
+        *status = child->exit_status;
+    }
+    
+    uint32_t child_pid = child->pid;
+    
+    terminal_writestring("[WAIT] Reaping child PID ");
+    // TODO: Print child PID
+    terminal_writestring("\n");
+    
+    // Clean up child
+    free_process_struct(child);
+    
+    return child_pid;
 }
 
 // sys_execve: Execute a new program
@@ -402,8 +829,22 @@ static uint64_t sys_execve(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_p
             terminal_writestring(builtins[i].name);
             terminal_writestring("\n");
             
+            // Other threads are still running in this address space
+            if (current->mm->users > 1) {
+                terminal_writestring("[EXEC] Refusing exec with live threads\n");
+                return -1;  // EBUSY
+            }
+            
             // Clear current address space (except kernel mappings)
-            vmm_clear_user_space(current->page_table);
+            shm_exit(current->mm);
+            io_ring_exit(current->mm);
+            vmm_clear_user_space(current->mm->page_table);
+            mm_clear_vmas(current->mm);
+            vmm_setup_user_heap(current);
+            fpu_release(current);
+            if (vdso_map(current) < 0) {
+                return -1;
+            }
             
             // Set up new process state
             current->context.rip = (uint64_t)builtins[i].entry;
@@ -428,51 +869,59 @@ static uint64_t sys_execve(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_p
 static uint64_t sys_ps(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
     (void)arg1; (void)arg2; (void)arg3; (void)arg4; (void)arg5;
     
-    terminal_writestring("PID  PPID  STATE     NAME\n");
-    terminal_writestring("---  ----  --------  ----------\n");
-    
-    // Iterate through process table
-    extern process_t* process_table[];
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_t* p = process_table[i];
-        if (p) {
-            const char* state_str = "UNKNOWN";
-            switch (p->state) {
-                case PROCESS_STATE_READY:      state_str = "READY"; break;
-                case PROCESS_STATE_RUNNING:    state_str = "RUN"; break;
-                case PROCESS_STATE_BLOCKED:    state_str = "BLOCK"; break;
-                case PROCESS_STATE_WAITING:    state_str = "WAIT"; break;
-                case PROCESS_STATE_ZOMBIE:     state_str = "ZOMBIE"; break;
-                case PROCESS_STATE_TERMINATED: state_str = "TERM"; break;
-            }
-            
-            // Print PID (simple - just show first digit for now)
-            char pid_str[16];
-            int_to_string(p->pid, pid_str);
-            terminal_writestring(pid_str);
-            terminal_writestring("    ");
-            
-            // Print PPID
-            char ppid_str[16];
-            int_to_string(p->parent_pid, ppid_str);
-            terminal_writestring(ppid_str);
-            terminal_writestring("    ");
-            
-            // Print STATE
-            terminal_writestring(state_str);
-            
-            // Pad to align NAME column
-            int state_len = 0;
-            while (state_str[state_len]) state_len++;
-            for (int j = state_len; j < 8; j++) {
-                terminal_writestring(" ");
-            }
-            terminal_writestring("  ");
-            
-            // Print NAME
-            terminal_writestring(p->name);
-            terminal_writestring("\n");
+    terminal_writestring("PID  PPID  STATE     TIME(ms)  NAME\n");
+    terminal_writestring("---  ----  --------  --------  ----------\n");
+    
+    // Walk the process list
+    for (process_t* p = process_next(NULL); p; p = process_next(p)) {
+        const char* state_str = "UNKNOWN";
+        switch (p->state) {
+            case PROCESS_STATE_READY:      state_str = "READY"; break;
+            case PROCESS_STATE_RUNNING:    state_str = "RUN"; break;
+            case PROCESS_STATE_BLOCKED:    state_str = "BLOCK"; break;
+            case PROCESS_STATE_SLEEPING:   state_str = "SLEEP"; break;
+            case PROCESS_STATE_WAITING:    state_str = "WAIT"; break;
+            case PROCESS_STATE_ZOMBIE:     state_str = "ZOMBIE"; break;
+            case PROCESS_STATE_TERMINATED: state_str = "TERM"; break;
+        }
+        
+        // Print PID (simple - just show first digit for now)
+        char pid_str[16];
+        int_to_string(p->pid, pid_str);
+        terminal_writestring(pid_str);
+        terminal_writestring("    ");
+        
+        // Print PPID
+        char ppid_str[16];
+        int_to_string(p->parent_pid, ppid_str);
+        terminal_writestring(ppid_str);
+        terminal_writestring("    ");
+        
+        // Print STATE
+        terminal_writestring(state_str);
+        
+        // Pad to align NAME column
+        int state_len = 0;
+        while (state_str[state_len]) state_len++;
+        for (int j = state_len; j < 8; j++) {
+            terminal_writestring(" ");
+        }
+        terminal_writestring("  ");
+        
+        // Print CPU time
+        char time_str[16];
+        int_to_string((uint32_t)(p->sum_exec_runtime / NSEC_PER_MSEC), time_str);
+        terminal_writestring(time_str);
+        int time_len = 0;
+        while (time_str[time_len]) time_len++;
+        for (int j = time_len; j < 8; j++) {
+            terminal_writestring(" ");
         }
+        terminal_writestring("  ");
+        
+        // Print NAME
+        terminal_writestring(p->name);
+        terminal_writestring("\n");
     }
     
     return 0;
@@ -660,34 +1109,15 @@ void init_main(void) {
     }
 }
 
-// File descriptor table (per-process)
-#define MAX_FDS 16
-typedef struct {
-    fs_node_t* node;
-    pipe_t* pipe;
-    uint32_t offset;
-    int flags;
-    int is_pipe;
-} fd_entry_t;
-
-// Get current process's fd table
-static fd_entry_t* get_fd_table(void) {
-    process_t* current = process_get_current();
-    if (!current || !current->fd_table) {
-        return NULL;
-    }
-    return (fd_entry_t*)current->fd_table;
-}
-
-// Initialize fd table for a process
+// Initialize the fd table in a process's (new) mm
 void init_process_fd_table(process_t* proc) {
     if (!proc) return;
     
     // Allocate fd table
-    proc->fd_table = kmalloc(sizeof(fd_entry_t) * MAX_FDS);
-    if (!proc->fd_table) return;
+    proc->mm->fd_table = kmalloc(sizeof(fd_entry_t) * MAX_FDS);
+    if (!proc->mm->fd_table) return;
     
-    fd_entry_t* fds = (fd_entry_t*)proc->fd_table;
+    fd_entry_t* fds = (fd_entry_t*)proc->mm->fd_table;
     
     // Clear all entries
     for (int i = 0; i < MAX_FDS; i++) {
@@ -939,6 +1369,214 @@ static uint64_t sys_dup2(uint64_t oldfd, uint64_t newfd, uint64_t arg3, uint64_t
     return newfd;
 }
 
+// sys_shmget: Create or look up a shared memory segment
+static uint64_t sys_shmget(uint64_t key, uint64_t size, uint64_t flags, uint64_t arg4, uint64_t arg5) {
+    (void)arg4; (void)arg5;
+    
+    return shm_get((int)key, (size_t)size, (int)flags);
+}
+
+// sys_shmat: Attach a shared memory segment (addr 0 = kernel picks)
+static uint64_t sys_shmat(uint64_t shmid, uint64_t addr, uint64_t flags, uint64_t arg4, uint64_t arg5) {
+    (void)flags; (void)arg4; (void)arg5;
+    
+    return shm_attach(process_get_current(), (int)shmid, addr);
+}
+
+// sys_shmdt: Detach a shared memory segment
+static uint64_t sys_shmdt(uint64_t addr, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    (void)arg2; (void)arg3; (void)arg4; (void)arg5;
+    
+    return shm_detach(process_get_current(), addr);
+}
+
+// sys_shmctl: Shared memory control (IPC_STAT, IPC_RMID)
+static uint64_t sys_shmctl(uint64_t shmid, uint64_t cmd, uint64_t buf_ptr, uint64_t arg4, uint64_t arg5) {
+    (void)arg4; (void)arg5;
+    
+    return shm_ctl((int)shmid, (int)cmd, (shmid_ds_t*)buf_ptr);
+}
+
+// Look up a process by PID (0 = caller), pinned; release with
+// process_put()
+static process_t* sched_target(uint64_t pid) {
+    if (pid == 0) {
+        return process_get(process_get_current());
+    }
+    return process_find_by_pid((uint32_t)pid);
+}
+
+// sys_sched_setattr: Set scheduling class and parameters
+static uint64_t sys_sched_setattr(uint64_t pid, uint64_t attr_ptr, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    (void)arg3; (void)arg4; (void)arg5;
+    
+    process_t* proc = sched_target(pid);
+    int ret = sched_setattr(proc, (const sched_attr_t*)attr_ptr);
+    process_put(proc);
+    return ret;
+}
+
+// sys_sched_getattr: Get scheduling class and parameters
+static uint64_t sys_sched_getattr(uint64_t pid, uint64_t attr_ptr, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    (void)arg3; (void)arg4; (void)arg5;
+    
+    process_t* proc = sched_target(pid);
+    int ret = sched_getattr(proc, (sched_attr_t*)attr_ptr);
+    process_put(proc);
+    return ret;
+}
+
+// sys_clock_gettime: Read a clock with nanosecond resolution
+static uint64_t sys_clock_gettime(uint64_t clock_id, uint64_t ts_ptr, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    (void)arg3; (void)arg4; (void)arg5;
+    
+    if (clock_id != CLOCK_MONOTONIC || !ts_ptr) {
+        return -1;  // EINVAL
+    }
+    
+    uint64_t now = ktime_get_ns();
+    timespec_t* ts = (timespec_t*)ts_ptr;
+    ts->tv_sec = now / NSEC_PER_SEC;
+    ts->tv_nsec = now % NSEC_PER_SEC;
+    return 0;
+}
+
+// sys_ring_setup: Give the caller's address space an I/O ring; returns
+// where it is mapped
+static uint64_t sys_ring_setup(uint64_t entries, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    (void)arg2; (void)arg3; (void)arg4; (void)arg5;
+    
+    return io_ring_setup(process_get_current(), (uint32_t)entries);
+}
+
+// sys_ring_enter: Submit queued I/O requests and optionally wait for
+// completions
+static uint64_t sys_ring_enter(uint64_t to_submit, uint64_t min_complete, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    (void)arg3; (void)arg4; (void)arg5;
+    
+    return io_ring_enter(process_get_current(), (uint32_t)to_submit, (uint32_t)min_complete);
+}
+
+// sys_systrace: Turn tracing on or off, read out trace events or copy
+// out per system call statistics
+static uint64_t sys_systrace(uint64_t op, uint64_t arg, uint64_t arg2, uint64_t arg4, uint64_t arg5) {
+    (void)arg4; (void)arg5;
+    
+    return systrace_ctl(op, arg, arg2);
+}
+
+// sys_clone: Start a thread in the caller's address space. It returns
+// from this system call with 0, on 'stack' if one is given and with its
+// FS base at 'tls' (CLONE_SETTLS). With CLONE_CHILD_CLEARTID the new TID
+// is stored at 'ctid', which is cleared and futex-woken when the thread
+// exits. Only threads are made here; fork() copies an address space.
+static uint64_t sys_clone(uint64_t flags, uint64_t stack, uint64_t tls, uint64_t ctid, uint64_t arg5) {
+    (void)arg5;
+    
+    process_t* parent = process_get_current();
+    if (!parent || parent->pid == 0 || !parent->syscall_regs || !(flags & CLONE_VM)) {
+        return -1;  // EINVAL
+    }
+    
+    // Nothing to copy: the new task holds a reference to our mm
+    process_t* child = allocate_process_struct(mm_get(parent->mm));
+    if (!child) {
+        return -1;  // EAGAIN
+    }
+    
+    strncpy(child->name, parent->name, 31);
+    child->name[31] = '\0';
+    child->tgid = parent->tgid;
+    child->priority = parent->priority;
+    if (parent->policy == SCHED_FIFO || parent->policy == SCHED_RR) {
+        child->policy = parent->policy;
+        child->rt_priority = parent->rt_priority;
+    }
+    child->ticks_remaining = process_quantum(child);
+    child->stack_top = stack;
+    child->fs_base = (flags & CLONE_SETTLS) ? tls : parent->fs_base;
+    child->gs_base = rdmsr(MSR_KERNEL_GS_BASE);
+    if (fpu_copy(child, parent) < 0) {
+        free_process_struct(child);
+        return -1;  // ENOMEM
+    }
+    
+    if ((flags & CLONE_CHILD_CLEARTID) && ctid) {
+        child->clear_child_tid = (volatile uint32_t*)ctid;
+        *child->clear_child_tid = child->pid;
+    }
+    
+    // The child starts on a copy of our trap frame at the top of its own
+    // kernel stack and leaves through clone_return_trampoline
+    registers_t* frame = (registers_t*)((uint8_t*)child->kernel_stack + child->kernel_stack_size) - 1;
+    *frame = *parent->syscall_regs;
+    frame->rax = 0;
+    if (stack) {
+        frame->rsp = stack;
+    }
+    child->context.rsp = (uint64_t)frame;
+    child->context.rip = (uint64_t)clone_return_trampoline;
+    
+    child->state = PROCESS_STATE_READY;
+    ready_queue_push(child);
+    
+    return child->pid;
+}
+
+// sys_futex: Wait on or wake a user-space lock word
+static uint64_t sys_futex(uint64_t uaddr, uint64_t op, uint64_t val, uint64_t timeout_ms, uint64_t arg5) {
+    (void)arg5;
+    
+    if (!uaddr || (uaddr & 3)) {
+        return -1;  // EINVAL
+    }
+    
+    switch (op) {
+        case FUTEX_WAIT:
+            return futex_wait((volatile uint32_t*)uaddr, (uint32_t)val, timeout_ms);
+        case FUTEX_WAKE:
+            return futex_wake((volatile uint32_t*)uaddr, (uint32_t)val);
+        default:
+            return -1;  // ENOSYS
+    }
+}
+
+// sys_arch_prctl: Set or get the FS base used for thread-local storage,
+// or the user GS base (kept in KERNEL_GS_BASE while we are in here)
+static uint64_t sys_arch_prctl(uint64_t code, uint64_t addr, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    (void)arg3; (void)arg4; (void)arg5;
+    
+    process_t* current = process_get_current();
+    
+    switch (code) {
+        case ARCH_SET_FS:
+            current->fs_base = addr;
+            wrmsr(MSR_FS_BASE, addr);
+            return 0;
+        case ARCH_GET_FS:
+            if (!addr) {
+                return -1;
+            }
+            *(uint64_t*)addr = current->fs_base;
+            return 0;
+        case ARCH_SET_GS:
+            if (addr >= USER_SPACE_END) {
+                return -1;
+            }
+            current->gs_base = addr;
+            wrmsr(MSR_KERNEL_GS_BASE, addr);
+            return 0;
+        case ARCH_GET_GS:
+            if (!addr) {
+                return -1;
+            }
+            *(uint64_t*)addr = rdmsr(MSR_KERNEL_GS_BASE);
+            return 0;
+        default:
+            return -1;  // EINVAL
+    }
+}
+
 // System call handler (called from INT 0x80)
 void syscall_handler(registers_t* regs) {
     // We're now in kernel mode with kernel stack from TSS
@@ -960,13 +1598,44 @@ void syscall_handler(registers_t* regs) {
         return;
     }
     
-    // Call the system call
+    // clone() copies the caller's registers from here
+    process_t* current = process_get_current();
+    current->syscall_regs = regs;
+    
+    // Call the system call. System calls still assume they have the
+    // kernel to themselves, so they run under the big kernel lock.
+    // Timing covers the wait for the lock.
+    uint64_t start = rdtsc();
+    lock_kernel();
     uint64_t result = syscall_table[syscall_num](arg1, arg2, arg3, arg4, arg5);
+    uint64_t args[5] = { arg1, arg2, arg3, arg4, arg5 };
+    systrace_account(current, syscall_num, args, result, start);
+    unlock_kernel();
     
     // Return value in RAX
     regs->rax = result;
 }
 
+// Same table, no trap: the caller already holds the big kernel lock
+uint64_t syscall_invoke(uint64_t num, uint64_t arg1, uint64_t arg2, uint64_t arg3) {
+    if (num >= MAX_SYSCALLS || syscall_table[num] == NULL) {
+        return -1;  // ENOSYS
+    }
+    return syscall_table[num](arg1, arg2, arg3, 0, 0);
+}
+
+// SYSCALL entry for this CPU: kernel CS/SS from STAR[47:32], user SS
+// and CS at STAR[63:48] + 8 and + 16 for SYSRET, and IF, DF, TF and AC
+// cleared on entry
+void syscall_init_cpu(void) {
+    extern void syscall_entry(void);
+    
+    wrmsr(MSR_STAR, (0x10ULL << 48) | (0x08ULL << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+    wrmsr(MSR_FMASK, 0x200 | 0x400 | 0x100 | 0x40000);
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | 1);    // SCE
+}
+
 // Initialize system call interface
 void init_syscalls(void) {
     // Clear syscall table
@@ -993,9 +1662,32 @@ void init_syscalls(void) {
     syscall_table[SYS_KILL] = sys_kill;
     syscall_table[SYS_PIPE] = sys_pipe;
     syscall_table[SYS_DUP2] = sys_dup2;
+    syscall_table[SYS_SHMGET] = sys_shmget;
+    syscall_table[SYS_SHMAT] = sys_shmat;
+    syscall_table[SYS_SHMDT] = sys_shmdt;
+    syscall_table[SYS_SHMCTL] = sys_shmctl;
+    syscall_table[SYS_MADVISE] = sys_madvise;
+    syscall_table[SYS_SCHED_SETATTR] = sys_sched_setattr;
+    syscall_table[SYS_SCHED_GETATTR] = sys_sched_getattr;
+    syscall_table[SYS_CLOCK_GETTIME] = sys_clock_gettime;
+    syscall_table[SYS_CLONE] = sys_clone;
+    syscall_table[SYS_FUTEX] = sys_futex;
+    syscall_table[SYS_ARCH_PRCTL] = sys_arch_prctl;
+    syscall_table[SYS_GETTID] = sys_gettid;
+    syscall_table[SYS_GETCPU] = sys_getcpu;
+    syscall_table[SYS_RING_SETUP] = sys_ring_setup;
+    syscall_table[SYS_RING_ENTER] = sys_ring_enter;
+    syscall_table[SYS_READV] = sys_readv;
+    syscall_table[SYS_WRITEV] = sys_writev;
+    syscall_table[SYS_PREAD] = sys_pread;
+    syscall_table[SYS_PWRITE] = sys_pwrite;
+    syscall_table[SYS_SYSTRACE] = sys_systrace;
+    syscall_table[SYS_SENDFILE] = sys_sendfile;
+    syscall_table[SYS_SPLICE] = sys_splice;
     
     // Register INT 0x80 handler
     register_interrupt_handler(0x80, syscall_handler);
+    syscall_init_cpu();
     
-    terminal_writestring("System call interface initialized (INT 0x80)\n");
-}
\ No newline at end of file
+    terminal_writestring("System call interface initialized (INT 0x80, SYSCALL)\n");
+}
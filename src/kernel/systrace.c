@@ -0,0 +1,246 @@
+#include "../include/systrace.h"
+#include "../include/process.h"
+#include "../include/kmalloc.h"
+#include "../include/cpu.h"
+#include "../include/string.h"
+#include "../include/terminal.h"
+
+// Everything here changes under the big kernel lock, which every system
+// call holds by the time it is accounted.
+
+static syscall_stat_t systrace_stats_all[MAX_SYSCALLS];
+
+// Trace ring
+static systrace_event_t systrace_ring[SYSTRACE_RING_SIZE];
+static uint64_t systrace_head = 0;      // Sequence number of the next event
+static uint64_t systrace_tail = 0;      // Oldest unread event
+static bool systrace_on = false;
+static uint32_t systrace_pid = 0;       // 0: every process
+
+static const char* const syscall_names[MAX_SYSCALLS] = {
+    [SYS_EXIT] = "exit",
+    [SYS_WRITE] = "write",
+    [SYS_READ] = "read",
+    [SYS_GETPID] = "getpid",
+    [SYS_SLEEP] = "sleep",
+    [SYS_SBRK] = "sbrk",
+    [SYS_FORK] = "fork",
+    [SYS_WAIT] = "wait",
+    [SYS_EXECVE] = "execve",
+    [SYS_PS] = "ps",
+    [SYS_OPEN] = "open",
+    [SYS_CLOSE] = "close",
+    [SYS_STAT] = "stat",
+    [SYS_MKDIR] = "mkdir",
+    [SYS_READDIR] = "readdir",
+    [SYS_KILL] = "kill",
+    [SYS_PIPE] = "pipe",
+    [SYS_DUP2] = "dup2",
+    [SYS_SHMGET] = "shmget",
+    [SYS_SHMAT] = "shmat",
+    [SYS_SHMDT] = "shmdt",
+    [SYS_SHMCTL] = "shmctl",
+    [SYS_MADVISE] = "madvise",
+    [SYS_SCHED_SETATTR] = "sched_setattr",
+    [SYS_SCHED_GETATTR] = "sched_getattr",
+    [SYS_CLOCK_GETTIME] = "clock_gettime",
+    [SYS_CLONE] = "clone",
+    [SYS_FUTEX] = "futex",
+    [SYS_ARCH_PRCTL] = "arch_prctl",
+    [SYS_GETTID] = "gettid",
+    [SYS_GETCPU] = "getcpu",
+    [SYS_RING_SETUP] = "ring_setup",
+    [SYS_RING_ENTER] = "ring_enter",
+    [SYS_READV] = "readv",
+    [SYS_WRITEV] = "writev",
+    [SYS_PREAD] = "pread",
+    [SYS_PWRITE] = "pwrite",
+    [SYS_SYSTRACE] = "systrace",
+    [SYS_SENDFILE] = "sendfile",
+    [SYS_SPLICE] = "splice",
+};
+
+// Helper to print a decimal number
+static void print_dec(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
+// Add one call taking 'cycles'
+static void systrace_stat_add(syscall_stat_t* stat, uint64_t cycles) {
+    uint32_t bucket = 63 - __builtin_clzll(cycles | 1);
+    if (bucket >= SYSTRACE_HIST_BUCKETS) {
+        bucket = SYSTRACE_HIST_BUCKETS - 1;
+    }
+    
+    if (stat->count == 0 || cycles < stat->min) {
+        stat->min = cycles;
+    }
+    if (cycles > stat->max) {
+        stat->max = cycles;
+    }
+    stat->count++;
+    stat->total += cycles;
+    stat->hist[bucket]++;
+}
+
+// The process's table is allocated on its first call; without memory
+// only the system-wide numbers are kept
+void systrace_account(process_t* proc, uint64_t nr, const uint64_t* args,
+                      uint64_t ret, uint64_t start) {
+    uint64_t cycles = rdtsc() - start;
+    
+    systrace_stat_add(&systrace_stats_all[nr], cycles);
+    if (proc) {
+        if (!proc->syscall_stats) {
+            proc->syscall_stats = (syscall_stat_t*)kzalloc(sizeof(syscall_stat_t) * MAX_SYSCALLS);
+        }
+        if (proc->syscall_stats) {
+            systrace_stat_add(&proc->syscall_stats[nr], cycles);
+        }
+    }
+    
+    // The tracer's own reads would drown out what it is looking at
+    if (!systrace_on || nr == SYS_SYSTRACE || !proc) {
+        return;
+    }
+    if (systrace_pid && proc->tgid != systrace_pid && proc->pid != systrace_pid) {
+        return;
+    }
+    
+    systrace_event_t* ev = &systrace_ring[systrace_head & (SYSTRACE_RING_SIZE - 1)];
+    ev->seq = systrace_head;
+    ev->start = start;
+    ev->cycles = cycles;
+    ev->pid = proc->pid;
+    ev->nr = (uint32_t)nr;
+    memcpy(ev->args, args, sizeof(ev->args));
+    ev->ret = (int64_t)ret;
+    
+    systrace_head++;
+    if (systrace_head - systrace_tail > SYSTRACE_RING_SIZE) {
+        systrace_tail = systrace_head - SYSTRACE_RING_SIZE;
+    }
+}
+
+// Copy out the oldest unread events
+static int64_t systrace_read_events(systrace_event_t* events, uint64_t max) {
+    if (!events) {
+        return -1;
+    }
+    
+    uint64_t n = 0;
+    while (n < max && systrace_tail != systrace_head) {
+        events[n++] = systrace_ring[systrace_tail & (SYSTRACE_RING_SIZE - 1)];
+        systrace_tail++;
+    }
+    return n;
+}
+
+// Copy out a process's table, or the system-wide one for PID 0
+static int64_t systrace_copy_stats(uint32_t pid, syscall_stat_t* stats) {
+    if (!stats) {
+        return -1;
+    }
+    
+    // The pin keeps the table until the copy is done
+    const syscall_stat_t* src = systrace_stats_all;
+    process_t* proc = NULL;
+    if (pid) {
+        proc = process_find_by_pid(pid);
+        if (!proc) {
+            return -1;
+        }
+        src = proc->syscall_stats;
+    }
+    
+    if (src) {
+        memcpy(stats, src, sizeof(syscall_stat_t) * MAX_SYSCALLS);
+    } else {
+        memset(stats, 0, sizeof(syscall_stat_t) * MAX_SYSCALLS);
+    }
+    process_put(proc);
+    return 0;
+}
+
+// Turning tracing on starts over; events left from before are dropped
+int64_t systrace_ctl(uint64_t op, uint64_t arg, uint64_t arg2) {
+    switch (op) {
+    case SYSTRACE_ENABLE:
+        // Start a fresh trace
+        systrace_tail = systrace_head;
+        systrace_pid = (uint32_t)arg;
+        systrace_on = true;
+        return 0;
+    case SYSTRACE_DISABLE:
+        systrace_on = false;
+        return 0;
+    case SYSTRACE_READ:
+        return systrace_read_events((systrace_event_t*)arg, arg2);
+    case SYSTRACE_STATS:
+        return systrace_copy_stats((uint32_t)arg, (syscall_stat_t*)arg2);
+    case SYSTRACE_RESET:
+        memset(systrace_stats_all, 0, sizeof(systrace_stats_all));
+        return 0;
+    default:
+        return -1;  // EINVAL
+    }
+}
+
+// The table goes with the process
+void systrace_release(process_t* proc) {
+    if (proc->syscall_stats) {
+        kfree(proc->syscall_stats);
+        proc->syscall_stats = NULL;
+    }
+}
+
+// For printing traces
+const char* systrace_name(uint64_t nr) {
+    return nr < MAX_SYSCALLS ? syscall_names[nr] : NULL;
+}
+
+// One line per system call that has been made: count, average, fastest,
+// slowest and the median's histogram bucket
+void systrace_print_stats(void) {
+    terminal_writestring("System calls (cycles, entry to return):\n");
+    
+    for (uint32_t nr = 0; nr < MAX_SYSCALLS; nr++) {
+        const syscall_stat_t* stat = &systrace_stats_all[nr];
+        if (stat->count == 0) {
+            continue;
+        }
+        
+        // The bucket holding the middle call
+        uint64_t seen = 0;
+        uint32_t median = 0;
+        for (uint32_t b = 0; b < SYSTRACE_HIST_BUCKETS; b++) {
+            seen += stat->hist[b];
+            if (seen * 2 >= stat->count) {
+                median = b;
+                break;
+            }
+        }
+        
+        terminal_writestring("  ");
+        terminal_writestring(syscall_names[nr] ? syscall_names[nr] : "?");
+        terminal_writestring(": ");
+        print_dec(stat->count);
+        terminal_writestring(" calls, avg ");
+        print_dec(stat->total / stat->count);
+        terminal_writestring(" min ");
+        print_dec(stat->min);
+        terminal_writestring(" max ");
+        print_dec(stat->max);
+        terminal_writestring(", median under ");
+        print_dec(2ULL << median);
+        terminal_writestring("\n");
+    }
+    terminal_writestring(systrace_on ? "Tracing on\n" : "Tracing off\n");
+}
@@ -0,0 +1,244 @@
+#include "../include/vdso.h"
+#include "../include/process.h"
+#include "../include/syscall.h"
+#include "../include/mm.h"
+#include "../include/vmm.h"
+#include "../include/pmm.h"
+#include "../include/smp.h"
+#include "../include/cpu.h"
+#include "../include/string.h"
+#include "../include/panic.h"
+
+// CPUID.80000001H:EDX
+#define CPUID_RDTSCP    (1 << 27)
+
+// vDSO code runs in ring 3 from a copy at VDSO_TEXT_ADDR, so it may only
+// call within its own section and reaches data through fixed addresses.
+// Helpers are forced inline to keep them out of the kernel's .text.
+#define VDSO_FN         static __attribute__((section(".vdso.text"), used, noipa))
+#define VDSO_INLINE     static inline __attribute__((always_inline))
+
+// Bounds of the vDSO code in the kernel image (linker.ld)
+extern uint8_t __vdso_start[];
+extern uint8_t __vdso_end[];
+
+static vdso_data_t* vdso_data = NULL;
+static void* vdso_text[VDSO_TEXT_PAGES];
+static uint32_t vdso_text_pages = 0;
+
+// A system call for what the vDSO cannot answer itself. Only ring 3
+// calls into the vDSO, so SYSCALL is safe here.
+VDSO_INLINE uint64_t vdso_syscall2(uint64_t num, uint64_t arg1, uint64_t arg2) {
+    uint64_t ret;
+    asm volatile("syscall" : "=a"(ret) : "a"(num), "D"(arg1), "S"(arg2) : "rcx", "r11", "memory");
+    return ret;
+}
+
+VDSO_INLINE uint64_t vdso_rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Nanoseconds since boot, read like ktime_get_ns(). False if the clock
+// is not one user mode can read.
+VDSO_INLINE bool vdso_read_ns(uint64_t* ns) {
+    const vdso_data_t* vd = (const vdso_data_t*)VDSO_VVAR_ADDR;
+    uint32_t seq;
+    
+    do {
+        seq = vd->seq;
+        __sync_synchronize();
+        if (vd->clock_mode != VDSO_CLOCK_TSC) {
+            return false;
+        }
+        uint64_t delta = (vdso_rdtsc() - vd->base_cycles) & vd->mask;
+        *ns = vd->base_ns + (uint64_t)(((unsigned __int128)delta * vd->mult) >> 32);
+        __sync_synchronize();
+    } while ((seq & 1) || seq != vd->seq);
+    
+    return true;
+}
+
+// clock_gettime(): CLOCK_MONOTONIC from the TSC, anything else from
+// the kernel
+VDSO_FN int vdso_fn_clock_gettime(uint32_t clock_id, timespec_t* ts) {
+    uint64_t ns;
+    if (clock_id != CLOCK_MONOTONIC || !vdso_read_ns(&ns)) {
+        return (int)vdso_syscall2(SYS_CLOCK_GETTIME, clock_id, (uint64_t)ts);
+    }
+    
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+    return 0;
+}
+
+// gettimeofday(): there is no RTC, so like every clock here it counts
+// from boot. The time zone is ignored.
+VDSO_FN int vdso_fn_gettimeofday(timeval_t* tv, void* tz) {
+    (void)tz;
+    
+    uint64_t ns;
+    if (!vdso_read_ns(&ns)) {
+        timespec_t ts;
+        if ((int)vdso_syscall2(SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, (uint64_t)&ts) < 0) {
+            return -1;
+        }
+        ns = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+    }
+    
+    if (tv) {
+        tv->tv_sec = ns / NSEC_PER_SEC;
+        tv->tv_usec = (ns % NSEC_PER_SEC) / NSEC_PER_USEC;
+    }
+    return 0;
+}
+
+// getpid(): from this address space's identity page
+VDSO_FN uint64_t vdso_fn_getpid(void) {
+    return ((const vdso_ident_t*)VDSO_IDENT_ADDR)->pid;
+}
+
+// getcpu(): RDTSCP returns TSC_AUX, which holds the CPU number. The
+// answer may be stale by the time the caller looks at it.
+VDSO_FN int vdso_fn_getcpu(uint32_t* cpu, uint32_t* node) {
+    const vdso_data_t* vd = (const vdso_data_t*)VDSO_VVAR_ADDR;
+    uint32_t id;
+    
+    if (vd->have_rdtscp) {
+        uint32_t lo, hi;
+        asm volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(id));
+    } else {
+        id = (uint32_t)vdso_syscall2(SYS_GETCPU, 0, 0);
+    }
+    
+    if (cpu) {
+        *cpu = id;
+    }
+    if (node) {
+        *node = 0;                  // One memory node
+    }
+    return 0;
+}
+
+// Where a vDSO function lands in user space
+static uint64_t vdso_user_addr(void* fn) {
+    return VDSO_TEXT_ADDR + ((uint8_t*)fn - __vdso_start);
+}
+
+// Copy the code into frames of its own and fill in the data page. The
+// frames are shared by every address space and never freed.
+void vdso_init(void) {
+    size_t size = __vdso_end - __vdso_start;
+    vdso_text_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (vdso_text_pages > VDSO_TEXT_PAGES) {
+        panic("vDSO: code does not fit in VDSO_TEXT_PAGES");
+    }
+    
+    vdso_data = (vdso_data_t*)pmm_alloc_page();
+    if (!vdso_data) {
+        panic("vDSO: out of memory");
+    }
+    for (uint32_t i = 0; i < vdso_text_pages; i++) {
+        vdso_text[i] = pmm_alloc_page();
+        if (!vdso_text[i]) {
+            panic("vDSO: out of memory");
+        }
+        
+        size_t offset = i * PAGE_SIZE;
+        size_t len = size - offset < PAGE_SIZE ? size - offset : PAGE_SIZE;
+        memcpy(vdso_text[i], __vdso_start + offset, len);
+    }
+    
+    vdso_data->sym[VDSO_SYM_CLOCK_GETTIME] = vdso_user_addr((void*)vdso_fn_clock_gettime);
+    vdso_data->sym[VDSO_SYM_GETTIMEOFDAY] = vdso_user_addr((void*)vdso_fn_gettimeofday);
+    vdso_data->sym[VDSO_SYM_GETPID] = vdso_user_addr((void*)vdso_fn_getpid);
+    vdso_data->sym[VDSO_SYM_GETCPU] = vdso_user_addr((void*)vdso_fn_getcpu);
+    
+    // Until clocksource_init() says otherwise, time comes from the kernel
+    vdso_data->clock_mode = VDSO_CLOCK_NONE;
+    
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000001) {
+        cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+        vdso_data->have_rdtscp = (edx & CPUID_RDTSCP) != 0;
+    }
+    
+    vdso_init_cpu();
+}
+
+// TSC_AUX is only read by RDTSCP, so the CPU number can live there
+void vdso_init_cpu(void) {
+    if (vdso_data->have_rdtscp) {
+        wrmsr(MSR_TSC_AUX, this_cpu()->id);
+    }
+}
+
+// Map a kernel frame read-only for user mode. Pinned, it is not
+// reference counted, so any number of address spaces can share it.
+static int vdso_map_shared(process_t* proc, uint64_t virt, void* frame) {
+    return vmm_map_page(proc->mm->page_table, virt, (uint64_t)frame,
+                        PAGE_USER | PAGE_SHARED | PAGE_PINNED);
+}
+
+// Give the address space a new identity page, dropping the one it had
+// (fork shares the parent's). PAGE_SHARED keeps it out of swap.
+static int vdso_map_ident(process_t* proc) {
+    vdso_ident_t* ident = (vdso_ident_t*)pmm_alloc_page();
+    if (!ident) {
+        return -1;
+    }
+    ident->pid = proc->tgid;
+    
+    uint64_t* pte = vmm_get_pte(proc->mm->page_table, VDSO_IDENT_ADDR);
+    uint64_t old = pte ? *pte : 0;
+    if (vmm_map_page(proc->mm->page_table, VDSO_IDENT_ADDR, (uint64_t)ident, PAGE_USER | PAGE_SHARED) < 0) {
+        pmm_free_page(ident);
+        return -1;
+    }
+    if (old & PAGE_PRESENT) {
+        pmm_page_unref((void*)(old & ~0xFFF));
+    }
+    return 0;
+}
+
+// Map the data, identity and code pages at their fixed addresses
+int vdso_map(process_t* proc) {
+    if (vdso_map_shared(proc, VDSO_VVAR_ADDR, vdso_data) < 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < vdso_text_pages; i++) {
+        if (vdso_map_shared(proc, VDSO_TEXT_ADDR + i * PAGE_SIZE, vdso_text[i]) < 0) {
+            return -1;
+        }
+    }
+    if (vdso_map_ident(proc) < 0) {
+        return -1;
+    }
+    
+    return mm_add_vma(proc->mm, VDSO_VVAR_ADDR, VDSO_TEXT_ADDR + vdso_text_pages * PAGE_SIZE,
+                      VMA_READ | VMA_EXEC);
+}
+
+// The copied address space already shares the data and code pages
+int vdso_fork(process_t* child) {
+    return vdso_map_ident(child);
+}
+
+// Called with the clocksource's sequence count held odd, so the two
+// pages never disagree for long
+void vdso_update_clock(uint32_t mode, uint64_t base_cycles, uint64_t base_ns,
+                       uint64_t mult, uint64_t mask) {
+    vdso_data_t* vd = vdso_data;
+    
+    vd->seq++;
+    __sync_synchronize();
+    vd->clock_mode = mode;
+    vd->base_cycles = base_cycles;
+    vd->base_ns = base_ns;
+    vd->mult = mult;
+    vd->mask = mask;
+    __sync_synchronize();
+    vd->seq++;
+}
@@ -0,0 +1,124 @@
+#include "../include/wait.h"
+#include "../include/process.h"
+#include "../include/scheduler.h"
+
+// Initialize an empty wait queue
+void wait_queue_init(wait_queue_t* wq) {
+    spin_init(&wq->lock);
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+// Append an entry to the queue
+static void wait_queue_add(wait_queue_t* wq, wait_entry_t* entry) {
+    entry->next = NULL;
+    entry->prev = wq->tail;
+    if (wq->tail) {
+        wq->tail->next = entry;
+    } else {
+        wq->head = entry;
+    }
+    wq->tail = entry;
+    entry->queued = true;
+}
+
+// Unlink an entry if it is still queued
+static void wait_queue_remove(wait_queue_t* wq, wait_entry_t* entry) {
+    if (!entry->queued) {
+        return;
+    }
+    
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wq->head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        wq->tail = entry->prev;
+    }
+    entry->next = NULL;
+    entry->prev = NULL;
+    entry->queued = false;
+}
+
+// Queue the current process (again, if a wakeup took it off) and mark it
+// blocked. Contexts that can't block (the idle loop, early boot) are
+// queued but keep running.
+void prepare_to_wait(wait_queue_t* wq, wait_entry_t* entry) {
+    process_t* self = process_get_current();
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    
+    entry->proc = self;
+    if (!entry->queued) {
+        wait_queue_add(wq, entry);
+    }
+    if (self->pid != 0) {
+        self->state = PROCESS_STATE_BLOCKED;
+    }
+    
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Done waiting
+void finish_wait(wait_queue_t* wq, wait_entry_t* entry) {
+    process_t* self = process_get_current();
+    if (self->pid != 0) {
+        self->state = PROCESS_STATE_RUNNING;
+    }
+    
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    wait_queue_remove(wq, entry);
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Switch away until woken. The idle loop just waits for the next
+// interrupt and lets the caller re-check.
+bool wait_schedule(uint64_t timeout) {
+    process_t* self = process_get_current();
+    if (self->pid == 0) {
+        asm volatile("sti; hlt; cli");
+        return true;
+    }
+    
+    bool woken = true;
+    if (timeout) {
+        woken = process_schedule_timeout((uint32_t)timeout);
+    } else {
+        schedule();
+    }
+    
+    asm volatile("cli");
+    return woken;
+}
+
+// Wake the first sleeper still waiting. Entries whose process already
+// woke up on a timeout are dropped on the way.
+void wake_up(wait_queue_t* wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    
+    while (wq->head) {
+        wait_entry_t* entry = wq->head;
+        wait_queue_remove(wq, entry);
+        if (try_to_wake_up(entry->proc, STATE_BIT(PROCESS_STATE_BLOCKED))) {
+            timer_del(&entry->proc->sleep_timer);
+            break;
+        }
+    }
+    
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Wake every sleeper
+void wake_up_all(wait_queue_t* wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    
+    while (wq->head) {
+        wait_entry_t* entry = wq->head;
+        wait_queue_remove(wq, entry);
+        process_unblock(entry->proc);
+    }
+    
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
@@ -0,0 +1,139 @@
+#include "../include/workqueue.h"
+#include "../include/process.h"
+#include "../include/kmalloc.h"
+#include "../include/terminal.h"
+
+#define MAX_WORKQUEUES 8
+
+// Shared queue for drivers that need process context now and then
+static workqueue_t events_wq = WORKQUEUE_INIT("events");
+
+// Every queue with a worker, for the stats
+static workqueue_t* workqueues[MAX_WORKQUEUES];
+static uint32_t workqueue_count = 0;
+
+// Take the next item off the queue, or NULL
+static work_t* workqueue_next(workqueue_t* wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    work_t* work = wq->head;
+    if (work) {
+        wq->head = work->next;
+        if (!wq->head) {
+            wq->tail = NULL;
+        }
+        work->next = NULL;
+        
+        // Requeuing from here on runs the item again
+        work->pending = false;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return work;
+}
+
+// Worker thread: run items in the order they were queued, sleeping
+// while there are none
+static void worker_thread(void* arg) {
+    workqueue_t* wq = (workqueue_t*)arg;
+    
+    while (1) {
+        wait_event(wq->wait, wq->head != NULL);
+        
+        work_t* work;
+        while ((work = workqueue_next(wq)) != NULL) {
+            work->func(work);
+            __sync_fetch_and_add(&wq->run, 1);
+        }
+    }
+}
+
+// Give a queue its worker
+static int workqueue_start(workqueue_t* wq, uint32_t priority) {
+    if (workqueue_count >= MAX_WORKQUEUES) {
+        return -1;
+    }
+    
+    wq->worker = kthread_create(wq->name, worker_thread, wq, priority);
+    if (!wq->worker) {
+        return -1;
+    }
+    workqueues[workqueue_count++] = wq;
+    return 0;
+}
+
+// The shared queue's worker runs at top priority: the work on it stands
+// in for what interrupt handlers used to do on the spot
+void workqueue_init(void) {
+    if (workqueue_start(&events_wq, 0) < 0) {
+        terminal_writestring("Workqueue: could not start the events worker\n");
+    }
+}
+
+// A queue of its own, for work that should not wait behind others'
+workqueue_t* workqueue_create(const char* name, uint32_t priority) {
+    workqueue_t* wq = (workqueue_t*)kmalloc(sizeof(workqueue_t));
+    if (!wq) {
+        return NULL;
+    }
+    
+    *wq = (workqueue_t)WORKQUEUE_INIT(name);
+    if (workqueue_start(wq, priority) < 0) {
+        kfree(wq);
+        return NULL;
+    }
+    return wq;
+}
+
+// Append to the queue and wake the worker. Safe from interrupt handlers.
+bool queue_work(workqueue_t* wq, work_t* work) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    if (work->pending) {
+        spin_unlock_irqrestore(&wq->lock, flags);
+        return false;
+    }
+    
+    work->pending = true;
+    work->next = NULL;
+    if (wq->tail) {
+        wq->tail->next = work;
+    } else {
+        wq->head = work;
+    }
+    wq->tail = work;
+    wq->queued++;
+    spin_unlock_irqrestore(&wq->lock, flags);
+    
+    wake_up(&wq->wait);
+    return true;
+}
+
+// Queue work on the shared queue
+bool schedule_work(work_t* work) {
+    return queue_work(&events_wq, work);
+}
+
+// Helper to print a decimal number
+static void print_dec(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
+// Print how much each queue has done
+void workqueue_print_stats(void) {
+    terminal_writestring("Workqueues:\n");
+    for (uint32_t i = 0; i < workqueue_count; i++) {
+        workqueue_t* wq = workqueues[i];
+        terminal_writestring("  ");
+        terminal_writestring(wq->name);
+        terminal_writestring(": ");
+        print_dec(wq->queued);
+        terminal_writestring(" queued, ");
+        print_dec(wq->run);
+        terminal_writestring(" run\n");
+    }
+}
@@ -1,6 +1,7 @@
 #include "../include/elf.h"
 #include "../include/process.h"
 #include "../include/vmm.h"
+#include "../include/mm.h"
 #include "../include/pmm.h"
 #include "../include/string.h"
 #include "../include/terminal.h"
@@ -72,6 +73,17 @@ int elf_load(process_t* process, void* elf_data, size_t size) {
         uint64_t end = (phdr->p_vaddr + phdr->p_memsz + 0xFFF) & ~0xFFF;
         uint64_t pages = (end - start) / PAGE_SIZE;
         
+        // Record the region. A segment sharing its first page with the
+        // previous one overlaps it and is already covered.
+        uint32_t vma_flags = VMA_READ;
+        if (phdr->p_flags & PF_W) {
+            vma_flags |= VMA_WRITE;
+        }
+        if (phdr->p_flags & PF_X) {
+            vma_flags |= VMA_EXEC;
+        }
+        mm_add_vma(process->mm, start, end, vma_flags);
+        
         // Map pages
         for (uint64_t j = 0; j < pages; j++) {
             uint64_t vaddr = start + j * PAGE_SIZE;
@@ -90,13 +102,13 @@ int elf_load(process_t* process, void* elf_data, size_t size) {
                 flags |= PAGE_WRITABLE;
             }
             
-            if (vmm_map_page(process->page_table, vaddr, paddr, flags) < 0) {
+            if (vmm_map_page(process->mm->page_table, vaddr, paddr, flags) < 0) {
                 terminal_writestring("ELF: Failed to map page\n");
                 pmm_free_page(phys_page);
                 return -1;
             }
             
-            process->pages_allocated++;
+            process->mm->pages_allocated++;
         }
         
         // Copy data
@@ -106,7 +118,7 @@ int elf_load(process_t* process, void* elf_data, size_t size) {
             // Copy page by page (since physical pages might not be contiguous)
             for (uint64_t off = 0; off < phdr->p_filesz; ) {
                 uint64_t vaddr = phdr->p_vaddr + off;
-                uint64_t paddr = vmm_get_physical(process->page_table, vaddr);
+                uint64_t paddr = vmm_get_physical(process->mm->page_table, vaddr);
                 if (paddr == 0) {
                     terminal_writestring("ELF: Failed to get physical address\n");
                     return -1;
@@ -132,7 +144,7 @@ int elf_load(process_t* process, void* elf_data, size_t size) {
             // Zero it out
             for (uint64_t off = 0; off < bss_size; ) {
                 uint64_t vaddr = bss_start + off;
-                uint64_t paddr = vmm_get_physical(process->page_table, vaddr);
+                uint64_t paddr = vmm_get_physical(process->mm->page_table, vaddr);
                 if (paddr == 0) {
                     terminal_writestring("ELF: Failed to get physical address for BSS\n");
                     return -1;
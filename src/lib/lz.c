@@ -0,0 +1,157 @@
+#include "../include/lz.h"
+
+// Each sequence is: token (literal length << 4 | match length - 4),
+// optional extra literal length bytes, literals, 16-bit offset and
+// optional extra match length bytes. The final sequence has literals only.
+
+#define LZ_MIN_MATCH  4
+#define LZ_HASH_BITS  10
+#define LZ_HASH_SIZE  (1 << LZ_HASH_BITS)
+#define LZ_MAX_OFFSET 0xFFFF
+
+// Match finder table (positions of recent 4-byte sequences)
+static uint16_t lz_table[LZ_HASH_SIZE];
+
+static inline uint32_t lz_read32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t lz_hash(uint32_t seq) {
+    return (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Write a length continuation (after a saturated 4-bit nibble)
+static int lz_put_length(uint8_t** op, uint8_t* oend, size_t n) {
+    while (n >= 255) {
+        if (*op >= oend) return -1;
+        *(*op)++ = 255;
+        n -= 255;
+    }
+    if (*op >= oend) return -1;
+    *(*op)++ = (uint8_t)n;
+    return 0;
+}
+
+// Emit one sequence. match_len == 0 means the trailing literal run.
+static int lz_emit(uint8_t** op, uint8_t* oend, const uint8_t* lits, size_t lit_len,
+                   size_t offset, size_t match_len) {
+    if (*op >= oend) return -1;
+    
+    uint8_t* token = (*op)++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15 && lz_put_length(op, oend, lit_len - 15) < 0) return -1;
+    
+    if ((size_t)(oend - *op) < lit_len) return -1;
+    for (size_t i = 0; i < lit_len; i++) {
+        *(*op)++ = lits[i];
+    }
+    
+    if (match_len == 0) return 0;
+    
+    if (oend - *op < 2) return -1;
+    *(*op)++ = (uint8_t)(offset & 0xFF);
+    *(*op)++ = (uint8_t)(offset >> 8);
+    
+    size_t ml = match_len - LZ_MIN_MATCH;
+    *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+    if (ml >= 15 && lz_put_length(op, oend, ml - 15) < 0) return -1;
+    
+    return 0;
+}
+
+// Compress a buffer
+size_t lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_cap) {
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_cap;
+    size_t ip = 0;
+    size_t anchor = 0;
+    
+    for (int i = 0; i < LZ_HASH_SIZE; i++) {
+        lz_table[i] = 0;
+    }
+    
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t seq = lz_read32(src + ip);
+        uint32_t h = lz_hash(seq);
+        size_t ref = lz_table[h];
+        lz_table[h] = (uint16_t)ip;
+        
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+        
+        // Extend the match as far as it goes
+        size_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < len && src[ref + match_len] == src[ip + match_len]) {
+            match_len++;
+        }
+        
+        if (lz_emit(&op, oend, src + anchor, ip - anchor, ip - ref, match_len) < 0) {
+            return 0;
+        }
+        
+        ip += match_len;
+        anchor = ip;
+    }
+    
+    // Trailing literals
+    if (lz_emit(&op, oend, src + anchor, len - anchor, 0, 0) < 0) {
+        return 0;
+    }
+    
+    return op - dst;
+}
+
+// Read a length continuation
+static int lz_get_length(const uint8_t** ip, const uint8_t* iend, size_t* n) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Decompress a buffer
+int lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_cap) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_cap;
+    
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        
+        // Literals
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && lz_get_length(&ip, iend, &lit_len) < 0) return -1;
+        if ((size_t)(iend - ip) < lit_len || (size_t)(oend - op) < lit_len) return -1;
+        for (size_t i = 0; i < lit_len; i++) {
+            *op++ = *ip++;
+        }
+        
+        if (ip >= iend) break;  // Last sequence has no match
+        
+        // Match
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+        
+        size_t match_len = token & 0x0F;
+        if (match_len == 15 && lz_get_length(&ip, iend, &match_len) < 0) return -1;
+        match_len += LZ_MIN_MATCH;
+        if ((size_t)(oend - op) < match_len) return -1;
+        
+        // Byte-wise copy handles overlapping matches (runs)
+        const uint8_t* match = op - offset;
+        for (size_t i = 0; i < match_len; i++) {
+            *op++ = match[i];
+        }
+    }
+    
+    return op - dst;
+}
@@ -0,0 +1,191 @@
+#include "../include/cma.h"
+#include "../include/pmm.h"
+#include "../include/vmm.h"
+#include "../include/process.h"
+#include "../include/multiboot.h"
+#include "../include/kmalloc.h"
+#include "../include/string.h"
+#include "../include/cpu.h"
+#include "../include/terminal.h"
+#include <stdbool.h>
+
+static uint64_t cma_base = 0;
+static size_t cma_pages = 0;
+static uint8_t* cma_used = NULL;    // Per page: owned by a DMA buffer
+static cma_stats_t cma_stats;
+
+// Reserve the region
+void cma_init(void) {
+    uint64_t size = cmdline_size("cma", CMA_DEFAULT_SIZE);
+    if (size == 0) {
+        terminal_writestring("CMA: disabled\n");
+        return;
+    }
+    
+    size_t pages = PAGE_ALIGN_UP(size) / PAGE_SIZE;
+    void* base = pmm_reserve_cma(pages);
+    if (!base) {
+        terminal_writestring("CMA: failed to reserve region\n");
+        return;
+    }
+    
+    // The PMM rounds the region up to its alignment
+    pmm_get_cma_stats(&pages, NULL);
+    
+    cma_used = (uint8_t*)kzalloc(pages);
+    if (!cma_used) {
+        terminal_writestring("CMA: out of memory for page map\n");
+        return;
+    }
+    
+    cma_base = (uint64_t)base;
+    cma_pages = pages;
+    terminal_writestring("CMA: contiguous region reserved\n");
+}
+
+// Find the PTE that maps a user frame. There is no reverse map, so every
+// user address space is searched.
+static uint64_t* cma_find_mapping(uint64_t frame, process_t** owner, uint64_t* virt) {
+    for (process_t* p = process_next(NULL); p; p = process_next(p)) {
+        if (!p->mm->page_table) continue;
+        
+        uint64_t va = 0;
+        uint64_t* pt;
+        while ((pt = vmm_next_pt(p->mm->page_table, &va)) != NULL) {
+            for (int i = 0; i < 512; i++) {
+                if ((pt[i] & PAGE_PRESENT) && (pt[i] & ~0xFFF & ~PAGE_NX) == frame) {
+                    *owner = p;
+                    *virt = va + (uint64_t)i * PAGE_SIZE;
+                    return &pt[i];
+                }
+            }
+            va += 1ULL << 21;
+        }
+    }
+    return NULL;
+}
+
+// Move a movable user page out of the region. On success the frame is
+// left allocated (refcount 1) for the caller.
+static int cma_migrate(uint64_t frame) {
+    if (pmm_page_refcount((void*)frame) != 1) {
+        return -1;  // Pinned or shared
+    }
+    
+    // Hold an extra reference so reclaim can't swap the page out from
+    // under us while allocating the copy
+    pmm_page_ref((void*)frame);
+    void* copy = pmm_alloc_page();  // Ordinary memory, never CMA
+    pmm_page_unref((void*)frame);
+    if (!copy) {
+        return -1;
+    }
+    
+    process_t* owner;
+    uint64_t virt;
+    uint64_t* pte = cma_find_mapping(frame, &owner, &virt);
+    if (!pte) {
+        pmm_free_page(copy);
+        return -1;
+    }
+    memcpy(copy, (void*)frame, PAGE_SIZE);
+    
+    *pte = (uint64_t)copy | (*pte & (0xFFF | PAGE_NX));
+    smp_flush_tlb_page(owner->mm->page_table, virt);
+    
+    cma_stats.pages_migrated++;
+    return 0;
+}
+
+// Take pages [first, first + count) of the region for a buffer
+static int cma_claim_range(size_t first, size_t count) {
+    size_t i;
+    
+    for (i = 0; i < count; i++) {
+        uint64_t page = cma_base + (first + i) * PAGE_SIZE;
+        if (cma_used[first + i]) {
+            break;
+        }
+        
+        if (pmm_alloc_page_at((void*)page) < 0 && cma_migrate(page) < 0) {
+            cma_stats.migrate_failures++;
+            break;
+        }
+        cma_used[first + i] = 1;
+    }
+    
+    if (i == count) {
+        return 0;
+    }
+    
+    // Roll back; migrated pages simply become free region pages
+    while (i-- > 0) {
+        cma_used[first + i] = 0;
+        pmm_free_page((void*)(cma_base + (first + i) * PAGE_SIZE));
+    }
+    return -1;
+}
+
+// Allocate a contiguous DMA buffer
+void* dma_alloc_coherent(size_t size, dma_addr_t* dma_handle) {
+    if (!cma_used || size == 0 || !dma_handle) {
+        return NULL;
+    }
+    
+    size_t count = PAGE_ALIGN_UP(size) / PAGE_SIZE;
+    size_t align = 1;
+    while (align < count && align < CMA_MAX_ALIGN_PAGES) {
+        align <<= 1;
+    }
+    
+    uint64_t flags = irq_save();
+    
+    // The region itself is 2MB aligned, so index alignment is enough
+    for (size_t first = 0; first + count <= cma_pages; first += align) {
+        if (cma_claim_range(first, count) == 0) {
+            uint64_t addr = cma_base + first * PAGE_SIZE;
+            memset((void*)addr, 0, count * PAGE_SIZE);
+            
+            cma_stats.allocs++;
+            cma_stats.pages_in_use += count;
+            irq_restore(flags);
+            
+            *dma_handle = addr;
+            return (void*)addr;
+        }
+    }
+    
+    cma_stats.failures++;
+    irq_restore(flags);
+    return NULL;
+}
+
+// Free a DMA buffer
+void dma_free_coherent(void* vaddr, size_t size, dma_addr_t dma_handle) {
+    uint64_t addr = (uint64_t)vaddr;
+    size_t count = PAGE_ALIGN_UP(size) / PAGE_SIZE;
+    
+    if (addr != dma_handle || addr < cma_base ||
+        addr + count * PAGE_SIZE > cma_base + cma_pages * PAGE_SIZE) {
+        terminal_writestring("dma_free_coherent: Bad buffer\n");
+        return;
+    }
+    
+    uint64_t flags = irq_save();
+    size_t first = (addr - cma_base) / PAGE_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        if (cma_used[first + i]) {
+            cma_used[first + i] = 0;
+            pmm_free_page((void*)(addr + i * PAGE_SIZE));
+            cma_stats.pages_in_use--;
+        }
+    }
+    irq_restore(flags);
+}
+
+// Get a copy of the statistics
+void cma_get_stats(cma_stats_t* stats) {
+    if (stats) {
+        *stats = cma_stats;
+    }
+}
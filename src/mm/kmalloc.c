@@ -2,6 +2,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "../include/panic.h"
+#include "../include/spinlock.h"
 
 // Memory block header
 typedef struct block {
@@ -21,6 +22,7 @@ static uint8_t* heap_start = (uint8_t*)HEAP_START;
 static uint8_t* heap_end = (uint8_t*)(HEAP_START + HEAP_SIZE);
 static block_t* head = NULL;
 static bool heap_initialized = false;
+static spinlock_t heap_lock = SPINLOCK_INIT;
 
 // Statistics
 static size_t total_allocated = 0;
@@ -83,6 +85,8 @@ static void coalesce_free_blocks(void) {
 
 // Allocate memory
 void* kmalloc(size_t size) {
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    
     // Initialize heap on first allocation
     if (!heap_initialized) {
         init_heap();
@@ -94,6 +98,7 @@ void* kmalloc(size_t size) {
     // Find a free block
     block_t* block = find_free_block(size);
     if (!block) {
+        spin_unlock_irqrestore(&heap_lock, flags);
         panic("kmalloc: Out of memory!");
         return NULL;
     }
@@ -108,6 +113,7 @@ void* kmalloc(size_t size) {
     total_allocated += block->size;
     total_free -= block->size;
     allocation_count++;
+    spin_unlock_irqrestore(&heap_lock, flags);
     
     // Return pointer to data (after header)
     return (uint8_t*)block + BLOCK_HEADER_SIZE;
@@ -126,7 +132,9 @@ void kfree(void* ptr) {
         return;
     }
     
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
     if (block->free) {
+        spin_unlock_irqrestore(&heap_lock, flags);
         panic("kfree: Double free detected!");
         return;
     }
@@ -141,6 +149,7 @@ void kfree(void* ptr) {
     
     // Coalesce adjacent free blocks
     coalesce_free_blocks();
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 // Get heap statistics
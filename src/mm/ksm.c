@@ -0,0 +1,334 @@
+#include "../include/ksm.h"
+#include "../include/process.h"
+#include "../include/pmm.h"
+#include "../include/vmm.h"
+#include "../include/cpu.h"
+#include "../include/timer.h"
+#include "../include/wait.h"
+#include "../include/kmalloc.h"
+#include "../include/string.h"
+#include "../include/terminal.h"
+
+// A merged frame. The node holds its own reference so the frame stays
+// findable; it is pruned once no mapping is left.
+typedef struct ksm_node {
+    uint32_t checksum;
+    void* frame;
+    struct ksm_node* next;
+} ksm_node_t;
+
+// A page seen earlier in the current pass that may find a twin
+typedef struct {
+    uint32_t checksum;
+    uint32_t pid;           // 0 = empty
+    uint64_t virt;
+} ksm_item_t;
+
+static ksm_node_t* ksm_stable[KSM_STABLE_BUCKETS];
+static ksm_item_t ksm_unstable[KSM_UNSTABLE_SIZE];
+
+// Tunables
+static bool ksm_run = true;
+static uint32_t ksm_pages_to_scan = KSM_PAGES_TO_SCAN;
+static uint32_t ksm_sleep_ms = KSM_SLEEP_MS;
+static wait_queue_t ksm_wait = WAIT_QUEUE_INIT;     // Scanner waits here while stopped
+
+// Scan cursor
+static uint32_t ksm_scan_pid = 0;
+static uint64_t ksm_scan_addr = 0;
+
+static ksm_stats_t ksm_stats;
+
+// Tune the scanner
+void ksm_set_params(bool run, uint32_t pages_to_scan, uint32_t sleep_ms) {
+    ksm_run = run;
+    if (pages_to_scan) {
+        ksm_pages_to_scan = pages_to_scan;
+    }
+    ksm_sleep_ms = sleep_ms;
+    if (run) {
+        wake_up(&ksm_wait);
+    }
+}
+
+bool ksm_is_running(void) {
+    return ksm_run;
+}
+
+// Cheap page checksum used to find merge candidates
+static uint32_t ksm_checksum(const uint64_t* page) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < PAGE_SIZE / 8; i++) {
+        h = (h ^ page[i]) * 0x100000001b3ULL;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// Find a merged frame with the same contents that can take another mapping
+static ksm_node_t* ksm_stable_find(uint32_t checksum, const void* page) {
+    for (ksm_node_t* n = ksm_stable[checksum % KSM_STABLE_BUCKETS]; n; n = n->next) {
+        if (n->checksum == checksum && pmm_page_refcount(n->frame) < 0xFF &&
+            memcmp(n->frame, page, PAGE_SIZE) == 0) {
+            return n;
+        }
+    }
+    return NULL;
+}
+
+// Check whether a PTE maps a private writable page we may merge
+static bool ksm_candidate(uint64_t pte) {
+    if (!(pte & PAGE_PRESENT) || !(pte & PAGE_USER) || !(pte & PAGE_WRITABLE)) {
+        return false;
+    }
+    if (pte & (PAGE_SHARED | PAGE_COW | PAGE_LAZYFREE)) {
+        return false;
+    }
+    // Merged frames are pinned, so keep them out of the CMA region
+    void* frame = (void*)(pte & ~0xFFF);
+    return pmm_page_refcount(frame) == 1 && !pmm_page_is_cma(frame);
+}
+
+// Flush a TLB entry on every CPU the address space is live on
+static void ksm_flush(mm_t* mm, uint64_t virt) {
+    smp_flush_tlb_page(mm->page_table, virt);
+}
+
+// Point a PTE at a merged frame, read-only and copy-on-write. The page
+// is write-protected first and only then compared, so a write from a
+// thread on another CPU can't slip in between.
+static int ksm_merge(mm_t* mm, uint64_t* pte, uint64_t virt, void* shared) {
+    uint64_t entry = *pte;
+    uint64_t prot = vmm_pte_wrprotect(mm->page_table, pte, virt, entry);
+    if (!prot) {
+        return -1;
+    }
+    
+    void* old = (void*)(prot & ~0xFFF);
+    if (memcmp(old, shared, PAGE_SIZE) != 0 || pmm_page_ref(shared) < 0) {
+        vmm_pte_restore(pte, prot, entry);
+        return -1;
+    }
+    
+    // A write fault may have taken the page back meanwhile
+    if (!__sync_bool_compare_and_swap(pte, prot, (uint64_t)shared | (prot & (0xFFF | PAGE_NX)))) {
+        pmm_page_unref(shared);
+        return -1;
+    }
+    ksm_flush(mm, virt);
+    pmm_page_unref(old);
+    
+    ksm_stats.merges++;
+    return 0;
+}
+
+// Turn a page into a new merged frame
+static ksm_node_t* ksm_promote(mm_t* mm, uint64_t* pte, uint64_t virt, uint32_t checksum) {
+    ksm_node_t* node = (ksm_node_t*)kmalloc(sizeof(ksm_node_t));
+    if (!node) {
+        return NULL;
+    }
+    
+    uint64_t entry = *pte;
+    node->frame = (void*)(entry & ~0xFFF);
+    node->checksum = checksum;
+    if (pmm_page_ref(node->frame) < 0) {
+        kfree(node);
+        return NULL;
+    }
+    
+    // With our reference taken first, a write after this copies the page
+    // instead of taking it back
+    if (!vmm_pte_wrprotect(mm->page_table, pte, virt, entry)) {
+        pmm_page_unref(node->frame);
+        kfree(node);
+        return NULL;
+    }
+    
+    node->next = ksm_stable[checksum % KSM_STABLE_BUCKETS];
+    ksm_stable[checksum % KSM_STABLE_BUCKETS] = node;
+    return node;
+}
+
+// Try to merge one page of process 'pid', whose address space the
+// caller has pinned
+static void ksm_scan_page(mm_t* mm, uint32_t pid, uint64_t* pte, uint64_t virt) {
+    if (!ksm_candidate(*pte)) {
+        return;
+    }
+    
+    void* frame = (void*)(*pte & ~0xFFF);
+    uint32_t checksum = ksm_checksum((uint64_t*)frame);
+    ksm_stats.pages_scanned++;
+    
+    // Identical to an already merged page?
+    ksm_node_t* node = ksm_stable_find(checksum, frame);
+    if (node) {
+        ksm_merge(mm, pte, virt, node->frame);
+        return;
+    }
+    
+    // Identical to a page seen earlier in this pass? Re-check it, since
+    // its contents may have changed since it was recorded. Both pages are
+    // still writable here; ksm_merge() compares them again once they
+    // aren't.
+    ksm_item_t* item = &ksm_unstable[checksum % KSM_UNSTABLE_SIZE];
+    if (item->pid && item->checksum == checksum &&
+        !(item->pid == pid && item->virt == virt)) {
+        // The recorded process may have exited since: look it up again
+        // and pin its address space. A thread of the same process sees
+        // the very same page.
+        mm_t* other = process_get_mm(item->pid);
+        uint64_t* other_pte = NULL;
+        if (other && !(other == mm && item->virt == virt)) {
+            other_pte = vmm_get_pte(other->page_table, item->virt);
+        }
+        
+        if (other_pte && ksm_candidate(*other_pte) &&
+            memcmp((void*)(*other_pte & ~0xFFF), frame, PAGE_SIZE) == 0) {
+            node = ksm_promote(other, other_pte, item->virt, checksum);
+            if (node) {
+                ksm_merge(mm, pte, virt, node->frame);
+            }
+            item->pid = 0;
+            mm_put_async(other);
+            return;
+        }
+        mm_put_async(other);
+    }
+    
+    item->checksum = checksum;
+    item->pid = pid;
+    item->virt = virt;
+}
+
+// End of a full pass: forget candidates and drop merged frames that
+// nobody maps any more
+static void ksm_pass_done(void) {
+    for (int i = 0; i < KSM_UNSTABLE_SIZE; i++) {
+        ksm_unstable[i].pid = 0;
+    }
+    
+    for (int b = 0; b < KSM_STABLE_BUCKETS; b++) {
+        ksm_node_t** link = &ksm_stable[b];
+        while (*link) {
+            ksm_node_t* n = *link;
+            if (pmm_page_refcount(n->frame) == 1) {
+                *link = n->next;
+                pmm_page_unref(n->frame);
+                kfree(n);
+            } else {
+                link = &n->next;
+            }
+        }
+    }
+    
+    ksm_stats.full_scans++;
+}
+
+// Scan a batch of pages, resuming where the last batch stopped. The
+// cursor is a PID, looked up again each batch; the address space being
+// scanned is pinned so the reaper can't free its page tables meanwhile.
+void ksm_scan(size_t pages) {
+    uint64_t flags = irq_save();
+    
+    uint32_t pid = ksm_scan_pid;
+    mm_t* mm = pid ? process_get_mm(pid) : NULL;
+    uint64_t va = mm ? ksm_scan_addr : 0;
+    if (!mm) {
+        // First batch, or the process we were in has exited
+        pid = 0;
+        mm = process_next_mm(0, &pid);
+    }
+    
+    while (pages > 0) {
+        if (!mm) {
+            ksm_pass_done();
+            break;
+        }
+        
+        uint64_t base = va;
+        uint64_t* pt = vmm_next_pt(mm->page_table, &base);
+        if (!pt) {
+            uint32_t next = 0;
+            mm_t* next_mm = process_next_mm(pid, &next);
+            mm_put_async(mm);
+            mm = next_mm;
+            pid = next;
+            va = 0;
+            continue;
+        }
+        
+        int i = (base > va) ? 0 : (int)PT_INDEX(va);
+        for (; i < 512 && pages > 0; i++, pages--) {
+            ksm_scan_page(mm, pid, &pt[i], base + (uint64_t)i * PAGE_SIZE);
+        }
+        va = base + (uint64_t)i * PAGE_SIZE;
+    }
+    
+    ksm_scan_pid = mm ? pid : 0;
+    ksm_scan_addr = mm ? va : 0;
+    mm_put_async(mm);
+    
+    irq_restore(flags);
+}
+
+// Scanner kernel thread: a batch every ksm_sleep_ms while enabled, and
+// asleep on ksm_wait while stopped
+void ksm_thread(void* arg) {
+    (void)arg;
+    
+    while (1) {
+        wait_event(ksm_wait, ksm_run);
+        ksm_scan(ksm_pages_to_scan);
+        sleep_ms(ksm_sleep_ms);
+    }
+}
+
+// Get a copy of the statistics
+void ksm_get_stats(ksm_stats_t* stats) {
+    ksm_stats.pages_shared = 0;
+    ksm_stats.pages_sharing = 0;
+    
+    for (int b = 0; b < KSM_STABLE_BUCKETS; b++) {
+        for (ksm_node_t* n = ksm_stable[b]; n; n = n->next) {
+            ksm_stats.pages_shared++;
+            ksm_stats.pages_sharing += pmm_page_refcount(n->frame) - 1;
+        }
+    }
+    
+    if (stats) {
+        *stats = ksm_stats;
+    }
+}
+
+// Helper to print a decimal number
+static void ksm_print_num(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
+// Print KSM statistics
+void ksm_print_stats(void) {
+    ksm_stats_t s;
+    ksm_get_stats(&s);
+    
+    terminal_writestring("\nSamepage merging (");
+    terminal_writestring(ksm_run ? "running" : "stopped");
+    terminal_writestring("):\n  Pages shared:   ");
+    ksm_print_num(s.pages_shared);
+    terminal_writestring("\n  Pages sharing:  ");
+    ksm_print_num(s.pages_sharing);
+    terminal_writestring("\n  Pages saved:    ");
+    ksm_print_num(s.pages_sharing > s.pages_shared ? s.pages_sharing - s.pages_shared : 0);
+    terminal_writestring("\n  Pages scanned:  ");
+    ksm_print_num(s.pages_scanned);
+    terminal_writestring("\n  Full scans:     ");
+    ksm_print_num(s.full_scans);
+    terminal_writestring("\n");
+}
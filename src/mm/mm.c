@@ -0,0 +1,204 @@
+#include "../include/mm.h"
+#include "../include/vmm.h"
+#include "../include/shm.h"
+#include "../include/io_ring.h"
+#include "../include/kmalloc.h"
+#include "../include/process.h"
+
+// Allocate an empty address space. The caller fills in the page table.
+mm_t* mm_create(void) {
+    mm_t* mm = (mm_t*)kzalloc(sizeof(mm_t));
+    if (!mm) {
+        return NULL;
+    }
+    
+    mm->users = 1;
+    spin_init(&mm->lock);
+    return mm;
+}
+
+// Another process (a thread) starts using this address space
+mm_t* mm_get(mm_t* mm) {
+    __sync_add_and_fetch(&mm->users, 1);
+    return mm;
+}
+
+// Free an address space nobody uses any more
+static void mm_destroy(mm_t* mm) {
+    // Detach shared memory and the I/O ring, then free page table and
+    // address space
+    shm_exit(mm);
+    io_ring_exit(mm);
+    if (mm->page_table) {
+        vmm_destroy_address_space(mm->page_table);
+    }
+    mm_clear_vmas(mm);
+    if (mm->fd_table) {
+        kfree(mm->fd_table);
+    }
+    kfree(mm);
+}
+
+// Drop a reference; the last user tears everything down
+void mm_put(mm_t* mm) {
+    if (!mm || __sync_sub_and_fetch(&mm->users, 1) != 0) {
+        return;
+    }
+    mm_destroy(mm);
+}
+
+// Address spaces whose last reference went through mm_put_async()
+static mm_t* mm_dead_list = NULL;
+static spinlock_t mm_dead_lock = SPINLOCK_INIT;
+
+// Drop a reference without tearing down here
+void mm_put_async(mm_t* mm) {
+    if (!mm || __sync_sub_and_fetch(&mm->users, 1) != 0) {
+        return;
+    }
+    
+    uint64_t flags = spin_lock_irqsave(&mm_dead_lock);
+    mm->dead_next = mm_dead_list;
+    mm_dead_list = mm;
+    spin_unlock_irqrestore(&mm_dead_lock, flags);
+    
+    process_wake_reaper();
+}
+
+// Tear down everything mm_put_async() queued. Process context only.
+void mm_reap(void) {
+    uint64_t flags = spin_lock_irqsave(&mm_dead_lock);
+    mm_t* mm = mm_dead_list;
+    mm_dead_list = NULL;
+    spin_unlock_irqrestore(&mm_dead_lock, flags);
+    
+    while (mm) {
+        mm_t* next = mm->dead_next;
+        mm_destroy(mm);
+        mm = next;
+    }
+}
+
+// For the reaper's wait condition
+bool mm_reap_pending(void) {
+    return mm_dead_list != NULL;
+}
+
+// Insert a region, keeping the list sorted. Empty regions (a heap before
+// the first sbrk) are allowed.
+int mm_add_vma(mm_t* mm, uint64_t start, uint64_t end, uint32_t flags) {
+    if (end < start) {
+        return -1;
+    }
+    
+    vma_t* vma = (vma_t*)kmalloc(sizeof(vma_t));
+    if (!vma) {
+        return -1;
+    }
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    
+    uint64_t irq = spin_lock_irqsave(&mm->lock);
+    vma_t* prev = NULL;
+    vma_t* next = mm->vmas;
+    while (next && next->start < start) {
+        prev = next;
+        next = next->next;
+    }
+    
+    // Overlap with the neighbours on either side?
+    if ((prev && prev->end > start) || (next && next->start < end)) {
+        spin_unlock_irqrestore(&mm->lock, irq);
+        kfree(vma);
+        return -1;
+    }
+    
+    vma->next = next;
+    if (prev) {
+        prev->next = vma;
+    } else {
+        mm->vmas = vma;
+    }
+    spin_unlock_irqrestore(&mm->lock, irq);
+    return 0;
+}
+
+// Remove the region starting at 'start'
+int mm_remove_vma(mm_t* mm, uint64_t start) {
+    uint64_t irq = spin_lock_irqsave(&mm->lock);
+    vma_t** link = &mm->vmas;
+    while (*link && (*link)->start != start) {
+        link = &(*link)->next;
+    }
+    
+    vma_t* vma = *link;
+    if (vma) {
+        *link = vma->next;
+    }
+    spin_unlock_irqrestore(&mm->lock, irq);
+    
+    if (!vma) {
+        return -1;
+    }
+    kfree(vma);
+    return 0;
+}
+
+// Move the end of the region starting at 'start' (sbrk)
+int mm_resize_vma(mm_t* mm, uint64_t start, uint64_t end) {
+    int result = -1;
+    uint64_t irq = spin_lock_irqsave(&mm->lock);
+    
+    for (vma_t* vma = mm->vmas; vma; vma = vma->next) {
+        if (vma->start == start) {
+            if (end >= start && (!vma->next || end <= vma->next->start)) {
+                vma->end = end;
+                result = 0;
+            }
+            break;
+        }
+    }
+    
+    spin_unlock_irqrestore(&mm->lock, irq);
+    return result;
+}
+
+// Find the region containing addr. The caller must keep the region from
+// going away (system calls and faults hold the big kernel lock).
+vma_t* mm_find_vma(mm_t* mm, uint64_t addr) {
+    uint64_t irq = spin_lock_irqsave(&mm->lock);
+    vma_t* vma = mm->vmas;
+    while (vma && vma->end <= addr) {
+        vma = vma->next;
+    }
+    if (vma && vma->start > addr) {
+        vma = NULL;
+    }
+    spin_unlock_irqrestore(&mm->lock, irq);
+    return vma;
+}
+
+// Copy every region into a new address space (fork)
+int mm_dup_vmas(mm_t* dst, mm_t* src) {
+    for (vma_t* vma = src->vmas; vma; vma = vma->next) {
+        if (mm_add_vma(dst, vma->start, vma->end, vma->flags) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Forget every region (exec and teardown)
+void mm_clear_vmas(mm_t* mm) {
+    uint64_t irq = spin_lock_irqsave(&mm->lock);
+    vma_t* vma = mm->vmas;
+    mm->vmas = NULL;
+    spin_unlock_irqrestore(&mm->lock, irq);
+    
+    while (vma) {
+        vma_t* next = vma->next;
+        kfree(vma);
+        vma = next;
+    }
+}
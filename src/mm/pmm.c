@@ -1,6 +1,10 @@
 #include "../include/pmm.h"
 #include "../include/terminal.h"
 #include "../include/panic.h"
+#include "../include/swap.h"
+#include "../include/cpu.h"
+#include "../include/spinlock.h"
+#include "../include/timer.h"
 #include <stdint.h>
 
 // Simple bitmap-based physical memory manager
@@ -10,17 +14,43 @@
 #define BITMAP_SIZE (128 * 1024)  // Support up to 4GB of RAM (128KB bitmap)
 
 static uint32_t pmm_bitmap[BITMAP_SIZE / 4];  // Bitmap of free pages
+static uint8_t pmm_refcount[BITMAP_SIZE * 8];  // Per-page reference counts
 static size_t pmm_total_pages = 0;
 static size_t pmm_free_pages = 0;
 static size_t pmm_reserved_pages = 0;
+static spinlock_t pmm_lock = SPINLOCK_INIT;    // Bitmap, counts and refcounts
 
-// Find first free page in bitmap
+// Free pages the zeroing thread has already cleared. Allocation skips
+// clearing them again; a page loses the bit when it is handed out.
+static uint32_t pmm_zeroed[BITMAP_SIZE / 4];
+static size_t pmm_zeroed_pages = 0;
+static size_t pmm_zero_cursor = 0;
+static uint64_t pmm_zero_hits = 0;             // Allocations that found a zeroed page
+static uint64_t pmm_zero_misses = 0;           // Allocations that cleared the page themselves
+
+// Page coloring: frames whose PFNs are equal modulo the color count map
+// to the same sets of the largest cache
+static uint32_t pmm_colors = 1;
+static uint32_t pmm_cache_ways = 1;
+static bool pmm_coloring = false;
+
+// Contiguous memory area (page numbers). Ordinary allocations stay out;
+// only movable user pages and DMA buffers live here.
+static size_t pmm_cma_start = 0;
+static size_t pmm_cma_end = 0;
+static size_t pmm_cma_free = 0;
+
+static inline bool pmm_in_cma(size_t page) {
+    return page >= pmm_cma_start && page < pmm_cma_end;
+}
+
+// Find first free page in bitmap (outside the CMA region)
 static int bitmap_find_free(void) {
     for (size_t i = 0; i < BITMAP_SIZE / 4; i++) {
         if (pmm_bitmap[i] != 0xFFFFFFFF) {
             // Found a word with free bit
             for (int bit = 0; bit < 32; bit++) {
-                if (!(pmm_bitmap[i] & (1 << bit))) {
+                if (!(pmm_bitmap[i] & (1 << bit)) && !pmm_in_cma(i * 32 + bit)) {
                     return i * 32 + bit;
                 }
             }
@@ -50,6 +80,61 @@ static bool bitmap_test(size_t page) {
     return pmm_bitmap[idx] & (1 << bit);
 }
 
+// Zeroed-page bitmap, same layout
+static inline bool zeroed_test(size_t page) {
+    return pmm_zeroed[page / 32] & (1U << (page % 32));
+}
+
+static inline void zeroed_set(size_t page) {
+    pmm_zeroed[page / 32] |= 1U << (page % 32);
+    pmm_zeroed_pages++;
+}
+
+static inline void zeroed_clear(size_t page) {
+    if (zeroed_test(page)) {
+        pmm_zeroed[page / 32] &= ~(1U << (page % 32));
+        pmm_zeroed_pages--;
+    }
+}
+
+// Work out the number of page colors from the cache geometry reported
+// by CPUID leaf 4 (0x8000001D on AMD): one way of the largest cache
+// divided by the page size.
+static uint32_t pmm_detect_colors(void) {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t leaf = 4;
+    
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 4) {
+        cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+        if (eax < 0x8000001D) {
+            return 1;
+        }
+        leaf = 0x8000001D;
+    }
+    
+    uint64_t way_size = 0;
+    for (uint32_t sub = 0; sub < 16; sub++) {
+        cpuid(leaf, sub, &eax, &ebx, &ecx, &edx);
+        uint32_t type = eax & 0x1F;
+        if (type == 0) break;           // No more caches
+        if (type == 2) continue;        // Instruction cache
+        
+        uint64_t line = (ebx & 0xFFF) + 1;
+        uint64_t partitions = ((ebx >> 12) & 0x3FF) + 1;
+        uint64_t sets = (uint64_t)ecx + 1;
+        if (line * partitions * sets > way_size) {
+            way_size = line * partitions * sets;
+            pmm_cache_ways = ((ebx >> 22) & 0x3FF) + 1;
+        }
+    }
+    
+    uint64_t colors = way_size / PAGE_SIZE;
+    if (colors < 1) colors = 1;
+    if (colors > PMM_MAX_COLORS) colors = PMM_MAX_COLORS;
+    return (uint32_t)colors;
+}
+
 // Initialize physical memory manager
 void pmm_init(uint64_t memory_size) {
     // Calculate total pages
@@ -76,34 +161,182 @@ void pmm_init(uint64_t memory_size) {
     
     pmm_reserved_pages = first_free_page;  // Pages before PMM_START
     
+    pmm_colors = pmm_detect_colors();
+    pmm_coloring = pmm_colors > 1;
+    
     terminal_writestring("PMM initialized: ");
     // TODO: Print memory stats
     terminal_writestring(" MB total, ");
     terminal_writestring(" MB free\n");
+    if (pmm_coloring) {
+        terminal_writestring("PMM: cache coloring enabled\n");
+    }
 }
 
-// Allocate a single physical page
-void* pmm_alloc_page(void) {
-    int page = bitmap_find_free();
-    if (page == -1) {
-        return NULL;  // Out of memory
-    }
-    
+// Claim a free page found in the bitmap (pmm_lock held)
+static void* pmm_take_page(size_t page) {
     bitmap_set(page);
+    pmm_refcount[page] = 1;
     pmm_free_pages--;
+    if (pmm_in_cma(page)) {
+        pmm_cma_free--;
+    }
     
-    // Clear the page
+    // Clear the page unless the zeroing thread got there first
     uint64_t addr = (uint64_t)page * PAGE_SIZE;
+    if (zeroed_test(page)) {
+        zeroed_clear(page);
+        pmm_zero_hits++;
+        return (void*)addr;
+    }
+    
     uint64_t* ptr = (uint64_t*)addr;
     for (int i = 0; i < PAGE_SIZE / 8; i++) {
         ptr[i] = 0;
     }
+    pmm_zero_misses++;
     
     return (void*)addr;
 }
 
-// Free a physical page
-void pmm_free_page(void* page_addr) {
+// Allocate a single physical page
+void* pmm_alloc_page(void) {
+    // Push cold pages out to compressed swap when running low
+    swap_balance(pmm_free_pages - pmm_cma_free);
+    
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    int page = bitmap_find_free();
+    void* addr = page == -1 ? NULL : pmm_take_page(page);  // NULL: out of memory
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return addr;
+}
+
+// Allocate a page of color *cursor and advance the cursor, so a series
+// of allocations spreads across cache sets. Falls back to any free page
+// when that color is exhausted or coloring is off.
+void* pmm_alloc_page_color(uint32_t* cursor) {
+    if (!pmm_coloring || !cursor) {
+        return pmm_alloc_page();
+    }
+    
+    swap_balance(pmm_free_pages - pmm_cma_free);
+    
+    uint32_t color = *cursor % pmm_colors;
+    *cursor = color + 1;
+    
+    size_t last_page = pmm_total_pages < BITMAP_SIZE * 32 ? pmm_total_pages : BITMAP_SIZE * 32;
+    size_t first = PMM_START / PAGE_SIZE;
+    size_t page = first + (color + pmm_colors - first % pmm_colors) % pmm_colors;
+    void* addr = NULL;
+    
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    for (; page < last_page; page += pmm_colors) {
+        if (!bitmap_test(page) && !pmm_in_cma(page)) {
+            addr = pmm_take_page(page);
+            break;
+        }
+    }
+    if (!addr) {
+        int any = bitmap_find_free();
+        addr = any == -1 ? NULL : pmm_take_page(any);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return addr;
+}
+
+// Take any free page from the CMA region
+static void* pmm_cma_take_free(void) {
+    void* addr = NULL;
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    for (size_t page = pmm_cma_start; page < pmm_cma_end && pmm_cma_free; page++) {
+        if (!bitmap_test(page)) {
+            addr = pmm_take_page(page);
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return addr;
+}
+
+// Allocate a page that can be migrated later (private user data). Such
+// pages may borrow the CMA region: first when it holds more than half of
+// all free memory, otherwise only once ordinary memory runs out.
+void* pmm_alloc_page_movable(uint32_t* cursor) {
+    if (pmm_cma_free > pmm_free_pages / 2) {
+        void* page = pmm_cma_take_free();
+        if (page) return page;
+    }
+    
+    void* page = pmm_alloc_page_color(cursor);
+    return page ? page : pmm_cma_take_free();
+}
+
+// Set aside a contiguous region at the top of memory (below 4GB, 2MB
+// aligned) for the CMA allocator. Must be called while it is still free.
+void* pmm_reserve_cma(size_t count) {
+    size_t last_page = pmm_total_pages < BITMAP_SIZE * 32 ? pmm_total_pages : BITMAP_SIZE * 32;
+    size_t limit = 0x100000000ULL / PAGE_SIZE;
+    if (last_page > limit) last_page = limit;
+    
+    count = (count + PMM_CMA_ALIGN - 1) & ~(size_t)(PMM_CMA_ALIGN - 1);
+    size_t end = last_page & ~(size_t)(PMM_CMA_ALIGN - 1);
+    if (count == 0 || pmm_cma_end || count > (end - PMM_START / PAGE_SIZE) / 2) {
+        return NULL;
+    }
+    
+    size_t start = end - count;
+    for (size_t page = start; page < end; page++) {
+        if (bitmap_test(page)) {
+            return NULL;
+        }
+    }
+    
+    pmm_cma_start = start;
+    pmm_cma_end = end;
+    pmm_cma_free = count;
+    return (void*)(start * PAGE_SIZE);
+}
+
+// Allocate one specific free page (used by CMA to claim its region)
+int pmm_alloc_page_at(void* page_addr) {
+    size_t page = (uint64_t)page_addr / PAGE_SIZE;
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    if (page >= pmm_total_pages || bitmap_test(page)) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return -1;
+    }
+    pmm_take_page(page);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return 0;
+}
+
+// Check whether a frame belongs to the CMA region
+bool pmm_page_is_cma(void* page_addr) {
+    return pmm_in_cma((uint64_t)page_addr / PAGE_SIZE);
+}
+
+// Get CMA region statistics
+void pmm_get_cma_stats(size_t* total_pages, size_t* free_pages) {
+    if (total_pages) *total_pages = pmm_cma_end - pmm_cma_start;
+    if (free_pages) *free_pages = pmm_cma_free;
+}
+
+// Get the page color count (1 if coloring is unavailable) and the
+// associativity of the cache it was derived from
+void pmm_cache_geometry(uint32_t* colors, uint32_t* ways) {
+    if (colors) *colors = pmm_colors;
+    if (ways) *ways = pmm_cache_ways;
+}
+
+// Turn colored allocation on or off. Returns the previous setting.
+bool pmm_set_coloring(bool enabled) {
+    bool old = pmm_coloring;
+    pmm_coloring = enabled && pmm_colors > 1;
+    return old;
+}
+
+// Return a page to the bitmap (pmm_lock held)
+static void pmm_release_page(void* page_addr) {
     uint64_t addr = (uint64_t)page_addr;
     
     // Validate address
@@ -124,20 +357,35 @@ void pmm_free_page(void* page_addr) {
     }
     
     bitmap_clear(page);
+    pmm_refcount[page] = 0;
     pmm_free_pages++;
+    if (pmm_in_cma(page)) {
+        pmm_cma_free++;
+    }
+}
+
+// Free a physical page
+void pmm_free_page(void* page_addr) {
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    pmm_release_page(page_addr);
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 // Allocate multiple contiguous pages
 void* pmm_alloc_pages(size_t count) {
     if (count == 0) return NULL;
     
+    swap_balance(pmm_free_pages - pmm_cma_free);
+    
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    
     // Find contiguous free pages
     for (size_t start = PMM_START / PAGE_SIZE; start + count <= pmm_total_pages; start++) {
         bool found = true;
         
         // Check if all pages are free
         for (size_t i = 0; i < count; i++) {
-            if (bitmap_test(start + i)) {
+            if (bitmap_test(start + i) || pmm_in_cma(start + i)) {
                 found = false;
                 break;
             }
@@ -147,6 +395,8 @@ void* pmm_alloc_pages(size_t count) {
             // Allocate all pages
             for (size_t i = 0; i < count; i++) {
                 bitmap_set(start + i);
+                zeroed_clear(start + i);
+                pmm_refcount[start + i] = 1;
             }
             pmm_free_pages -= count;
             
@@ -157,10 +407,12 @@ void* pmm_alloc_pages(size_t count) {
                 ptr[i] = 0;
             }
             
+            spin_unlock_irqrestore(&pmm_lock, flags);
             return (void*)addr;
         }
     }
     
+    spin_unlock_irqrestore(&pmm_lock, flags);
     return NULL;  // No contiguous block found
 }
 
@@ -176,9 +428,126 @@ void pmm_free_pages(void* page_addr, size_t count) {
     }
 }
 
+// Take an extra reference on an allocated page (for frames mapped into
+// more than one address space). Returns -1 if the count would overflow.
+int pmm_page_ref(void* page_addr) {
+    size_t page = (uint64_t)page_addr / PAGE_SIZE;
+    if (page >= pmm_total_pages || !bitmap_test(page)) {
+        panic("pmm_page_ref: Page not allocated");
+        return -1;
+    }
+    
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    if (pmm_refcount[page] == 0xFF) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return -1;  // Too many sharers
+    }
+    
+    pmm_refcount[page]++;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return 0;
+}
+
+// Drop a reference on a page, freeing it when the last one goes away
+void pmm_page_unref(void* page_addr) {
+    size_t page = (uint64_t)page_addr / PAGE_SIZE;
+    if (page >= pmm_total_pages || pmm_refcount[page] == 0) {
+        panic("pmm_page_unref: Page not referenced");
+        return;
+    }
+    
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    if (--pmm_refcount[page] == 0) {
+        pmm_release_page(page_addr);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Get the number of references held on a page
+uint32_t pmm_page_refcount(void* page_addr) {
+    size_t page = (uint64_t)page_addr / PAGE_SIZE;
+    if (page >= pmm_total_pages) {
+        return 0;
+    }
+    return pmm_refcount[page];
+}
+
 // Get memory statistics
 void pmm_get_stats(size_t* total_pages, size_t* free_pages, size_t* used_pages) {
     if (total_pages) *total_pages = pmm_total_pages;
     if (free_pages) *free_pages = pmm_free_pages;
     if (used_pages) *used_pages = pmm_total_pages - pmm_free_pages;
+}
+
+// Clear up to 'max' free pages ahead of demand. A page is claimed while
+// it is cleared, so it cannot be handed out half-zeroed, and the lock is
+// dropped meanwhile. The CMA region is left alone so its claims never
+// find a page busy. Returns how many pages were cleared.
+size_t pmm_zero_pages(size_t max) {
+    size_t last_page = pmm_total_pages < BITMAP_SIZE * 32 ? pmm_total_pages : BITMAP_SIZE * 32;
+    size_t first = PMM_START / PAGE_SIZE;
+    size_t done = 0;
+    
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    size_t page = pmm_zero_cursor;
+    for (size_t scanned = 0; done < max && scanned < last_page - first; scanned++, page++) {
+        if (page < first || page >= last_page) {
+            page = first;
+        }
+        
+        if (pmm_in_cma(page)) {
+            scanned += pmm_cma_end - 1 - page;
+            page = pmm_cma_end - 1;
+            continue;
+        }
+        
+        // Skip whole words with nothing left to clear
+        size_t word = page / 32;
+        if (page % 32 == 0 && (pmm_bitmap[word] | pmm_zeroed[word]) == 0xFFFFFFFF) {
+            page += 31;
+            scanned += 31;
+            continue;
+        }
+        if (bitmap_test(page) || zeroed_test(page)) {
+            continue;
+        }
+        
+        bitmap_set(page);
+        pmm_free_pages--;
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        
+        uint64_t* ptr = (uint64_t*)(page * PAGE_SIZE);
+        for (int i = 0; i < PAGE_SIZE / 8; i++) {
+            ptr[i] = 0;
+        }
+        
+        flags = spin_lock_irqsave(&pmm_lock);
+        bitmap_clear(page);
+        pmm_free_pages++;
+        zeroed_set(page);
+        done++;
+    }
+    pmm_zero_cursor = page;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    
+    return done;
+}
+
+// Body of the "kzerod" kernel thread: clear free pages a batch at a time
+// while there are any, then look again now and then
+void pmm_zero_thread(void* arg) {
+    (void)arg;
+    
+    while (1) {
+        size_t cleared = pmm_zero_pages(PMM_ZERO_BATCH);
+        sleep_ms(cleared ? PMM_ZERO_BUSY_MS : PMM_ZERO_IDLE_MS);
+    }
+}
+
+// Get zeroing statistics: free pages already cleared, and allocations
+// that did and did not find their page cleared
+void pmm_get_zero_stats(size_t* zeroed_pages, uint64_t* hits, uint64_t* misses) {
+    if (zeroed_pages) *zeroed_pages = pmm_zeroed_pages;
+    if (hits) *hits = pmm_zero_hits;
+    if (misses) *misses = pmm_zero_misses;
 }
\ No newline at end of file
@@ -0,0 +1,427 @@
+#include "../include/swap.h"
+#include "../include/lz.h"
+#include "../include/cpu.h"
+#include "../include/kmalloc.h"
+#include "../include/string.h"
+#include "../include/terminal.h"
+#include "../include/panic.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+#include <stdbool.h>
+
+#define SWAP_NO_SLOT 0xFFFFFFFF
+
+// A compressed page. Zero-filled pages are stored with no data.
+typedef struct {
+    uint8_t* data;
+    uint16_t size;
+    uint16_t refs;          // Swap entries (PTEs) pointing at this slot
+    uint32_t next_free;
+} swap_slot_t;
+
+static swap_slot_t* swap_slots = NULL;
+static uint32_t swap_free_head = SWAP_NO_SLOT;
+static size_t swap_low = SWAP_LOW_WATERMARK;
+static size_t swap_high = SWAP_HIGH_WATERMARK;
+static spinlock_t swap_lock = SPINLOCK_INIT;   // Slot table and clock hand
+static swap_stats_t swap_stats;
+
+// Clock hand: where the next reclaim scan resumes
+static uint32_t swap_hand_pid = 0;
+static uint64_t swap_hand_addr = 0;
+
+// Scratch buffer for compression
+static uint8_t swap_buffer[SWAP_MAX_COMPRESSED];
+
+// Initialize the swap slot table
+void swap_init(void) {
+    swap_slots = (swap_slot_t*)kmalloc(SWAP_MAX_SLOTS * sizeof(swap_slot_t));
+    if (!swap_slots) {
+        terminal_writestring("Swap: failed to allocate slot table\n");
+        return;
+    }
+    
+    for (uint32_t i = 0; i < SWAP_MAX_SLOTS; i++) {
+        swap_slots[i].data = NULL;
+        swap_slots[i].size = 0;
+        swap_slots[i].refs = 0;
+        swap_slots[i].next_free = (i + 1 < SWAP_MAX_SLOTS) ? i + 1 : SWAP_NO_SLOT;
+    }
+    swap_free_head = 0;
+    
+    terminal_writestring("Compressed swap initialized\n");
+}
+
+// Set the free page watermarks that drive reclaim
+void swap_set_watermarks(size_t low, size_t high) {
+    if (high < low) {
+        high = low;
+    }
+    swap_low = low;
+    swap_high = high;
+}
+
+// Release a slot's storage once nothing refers to it. Called with
+// swap_lock held.
+static void swap_slot_put(uint32_t slot) {
+    swap_slot_t* s = &swap_slots[slot];
+    
+    if (--s->refs > 0) {
+        return;
+    }
+    
+    if (s->data) {
+        swap_stats.bytes_stored -= s->size;
+        kfree(s->data);
+        s->data = NULL;
+    } else {
+        swap_stats.zero_pages--;
+    }
+    s->size = 0;
+    s->next_free = swap_free_head;
+    swap_free_head = slot;
+    swap_stats.pages_stored--;
+}
+
+// Check whether a page is entirely zero
+static bool swap_page_is_zero(const uint64_t* page) {
+    for (int i = 0; i < PAGE_SIZE / 8; i++) {
+        if (page[i]) return false;
+    }
+    return true;
+}
+
+// Compress one page and replace its PTE with a swap entry. The page is
+// write-protected while it is compressed, so a write from another CPU
+// either lands before (and is kept) or faults and cancels the eviction.
+static int swap_out_page(mm_t* mm, uint64_t* pte, uint64_t virt) {
+    if (swap_free_head == SWAP_NO_SLOT) {
+        return -1;  // Slot table full
+    }
+    
+    uint64_t entry = *pte;
+    uint64_t prot = vmm_pte_wrprotect(mm->page_table, pte, virt, entry);
+    if (!prot) {
+        return -1;
+    }
+    
+    uint8_t* frame = (uint8_t*)(prot & ~0xFFF);
+    uint8_t* data = NULL;
+    size_t size = 0;
+    
+    if (!swap_page_is_zero((uint64_t*)frame)) {
+        size = lz_compress(frame, PAGE_SIZE, swap_buffer, SWAP_MAX_COMPRESSED);
+        if (size == 0) {
+            // Not worth keeping compressed; give it another lap
+            swap_stats.incompressible++;
+            vmm_pte_restore(pte, prot, entry | PAGE_ACCESSED);
+            return -1;
+        }
+        
+        if (swap_stats.bytes_stored + size > SWAP_POOL_LIMIT) {
+            vmm_pte_restore(pte, prot, entry);
+            return -1;
+        }
+        
+        data = (uint8_t*)kmalloc(size);
+        if (!data) {
+            vmm_pte_restore(pte, prot, entry);
+            return -1;
+        }
+        memcpy(data, swap_buffer, size);
+    }
+    
+    uint32_t slot = swap_free_head;
+    if (!__sync_bool_compare_and_swap(pte, prot, SWAP_ENTRY(slot, entry))) {
+        // Faulted on and written meanwhile
+        if (data) {
+            kfree(data);
+        }
+        return -1;
+    }
+    smp_flush_tlb_page(mm->page_table, virt);
+    pmm_page_unref(frame);
+    
+    swap_slot_t* s = &swap_slots[slot];
+    swap_free_head = s->next_free;
+    s->data = data;
+    s->size = (uint16_t)size;
+    s->refs = 1;
+    
+    if (mm->pages_allocated > 0) {
+        mm->pages_allocated--;
+    }
+    
+    swap_stats.pages_out++;
+    swap_stats.pages_stored++;
+    if (data) {
+        swap_stats.bytes_stored += size;
+    } else {
+        swap_stats.zero_pages++;
+    }
+    
+    return 0;
+}
+
+// Second-chance scan of one page table. Referenced pages have their
+// accessed bit cleared; unreferenced private pages are evicted. Threads
+// on other CPUs may be using the pages, so PTEs only change atomically.
+static size_t swap_scan_pt(mm_t* mm, uint64_t* pt, uint64_t base, size_t target) {
+    size_t reclaimed = 0;
+    
+    for (int i = 0; i < 512 && reclaimed < target; i++) {
+        uint64_t pte = pt[i];
+        uint64_t virt = base + (uint64_t)i * PAGE_SIZE;
+        
+        if (!(pte & PAGE_PRESENT) || !(pte & PAGE_USER) || (pte & PAGE_SHARED)) {
+            continue;
+        }
+        
+        void* frame = (void*)(pte & ~0xFFF);
+        if (pmm_page_refcount(frame) != 1) {
+            continue;  // Mapped elsewhere too
+        }
+        
+        // MADV_FREE pages that were not written since can simply go. A
+        // write may still set dirty through a stale TLB entry, so the
+        // page is write-protected and flushed before dirty counts.
+        if (pte & PAGE_LAZYFREE) {
+            uint64_t prot = 0;
+            if (!(pte & PAGE_DIRTY)) {
+                prot = vmm_pte_wrprotect(mm->page_table, &pt[i], virt, pte);
+            }
+            if (prot && __sync_bool_compare_and_swap(&pt[i], prot, 0)) {
+                smp_flush_tlb_page(mm->page_table, virt);
+                pmm_page_unref(frame);
+                if (mm->pages_allocated > 0) {
+                    mm->pages_allocated--;
+                }
+                swap_stats.lazyfree_dropped++;
+                reclaimed++;
+                continue;
+            }
+            __sync_fetch_and_and(&pt[i], ~(uint64_t)PAGE_LAZYFREE);
+            pte = pt[i];
+            if (!(pte & PAGE_PRESENT)) {
+                continue;
+            }
+        }
+        
+        // Sole remaining user of a merged page owns it again
+        if ((pte & PAGE_COW) &&
+            !__sync_bool_compare_and_swap(&pt[i], pte, (pte | PAGE_WRITABLE) & ~PAGE_COW)) {
+            continue;  // Changed under us; look again next lap
+        }
+        
+        if (pte & PAGE_ACCESSED) {
+            __sync_fetch_and_and(&pt[i], ~(uint64_t)PAGE_ACCESSED);
+            smp_flush_tlb_page(mm->page_table, virt);
+            continue;
+        }
+        
+        if (swap_out_page(mm, &pt[i], virt) == 0) {
+            reclaimed++;
+        }
+    }
+    
+    return reclaimed;
+}
+
+// Evict up to target pages, sweeping all user address spaces. Only one
+// CPU reclaims at a time, and allocations made while reclaiming or
+// swapping in (which hold the lock) don't recurse into it.
+size_t swap_reclaim(size_t target) {
+    if (!swap_slots || target == 0) {
+        return 0;
+    }
+    
+    uint64_t flags = irq_save();
+    if (!spin_trylock(&swap_lock)) {
+        irq_restore(flags);
+        return 0;
+    }
+    swap_stats.reclaim_runs++;
+    
+    // Resume at the clock hand. The address space being scanned is pinned
+    // so an exiting process can't free its page tables under us; the
+    // reaper gets any that we end up holding last.
+    size_t reclaimed = 0;
+    uint32_t pid = swap_hand_pid;
+    mm_t* mm = pid ? process_get_mm(pid) : NULL;
+    uint64_t va = mm ? swap_hand_addr : 0;
+    int laps = 0;
+    if (!mm) {
+        pid = 0;
+    }
+    
+    // Up to three wraps: the first pass may only clear accessed bits
+    while (reclaimed < target) {
+        if (!mm) {
+            uint32_t next = 0;
+            mm = process_next_mm(pid, &next);
+            va = 0;
+            if (!mm) {
+                // End of the list, or our place in it exited: wrap
+                if (pid == 0 || ++laps == 3) break;
+                pid = 0;
+                continue;
+            }
+            pid = next;
+        }
+        
+        uint64_t* pt = vmm_next_pt(mm->page_table, &va);
+        if (!pt) {
+            mm_put_async(mm);
+            mm = NULL;
+            continue;
+        }
+        
+        reclaimed += swap_scan_pt(mm, pt, va, target - reclaimed);
+        va += 1ULL << 21;
+    }
+    
+    swap_hand_pid = mm ? pid : 0;
+    swap_hand_addr = mm ? va : 0;
+    mm_put_async(mm);
+    
+    spin_unlock(&swap_lock);
+    irq_restore(flags);
+    return reclaimed;
+}
+
+// Called by the PMM on allocation: reclaim if free memory is low
+void swap_balance(size_t free_pages) {
+    if (!swap_slots || free_pages >= swap_low) {
+        return;
+    }
+    swap_reclaim(swap_high - free_pages);
+}
+
+// Bring a swapped page back in
+int swap_in(process_t* process, uint64_t virt, uint64_t* pte) {
+    uint64_t start = rdtsc();
+    uint64_t flags = spin_lock_irqsave(&swap_lock);
+    
+    uint64_t entry = *pte;
+    uint64_t slot = SWAP_ENTRY_SLOT(entry);
+    if (!IS_SWAP_ENTRY(entry) || slot >= SWAP_MAX_SLOTS || swap_slots[slot].refs == 0) {
+        spin_unlock_irqrestore(&swap_lock, flags);
+        return -1;
+    }
+    
+    void* frame = pmm_alloc_page_movable(&process->page_color);
+    if (!frame) {
+        spin_unlock_irqrestore(&swap_lock, flags);
+        return -1;
+    }
+    
+    // Zero pages need nothing: pmm_alloc_page() clears the frame
+    swap_slot_t* s = &swap_slots[slot];
+    if (s->data && lz_decompress(s->data, s->size, (uint8_t*)frame, PAGE_SIZE) != PAGE_SIZE) {
+        panic("swap_in: Corrupt compressed page");
+    }
+    
+    *pte = (uint64_t)frame | (entry & SWAP_ENTRY_FLAGS) | PAGE_PRESENT | PAGE_ACCESSED;
+    invlpg(virt);
+    swap_slot_put((uint32_t)slot);
+    process->mm->pages_allocated++;
+    
+    uint64_t cycles = rdtsc() - start;
+    swap_stats.pages_in++;
+    swap_stats.swapin_cycles += cycles;
+    if (cycles > swap_stats.swapin_cycles_max) {
+        swap_stats.swapin_cycles_max = cycles;
+    }
+    
+    spin_unlock_irqrestore(&swap_lock, flags);
+    return 0;
+}
+
+// Another PTE now refers to this swap entry (fork)
+int swap_entry_dup(uint64_t entry) {
+    uint64_t slot = SWAP_ENTRY_SLOT(entry);
+    uint64_t flags = spin_lock_irqsave(&swap_lock);
+    
+    if (slot >= SWAP_MAX_SLOTS || swap_slots[slot].refs == 0 ||
+        swap_slots[slot].refs == 0xFFFF) {
+        spin_unlock_irqrestore(&swap_lock, flags);
+        return -1;
+    }
+    swap_slots[slot].refs++;
+    
+    spin_unlock_irqrestore(&swap_lock, flags);
+    return 0;
+}
+
+// A PTE holding this swap entry went away
+void swap_entry_free(uint64_t entry) {
+    uint64_t slot = SWAP_ENTRY_SLOT(entry);
+    uint64_t flags = spin_lock_irqsave(&swap_lock);
+    
+    if (slot >= SWAP_MAX_SLOTS || swap_slots[slot].refs == 0) {
+        panic("swap_entry_free: Bad swap entry");
+        return;
+    }
+    swap_slot_put((uint32_t)slot);
+    
+    spin_unlock_irqrestore(&swap_lock, flags);
+}
+
+// Get a copy of the statistics
+void swap_get_stats(swap_stats_t* stats) {
+    if (stats) {
+        *stats = swap_stats;
+    }
+}
+
+// Helper to print a decimal number
+static void swap_print_num(uint64_t value) {
+    char buf[21];
+    int i = 20;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    terminal_writestring(&buf[i]);
+}
+
+// Print swap statistics
+void swap_print_stats(void) {
+    swap_stats_t* s = &swap_stats;
+    
+    terminal_writestring("\nCompressed swap:\n");
+    terminal_writestring("  Pages out/in:     ");
+    swap_print_num(s->pages_out);
+    terminal_writestring(" / ");
+    swap_print_num(s->pages_in);
+    terminal_writestring("\n  Stored pages:     ");
+    swap_print_num(s->pages_stored);
+    terminal_writestring(" (");
+    swap_print_num(s->zero_pages);
+    terminal_writestring(" zero)\n  Compressed bytes: ");
+    swap_print_num(s->bytes_stored);
+    
+    // Ratio of original to compressed size, zero pages excluded
+    uint64_t data_pages = s->pages_stored - s->zero_pages;
+    if (s->bytes_stored) {
+        terminal_writestring("\n  Ratio:            ");
+        swap_print_num(data_pages * PAGE_SIZE / s->bytes_stored);
+        terminal_writestring(":1");
+    }
+    
+    terminal_writestring("\n  Incompressible:   ");
+    swap_print_num(s->incompressible);
+    terminal_writestring("\n  Lazy-freed:       ");
+    swap_print_num(s->lazyfree_dropped);
+    terminal_writestring("\n  Reclaim runs:     ");
+    swap_print_num(s->reclaim_runs);
+    
+    if (s->pages_in) {
+        terminal_writestring("\n  Swap-in cycles:   avg ");
+        swap_print_num(s->swapin_cycles / s->pages_in);
+        terminal_writestring(", max ");
+        swap_print_num(s->swapin_cycles_max);
+    }
+    terminal_writestring("\n");
+}
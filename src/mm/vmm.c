@@ -2,18 +2,23 @@
 #include "../include/pmm.h"
 #include "../include/terminal.h"
 #include "../include/panic.h"
+#include "../include/swap.h"
+#include "../include/smp.h"
 #include <stddef.h>
 
 // Current kernel page table (set during boot)
 extern uint64_t* pml4;  // From kernel.c
 
+// Color cursor for page tables and other frames not tied to a process
+static uint32_t vmm_table_color = 0;
+
 // Get or create a page table entry
 static uint64_t* vmm_get_or_create_table(uint64_t* parent_table, size_t index, uint64_t flags) {
     uint64_t entry = parent_table[index];
     
     if (!(entry & PAGE_PRESENT)) {
         // Allocate new table
-        void* new_table = pmm_alloc_page();
+        void* new_table = pmm_alloc_page_color(&vmm_table_color);
         if (!new_table) {
             return NULL;
         }
@@ -30,7 +35,7 @@ static uint64_t* vmm_get_or_create_table(uint64_t* parent_table, size_t index, u
 // Create a new address space for a process
 uint64_t* vmm_create_address_space(void) {
     // Allocate a new PML4 table
-    uint64_t* new_pml4 = (uint64_t*)pmm_alloc_page();
+    uint64_t* new_pml4 = (uint64_t*)pmm_alloc_page_color(&vmm_table_color);
     if (!new_pml4) {
         return NULL;
     }
@@ -50,9 +55,11 @@ void vmm_destroy_address_space(uint64_t* pml4_to_destroy) {
         return;  // Don't destroy kernel page table
     }
     
-    // Free user space mappings (entries 0-255)
-    // TODO: Recursively free all page tables and mapped pages
-    // For now, just free the PML4
+    // No CPU may still be lazily running on these tables
+    smp_leave_mm(pml4_to_destroy);
+    
+    // Free user space mappings (entries 0-255), then the PML4 itself
+    vmm_free_user_mappings(pml4_to_destroy);
     pmm_free_page(pml4_to_destroy);
 }
 
@@ -88,8 +95,8 @@ int vmm_map_page(uint64_t* pml4_table, uint64_t virt, uint64_t phys, uint64_t fl
     // Map the page
     pt[pt_idx] = (phys & ~0xFFF) | flags | PAGE_PRESENT;
     
-    // Flush TLB for this address
-    asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    // Flush TLB for this address on every CPU using the table
+    smp_flush_tlb_page(pml4_table, virt);
     
     return 0;
 }
@@ -118,7 +125,7 @@ void vmm_unmap_page(uint64_t* pml4_table, uint64_t virt) {
     pt[pt_idx] = 0;
     
     // Flush TLB
-    asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    smp_flush_tlb_page(pml4_table, virt);
 }
 
 // Get physical address from virtual
@@ -145,6 +152,85 @@ uint64_t vmm_get_physical(uint64_t* pml4_table, uint64_t virt) {
     return (pt[pt_idx] & ~0xFFF) | (virt & 0xFFF);
 }
 
+// Get the page table entry for a virtual address
+uint64_t* vmm_get_pte(uint64_t* pml4_table, uint64_t virt) {
+    if (!(pml4_table[PML4_INDEX(virt)] & PAGE_PRESENT)) return NULL;
+    uint64_t* pdpt = (uint64_t*)(pml4_table[PML4_INDEX(virt)] & ~0xFFF);
+    
+    if (!(pdpt[PDPT_INDEX(virt)] & PAGE_PRESENT)) return NULL;
+    uint64_t* pd = (uint64_t*)(pdpt[PDPT_INDEX(virt)] & ~0xFFF);
+    
+    if (!(pd[PD_INDEX(virt)] & PAGE_PRESENT)) return NULL;
+    uint64_t* pt = (uint64_t*)(pd[PD_INDEX(virt)] & ~0xFFF);
+    
+    return &pt[PT_INDEX(virt)];
+}
+
+// Find the next present page table mapping user space at or above *addr.
+// *addr is updated to the (2MB aligned) base of the region it maps.
+uint64_t* vmm_next_pt(uint64_t* pml4, uint64_t* addr) {
+    uint64_t va = *addr;
+    
+    while (va < USER_SPACE_END) {
+        uint64_t e4 = pml4[PML4_INDEX(va)];
+        if (!(e4 & PAGE_PRESENT)) {
+            va = (va | ((1ULL << 39) - 1)) + 1;
+            continue;
+        }
+        
+        uint64_t e3 = ((uint64_t*)(e4 & ~0xFFF))[PDPT_INDEX(va)];
+        if (!(e3 & PAGE_PRESENT)) {
+            va = (va | ((1ULL << 30) - 1)) + 1;
+            continue;
+        }
+        
+        uint64_t e2 = ((uint64_t*)(e3 & ~0xFFF))[PD_INDEX(va)];
+        if (!(e2 & PAGE_PRESENT)) {
+            va = (va | ((1ULL << 21) - 1)) + 1;
+            continue;
+        }
+        
+        *addr = va & ~((1ULL << 21) - 1);
+        return (uint64_t*)(e2 & ~0xFFF);
+    }
+    
+    return NULL;
+}
+
+// Page reclaim and merging read pages without the big kernel lock, so a
+// thread on another CPU may be writing to them. Writable and dirty are
+// dropped in one atomic step, and copy-on-write is set so a write that
+// races in faults and simply takes the page back. Once every CPU's TLB
+// entry is gone nothing can write the page, but a write may have gone
+// through a stale entry before the flush: then dirty is set again and
+// we back off.
+uint64_t vmm_pte_wrprotect(uint64_t* pml4, uint64_t* pte, uint64_t virt, uint64_t entry) {
+    if (!(entry & PAGE_PRESENT)) {
+        return 0;
+    }
+    
+    uint64_t prot = entry & ~(uint64_t)PAGE_DIRTY;
+    if (entry & PAGE_WRITABLE) {
+        prot = (prot & ~(uint64_t)PAGE_WRITABLE) | PAGE_COW;
+    }
+    if (!__sync_bool_compare_and_swap(pte, entry, prot)) {
+        return 0;
+    }
+    smp_flush_tlb_page(pml4, virt);
+    
+    if (*pte != prot) {
+        __sync_bool_compare_and_swap(pte, prot | PAGE_DIRTY, entry | PAGE_DIRTY);
+        return 0;
+    }
+    return prot;
+}
+
+// Put back the entry vmm_pte_wrprotect() replaced. If the page was
+// faulted on meanwhile, the fault handler's entry stands.
+void vmm_pte_restore(uint64_t* pte, uint64_t prot, uint64_t entry) {
+    __sync_bool_compare_and_swap(pte, prot, entry);
+}
+
 // Switch to a different address space
 void vmm_switch_address_space(uint64_t* new_pml4) {
     asm volatile("mov %0, %%cr3" : : "r"(new_pml4) : "memory");
@@ -158,7 +244,7 @@ int vmm_alloc_user_pages(process_t* process, uint64_t virt_addr, size_t count) {
     }
     
     for (size_t i = 0; i < count; i++) {
-        void* phys_page = pmm_alloc_page();
+        void* phys_page = pmm_alloc_page_movable(&process->page_color);
         if (!phys_page) {
             // TODO: Cleanup on failure
             return -1;
@@ -167,23 +253,153 @@ int vmm_alloc_user_pages(process_t* process, uint64_t virt_addr, size_t count) {
         uint64_t virt = virt_addr + (i * PAGE_SIZE);
         uint64_t phys = (uint64_t)phys_page;
         
-        if (vmm_map_page(process->page_table, virt, phys, 
+        if (vmm_map_page(process->mm->page_table, virt, phys, 
                         PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER) < 0) {
             pmm_free_page(phys_page);
             return -1;
         }
         
-        process->pages_allocated++;
+        process->mm->pages_allocated++;
     }
     
     return 0;
 }
 
+// Unmap user pages and return their frames. Shared memory pages are left
+// alone since they belong to their segment. Returns the number freed.
+size_t vmm_free_user_pages(process_t* process, uint64_t virt_addr, size_t count) {
+    size_t freed = 0;
+    
+    for (size_t i = 0; i < count; i++) {
+        uint64_t virt = virt_addr + (i * PAGE_SIZE);
+        uint64_t* pte = vmm_get_pte(process->mm->page_table, virt);
+        
+        if (pte && IS_SWAP_ENTRY(*pte)) {
+            swap_entry_free(*pte);
+            *pte = 0;
+            freed++;
+            continue;
+        }
+        
+        if (!pte || !(*pte & PAGE_PRESENT) || (*pte & PAGE_SHARED)) {
+            continue;
+        }
+        
+        void* frame = (void*)(*pte & ~0xFFF);
+        vmm_unmap_page(process->mm->page_table, virt);
+        pmm_page_unref(frame);
+        
+        if (process->mm->pages_allocated > 0) {
+            process->mm->pages_allocated--;
+        }
+        freed++;
+    }
+    
+    return freed;
+}
+
+// Mark user pages as lazily freeable (MADV_FREE). Reclaim drops them
+// unless they are written again first.
+void vmm_lazyfree_user_pages(process_t* process, uint64_t virt_addr, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t virt = virt_addr + (i * PAGE_SIZE);
+        uint64_t* pte = vmm_get_pte(process->mm->page_table, virt);
+        
+        if (!pte || !(*pte & PAGE_PRESENT) || (*pte & PAGE_SHARED)) {
+            continue;
+        }
+        
+        // Clear dirty so a later write can be detected. Reclaim may be
+        // looking at the entry from another CPU, so update it atomically.
+        uint64_t entry;
+        do {
+            entry = *pte;
+        } while ((entry & PAGE_PRESENT) &&
+                 !__sync_bool_compare_and_swap(pte, entry, (entry | PAGE_LAZYFREE) & ~PAGE_DIRTY));
+        smp_flush_tlb_page(process->mm->page_table, virt);
+    }
+}
+
+// Give a writer its own copy of a copy-on-write page. Reclaim and KSM
+// may replace the entry from another CPU meanwhile; then the fault is
+// simply taken again.
+static int vmm_break_cow(process_t* process, uint64_t virt, uint64_t* pte) {
+    uint64_t entry = *pte;
+    void* frame = (void*)(entry & ~0xFFF);
+    uint64_t flags = (entry & (0xFFF | PAGE_NX) & ~PAGE_COW) | PAGE_WRITABLE;
+    
+    if (pmm_page_refcount(frame) == 1) {
+        // Last user: take the frame over
+        __sync_bool_compare_and_swap(pte, entry, (uint64_t)frame | flags);
+    } else {
+        void* copy = pmm_alloc_page_movable(&process->page_color);
+        if (!copy) {
+            return -1;
+        }
+        
+        uint64_t* src = (uint64_t*)frame;
+        uint64_t* dst = (uint64_t*)copy;
+        for (int i = 0; i < PAGE_SIZE / 8; i++) {
+            dst[i] = src[i];
+        }
+        
+        if (!__sync_bool_compare_and_swap(pte, entry, (uint64_t)copy | flags)) {
+            pmm_page_unref(copy);
+            return 0;
+        }
+        pmm_page_unref(frame);
+    }
+    
+    smp_flush_tlb_page(process->mm->page_table, virt);
+    return 0;
+}
+
+// Handle a user page fault. Writes to copy-on-write pages get a private
+// copy, swapped-out pages are decompressed, and missing pages of
+// anonymous regions (the heap inside the current break, stacks) are
+// brought back as fresh zeroed pages.
+int vmm_handle_fault(process_t* process, uint64_t addr, uint64_t error) {
+    if (!process || !process->mm->page_table || addr >= KERNEL_BASE) {
+        return -1;
+    }
+    
+    process->page_faults++;
+    
+    uint64_t page = PAGE_ALIGN_DOWN(addr);
+    uint64_t* pte = vmm_get_pte(process->mm->page_table, page);
+    
+    if ((error & PF_PRESENT) && (error & PF_WRITE) && pte &&
+        (*pte & PAGE_PRESENT) && (*pte & PAGE_COW)) {
+        return vmm_break_cow(process, page, pte);
+    }
+    
+    // Everything else must be a not-present fault
+    if (error & PF_PRESENT) {
+        return -1;
+    }
+    
+    if (pte && IS_SWAP_ENTRY(*pte)) {
+        return swap_in(process, page, pte);
+    }
+    
+    vma_t* vma = mm_find_vma(process->mm, page);
+    if (vma && (vma->flags & VMA_ANON)) {
+        return vmm_alloc_user_pages(process, page, 1);
+    }
+    
+    return -1;
+}
+
 // Set up user stack for a process
 int vmm_setup_user_stack(process_t* process) {
     process->stack_top = USER_STACK_TOP;
     process->stack_bottom = USER_STACK_TOP - USER_STACK_SIZE;
     
+    if (mm_add_vma(process->mm, process->stack_bottom, process->stack_top,
+                   VMA_READ | VMA_WRITE | VMA_ANON) < 0) {
+        return -1;
+    }
+    
     // Allocate pages for stack
     size_t stack_pages = USER_STACK_SIZE / PAGE_SIZE;
     return vmm_alloc_user_pages(process, process->stack_bottom, stack_pages);
@@ -191,18 +407,20 @@ int vmm_setup_user_stack(process_t* process) {
 
 // Set up user heap for a process
 int vmm_setup_user_heap(process_t* process) {
-    process->heap_start = USER_HEAP_START;
-    process->heap_current = USER_HEAP_START;
-    process->heap_max = USER_HEAP_START + 0x10000000;  // 256MB heap limit
-    
-    // Don't pre-allocate heap pages, they'll be allocated on demand via sbrk
-    return 0;
+    mm_t* mm = process->mm;
+    mm->heap_start = USER_HEAP_START;
+    mm->heap_current = USER_HEAP_START;
+    mm->heap_max = USER_HEAP_START + 0x10000000;  // 256MB heap limit
+    
+    // Don't pre-allocate heap pages, they'll be allocated on demand via
+    // sbrk; the region starts empty and grows with the break
+    return mm_add_vma(mm, mm->heap_start, mm->heap_start, VMA_READ | VMA_WRITE | VMA_ANON);
 }
 
 // Helper functions for address space cloning
 static uint64_t clone_page(uint64_t parent_page_phys, uint64_t flags) {
     // Allocate new page
-    void* child_page = pmm_alloc_page();
+    void* child_page = pmm_alloc_page_color(&vmm_table_color);
     if (!child_page) return 0;
     
     // Copy contents
@@ -216,14 +434,69 @@ static uint64_t clone_page(uint64_t parent_page_phys, uint64_t flags) {
     return ((uint64_t)child_page) | flags;
 }
 
+// Drop what the first 'count' entries of a page table map, then the
+// table. Mapped frames go by reference; pinned frames are left be.
+static void free_pt(uint64_t* pt, int count) {
+    for (int i = 0; i < count; i++) {
+        if ((pt[i] & PAGE_PRESENT) && !(pt[i] & PAGE_PINNED)) {
+            pmm_page_unref((void*)(pt[i] & ~0xFFF));
+        } else if (IS_SWAP_ENTRY(pt[i])) {
+            swap_entry_free(pt[i]);
+        }
+    }
+    pmm_free_page(pt);
+}
+
+// Same for the first 'count' entries of a page directory
+static void free_pd(uint64_t* pd, int count) {
+    for (int i = 0; i < count; i++) {
+        if (pd[i] & PAGE_PRESENT) {
+            free_pt((uint64_t*)(pd[i] & ~0xFFF), 512);
+        }
+    }
+    pmm_free_page(pd);
+}
+
+// Same for the first 'count' entries of a PDPT
+static void free_pdpt(uint64_t* pdpt, int count) {
+    for (int i = 0; i < count; i++) {
+        if (pdpt[i] & PAGE_PRESENT) {
+            free_pd((uint64_t*)(pdpt[i] & ~0xFFF), 512);
+        }
+    }
+    pmm_free_page(pdpt);
+}
+
+// On failure the entries copied so far are dropped again
 static uint64_t clone_pt(uint64_t parent_pt_phys) {
     uint64_t* parent_pt = (uint64_t*)parent_pt_phys;
-    uint64_t* child_pt = (uint64_t*)pmm_alloc_page();
+    uint64_t* child_pt = (uint64_t*)pmm_alloc_page_color(&vmm_table_color);
     
     if (!child_pt) return 0;
     
     for (int i = 0; i < 512; i++) {
-        if (parent_pt[i] & PAGE_PRESENT) {
+        if ((parent_pt[i] & PAGE_PRESENT) && (parent_pt[i] & PAGE_PINNED)) {
+            // Kernel-owned frame (the vDSO): map it as is
+            child_pt[i] = parent_pt[i];
+        } else if ((parent_pt[i] & PAGE_PRESENT) && (parent_pt[i] & PAGE_SHARED)) {
+            // Shared memory: map the same frame in the child
+            if (pmm_page_ref((void*)(parent_pt[i] & ~0xFFF)) < 0) {
+                free_pt(child_pt, i);
+                return 0;
+            }
+            child_pt[i] = parent_pt[i];
+        } else if ((parent_pt[i] & PAGE_PRESENT) && (parent_pt[i] & PAGE_COW) &&
+                   pmm_page_ref((void*)(parent_pt[i] & ~0xFFF)) == 0) {
+            // Merged read-only page: the child shares it too
+            child_pt[i] = parent_pt[i];
+        } else if (IS_SWAP_ENTRY(parent_pt[i])) {
+            // Swapped out: both children share the compressed copy
+            if (swap_entry_dup(parent_pt[i]) < 0) {
+                free_pt(child_pt, i);
+                return 0;
+            }
+            child_pt[i] = parent_pt[i];
+        } else if (parent_pt[i] & PAGE_PRESENT) {
             // Clone the actual page
             uint64_t page_phys = parent_pt[i] & ~0xFFF;
             uint64_t flags = parent_pt[i] & 0xFFF;
@@ -231,7 +504,7 @@ static uint64_t clone_pt(uint64_t parent_pt_phys) {
             
             if (!child_pt[i]) {
                 // Cleanup on failure
-                pmm_free_page(child_pt);
+                free_pt(child_pt, i);
                 return 0;
             }
         } else {
@@ -244,7 +517,7 @@ static uint64_t clone_pt(uint64_t parent_pt_phys) {
 
 static uint64_t clone_pd(uint64_t parent_pd_phys) {
     uint64_t* parent_pd = (uint64_t*)parent_pd_phys;
-    uint64_t* child_pd = (uint64_t*)pmm_alloc_page();
+    uint64_t* child_pd = (uint64_t*)pmm_alloc_page_color(&vmm_table_color);
     
     if (!child_pd) return 0;
     
@@ -252,7 +525,7 @@ static uint64_t clone_pd(uint64_t parent_pd_phys) {
         if (parent_pd[i] & PAGE_PRESENT) {
             uint64_t child_pt = clone_pt(parent_pd[i] & ~0xFFF);
             if (!child_pt) {
-                pmm_free_page(child_pd);
+                free_pd(child_pd, i);
                 return 0;
             }
             child_pd[i] = child_pt | (parent_pd[i] & 0xFFF);
@@ -266,7 +539,7 @@ static uint64_t clone_pd(uint64_t parent_pd_phys) {
 
 static uint64_t clone_pdpt(uint64_t parent_pdpt_phys) {
     uint64_t* parent_pdpt = (uint64_t*)parent_pdpt_phys;
-    uint64_t* child_pdpt = (uint64_t*)pmm_alloc_page();
+    uint64_t* child_pdpt = (uint64_t*)pmm_alloc_page_color(&vmm_table_color);
     
     if (!child_pdpt) return 0;
     
@@ -274,7 +547,7 @@ static uint64_t clone_pdpt(uint64_t parent_pdpt_phys) {
         if (parent_pdpt[i] & PAGE_PRESENT) {
             uint64_t child_pd = clone_pd(parent_pdpt[i] & ~0xFFF);
             if (!child_pd) {
-                pmm_free_page(child_pdpt);
+                free_pdpt(child_pdpt, i);
                 return 0;
             }
             child_pdpt[i] = child_pd | (parent_pdpt[i] & 0xFFF);
@@ -289,7 +562,7 @@ static uint64_t clone_pdpt(uint64_t parent_pdpt_phys) {
 // Clone an entire address space (for fork)
 uint64_t* vmm_clone_address_space(uint64_t* parent_pml4) {
     // Allocate new PML4
-    uint64_t* child_pml4 = (uint64_t*)pmm_alloc_page();
+    uint64_t* child_pml4 = (uint64_t*)pmm_alloc_page_color(&vmm_table_color);
     if (!child_pml4) return NULL;
     
     // Clear the new PML4
@@ -320,15 +593,19 @@ uint64_t* vmm_clone_address_space(uint64_t* parent_pml4) {
 
 // Clear user space mappings (for exec)
 void vmm_clear_user_space(uint64_t* pml4) {
-    // Clear user space entries (0-255)
-    for (int i = 0; i < 256; i++) {
-        if (pml4[i] & PAGE_PRESENT) {
-            // TODO: Recursively free all page tables and pages
-            // For now, just clear the entry
-            pml4[i] = 0;
-        }
-    }
+    vmm_free_user_mappings(pml4);
     
     // Flush TLB
     asm volatile("mov %%cr3, %%rax; mov %%rax, %%cr3" ::: "rax", "memory");
+}
+
+// Release all user pages and page tables (entries 0-255). Mapped frames
+// are dropped by reference so frames shared with other address spaces
+// survive until their last mapper goes away; pinned frames are left be.
+void vmm_free_user_mappings(uint64_t* pml4) {
+    for (int i = 0; i < 256; i++) {
+        if (!(pml4[i] & PAGE_PRESENT)) continue;
+        free_pdpt((uint64_t*)(pml4[i] & ~0xFFF), 512);
+        pml4[i] = 0;
+    }
 }
\ No newline at end of file
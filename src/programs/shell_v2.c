@@ -269,6 +269,24 @@ static int sys_getpid(void) {
     return ret;
 }
 
+// Copy between descriptors inside the kernel
+static int sys_sendfile(int out_fd, int in_fd, unsigned long* offset, int count) {
+    int ret;
+    asm volatile(
+        "mov $39, %%rax\n"     // SYS_SENDFILE
+        "mov %1, %%rdi\n"      // out_fd
+        "mov %2, %%rsi\n"      // in_fd
+        "mov %3, %%rdx\n"      // offset pointer
+        "mov %4, %%r10\n"      // count
+        "int $0x80\n"
+        "mov %%rax, %0"
+        : "=r"(ret)
+        : "r"((long)out_fd), "r"((long)in_fd), "r"(offset), "r"((long)count)
+        : "rax", "rdi", "rsi", "rdx", "r10"
+    );
+    return ret;
+}
+
 // String utilities
 static int str_len(const char* s) {
     int len = 0;
@@ -447,6 +465,7 @@ static int parse_command(char* cmd, char* argv[]) {
 
 // Execute command with potential pipe
 static int execute_pipe(char* cmd1, char* cmd2);
+static int sys_open(const char* path, int flags, int mode);
 
 // Execute a single command (with optional background flag)
 static int execute_command_bg(char* cmd, int background) {
@@ -460,6 +479,7 @@ static int execute_command_bg(char* cmd, int background) {
         sys_write(1, "  help     - Show this help\n", 28);
         sys_write(1, "  ps       - List processes\n", 28);
         sys_write(1, "  echo     - Print arguments\n", 29);
+        sys_write(1, "  cat      - Print a file\n", 26);
         sys_write(1, "  fork     - Test fork\n", 23);
         sys_write(1, "  stress   - Stress test\n", 25);
         sys_write(1, "  clear    - Clear screen\n", 26);
@@ -539,6 +559,33 @@ static int execute_command_bg(char* cmd, int background) {
         }
         return 0;
     }
+    else if (str_cmp(argv[0], "cat") == 0) {
+        if (argc < 2) {
+            sys_write(1, "Usage: cat <filename>\n", 22);
+            return 1;
+        }
+        
+        int fd = sys_open(argv[1], 0, 0);
+        if (fd < 0) {
+            sys_write(1, "cat: cannot open file\n", 22);
+            return 1;
+        }
+        
+        // Straight from the file to stdout, which may be a pipe: no
+        // trip through a buffer here
+        int n;
+        do {
+            n = sys_sendfile(1, fd, 0, 4096);
+        } while (n > 0);
+        
+        asm volatile(
+            "mov $12, %%rax\n"     // SYS_CLOSE
+            "mov %0, %%rdi\n"      // fd
+            "int $0x80"
+            : : "r"((long)fd) : "rax", "rdi"
+        );
+        return 0;
+    }
     else if (str_cmp(argv[0], "clear") == 0) {
         sys_write(1, "\033[2J\033[H", 7);
         return 0;